@@ -0,0 +1,126 @@
+#pragma once
+
+#include <core/math_definitions.h>
+#include <core/transform.h>
+
+namespace pbr
+{
+    /** Axis-aligned bounding box. An empty box has min > max on every axis. */
+    struct AABB
+    {
+        Vec min { PBR_INF };
+        Vec max { -PBR_INF };
+
+        inline void expand(const Vec& p)
+        {
+            min = { std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z) };
+            max = { std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z) };
+        }
+
+        /** Grow to contain another box. Expanding by an empty box leaves this one unchanged. */
+        inline void expand(const AABB& box)
+        {
+            min = { std::min(min.x, box.min.x), std::min(min.y, box.min.y), std::min(min.z, box.min.z) };
+            max = { std::max(max.x, box.max.x), std::max(max.y, box.max.y), std::max(max.z, box.max.z) };
+        }
+
+        inline bool empty() const
+        {
+            return min.x > max.x || min.y > max.y || min.z > max.z;
+        }
+
+        inline Vec extent() const
+        {
+            return max - min;
+        }
+
+        inline Point centroid() const
+        {
+            return (min + max) * 0.5;
+        }
+
+        /** Surface area of the box, used by the surface area heuristic. */
+        inline double surface_area() const
+        {
+            if (empty()) return 0;
+            Vec e = extent();
+            return 2 * (e.x * e.y + e.y * e.z + e.z * e.x);
+        }
+
+        /** Part of this box inside another one, or an empty box if they do not overlap. */
+        inline AABB intersection(const AABB& box) const
+        {
+            AABB overlap;
+            overlap.min = { std::max(min.x, box.min.x), std::max(min.y, box.min.y), std::max(min.z, box.min.z) };
+            overlap.max = { std::min(max.x, box.max.x), std::min(max.y, box.max.y), std::min(max.z, box.max.z) };
+            // Keep the empty box canonical, expanding by one that is only empty along some axes would grow the others
+            return overlap.empty() ? AABB {} : overlap;
+        }
+
+        /** Index of the axis along which the box is the longest. */
+        inline int longest_axis() const
+        {
+            Vec e = extent();
+            if (e.x > e.y && e.x > e.z) return 0;
+            return (e.y > e.z) ? 1 : 2;
+        }
+
+        /** Bounds of this box after a transform, found from its eight corners. */
+        inline AABB transformed(const Transform& t) const
+        {
+            AABB box;
+            for (int i = 0; i < 8; ++i)
+            {
+                Point corner { (i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z };
+                box.expand(t.point(corner));
+            }
+            return box;
+        }
+
+        /*!
+        * @brief Slab test against the ray segment [0, tmax]
+        *
+        * @param origin Ray origin
+        * @param inv_dir Component-wise reciprocal of the ray direction
+        * @param tmax Far end of the segment, usually the closest hit so far
+        * @return bool Indicates if the segment overlaps the box
+        */
+        inline bool intersect(const Point& origin, const Vec& inv_dir, double tmax) const
+        {
+            // NaNs from 0 * inf are dropped by the argument order of std::min/max
+            double tnear = 0;
+            double tfar = tmax;
+
+            double tx0 = (min.x - origin.x) * inv_dir.x;
+            double tx1 = (max.x - origin.x) * inv_dir.x;
+            tnear = std::max(tnear, std::min(tx0, tx1));
+            tfar = std::min(tfar, std::max(tx0, tx1));
+
+            double ty0 = (min.y - origin.y) * inv_dir.y;
+            double ty1 = (max.y - origin.y) * inv_dir.y;
+            tnear = std::max(tnear, std::min(ty0, ty1));
+            tfar = std::min(tfar, std::max(ty0, ty1));
+
+            double tz0 = (min.z - origin.z) * inv_dir.z;
+            double tz1 = (max.z - origin.z) * inv_dir.z;
+            tnear = std::max(tnear, std::min(tz0, tz1));
+            tfar = std::min(tfar, std::max(tz0, tz1));
+
+            return tnear <= tfar;
+        }
+    };
+
+    /** Access a vector component by axis index. */
+    inline double axis_of(const Vec& v, int axis)
+    {
+        return (axis == 0) ? v.x : (axis == 1) ? v.y : v.z;
+    }
+
+    /** Set a vector component by axis index. */
+    inline void set_axis(Vec& v, int axis, double value)
+    {
+        if (axis == 0) v.x = value;
+        else if (axis == 1) v.y = value;
+        else v.z = value;
+    }
+}
@@ -0,0 +1,678 @@
+#include "accelerator.h"
+
+#include <limits>
+
+namespace pbr
+{
+    ///////////////////////////////////////////////////////////////////////////////
+    // Linear
+    ///////////////////////////////////////////////////////////////////////////////
+
+    void LinearAccelerator::build(const Scene& scene)
+    {
+        p_scene = &scene;
+    }
+
+    bool LinearAccelerator::intersect(const Ray& ray, HitResult& out_hit) const
+    {
+        PBR_STAT_ADD(CLOSEST_HIT_QUERIES, 1);
+
+        double tmax = PBR_INF;
+        bool does_hit = false;
+        for (const auto& actor : *p_scene)
+        {
+            does_hit |= actor.find_hit(ray, tmax, out_hit);
+        }
+
+        if (does_hit) out_hit.actor->finish_hit(ray, out_hit);
+        return does_hit;
+    }
+
+    bool LinearAccelerator::occluded(const Ray& ray, double tmax) const
+    {
+        PBR_STAT_ADD(OCCLUSION_QUERIES, 1);
+
+        for (const auto& actor : *p_scene)
+        {
+            if (actor.occluded(ray, tmax))
+            {
+                PBR_STAT_ADD(OCCLUDED_RAYS, 1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+    // BVH
+    ///////////////////////////////////////////////////////////////////////////////
+
+    void BVHAccelerator::build(const Scene& scene)
+    {
+        std::vector<const Actor*> bounded;
+        std::vector<AABB> bounds;
+        _unbounded.clear();
+        for (const auto& actor : scene)
+        {
+            if (actor.bounded())
+            {
+                bounded.push_back(&actor);
+                bounds.push_back(actor.bounds());
+            }
+            else
+            {
+                _unbounded.push_back(&actor);
+            }
+        }
+
+        _scene_data = scene.data();
+        _scene_size = scene.size();
+        build_hierarchy(bounded, bounds, true);
+    }
+
+    void BVHAccelerator::build_hierarchy(const std::vector<const Actor*>& bounded, const std::vector<AABB>& bounds, bool use_cache)
+    {
+        if (use_cache)
+        {
+            _from_cache = build_cached(_bvh, bounds, SpherePack::WIDTH, build_method);
+        }
+        else
+        {
+            _bvh.build(bounds, SpherePack::WIDTH, PBR_BVH_REFIT_REBUILD_METHOD);
+            _from_cache = false;
+        }
+
+        _primitive_count = bounded.size();
+        _actors.clear();
+        _actors.reserve(_bvh.indices.size());
+        for (uint32_t index : _bvh.indices)
+        {
+            _actors.push_back(bounded[index]);
+        }
+
+        _spheres.build(_actors);
+        _sah_cost = _bvh.sah_cost();
+        _built_sah_cost = _sah_cost;
+    }
+
+    bool BVHAccelerator::update(const Scene& scene)
+    {
+        if (scene.data() != _scene_data || scene.size() != _scene_size)
+        {
+            build(scene);
+            return true;
+        }
+
+        // Actors and bounds in the order of the build. `_actors` is in the order of the leaves, where spatial splits
+        // can list an actor more than once
+        std::vector<const Actor*> bounded(_primitive_count);
+        for (size_t i = 0; i < _actors.size(); ++i)
+        {
+            bounded[_bvh.indices[i]] = _actors[i];
+        }
+        std::vector<AABB> bounds(_primitive_count);
+        for (size_t i = 0; i < _primitive_count; ++i)
+        {
+            bounds[i] = bounded[i]->bounds();
+        }
+
+        _bvh.refit(bounds);
+        _sah_cost = _bvh.sah_cost();
+        if (_sah_cost <= PBR_BVH_REFIT_REBUILD_RATIO * _built_sah_cost)
+        {
+            _spheres.build(_actors);
+            return false;
+        }
+
+        // The hierarchy only lives until the next rebuild, so it is not worth a cache file
+        build_hierarchy(bounded, bounds, false);
+        return true;
+    }
+
+    bool BVHAccelerator::intersect(const Ray& ray, HitResult& out_hit) const
+    {
+        PBR_STAT_ADD(CLOSEST_HIT_QUERIES, 1);
+
+        double tmax = PBR_INF;
+        bool does_hit = intersect_unbounded(ray, tmax, out_hit);
+
+        PackedRay packed(ray);
+        does_hit |= _bvh.intersect(ray, tmax, [&](uint32_t first, uint32_t count, double& tmax) {
+            return intersect_leaf(ray, packed, first, count, tmax, out_hit);
+        });
+
+        if (does_hit) out_hit.actor->finish_hit(ray, out_hit);
+        return does_hit;
+    }
+
+    void BVHAccelerator::intersect_packet(const Ray* rays, int count, HitResult* hits, bool* does_hit) const
+    {
+        if (count > 8) closest_hit_packet16(rays, count, hits, does_hit);
+        else closest_hit_packet8(rays, count, hits, does_hit);
+    }
+
+    template <int N>
+    PBR_FORCE_INLINE void BVHAccelerator::closest_hit_packet(const Ray* rays, int count, HitResult* hits, bool* does_hit) const
+    {
+        PBR_STAT_ADD(CLOSEST_HIT_QUERIES, count);
+        PBR_STAT_ADD(PACKET_RAYS, count);
+
+        double tmax[N];
+        for (int i = 0; i < N; ++i)
+        {
+            tmax[i] = PBR_INF;
+            if (i < count) does_hit[i] = intersect_unbounded(rays[i], tmax[i], hits[i]);
+        }
+
+        uint32_t active = (count >= 32) ? ~0u : (1u << count) - 1;
+        _bvh.intersect_packet<N>(rays, active, tmax, [&](uint32_t first, uint32_t leaf_count, uint32_t mask) {
+            // Primitives are tested one ray at a time, the packet only shares the node visits
+            for (int i = 0; mask != 0; ++i, mask >>= 1)
+            {
+                if (mask & 1) does_hit[i] |= intersect_leaf(rays[i], PackedRay(rays[i]), first, leaf_count, tmax[i], hits[i]);
+            }
+        });
+
+        for (int i = 0; i < count; ++i)
+        {
+            if (does_hit[i]) hits[i].actor->finish_hit(rays[i], hits[i]);
+        }
+    }
+
+    PBR_TARGET_CLONES void BVHAccelerator::closest_hit_packet8(const Ray* rays, int count, HitResult* hits, bool* does_hit) const
+    {
+        closest_hit_packet<8>(rays, count, hits, does_hit);
+    }
+
+    PBR_TARGET_CLONES void BVHAccelerator::closest_hit_packet16(const Ray* rays, int count, HitResult* hits, bool* does_hit) const
+    {
+        closest_hit_packet<16>(rays, count, hits, does_hit);
+    }
+
+    void BVHAccelerator::intersect_stream(const Ray* rays, size_t count, HitResult* hits, bool* does_hit) const
+    {
+        PBR_STAT_ADD(CLOSEST_HIT_QUERIES, count);
+        PBR_STAT_ADD(STREAM_RAYS, count);
+
+        std::vector<double> tmax(count, PBR_INF);
+        for (size_t i = 0; i < count; ++i)
+        {
+            does_hit[i] = intersect_unbounded(rays[i], tmax[i], hits[i]);
+        }
+
+        _bvh.intersect_stream(rays, count, tmax.data(), [&](uint32_t first, uint32_t leaf_count, const uint32_t* ids, uint32_t active) {
+            for (uint32_t k = 0; k < active; ++k)
+            {
+                uint32_t i = ids[k];
+                does_hit[i] |= intersect_leaf(rays[i], PackedRay(rays[i]), first, leaf_count, tmax[i], hits[i]);
+            }
+        });
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (does_hit[i]) hits[i].actor->finish_hit(rays[i], hits[i]);
+        }
+    }
+
+    bool BVHAccelerator::intersect_unbounded(const Ray& ray, double& tmax, HitResult& out_hit) const
+    {
+        bool does_hit = false;
+        for (const Actor* actor : _unbounded)
+        {
+            does_hit |= actor->find_hit(ray, tmax, out_hit);
+        }
+        return does_hit;
+    }
+
+    bool BVHAccelerator::intersect_leaf(const Ray& ray, const PackedRay& packed, uint32_t first, uint32_t count,
+                                        double& tmax, HitResult& out_hit) const
+    {
+        bool does_hit = false;
+        uint32_t end = first + count;
+        for (uint32_t batch = first; batch < end; batch += SpherePack::WIDTH)
+        {
+            // Only the candidates of the packed test get the exact test
+            float ftmax = std::nextafter((float) tmax, std::numeric_limits<float>::infinity());
+            uint32_t mask = _spheres.intersect(packed, batch, ftmax);
+            if (end - batch < SpherePack::WIDTH) mask &= (1u << (end - batch)) - 1;
+
+            for (uint32_t lane = 0; mask != 0; ++lane, mask >>= 1)
+            {
+                if (mask & 1) does_hit |= _actors[batch + lane]->find_hit(ray, tmax, out_hit);
+            }
+        }
+        return does_hit;
+    }
+
+    bool BVHAccelerator::occluded(const Ray& ray, double tmax) const
+    {
+        PBR_STAT_ADD(OCCLUSION_QUERIES, 1);
+
+        PackedRay packed(ray);
+        bool does_hit = occluded_unbounded(ray, tmax) || _bvh.occluded(ray, tmax, [&](uint32_t first, uint32_t count) {
+            return occluded_leaf(ray, packed, first, count, tmax);
+        });
+
+        PBR_STAT_ADD(OCCLUDED_RAYS, does_hit);
+        return does_hit;
+    }
+
+    bool BVHAccelerator::occluded_unbounded(const Ray& ray, double tmax) const
+    {
+        for (const Actor* actor : _unbounded)
+        {
+            if (actor->occluded(ray, tmax)) return true;
+        }
+        return false;
+    }
+
+    bool BVHAccelerator::occluded_leaf(const Ray& ray, const PackedRay& packed, uint32_t first, uint32_t count, double tmax) const
+    {
+        float ftmax = std::nextafter((float) tmax, std::numeric_limits<float>::infinity());
+        uint32_t end = first + count;
+        for (uint32_t batch = first; batch < end; batch += SpherePack::WIDTH)
+        {
+            uint32_t mask = _spheres.intersect(packed, batch, ftmax);
+            if (end - batch < SpherePack::WIDTH) mask &= (1u << (end - batch)) - 1;
+
+            for (uint32_t lane = 0; mask != 0; ++lane, mask >>= 1)
+            {
+                if ((mask & 1) && _actors[batch + lane]->occluded(ray, tmax)) return true;
+            }
+        }
+        return false;
+    }
+
+    size_t BVHAccelerator::memory_bytes() const
+    {
+        return _bvh.memory_bytes()
+            + (_actors.size() + _unbounded.size()) * sizeof(const Actor*)
+            + (_spheres.cx.size() * 4) * sizeof(float);
+    }
+
+    void BVHAccelerator::log_build_info() const
+    {
+        LOG_INFO("  %zu actors, %zu unbounded, %zu nodes, SAH cost %.2f, %.2f MB%s",
+                 _primitive_count, _unbounded.size(), _bvh.nodes.size(), _sah_cost, memory_bytes() / 1e6,
+                 _from_cache ? ", mapped from the cache" : "");
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+    // Wide BVH
+    ///////////////////////////////////////////////////////////////////////////////
+
+    template <int N, class Node>
+    void WideBVHAccelerator<N, Node>::build(const Scene& scene)
+    {
+        BVHAccelerator::build(scene);
+        _wide.build(_bvh);
+
+        // Only the leaf ranges of the binary hierarchy are still needed, and `_actors` already holds them
+        _bvh.nodes.clear();
+        _bvh.nodes.shrink_to_fit();
+    }
+
+    template <int N, class Node>
+    bool WideBVHAccelerator<N, Node>::intersect(const Ray& ray, HitResult& out_hit) const
+    {
+        PBR_STAT_ADD(CLOSEST_HIT_QUERIES, 1);
+        return closest_hit(ray, out_hit);
+    }
+
+    template <int N, class Node>
+    PBR_TARGET_CLONES bool WideBVHAccelerator<N, Node>::closest_hit(const Ray& ray, HitResult& out_hit) const
+    {
+        double tmax = PBR_INF;
+        bool does_hit = intersect_unbounded(ray, tmax, out_hit);
+
+        PackedRay packed(ray);
+        does_hit |= _wide.intersect(ray, tmax, [&](uint32_t first, uint32_t count, double& tmax) {
+            return intersect_leaf(ray, packed, first, count, tmax, out_hit);
+        });
+
+        if (does_hit) out_hit.actor->finish_hit(ray, out_hit);
+        return does_hit;
+    }
+
+    template <int N, class Node>
+    bool WideBVHAccelerator<N, Node>::occluded(const Ray& ray, double tmax) const
+    {
+        PBR_STAT_ADD(OCCLUSION_QUERIES, 1);
+
+        bool does_hit = any_hit(ray, tmax);
+        PBR_STAT_ADD(OCCLUDED_RAYS, does_hit);
+        return does_hit;
+    }
+
+    template <int N, class Node>
+    PBR_TARGET_CLONES bool WideBVHAccelerator<N, Node>::any_hit(const Ray& ray, double tmax) const
+    {
+        if (occluded_unbounded(ray, tmax)) return true;
+
+        PackedRay packed(ray);
+        return _wide.occluded(ray, tmax, [&](uint32_t first, uint32_t count) {
+            return occluded_leaf(ray, packed, first, count, tmax);
+        });
+    }
+
+    template <int N, class Node>
+    size_t WideBVHAccelerator<N, Node>::memory_bytes() const
+    {
+        return BVHAccelerator::memory_bytes() + _wide.memory_bytes();
+    }
+
+    template <int N, class Node>
+    void WideBVHAccelerator<N, Node>::log_build_info() const
+    {
+        LOG_INFO("  %zu actors, %zu unbounded, %zu nodes of width %d and %zu bytes, binary SAH cost %.2f, %.2f MB%s",
+                 _primitive_count, _unbounded.size(), _wide.nodes.size(), N, sizeof(Node), _sah_cost, memory_bytes() / 1e6,
+                 _from_cache ? ", binary BVH mapped from the cache" : "");
+    }
+
+    template struct WideBVHAccelerator<4>;
+    template struct WideBVHAccelerator<8>;
+    template struct WideBVHAccelerator<4, QuantizedBVHNode>;
+
+    ///////////////////////////////////////////////////////////////////////////////
+    // Grid
+    ///////////////////////////////////////////////////////////////////////////////
+
+    template <GridStorage Storage>
+    void GridAccelerator<Storage>::build(const Scene& scene)
+    {
+        std::vector<const Actor*> bounded;
+        std::vector<AABB> bounds;
+        _unbounded.clear();
+        for (const auto& actor : scene)
+        {
+            if (actor.bounded())
+            {
+                bounded.push_back(&actor);
+                bounds.push_back(actor.bounds());
+            }
+            else
+            {
+                _unbounded.push_back(&actor);
+            }
+        }
+
+        _grid.build(bounds, Storage);
+
+        _primitive_count = bounded.size();
+        _actors.clear();
+        _actors.reserve(_grid.indices.size());
+        for (uint32_t index : _grid.indices)
+        {
+            _actors.push_back(bounded[index]);
+        }
+        _spheres.build(_actors);
+    }
+
+    template <GridStorage Storage>
+    bool GridAccelerator<Storage>::intersect(const Ray& ray, HitResult& out_hit) const
+    {
+        PBR_STAT_ADD(CLOSEST_HIT_QUERIES, 1);
+
+        double tmax = PBR_INF;
+        bool does_hit = intersect_unbounded(ray, tmax, out_hit);
+
+        PackedRay packed(ray);
+        does_hit |= _grid.intersect(ray, tmax, [&](uint32_t first, uint32_t count, double& tmax) {
+            return intersect_leaf(ray, packed, first, count, tmax, out_hit);
+        });
+
+        if (does_hit) out_hit.actor->finish_hit(ray, out_hit);
+        return does_hit;
+    }
+
+    template <GridStorage Storage>
+    bool GridAccelerator<Storage>::occluded(const Ray& ray, double tmax) const
+    {
+        PBR_STAT_ADD(OCCLUSION_QUERIES, 1);
+
+        PackedRay packed(ray);
+        bool does_hit = occluded_unbounded(ray, tmax) || _grid.occluded(ray, tmax, [&](uint32_t first, uint32_t count) {
+            return occluded_leaf(ray, packed, first, count, tmax);
+        });
+
+        PBR_STAT_ADD(OCCLUDED_RAYS, does_hit);
+        return does_hit;
+    }
+
+    template <GridStorage Storage>
+    size_t GridAccelerator<Storage>::memory_bytes() const
+    {
+        return BVHAccelerator::memory_bytes() + _grid.memory_bytes();
+    }
+
+    template <GridStorage Storage>
+    void GridAccelerator<Storage>::log_build_info() const
+    {
+        LOG_INFO("  %zu references, %zu unbounded, %s grid of %d x %d x %d cells, %llu occupied, %.2f MB",
+                 _actors.size(), _unbounded.size(), Storage == GridStorage::DENSE ? "dense" : "hashed",
+                 _grid.resolution[0], _grid.resolution[1], _grid.resolution[2],
+                 (unsigned long long) _grid.occupied_cells(), memory_bytes() / 1e6);
+    }
+
+    template struct GridAccelerator<GridStorage::DENSE>;
+    template struct GridAccelerator<GridStorage::HASHED>;
+
+    ///////////////////////////////////////////////////////////////////////////////
+    // TESTS
+    ///////////////////////////////////////////////////////////////////////////////
+
+    static Scene make_test_spheres(int count)
+    {
+        std::mt19937 gen(7);
+        std::uniform_real_distribution<> position(-10.0, 10.0);
+        std::uniform_real_distribution<> radius(0.05, 1.0);
+
+        auto material = std::make_shared<Material>(PBR_COLOR_WHITE, PBR_COLOR_BLACK, new DiffuseBRDF);
+
+        Scene scene;
+        for (int i = 0; i < count; ++i)
+        {
+            Vec center { position(gen), position(gen), position(gen) };
+            scene.push_back(Actor { material, SphereGeometry { center, radius(gen) } });
+        }
+        return scene;
+    }
+
+    TEST_CASE("scene::Actor::find_hit")
+    {
+        auto material = std::make_shared<Material>(PBR_COLOR_WHITE, PBR_COLOR_BLACK, new DiffuseBRDF);
+        Actor near { material, SphereGeometry { Vec { 0, 0, -5 }, 1 } };
+        Actor far { material, SphereGeometry { Vec { 0, 0, -10 }, 1 } };
+        Ray ray { Vec { 0, 0, 0 }, Vec { 0, 0, -1 } };
+
+        // Only hits closer than the current one are recorded
+        double tmax = PBR_INF;
+        HitResult hit;
+        CHECK(far.find_hit(ray, tmax, hit));
+        CHECK(tmax == doctest::Approx(9));
+        CHECK(near.find_hit(ray, tmax, hit));
+        CHECK(tmax == doctest::Approx(4));
+        CHECK_FALSE(far.find_hit(ray, tmax, hit));
+        CHECK(hit.actor == &near);
+        CHECK(hit.param == tmax);
+
+        // Attributes are filled in for the winner only
+        hit.actor->finish_hit(ray, hit);
+        CHECK(hit.point.z == doctest::Approx(-4));
+        CHECK(hit.normal.z == doctest::Approx(1));
+
+        HitResult direct;
+        REQUIRE(near.intersect(ray, direct));
+        CHECK(direct.param == hit.param);
+        CHECK(direct.normal == hit.normal);
+    }
+
+    template <class Accelerator>
+    static void check_matches_linear()
+    {
+        Scene scene = make_test_spheres(500);
+        auto material = scene.front().material;
+        scene.push_back(Actor { material, PlaneGeometry { Vec { 0, -8, 0 }, Vec { 0, 1, 0 } } });
+        scene.push_back(Actor { material, QuadGeometry { Vec { -5, -5, -9 }, Vec { 10, 0, 0 }, Vec { 0, 10, 0 } } });
+
+        auto mesh = std::make_shared<TriangleMesh>();
+        mesh->positions = { { -1, -1, 0 }, { 1, -1, 0 }, { 1, 1, 0 }, { -1, 1, 0 } };
+        mesh->indices = { 0, 1, 2, 0, 2, 3 };
+        mesh->build();
+        scene.push_back(Actor { material, InstanceGeometry { mesh, Transform::translate({ 0, 0, 9 }) * Transform::rotate({ 1, 0, 0 }, 30) * Transform::scale({ 5, 5, 5 }) } });
+
+        LinearAccelerator linear;
+        Accelerator bvh;
+        linear.build(scene);
+        bvh.build(scene);
+
+        std::mt19937 gen(11);
+        std::uniform_real_distribution<> dist(-1.0, 1.0);
+        for (int i = 0; i < 1000; ++i)
+        {
+            Ray ray { Vec { dist(gen), dist(gen), dist(gen) } * 15, Vec { dist(gen), dist(gen), dist(gen) } };
+
+            HitResult expected, actual;
+            bool expected_hit = linear.intersect(ray, expected);
+            bool actual_hit = bvh.intersect(ray, actual);
+
+            REQUIRE(expected_hit == actual_hit);
+            if (expected_hit)
+            {
+                CHECK(expected.actor == actual.actor);
+                CHECK(expected.param == doctest::Approx(actual.param));
+            }
+
+            // Segments that end before the closest hit must not be occluded, longer ones must
+            double tmax = 30 * (dist(gen) + 1);
+            bool blocked = expected_hit && expected.param < tmax;
+            CHECK(linear.occluded(ray, tmax) == blocked);
+            CHECK(bvh.occluded(ray, tmax) == blocked);
+        }
+
+        // A stream of random rays must find what single rays find
+        std::vector<Ray> stream;
+        for (int i = 0; i < 2000; ++i)
+        {
+            stream.push_back(Ray { Vec { dist(gen), dist(gen), dist(gen) } * 15, Vec { dist(gen), dist(gen), dist(gen) } });
+        }
+        std::vector<HitResult> stream_hits(stream.size());
+        std::unique_ptr<bool[]> stream_does_hit(new bool[stream.size()]);
+        bvh.intersect_stream(stream.data(), stream.size(), stream_hits.data(), stream_does_hit.get());
+        for (size_t i = 0; i < stream.size(); ++i)
+        {
+            HitResult expected;
+            REQUIRE(linear.intersect(stream[i], expected) == stream_does_hit[i]);
+            if (stream_does_hit[i])
+            {
+                CHECK(expected.actor == stream_hits[i].actor);
+                CHECK(expected.param == doctest::Approx(stream_hits[i].param));
+            }
+        }
+
+        // Packets of nearby rays, of every size up to the largest, must find what single rays find
+        for (int count = 1; count <= BaseAccelerator::MAX_PACKET_SIZE; ++count)
+        {
+            Vec origin = Vec { dist(gen), dist(gen), dist(gen) } * 15;
+            Vec target = Vec { dist(gen), dist(gen), dist(gen) } * 5;
+            Ray rays[BaseAccelerator::MAX_PACKET_SIZE];
+            for (int i = 0; i < count; ++i)
+            {
+                rays[i] = Ray { origin, target + Vec { dist(gen), dist(gen), dist(gen) } - origin };
+            }
+
+            HitResult hits[BaseAccelerator::MAX_PACKET_SIZE];
+            bool does_hit[BaseAccelerator::MAX_PACKET_SIZE];
+            bvh.intersect_packet(rays, count, hits, does_hit);
+            for (int i = 0; i < count; ++i)
+            {
+                HitResult expected;
+                REQUIRE(linear.intersect(rays[i], expected) == does_hit[i]);
+                if (does_hit[i])
+                {
+                    CHECK(expected.actor == hits[i].actor);
+                    CHECK(expected.param == doctest::Approx(hits[i].param));
+                    CHECK(expected.normal.x == doctest::Approx(hits[i].normal.x));
+                }
+            }
+        }
+    }
+
+    TEST_CASE("accel::BVHAccelerator::matches_linear")
+    {
+        check_matches_linear<BVHAccelerator>();
+    }
+
+    static void check_update(BVHBuildMethod method)
+    {
+        Scene scene = make_test_spheres(500);
+        scene.push_back(Actor { scene.front().material, PlaneGeometry { Vec { 0, -12, 0 }, Vec { 0, 1, 0 } } });
+        CHECK_THROWS_AS(set_sphere(scene, scene.size() - 1, SphereGeometry { Vec { 0 }, 1 }), std::invalid_argument);
+
+        LinearAccelerator linear;
+        BVHAccelerator bvh;
+        bvh.build_method = method;
+        linear.build(scene);
+        bvh.build(scene);
+
+        // Spatial splits list some spheres in several leaves
+        if (method == BVHBuildMethod::SPATIAL) CHECK(bvh.bvh().indices.size() > scene.size() - 1);
+
+        std::mt19937 gen(12);
+        std::uniform_real_distribution<> dist(-1.0, 1.0);
+        auto check_rays = [&]() {
+            for (int i = 0; i < 1000; ++i)
+            {
+                Ray ray { Vec { dist(gen), dist(gen), dist(gen) } * 15, Vec { dist(gen), dist(gen), dist(gen) } };
+
+                HitResult expected, actual;
+                bool expected_hit = linear.intersect(ray, expected);
+                REQUIRE(expected_hit == bvh.intersect(ray, actual));
+                if (expected_hit) CHECK(expected.actor == actual.actor);
+            }
+        };
+        auto move_spheres = [&](double distance) {
+            for (size_t i = 0; i + 1 < scene.size(); ++i)
+            {
+                auto sphere = std::get<SphereGeometry>(scene[i].geometry);
+                sphere.center = sphere.center + Vec { dist(gen), dist(gen), dist(gen) } * distance;
+                set_sphere(scene, i, sphere);
+            }
+        };
+
+        // Small moves are refit, and rays must still find the moved spheres
+        move_spheres(0.2);
+        CHECK_FALSE(bvh.update(scene));
+        check_rays();
+
+        // Shuffling the spheres across the scene spoils the hierarchy, which is then built again
+        move_spheres(10);
+        CHECK(bvh.update(scene));
+        check_rays();
+
+        // A scene with other actors is built from scratch
+        scene.push_back(scene.front());
+        CHECK(bvh.update(scene));
+        linear.build(scene);
+        check_rays();
+    }
+
+    TEST_CASE("accel::BVHAccelerator::update")
+    {
+        check_update(BVHBuildMethod::BINNED);
+        check_update(BVHBuildMethod::SPATIAL);
+    }
+
+    TEST_CASE("accel::WideBVHAccelerator::matches_linear")
+    {
+        check_matches_linear<BVH4Accelerator>();
+        check_matches_linear<BVH8Accelerator>();
+        check_matches_linear<QuantizedBVH4Accelerator>();
+    }
+
+    TEST_CASE("accel::GridAccelerator::matches_linear")
+    {
+        check_matches_linear<DenseGridAccelerator>();
+        check_matches_linear<HashedGridAccelerator>();
+    }
+}
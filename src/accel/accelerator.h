@@ -0,0 +1,283 @@
+#pragma once
+
+#include <scene/scene.h>
+#include <debug.h>
+#include "bvh.h"
+#include "bvh_cache.h"
+#include "wide_bvh.h"
+#include "quantized_bvh.h"
+#include "grid.h"
+#include "sphere_pack.h"
+
+namespace pbr
+{
+    ///////////////////////////////////////////////////////////////////////////////
+    // Scene intersection backends
+    ///////////////////////////////////////////////////////////////////////////////
+
+    /** Interface for structures that answer ray queries against a scene. */
+    struct BaseAccelerator
+    {
+        /** Prepare the structure for the actors in the scene. The scene must outlive the accelerator. */
+        virtual void build(const Scene& scene) = 0;
+
+        /*!
+        * @brief Find the closest intersection along the ray
+        *
+        * @param ray Ray to test against the scene
+        * @param hit Output hit data for the closest actor
+        * @return bool Indicates if the ray hits anything
+        */
+        virtual bool intersect(const Ray& ray, HitResult& hit) const = 0;
+
+        /*!
+        * @brief Check whether anything blocks the ray, for shadow and visibility rays
+        *
+        * Returns on the first hit that is found, and computes no hit attributes.
+        *
+        * @param ray Ray to test against the scene
+        * @param tmax Far end of the segment, in units of the ray parameter. Hits at tmax or beyond are ignored.
+        * @return bool Indicates if any actor blocks the segment
+        */
+        virtual bool occluded(const Ray& ray, double tmax) const = 0;
+
+        /** Largest number of rays that intersect_packet() takes at once */
+        static constexpr int MAX_PACKET_SIZE = 16;
+
+        /*!
+        * @brief Find the closest intersections of a packet of coherent rays, such as the primary rays of one pixel
+        *
+        * Structures that can share node visits between the rays override this. The default traces them one at a time.
+        *
+        * @param rays Rays to test against the scene
+        * @param count Number of rays, at most MAX_PACKET_SIZE
+        * @param hits Output hit data for the closest actor of each ray
+        * @param does_hit Output, whether each ray hits anything
+        */
+        virtual void intersect_packet(const Ray* rays, int count, HitResult* hits, bool* does_hit) const
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                does_hit[i] = intersect(rays[i], hits[i]);
+            }
+        }
+
+        /*!
+        * @brief Find the closest intersections of a large stream of rays, such as one bounce of many paths
+        *
+        * Structures that can traverse the rays breadth-first override this. The default traces them one at a time.
+        *
+        * @param rays Rays to test against the scene
+        * @param count Number of rays
+        * @param hits Output hit data for the closest actor of each ray
+        * @param does_hit Output, whether each ray hits anything
+        */
+        virtual void intersect_stream(const Ray* rays, size_t count, HitResult* hits, bool* does_hit) const
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                does_hit[i] = intersect(rays[i], hits[i]);
+            }
+        }
+
+        /*!
+        * @brief Bring the structure up to date after actors of the scene moved in place, see set_sphere()
+        *
+        * Structures that can refit their bounds override this. The default builds again.
+        *
+        * @param scene Scene that was passed to build()
+        * @return bool Indicates if the structure was built again rather than refit
+        */
+        virtual bool update(const Scene& scene)
+        {
+            build(scene);
+            return true;
+        }
+
+        /** Memory held by the structure, not counting the scene itself. */
+        virtual size_t memory_bytes() const = 0;
+
+        /** Log the size and quality of the structure after build(). */
+        virtual void log_build_info() const
+        {
+            LOG_INFO("  %.2f MB", memory_bytes() / 1e6);
+        }
+
+        virtual ~BaseAccelerator() = default;
+    };
+
+    /** Tests every actor in the scene for every ray. */
+    struct LinearAccelerator : public BaseAccelerator
+    {
+        virtual void build(const Scene& scene) override;
+        virtual bool intersect(const Ray& ray, HitResult& hit) const override;
+        virtual bool occluded(const Ray& ray, double tmax) const override;
+        virtual size_t memory_bytes() const override { return 0; }
+
+    private:
+        const Scene* p_scene = nullptr;
+    };
+
+    /** Binary SAH hierarchy over the bounds of the actors in the scene. Spheres in a leaf are tested in SIMD batches. */
+    struct BVHAccelerator : public BaseAccelerator
+    {
+        virtual void build(const Scene& scene) override;
+        virtual bool intersect(const Ray& ray, HitResult& hit) const override;
+        virtual bool occluded(const Ray& ray, double tmax) const override;
+        virtual void intersect_packet(const Ray* rays, int count, HitResult* hits, bool* does_hit) const override;
+        virtual void intersect_stream(const Ray* rays, size_t count, HitResult* hits, bool* does_hit) const override;
+        virtual size_t memory_bytes() const override;
+        virtual void log_build_info() const override;
+
+        /** Refits the hierarchy to the actors, and builds it again once the refit SAH cost passes PBR_BVH_REFIT_REBUILD_RATIO times its cost after the build */
+        virtual bool update(const Scene& scene) override;
+
+        const BVH& bvh() const { return _bvh; }
+
+        /** Method of build(), which goes through the cache directory. Rebuilds after refits use PBR_BVH_REFIT_REBUILD_METHOD. */
+        BVHBuildMethod build_method = PBR_BVH_BUILD_METHOD;
+
+    protected:
+        /** Packet traversals with 8 and 16 lanes, compiled once per instruction set. Templates cannot be. */
+        void closest_hit_packet8(const Ray* rays, int count, HitResult* hits, bool* does_hit) const;
+        void closest_hit_packet16(const Ray* rays, int count, HitResult* hits, bool* does_hit) const;
+
+        template <int N>
+        void closest_hit_packet(const Ray* rays, int count, HitResult* hits, bool* does_hit) const;
+
+        /** Closest hit among the unbounded actors, closer than tmax. Shrinks tmax on a hit, and leaves the point and normal unset. */
+        bool intersect_unbounded(const Ray& ray, double& tmax, HitResult& out_hit) const;
+
+        /** Closest hit among positions [first, first + count) of `_actors`, closer than tmax. Shrinks tmax on a hit, and leaves the point and normal unset. */
+        bool intersect_leaf(const Ray& ray, const PackedRay& packed, uint32_t first, uint32_t count,
+                            double& tmax, HitResult& out_hit) const;
+
+        /** Whether the unbounded actors block the ray before tmax */
+        bool occluded_unbounded(const Ray& ray, double tmax) const;
+
+        /** Whether any of positions [first, first + count) of `_actors` blocks the ray before tmax */
+        bool occluded_leaf(const Ray& ray, const PackedRay& packed, uint32_t first, uint32_t count, double tmax) const;
+
+        /*!
+        * @brief Build `_bvh` over the bounded actors, in any order, and set up everything that depends on it
+        *
+        * @param use_cache Build through the cache directory with `build_method`. Otherwise build with
+        *                  PBR_BVH_REFIT_REBUILD_METHOD, for rebuilds between frames.
+        */
+        void build_hierarchy(const std::vector<const Actor*>& bounded, const std::vector<AABB>& bounds, bool use_cache);
+
+        BVH _bvh;
+
+        /** SAH cost of `_bvh`, kept since derived structures may drop its nodes */
+        double _sah_cost = 0;
+
+        /** SAH cost of `_bvh` right after it was last built, which refits are measured against */
+        double _built_sah_cost = 0;
+
+        // First actor and size of the scene the structure was built for, update() builds again if they changed
+        const Actor* _scene_data = nullptr;
+        size_t _scene_size = 0;
+
+        // Whether the hierarchy was mapped from the cache directory instead of built
+        bool _from_cache = false;
+
+        /** Actors in the order of `_bvh.indices`, so that leaves are contiguous */
+        std::vector<const Actor*> _actors;
+
+        /** Number of bounded actors. Spatial splits list some actors in several leaves, so `_actors` can be longer. */
+        size_t _primitive_count = 0;
+
+        /** Packed copy of `_actors` */
+        SpherePack _spheres;
+
+        /** Actors without finite bounds, tested against every ray */
+        std::vector<const Actor*> _unbounded;
+    };
+
+    /** The hierarchy of BVHAccelerator collapsed to N children per node, whose boxes are tested together. */
+    template <int N, class Node = WideBVHNode<N>>
+    struct WideBVHAccelerator : public BVHAccelerator
+    {
+        virtual void build(const Scene& scene) override;
+        virtual bool intersect(const Ray& ray, HitResult& hit) const override;
+        virtual bool occluded(const Ray& ray, double tmax) const override;
+        virtual size_t memory_bytes() const override;
+        virtual void log_build_info() const override;
+
+        /** The binary nodes are dropped after the collapse, and a wide node already tests its boxes together, so rays go one at a time */
+        virtual void intersect_packet(const Ray* rays, int count, HitResult* hits, bool* does_hit) const override
+        {
+            BaseAccelerator::intersect_packet(rays, count, hits, does_hit);
+        }
+
+        virtual void intersect_stream(const Ray* rays, size_t count, HitResult* hits, bool* does_hit) const override
+        {
+            BaseAccelerator::intersect_stream(rays, count, hits, does_hit);
+        }
+
+        /** There are no binary nodes left to refit, so the hierarchy is built again */
+        virtual bool update(const Scene& scene) override
+        {
+            build(scene);
+            return true;
+        }
+
+        const WideBVH<N, Node>& wide_bvh() const { return _wide; }
+
+    private:
+        /** The traversals, compiled once per instruction set since virtual functions cannot be */
+        bool closest_hit(const Ray& ray, HitResult& out_hit) const;
+        bool any_hit(const Ray& ray, double tmax) const;
+
+        WideBVH<N, Node> _wide;
+    };
+
+    using BVH4Accelerator = WideBVHAccelerator<4>;
+    using BVH8Accelerator = WideBVHAccelerator<8>;
+
+    /** BVH4Accelerator with nodes quantized to one cache line each, for scenes that are short on memory */
+    using QuantizedBVH4Accelerator = WideBVHAccelerator<4, QuantizedBVHNode>;
+
+    /*!
+    * @brief Uniform grid over the bounds of the actors in the scene, for dense clouds of similar-size spheres
+    *
+    * Builds in linear time and walks the cells along each ray with a 3D-DDA, which can beat a hierarchy on both
+    * counts when the actors fill the scene evenly. It reuses the packed leaf tests of BVHAccelerator: `_actors`
+    * holds one entry per reference of the grid, so that each cell is a contiguous range of it. No hierarchy is built.
+    */
+    template <GridStorage Storage>
+    struct GridAccelerator : public BVHAccelerator
+    {
+        virtual void build(const Scene& scene) override;
+        virtual bool intersect(const Ray& ray, HitResult& hit) const override;
+        virtual bool occluded(const Ray& ray, double tmax) const override;
+        virtual size_t memory_bytes() const override;
+        virtual void log_build_info() const override;
+
+        /** There is no hierarchy to share node visits or to traverse breadth-first, so rays go one at a time */
+        virtual void intersect_packet(const Ray* rays, int count, HitResult* hits, bool* does_hit) const override
+        {
+            BaseAccelerator::intersect_packet(rays, count, hits, does_hit);
+        }
+
+        virtual void intersect_stream(const Ray* rays, size_t count, HitResult* hits, bool* does_hit) const override
+        {
+            BaseAccelerator::intersect_stream(rays, count, hits, does_hit);
+        }
+
+        /** Building a grid costs about as much as refitting a hierarchy, so it is built again */
+        virtual bool update(const Scene& scene) override
+        {
+            build(scene);
+            return true;
+        }
+
+        const Grid& grid() const { return _grid; }
+
+    private:
+        Grid _grid;
+    };
+
+    using DenseGridAccelerator = GridAccelerator<GridStorage::DENSE>;
+    using HashedGridAccelerator = GridAccelerator<GridStorage::HASHED>;
+}
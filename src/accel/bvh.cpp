@@ -0,0 +1,634 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+
+namespace pbr
+{
+    void BVH::build(const std::vector<AABB>& bounds, uint32_t batch_size_, BVHBuildMethod method)
+    {
+        batch_size = batch_size_;
+        nodes.clear();
+        indices.resize(bounds.size());
+        std::iota(indices.mutable_data(), indices.mutable_data() + indices.size(), 0);
+        if (bounds.empty()) return;
+
+        if (method == BVHBuildMethod::FULL_SWEEP)
+        {
+            nodes.reserve(2 * bounds.size());
+
+            std::vector<Point> centroids;
+            centroids.reserve(bounds.size());
+            for (const auto& box : bounds)
+            {
+                centroids.push_back(box.centroid());
+            }
+
+            build_recursive(bounds, centroids, 0, bounds.size(), 0);
+        }
+        else if (method == BVHBuildMethod::MORTON || method == BVHBuildMethod::MORTON_TREELETS)
+        {
+            build_morton(bounds);
+            if (method == BVHBuildMethod::MORTON_TREELETS) restructure_treelets();
+        }
+        else if (method == BVHBuildMethod::SPATIAL)
+        {
+            // Applies the layout itself
+            build_spatial(bounds, nullptr, batch_size);
+            return;
+        }
+        else
+        {
+            std::vector<PrimRef> refs(bounds.size());
+            std::vector<BVHNode> built;
+            built.reserve(2 * bounds.size());
+#if PBR_USE_THREADS
+#pragma omp parallel for if (bounds.size() >= PARALLEL_BUILD_THRESHOLD)
+#endif
+            for (size_t i = 0; i < bounds.size(); ++i)
+            {
+                refs[i] = { bounds[i], (uint32_t) i };
+            }
+
+#if PBR_USE_THREADS
+#pragma omp parallel if (bounds.size() >= PARALLEL_BUILD_THRESHOLD)
+#pragma omp single
+#endif
+            build_binned(refs, 0, bounds.size(), 0, built);
+            nodes.assign(std::move(built));
+
+            uint32_t* ids = indices.mutable_data();
+            for (size_t i = 0; i < refs.size(); ++i)
+            {
+                ids[i] = refs[i].index;
+            }
+        }
+
+        if (PBR_BVH_LAYOUT != BVHLayout::DEPTH_FIRST) reorder(PBR_BVH_LAYOUT);
+    }
+
+    /** Appends the subtree at `index` of `nodes` to `out` in the order of `layout`, and returns where it went */
+    static uint32_t reorder_subtree(const Buffer<BVHNode>& nodes, uint32_t index, BVHLayout layout, std::vector<BVHNode>& out)
+    {
+        uint32_t out_index = out.size();
+        out.push_back(nodes[index]);
+        const BVHNode& node = nodes[index];
+        if (node.is_leaf()) return out_index;
+
+        uint32_t low = index + 1;
+        uint32_t high = node.offset;
+        if (node.high_first()) std::swap(low, high);
+
+        bool high_first = layout == BVHLayout::HOT_CHILD_FIRST
+                       && nodes[high].bounds.surface_area() > nodes[low].bounds.surface_area();
+        reorder_subtree(nodes, high_first ? high : low, layout, out);
+        uint32_t second = reorder_subtree(nodes, high_first ? low : high, layout, out);
+
+        out[out_index].offset = second;
+        out[out_index].axis = node.split_axis() | (high_first ? BVHNode::HIGH_FIRST : 0);
+        return out_index;
+    }
+
+    void BVH::reorder(BVHLayout layout)
+    {
+        if (nodes.empty()) return;
+
+        std::vector<BVHNode> ordered;
+        ordered.reserve(nodes.size());
+        reorder_subtree(nodes, 0, layout, ordered);
+        nodes.assign(std::move(ordered));
+    }
+
+    // Levels of the hierarchy at the top whose subtrees are refit as separate tasks
+    static constexpr int PARALLEL_REFIT_DEPTH = 6;
+
+    /** Refits the subtree under node `index` bottom-up, and returns its new box */
+    static AABB refit_subtree(BVHNode* nodes, const uint32_t* indices, const std::vector<AABB>& bounds, uint32_t index, int depth)
+    {
+        BVHNode& node = nodes[index];
+        AABB box;
+        if (node.is_leaf())
+        {
+            for (uint32_t i = node.offset; i < node.offset + node.count; ++i)
+            {
+                box.expand(bounds[indices[i]]);
+            }
+        }
+        else if (depth < PARALLEL_REFIT_DEPTH)
+        {
+            AABB second;
+#if PBR_USE_THREADS
+#pragma omp task default(shared)
+#endif
+            second = refit_subtree(nodes, indices, bounds, node.offset, depth + 1);
+
+            box = refit_subtree(nodes, indices, bounds, index + 1, depth + 1);
+#if PBR_USE_THREADS
+#pragma omp taskwait
+#endif
+            box.expand(second);
+        }
+        else
+        {
+            box = refit_subtree(nodes, indices, bounds, index + 1, depth + 1);
+            box.expand(refit_subtree(nodes, indices, bounds, node.offset, depth + 1));
+        }
+
+        node.bounds = box;
+        return box;
+    }
+
+    void BVH::refit(const std::vector<AABB>& bounds)
+    {
+        if (nodes.empty()) return;
+
+        // Writing copies a hierarchy mapped from the cache into memory of its own first
+        BVHNode* out = nodes.mutable_data();
+#if PBR_USE_THREADS
+#pragma omp parallel if (indices.size() >= PARALLEL_BUILD_THRESHOLD)
+#pragma omp single
+#endif
+        refit_subtree(out, indices.data(), bounds, 0, 0);
+    }
+
+    BVH::StreamRays::StreamRays(const Ray* rays, uint32_t count)
+    {
+        for (int a = 0; a < 3; ++a)
+        {
+            origin[a].resize(count);
+            inv_dir[a].resize(count);
+        }
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            origin[0][i] = rays[i].origin.x;
+            origin[1][i] = rays[i].origin.y;
+            origin[2][i] = rays[i].origin.z;
+            inv_dir[0][i] = 1 / rays[i].direction.x;
+            inv_dir[1][i] = 1 / rays[i].direction.y;
+            inv_dir[2][i] = 1 / rays[i].direction.z;
+        }
+    }
+
+    PBR_TARGET_CLONES uint32_t BVH::filter_stream(const StreamRays& stream, const AABB& box, const double* tmax,
+                                                  const uint32_t* in, uint32_t count, uint32_t* out)
+    {
+        const double* ox = stream.origin[0].data();
+        const double* oy = stream.origin[1].data();
+        const double* oz = stream.origin[2].data();
+        const double* ix = stream.inv_dir[0].data();
+        const double* iy = stream.inv_dir[1].data();
+        const double* iz = stream.inv_dir[2].data();
+
+        // Written without branches, the id is always stored and only kept if the ray overlaps
+        uint32_t active = 0;
+        for (uint32_t k = 0; k < count; ++k)
+        {
+            uint32_t i = in[k];
+            double tx0 = (box.min.x - ox[i]) * ix[i];
+            double tx1 = (box.max.x - ox[i]) * ix[i];
+            double ty0 = (box.min.y - oy[i]) * iy[i];
+            double ty1 = (box.max.y - oy[i]) * iy[i];
+            double tz0 = (box.min.z - oz[i]) * iz[i];
+            double tz1 = (box.max.z - oz[i]) * iz[i];
+
+            // NaNs from 0 * inf are dropped by the argument order, as in AABB::intersect
+            double tnear = std::max(std::max(std::max(0.0, std::min(tx0, tx1)), std::min(ty0, ty1)), std::min(tz0, tz1));
+            double tfar = std::min(std::min(std::min(tmax[i], std::max(tx0, tx1)), std::max(ty0, ty1)), std::max(tz0, tz1));
+
+            out[active] = i;
+            active += tnear <= tfar;
+        }
+        return active;
+    }
+
+    double BVH::sah_cost() const
+    {
+        if (nodes.empty()) return 0;
+
+        double root_area = std::max(nodes.front().bounds.surface_area(), 1e-300);
+        double cost = 0;
+        for (const auto& node : nodes)
+        {
+            double probability = node.bounds.surface_area() / root_area;
+            if (node.is_leaf())
+            {
+                cost += probability * PBR_BVH_INTERSECTION_COST * ((node.count + batch_size - 1) / batch_size);
+            }
+            else
+            {
+                cost += probability * PBR_BVH_TRAVERSAL_COST;
+            }
+        }
+        return cost;
+    }
+
+    uint32_t BVH::build_recursive(const std::vector<AABB>& bounds, const std::vector<Point>& centroids,
+                                  uint32_t begin, uint32_t end, int depth)
+    {
+        uint32_t node_index = nodes.size();
+        nodes.emplace_back();
+        uint32_t* ids = indices.mutable_data();
+
+        AABB node_bounds;
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            node_bounds.expand(bounds[indices[i]]);
+        }
+        nodes.mutable_data()[node_index].bounds = node_bounds;
+
+        uint32_t count = end - begin;
+        auto make_leaf = [&]() {
+            nodes.mutable_data()[node_index].offset = begin;
+            nodes.mutable_data()[node_index].count = count;
+            return node_index;
+        };
+
+        if (count == 1) return make_leaf();
+
+        auto by_axis = [&](int axis) {
+            return [&centroids, axis](uint32_t a, uint32_t b) {
+                return axis_of(centroids[a], axis) < axis_of(centroids[b], axis);
+            };
+        };
+
+        auto batches = [this](uint32_t n) { return (double) ((n + batch_size - 1) / batch_size); };
+
+        int best_axis = -1;
+        uint32_t best_split = 0;
+        double best_cost = PBR_INF;
+
+        // Past this depth fall back to median splits so that the tree depth stays bounded
+        // for any input, which keeps the fixed-size traversal stack safe.
+        bool use_sah = depth < PBR_BVH_MAX_DEPTH - 32;
+        if (use_sah)
+        {
+            // Full sweep SAH. For every axis, sort along centroids and evaluate every split position.
+            std::vector<double> right_area(count);
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                std::sort(ids + begin, ids + end, by_axis(axis));
+
+                AABB right;
+                for (uint32_t i = count - 1; i > 0; --i)
+                {
+                    right.expand(bounds[indices[begin + i]]);
+                    right_area[i] = right.surface_area();
+                }
+
+                AABB left;
+                for (uint32_t i = 1; i < count; ++i)
+                {
+                    left.expand(bounds[indices[begin + i - 1]]);
+                    double cost = left.surface_area() * batches(i) + right_area[i] * batches(count - i);
+                    if (cost < best_cost)
+                    {
+                        best_cost = cost;
+                        best_axis = axis;
+                        best_split = i;
+                    }
+                }
+            }
+
+            double area = node_bounds.surface_area();
+            best_cost = PBR_BVH_TRAVERSAL_COST + PBR_BVH_INTERSECTION_COST * best_cost / std::max(area, 1e-300);
+
+            double leaf_cost = PBR_BVH_INTERSECTION_COST * batches(count);
+            if (count <= PBR_BVH_MAX_LEAF_SIZE && leaf_cost <= best_cost) return make_leaf();
+        }
+        else
+        {
+            if (count <= PBR_BVH_MAX_LEAF_SIZE) return make_leaf();
+
+            AABB centroid_bounds;
+            for (uint32_t i = begin; i < end; ++i)
+            {
+                centroid_bounds.expand(centroids[indices[i]]);
+            }
+            best_axis = centroid_bounds.longest_axis();
+            best_split = count / 2;
+        }
+
+        // The last sort was along z, redo it if a different axis won
+        if (best_axis != 2 || !use_sah)
+        {
+            std::nth_element(ids + begin, ids + begin + best_split, ids + end, by_axis(best_axis));
+        }
+
+        uint32_t mid = begin + best_split;
+        build_recursive(bounds, centroids, begin, mid, depth + 1);
+        uint32_t second = build_recursive(bounds, centroids, mid, end, depth + 1);
+
+        nodes.mutable_data()[node_index].offset = second;
+        nodes.mutable_data()[node_index].count = 0;
+        nodes.mutable_data()[node_index].axis = best_axis;
+        return node_index;
+    }
+
+    void BVH::build_binned(std::vector<PrimRef>& refs, uint32_t begin, uint32_t end, int depth, std::vector<BVHNode>& out)
+    {
+        uint32_t node_index = out.size();
+        out.emplace_back();
+
+        AABB node_bounds;
+        AABB centroid_bounds;
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            node_bounds.expand(refs[i].bounds);
+            centroid_bounds.expand(refs[i].bounds.centroid());
+        }
+        out[node_index].bounds = node_bounds;
+
+        uint32_t count = end - begin;
+        auto make_leaf = [&]() {
+            out[node_index].offset = begin;
+            out[node_index].count = count;
+        };
+
+        if (count == 1) return make_leaf();
+
+        auto batches = [this](uint32_t n) { return (double) ((n + batch_size - 1) / batch_size); };
+
+        // Bin of a centroid along each axis, the same during evaluation and partitioning
+        // Small nodes get fewer bins, there are not many splits to choose from anyway
+        int bins = std::min<int>(PBR_BVH_BINS, count);
+        double bin_scale[3];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            double extent = axis_of(centroid_bounds.max, axis) - axis_of(centroid_bounds.min, axis);
+            bin_scale[axis] = (extent > 0) ? bins / extent : 0;
+        }
+        auto bin_of = [&](const Point& centroid, int axis) {
+            double offset = axis_of(centroid, axis) - axis_of(centroid_bounds.min, axis);
+            return std::min(bins - 1, (int) (offset * bin_scale[axis]));
+        };
+
+        int best_axis = -1;
+        int best_bin = 0;
+        double best_cost = PBR_INF;
+
+        // Same depth limit as the full sweep, past it splits are at the median
+        if (depth < PBR_BVH_MAX_DEPTH - 32)
+        {
+            // Bin along all three axes in one pass over the primitives
+            AABB bin_bounds[3][PBR_BVH_BINS];
+            uint32_t bin_count[3][PBR_BVH_BINS] = {};
+            for (uint32_t i = begin; i < end; ++i)
+            {
+                Point centroid = refs[i].bounds.centroid();
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    int bin = bin_of(centroid, axis);
+                    bin_bounds[axis][bin].expand(refs[i].bounds);
+                    ++bin_count[axis][bin];
+                }
+            }
+
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                if (bin_scale[axis] == 0) continue;
+
+                // Split b puts bins [0, b) on the left and [b, bins) on the right
+                double right_area[PBR_BVH_BINS];
+                uint32_t right_count[PBR_BVH_BINS];
+                AABB right;
+                uint32_t in_right = 0;
+                for (int b = bins - 1; b > 0; --b)
+                {
+                    right.expand(bin_bounds[axis][b]);
+                    in_right += bin_count[axis][b];
+                    right_area[b] = right.surface_area();
+                    right_count[b] = in_right;
+                }
+
+                AABB left;
+                uint32_t in_left = 0;
+                for (int b = 1; b < bins; ++b)
+                {
+                    left.expand(bin_bounds[axis][b - 1]);
+                    in_left += bin_count[axis][b - 1];
+                    if (in_left == 0 || right_count[b] == 0) continue;
+
+                    double cost = left.surface_area() * batches(in_left) + right_area[b] * batches(right_count[b]);
+                    if (cost < best_cost)
+                    {
+                        best_cost = cost;
+                        best_axis = axis;
+                        best_bin = b;
+                    }
+                }
+            }
+
+            if (best_axis >= 0)
+            {
+                double area = node_bounds.surface_area();
+                best_cost = PBR_BVH_TRAVERSAL_COST + PBR_BVH_INTERSECTION_COST * best_cost / std::max(area, 1e-300);
+
+                double leaf_cost = PBR_BVH_INTERSECTION_COST * batches(count);
+                if (count <= PBR_BVH_MAX_LEAF_SIZE && leaf_cost <= best_cost) return make_leaf();
+            }
+        }
+
+        uint32_t mid;
+        if (best_axis >= 0)
+        {
+            auto left_of_split = [&](const PrimRef& ref) { return bin_of(ref.bounds.centroid(), best_axis) < best_bin; };
+            mid = std::partition(refs.begin() + begin, refs.begin() + end, left_of_split) - refs.begin();
+        }
+        else
+        {
+            // Too deep, or all centroids coincide
+            if (count <= PBR_BVH_MAX_LEAF_SIZE) return make_leaf();
+
+            best_axis = centroid_bounds.longest_axis();
+            mid = begin + count / 2;
+            std::nth_element(refs.begin() + begin, refs.begin() + mid, refs.begin() + end,
+                             [best_axis](const PrimRef& a, const PrimRef& b) {
+                                 return axis_of(a.bounds.centroid(), best_axis) < axis_of(b.bounds.centroid(), best_axis);
+                             });
+        }
+
+        uint32_t second;
+        if (count >= PARALLEL_BUILD_THRESHOLD)
+        {
+            // The right subtree goes to its own array while this task appends the left one, then it is moved in place
+            std::vector<BVHNode> right_nodes;
+            right_nodes.reserve(2 * (end - mid));
+#if PBR_USE_THREADS
+#pragma omp task default(shared) firstprivate(mid, end, depth)
+#endif
+            build_binned(refs, mid, end, depth + 1, right_nodes);
+
+            build_binned(refs, begin, mid, depth + 1, out);
+#if PBR_USE_THREADS
+#pragma omp taskwait
+#endif
+
+            second = out.size();
+            for (auto& node : right_nodes)
+            {
+                if (!node.is_leaf()) node.offset += second;
+            }
+            out.insert(out.end(), right_nodes.begin(), right_nodes.end());
+        }
+        else
+        {
+            build_binned(refs, begin, mid, depth + 1, out);
+            second = out.size();
+            build_binned(refs, mid, end, depth + 1, out);
+        }
+
+        out[node_index].offset = second;
+        out[node_index].count = 0;
+        out[node_index].axis = best_axis;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+    // TESTS
+    ///////////////////////////////////////////////////////////////////////////////
+
+    /** Checks that every primitive is in exactly one leaf and that every box contains its children. */
+    static void check_hierarchy(const BVH& bvh, const std::vector<AABB>& bounds)
+    {
+        std::vector<int> seen(bounds.size(), 0);
+        // Only used in checks, which are compiled away outside the test build
+        [[maybe_unused]] auto contains = [](const AABB& outer, const AABB& inner) {
+            return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && outer.min.z <= inner.min.z
+                && outer.max.x >= inner.max.x && outer.max.y >= inner.max.y && outer.max.z >= inner.max.z;
+        };
+
+        for (uint32_t i = 0; i < bvh.nodes.size(); ++i)
+        {
+            const BVHNode& node = bvh.nodes[i];
+            if (node.is_leaf())
+            {
+                for (uint32_t j = node.offset; j < node.offset + node.count; ++j)
+                {
+                    ++seen[bvh.indices[j]];
+                    CHECK(contains(node.bounds, bounds[bvh.indices[j]]));
+                }
+            }
+            else
+            {
+                REQUIRE(node.offset < bvh.nodes.size());
+                CHECK(contains(node.bounds, bvh.nodes[i + 1].bounds));
+                CHECK(contains(node.bounds, bvh.nodes[node.offset].bounds));
+            }
+        }
+        CHECK(std::count(seen.begin(), seen.end(), 1) == (long) bounds.size());
+    }
+
+    /** Boxes with centers in [-100, 100] and half sizes in [0.1, 2] along each axis */
+    static std::vector<AABB> random_boxes(size_t count, uint32_t seed)
+    {
+        std::mt19937 gen(seed);
+        std::uniform_real_distribution<> position(-100.0, 100.0);
+        std::uniform_real_distribution<> size(0.1, 2.0);
+        std::vector<AABB> boxes(count);
+        for (auto& box : boxes)
+        {
+            Vec center { position(gen), position(gen), position(gen) };
+            Vec half { size(gen), size(gen), size(gen) };
+            box = { center - half, center + half };
+        }
+        return boxes;
+    }
+
+    TEST_CASE("accel::BVH::binned_build")
+    {
+        // Enough primitives for the binned build to split into tasks
+        std::vector<AABB> bounds = random_boxes(20000, 5);
+
+        BVH sweep, binned;
+        sweep.build(bounds, 1, BVHBuildMethod::FULL_SWEEP);
+        binned.build(bounds, 1, BVHBuildMethod::BINNED);
+        check_hierarchy(sweep, bounds);
+        check_hierarchy(binned, bounds);
+
+        // Binning only evaluates a subset of the splits, the trees should still be close
+        CHECK(binned.sah_cost() <= sweep.sah_cost() * 1.1);
+
+        // Identical centroids cannot be split by bins, and must still end in small leaves
+        std::vector<AABB> stacked(100, AABB { Vec { 0 }, Vec { 1 } });
+        binned.build(stacked, 1, BVHBuildMethod::BINNED);
+        check_hierarchy(binned, stacked);
+        for (const auto& node : binned.nodes)
+        {
+            CHECK(node.count <= PBR_BVH_MAX_LEAF_SIZE);
+        }
+    }
+
+    TEST_CASE("accel::BVH::reorder")
+    {
+        std::vector<AABB> bounds = random_boxes(5000, 7);
+
+        BVH built;
+        built.build(bounds, 1, BVHBuildMethod::BINNED);
+        built.reorder(BVHLayout::DEPTH_FIRST);
+        BVH hot = built;
+        hot.reorder(BVHLayout::HOT_CHILD_FIRST);
+        check_hierarchy(hot, bounds);
+        CHECK(hot.sah_cost() == doctest::Approx(built.sah_cost()));
+        CHECK(std::count_if(hot.nodes.begin(), hot.nodes.end(), [](const BVHNode& node) { return node.high_first(); }) > 0);
+
+        // The children are visited in the same order wherever they are, so every query finds the same leaves
+        std::vector<Ray> rays;
+        std::mt19937 gen(7);
+        std::uniform_real_distribution<> position(-100.0, 100.0);
+        std::uniform_real_distribution<> direction(-1.0, 1.0);
+        for (int i = 0; i < 300; ++i)
+        {
+            rays.push_back({ Vec { position(gen), position(gen), position(gen) }, normalize(Vec { direction(gen), direction(gen), direction(gen) }) });
+        }
+        auto leaves = [&](const BVH& bvh) {
+            std::vector<uint32_t> visited;
+            for (const auto& ray : rays)
+            {
+                double tmax = PBR_INF;
+                bvh.intersect(ray, tmax, [&](uint32_t first, uint32_t, double& tmax) {
+                    visited.push_back(first);
+                    tmax *= 0.9;
+                    return true;
+                });
+            }
+            std::vector<double> tmax(rays.size(), 50.0);
+            bvh.intersect_stream(rays.data(), rays.size(), tmax.data(), [&](uint32_t first, uint32_t, const uint32_t* ids, uint32_t count) {
+                for (uint32_t i = 0; i < count; ++i) visited.push_back(first ^ (ids[i] << 16));
+            });
+            return visited;
+        };
+        CHECK(leaves(hot) == leaves(built));
+
+        // Going back gives the nodes as built
+        hot.reorder(BVHLayout::DEPTH_FIRST);
+        REQUIRE(hot.nodes.size() == built.nodes.size());
+        CHECK(std::memcmp(hot.nodes.data(), built.nodes.data(), built.nodes.size() * sizeof(BVHNode)) == 0);
+    }
+
+    TEST_CASE("accel::BVH::morton_build")
+    {
+        // More primitives than one block of the radix sort
+        std::vector<AABB> bounds = random_boxes(100000, 6);
+
+        BVH binned, morton, treelets;
+        binned.build(bounds, 1, BVHBuildMethod::BINNED);
+        morton.build(bounds, 1, BVHBuildMethod::MORTON);
+        treelets.build(bounds, 1, BVHBuildMethod::MORTON_TREELETS);
+        check_hierarchy(morton, bounds);
+        check_hierarchy(treelets, bounds);
+
+        // Restructuring keeps the leaves and only lowers the cost
+        CHECK(treelets.nodes.size() == morton.nodes.size());
+        CHECK(treelets.sah_cost() < morton.sah_cost());
+        CHECK(treelets.sah_cost() <= binned.sah_cost() * 1.25);
+
+        // Equal codes are split in the middle of their range
+        std::vector<AABB> stacked(100, AABB { Vec { 0 }, Vec { 1 } });
+        treelets.build(stacked, 1, BVHBuildMethod::MORTON_TREELETS);
+        check_hierarchy(treelets, stacked);
+        for (const auto& node : treelets.nodes)
+        {
+            CHECK(node.count <= PBR_BVH_MAX_LEAF_SIZE);
+        }
+    }
+}
@@ -0,0 +1,531 @@
+#pragma once
+
+#include "aabb.h"
+#include <core/buffer.h>
+#include <config.h>
+#include <stats.h>
+#include <core/simd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#if PBR_BVH_PREFETCH && defined(__GNUC__)
+    /** Start loading a node that the traversal is going to visit, so that the load overlaps with the work before it */
+    #define PBR_BVH_PREFETCH_NODE(NODE) __builtin_prefetch(NODE)
+#else
+    #define PBR_BVH_PREFETCH_NODE(NODE)
+#endif
+
+namespace pbr
+{
+    /** A node of a binary BVH, stored in depth-first order. The first child of an interior node directly follows it. */
+    struct BVHNode
+    {
+        AABB bounds;
+
+        /** Index of the second child for interior nodes, or of the first primitive for leaves. */
+        uint32_t offset;
+
+        /** Number of primitives in a leaf, 0 for interior nodes. */
+        uint16_t count;
+
+        /** Axis along which the children of an interior node were split, or'ed with HIGH_FIRST. Use split_axis() to read it. */
+        uint16_t axis;
+
+        /** Set in `axis` when the first child is the one on the high side of the split, see BVHLayout */
+        static constexpr uint16_t HIGH_FIRST = 4;
+
+        inline bool is_leaf() const { return count > 0; }
+
+        inline int split_axis() const { return axis & 3; }
+
+        inline bool high_first() const { return (axis & HIGH_FIRST) != 0; }
+    };
+
+    /** How BVH::build chooses the split of each node. */
+    enum class BVHBuildMethod
+    {
+        /** Sort along every axis and evaluate every split position, single-threaded */
+        FULL_SWEEP,
+
+        /** Evaluate splits between PBR_BVH_BINS bins of centroids, and build large subtrees as parallel tasks */
+        BINNED,
+
+        /** Sort centroids along a Morton curve and split where the codes first differ. Builds in linear time after
+         *  the sort, for scenes rebuilt every frame, at a higher traversal cost than the SAH builds */
+        MORTON,
+
+        /** MORTON followed by PBR_BVH_TREELET_ROUNDS rounds of treelet restructuring, which wins back most of the traversal cost */
+        MORTON_TREELETS,
+
+        /** BINNED, plus splits that cut primitives at a plane and give each side its own reference, see
+         *  BVH::build_spatial(). From bounds alone only the boxes can be cut, which helps much less than cutting the geometry */
+        SPATIAL,
+    };
+
+    /*!
+    * @brief Order of the nodes of a BVH in memory
+    *
+    * Both orders are depth-first, so that one child of every interior node is the next node in memory, which
+    * is likely on the same cache line or on the one the hardware prefetches next. They differ in which child that is.
+    */
+    enum class BVHLayout
+    {
+        /** The child on the low side of the split comes first, as the builders produce it */
+        DEPTH_FIRST,
+
+        /** The child with the larger surface area comes first. Under the surface area heuristic it is the one more rays visit. */
+        HOT_CHILD_FIRST,
+    };
+
+    /*!
+    * @brief Bounding volume hierarchy over a set of primitive bounds
+    *
+    * The hierarchy only knows about boxes. Primitives are referred to by their index in the
+    * array that was passed to build(), and leaves hold ranges into the reordered `indices`.
+    * Callers supply the primitive test as a callback during traversal.
+    */
+    struct BVH
+    {
+        Buffer<BVHNode> nodes;
+        Buffer<uint32_t> indices;
+
+        /*!
+        * @brief Build the hierarchy with the surface area heuristic
+        *
+        * @param bounds Bounds of each primitive
+        * @param batch_size Number of primitives a leaf tests for the cost of one, for leaves tested with SIMD
+        * @param method Full sweep or binned evaluation of the splits
+        */
+        void build(const std::vector<AABB>& bounds, uint32_t batch_size = 1, BVHBuildMethod method = PBR_BVH_BUILD_METHOD);
+
+        /** Bounds of the parts of primitive `index` within `box` on either side of the plane at `position` along `axis`.
+         *  Each may be empty, and neither may extend outside of `box`. */
+        using SplitFn = std::function<void(uint32_t index, const AABB& box, int axis, double position, AABB& left, AABB& right)>;
+
+        /*!
+        * @brief Build with spatial splits, for primitives that overlap a lot, such as the long thin triangles of buildings
+        *
+        * Stich, Friedrich and Dietrich, "Spatial Splits in Bounding Volume Hierarchies", 2009. Where the children of the
+        * best object split overlap by more than PBR_BVH_SPATIAL_ALPHA of the root area, splits that cut primitives
+        * at a plane are tried as well. A cut primitive is referenced from both sides, so `indices` can hold an index
+        * more than once, and has more entries than there are primitives. At most PBR_BVH_SPATIAL_MAX_DUPLICATION
+        * extra references per primitive are added.
+        *
+        * @param bounds Bounds of each primitive
+        * @param split Cuts a primitive in two. An empty function cuts the box of the reference instead.
+        * @param batch_size Number of primitives a leaf tests for the cost of one, for leaves tested with SIMD
+        */
+        void build_spatial(const std::vector<AABB>& bounds, const SplitFn& split, uint32_t batch_size = 1);
+
+        inline bool empty() const { return nodes.empty(); }
+
+        /*!
+        * @brief Recompute the boxes for primitives that moved, keeping the topology
+        *
+        * Much cheaper than build(), but the hierarchy gets worse as primitives move away from where it was built
+        * for. Comparing sah_cost() against its value after the build tells when to build again.
+        *
+        * @param bounds New bounds of each primitive, indexed as in build()
+        */
+        void refit(const std::vector<AABB>& bounds);
+
+        /** Move the nodes into another order, see BVHLayout. The builds already apply PBR_BVH_LAYOUT, and `indices` stay as they are. */
+        void reorder(BVHLayout layout);
+
+        /** Expected cost of a random ray under the surface area heuristic, in units of one primitive test. Lower is better. */
+        double sah_cost() const;
+
+        inline size_t memory_bytes() const
+        {
+            return nodes.size() * sizeof(BVHNode) + indices.size() * sizeof(uint32_t);
+        }
+
+        /** Write the hierarchy to a cache file tagged with `key`, see bvh_cache.h. Throws std::runtime_error on failure. */
+        void save(const std::string& path, uint64_t key) const;
+
+        /*!
+        * @brief Map a file written by save() into `nodes` and `indices`, without a copy
+        *
+        * @param primitive_count Number of primitives the hierarchy was built over, which the indices are checked against
+        * @return bool False if the file is missing, its version, node layout or key differ, or its nodes or indices point
+        *              outside of the arrays. The hierarchy is then left as it was.
+        */
+        bool load(const std::string& path, uint64_t key, size_t primitive_count);
+
+        /*!
+        * @brief Find the closest leaf hits along a ray
+        *
+        * @param ray Ray to traverse the hierarchy with
+        * @param tmax Closest hit so far, shrunk by the leaf callback as hits are found
+        * @param leaf Callback with signature bool(uint32_t first, uint32_t count, double& tmax)
+        *             that tests positions [first, first + count) of `indices`
+        * @return bool Indicates if any leaf callback reported a hit
+        */
+        template <class LeafFn>
+        bool intersect(const Ray& ray, double& tmax, LeafFn&& leaf) const
+        {
+            if (nodes.empty()) return false;
+
+            Vec inv_dir { 1 / ray.direction.x, 1 / ray.direction.y, 1 / ray.direction.z };
+            bool dir_neg[3] = { inv_dir.x < 0, inv_dir.y < 0, inv_dir.z < 0 };
+
+            uint32_t stack[PBR_BVH_MAX_DEPTH];
+            int top = 0;
+            uint32_t current = 0;
+            uint32_t visited = 0;
+            bool hit = false;
+
+            while (true)
+            {
+                const BVHNode& node = nodes[current];
+                ++visited;
+                if (node.bounds.intersect(ray.origin, inv_dir, tmax))
+                {
+                    if (node.is_leaf())
+                    {
+                        hit |= leaf(node.offset, node.count, tmax);
+                    }
+                    else
+                    {
+                        // Visit the child on the near side of the split first
+                        uint32_t near = current + 1;
+                        uint32_t far = node.offset;
+                        if (dir_neg[node.split_axis()] != node.high_first()) std::swap(near, far);
+
+                        PBR_BVH_PREFETCH_NODE(&nodes[far]);
+                        stack[top++] = far;
+                        current = near;
+                        continue;
+                    }
+                }
+
+                if (top == 0) break;
+                current = stack[--top];
+            }
+
+            PBR_STAT_ADD(NODES_VISITED, visited);
+            return hit;
+        }
+
+        /*!
+        * @brief Find the closest leaf hits for a packet of up to N rays that visit the hierarchy together
+        *
+        * Each node is visited once for the whole packet, and its box is tested against all rays at once. Only
+        * the rays that overlap it go on into its children. This pays off for coherent rays, such as the primary
+        * rays of one pixel, which mostly visit the same nodes.
+        *
+        * @param rays Rays of the packet, only those in `active` are read
+        * @param active Bit i is set if ray i takes part
+        * @param tmax Closest hit so far for each ray, shrunk by the leaf callback as hits are found
+        * @param leaf Callback with signature void(uint32_t first, uint32_t count, uint32_t mask) that tests
+        *             positions [first, first + count) of `indices` against the rays in `mask`
+        */
+        template <int N, class LeafFn>
+        PBR_FORCE_INLINE void intersect_packet(const Ray* rays, uint32_t active, const double* tmax, LeafFn&& leaf) const
+        {
+            static_assert(N >= 1 && N <= 32, "Ray masks are 32 bits wide");
+            if (nodes.empty() || active == 0) return;
+
+            // Rays by axis, inactive lanes get a ray that no mask lets through anyway
+            PacketRays<N> packet;
+            int lead = -1;
+            for (int i = 0; i < N; ++i)
+            {
+                bool is_active = active & (1u << i);
+                if (is_active && lead < 0) lead = i;
+                for (int a = 0; a < 3; ++a)
+                {
+                    packet.origin[a][i] = is_active ? axis_of(rays[i].origin, a) : 0;
+                    packet.inv_dir[a][i] = is_active ? 1 / axis_of(rays[i].direction, a) : 1;
+                }
+            }
+
+            // The first ray picks the near child for the whole packet
+            bool dir_neg[3] = { packet.inv_dir[0][lead] < 0, packet.inv_dir[1][lead] < 0, packet.inv_dir[2][lead] < 0 };
+
+            struct Entry
+            {
+                uint32_t node;
+                uint32_t mask;
+            };
+
+            Entry stack[PBR_BVH_MAX_DEPTH];
+            int top = 0;
+            Entry current = { 0, active };
+            uint32_t visited = 0;
+
+            while (true)
+            {
+                const BVHNode& node = nodes[current.node];
+                ++visited;
+
+                // Rays whose closest hit moved in front of the box drop out here
+                uint32_t mask = current.mask & packet.overlap(node.bounds, tmax);
+                if (mask != 0)
+                {
+                    if (node.is_leaf())
+                    {
+                        leaf(node.offset, node.count, mask);
+                    }
+                    else
+                    {
+                        uint32_t near = current.node + 1;
+                        uint32_t far = node.offset;
+                        if (dir_neg[node.split_axis()] != node.high_first()) std::swap(near, far);
+
+                        stack[top++] = { far, mask };
+                        current = { near, mask };
+                        continue;
+                    }
+                }
+
+                if (top == 0) break;
+                current = stack[--top];
+            }
+
+            PBR_STAT_ADD(PACKET_NODES_VISITED, visited);
+        }
+
+        /** Origins and reciprocal directions of a ray stream, by axis, indexed by ray */
+        struct StreamRays
+        {
+            std::vector<double> origin[3];
+            std::vector<double> inv_dir[3];
+
+            StreamRays(const Ray* rays, uint32_t count);
+        };
+
+        /*!
+        * @brief Find the closest leaf hits for a large stream of incoherent rays, such as the bounces of many paths
+        *
+        * The stream goes through the hierarchy together, so that each node is loaded once per stream
+        * rather than once per ray. At each node the rays that overlap its box are filtered into a new
+        * list, which both children then work from.
+        *
+        * @param rays Rays of the stream
+        * @param count Number of rays
+        * @param tmax Closest hit so far for each ray, shrunk by the leaf callback as hits are found
+        * @param leaf Callback with signature void(uint32_t first, uint32_t count, const uint32_t* rays, uint32_t ray_count)
+        *             that tests positions [first, first + count) of `indices` against the listed rays
+        */
+        template <class LeafFn>
+        void intersect_stream(const Ray* rays, uint32_t count, const double* tmax, LeafFn&& leaf) const
+        {
+            if (nodes.empty() || count == 0) return;
+
+            StreamRays stream(rays, count);
+
+            // Lists of ray ids, one after the other for the nodes on the stack. Entries work from a range of the
+            // list of their parent, and write their own list past the end of it. Whatever was written there
+            // before belongs to subtrees that are done.
+            std::vector<uint32_t> ids(2 * (size_t) count);
+            for (uint32_t i = 0; i < count; ++i) ids[i] = i;
+
+            struct Entry
+            {
+                uint32_t node;
+                size_t begin;
+                uint32_t count;
+
+                /** End of the list that [begin, begin + count) is part of */
+                size_t end;
+            };
+
+            // Each level adds at most two entries net
+            Entry stack[2 * PBR_BVH_MAX_DEPTH + 2];
+            int top = 0;
+            stack[top++] = { 0, 0, count, count };
+            uint32_t visited = 0;
+
+            while (top > 0)
+            {
+                Entry entry = stack[--top];
+                const BVHNode& node = nodes[entry.node];
+                ++visited;
+
+                size_t begin = entry.end;
+                if (ids.size() < begin + entry.count) ids.resize(std::max(2 * ids.size(), begin + entry.count));
+
+                uint32_t active = filter_stream(stream, node.bounds, tmax, &ids[entry.begin], entry.count, &ids[begin]);
+                if (active == 0) continue;
+
+                if (node.is_leaf())
+                {
+                    leaf(node.offset, node.count, &ids[begin], active);
+                }
+                else
+                {
+                    // Every ray visits the near child on its side of the split first, so that closer hits prune the
+                    // far one. Rays going up the axis come first in the list, and the popped order is:
+                    // first child for rays going up, second child for all, first child for rays going down.
+                    const std::vector<double>& inv_dir = stream.inv_dir[node.split_axis()];
+                    uint32_t* list = &ids[begin];
+                    uint32_t up = std::partition(list, list + active, [&](uint32_t i) { return inv_dir[i] >= 0; }) - list;
+
+                    // Here `first` is the child on the low side of the split, wherever it is in memory
+                    uint32_t first = entry.node + 1;
+                    uint32_t second = node.offset;
+                    if (node.high_first()) std::swap(first, second);
+                    size_t end = begin + active;
+                    if (up < active) stack[top++] = { first, begin + up, active - up, end };
+                    stack[top++] = { second, begin, active, end };
+                    if (up > 0) stack[top++] = { first, begin, up, end };
+                }
+            }
+
+            PBR_STAT_ADD(STREAM_NODES_VISITED, visited);
+        }
+
+        /*!
+        * @brief Find whether any leaf reports a hit along a ray, stopping at the first one
+        *
+        * @param ray Ray to traverse the hierarchy with
+        * @param tmax Far end of the ray segment
+        * @param leaf Callback with signature bool(uint32_t first, uint32_t count) that tests positions
+        *             [first, first + count) of `indices` and returns true on any hit closer than tmax
+        * @return bool Indicates if any leaf callback reported a hit
+        */
+        template <class LeafFn>
+        bool occluded(const Ray& ray, double tmax, LeafFn&& leaf) const
+        {
+            if (nodes.empty()) return false;
+
+            Vec inv_dir { 1 / ray.direction.x, 1 / ray.direction.y, 1 / ray.direction.z };
+
+            uint32_t stack[PBR_BVH_MAX_DEPTH];
+            int top = 0;
+            uint32_t current = 0;
+            uint32_t visited = 0;
+            bool hit = false;
+
+            while (true)
+            {
+                const BVHNode& node = nodes[current];
+                ++visited;
+                if (node.bounds.intersect(ray.origin, inv_dir, tmax))
+                {
+                    if (node.is_leaf())
+                    {
+                        if (leaf(node.offset, node.count))
+                        {
+                            hit = true;
+                            break;
+                        }
+                    }
+                    else
+                    {
+                        // Any hit will do, so the order of the children does not matter
+                        PBR_BVH_PREFETCH_NODE(&nodes[node.offset]);
+                        stack[top++] = node.offset;
+                        current = current + 1;
+                        continue;
+                    }
+                }
+
+                if (top == 0) break;
+                current = stack[--top];
+            }
+
+            PBR_STAT_ADD(OCCLUSION_NODES_VISITED, visited);
+            return hit;
+        }
+
+    private:
+        uint32_t batch_size = 1;
+
+        // Subtrees with at least this many primitives are built as separate tasks
+        static constexpr uint32_t PARALLEL_BUILD_THRESHOLD = 4096;
+
+        /** Copies the ids of the rays that overlap the box before their tmax from `in` to `out`, and returns how many there are */
+        static uint32_t filter_stream(const StreamRays& stream, const AABB& box, const double* tmax,
+                                      const uint32_t* in, uint32_t count, uint32_t* out);
+
+        /** Origins and reciprocal directions of a ray packet, by axis */
+        template <int N>
+        struct PacketRays
+        {
+            alignas(64) double origin[3][N];
+            alignas(64) double inv_dir[3][N];
+
+            /** Bit i is set if ray i overlaps the box before tmax[i]. NaNs from 0 * inf are dropped, as in AABB::intersect. */
+            PBR_FORCE_INLINE uint32_t overlap(const AABB& box, const double* tmax) const
+            {
+                const double lo[3] = { box.min.x, box.min.y, box.min.z };
+                const double hi[3] = { box.max.x, box.max.y, box.max.z };
+#if PBR_VECTOR_EXTENSIONS
+                // Chunks of one AVX register, wider GCC vectors get split up lane by lane for the selects
+                constexpr int W = (N % 4 == 0) ? 4 : N;
+                using V = typename simd::Lanes<W, double>::type;
+                uint32_t mask = 0;
+                for (int c = 0; c < N; c += W)
+                {
+                    V tn = V {};
+                    V tf;
+                    std::memcpy(&tf, tmax + c, sizeof(V));
+                    for (int a = 0; a < 3; ++a)
+                    {
+                        V o, inv;
+                        std::memcpy(&o, origin[a] + c, sizeof(V));
+                        std::memcpy(&inv, inv_dir[a] + c, sizeof(V));
+                        V t0 = (lo[a] - o) * inv;
+                        V t1 = (hi[a] - o) * inv;
+                        V entry = (t0 < t1) ? t0 : t1;
+                        V exit = (t0 < t1) ? t1 : t0;
+                        tn = (entry > tn) ? entry : tn;
+                        tf = (exit < tf) ? exit : tf;
+                    }
+                    auto inside = tn <= tf;
+                    for (int i = 0; i < W; ++i)
+                    {
+                        mask |= (inside[i] ? 1u : 0u) << (c + i);
+                    }
+                }
+                return mask;
+#else
+                uint32_t mask = 0;
+                for (int i = 0; i < N; ++i)
+                {
+                    double tn = 0;
+                    double tf = tmax[i];
+                    for (int a = 0; a < 3; ++a)
+                    {
+                        double t0 = (lo[a] - origin[a][i]) * inv_dir[a][i];
+                        double t1 = (hi[a] - origin[a][i]) * inv_dir[a][i];
+                        tn = std::max(tn, std::min(t0, t1));
+                        tf = std::min(tf, std::max(t0, t1));
+                    }
+                    mask |= (tn <= tf ? 1u : 0u) << i;
+                }
+                return mask;
+#endif
+            }
+        };
+
+        uint32_t build_recursive(const std::vector<AABB>& bounds, const std::vector<Point>& centroids,
+                                 uint32_t begin, uint32_t end, int depth);
+
+        /** Bounds of a primitive and its index. The binned build moves these instead of indices, so it reads them in order. */
+        struct PrimRef
+        {
+            AABB bounds;
+            uint32_t index;
+        };
+
+        /** Appends the subtree over refs [begin, end) to `out` in depth-first order. Offsets are relative to the start of `out`. */
+        void build_binned(std::vector<PrimRef>& refs, uint32_t begin, uint32_t end, int depth, std::vector<BVHNode>& out);
+
+        /** Linear build over Morton codes of the centroids, see bvh_morton.cpp */
+        void build_morton(const std::vector<AABB>& bounds);
+
+        /** Appends the subtree over sorted `codes` [begin, end) to `out`, like build_binned(). `indices` must be in the same order. */
+        void emit_morton(const std::vector<AABB>& bounds, const std::vector<uint64_t>& codes, uint32_t begin, uint32_t end,
+                         int depth, std::vector<BVHNode>& out) const;
+
+        /** Rebuilds the top of every small subtree with the split that has the lowest SAH cost. Leaves are kept as they are. */
+        void restructure_treelets();
+    };
+}
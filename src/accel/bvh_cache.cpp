@@ -0,0 +1,485 @@
+#include "bvh_cache.h"
+#include "accelerator.h"
+
+#include <debug.h>
+
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #define PBR_HAS_MMAP 1
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#else
+    #define PBR_HAS_MMAP 0
+#endif
+
+namespace pbr
+{
+    ///////////////////////////////////////////////////////////////////////////////
+    // File layout
+    ///////////////////////////////////////////////////////////////////////////////
+
+    static constexpr char CACHE_MAGIC[8] = { 'P', 'B', 'R', 'B', 'V', 'H', 0, 0 };
+
+    /** Written in native byte order, so a file from a machine with the other order is rejected */
+    static constexpr uint32_t CACHE_BYTE_ORDER = 0x01020304;
+
+    /** Arrays start at multiples of this, so that mapped nodes are as aligned as allocated ones */
+    static constexpr uint64_t CACHE_ALIGNMENT = 64;
+
+    /** Start of every cache file. Everything after it is addressed by offsets from the start of the file. */
+    struct CacheHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint32_t node_size;
+        uint32_t batch_size;
+        uint64_t key;
+        uint64_t node_count;
+        uint64_t node_offset;
+        uint64_t index_count;
+        uint64_t index_offset;
+    };
+
+    static inline uint64_t align_up(uint64_t offset)
+    {
+        return (offset + CACHE_ALIGNMENT - 1) / CACHE_ALIGNMENT * CACHE_ALIGNMENT;
+    }
+
+    /** Tells the temporary files of concurrent runs apart */
+    static uint64_t process_tag()
+    {
+#if PBR_HAS_MMAP
+        return (uint64_t) ::getpid();
+#else
+        static const uint64_t tag = std::random_device {}();
+        return tag;
+#endif
+    }
+
+    /*!
+    * @brief Whether the nodes and indices of a file can be traversed without leaving the arrays
+    *
+    * Every leaf range must lie within `indices`, and every index name a primitive. The second child of an interior
+    * node must come after its first, which directly follows the node, so that a corrupt file cannot loop either.
+    */
+    static bool valid_hierarchy(const BVHNode* nodes, uint64_t node_count, const uint32_t* indices, uint64_t index_count,
+                                size_t primitive_count)
+    {
+        if (node_count == 0 || index_count < primitive_count) return false;
+        for (uint64_t i = 0; i < node_count; ++i)
+        {
+            const BVHNode& node = nodes[i];
+            if (node.is_leaf())
+            {
+                if ((uint64_t) node.offset + node.count > index_count) return false;
+            }
+            else if (node.offset <= i + 1 || node.offset >= node_count)
+            {
+                return false;
+            }
+        }
+        for (uint64_t i = 0; i < index_count; ++i)
+        {
+            if (indices[i] >= primitive_count) return false;
+        }
+        return true;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+    // Save and load
+    ///////////////////////////////////////////////////////////////////////////////
+
+    void BVH::save(const std::string& path, uint64_t key) const
+    {
+        CacheHeader header {};
+        std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        header.version = BVH_CACHE_VERSION;
+        header.byte_order = CACHE_BYTE_ORDER;
+        header.node_size = sizeof(BVHNode);
+        header.batch_size = batch_size;
+        header.key = key;
+        header.node_count = nodes.size();
+        header.node_offset = align_up(sizeof(CacheHeader));
+        header.index_count = indices.size();
+        header.index_offset = align_up(header.node_offset + nodes.size() * sizeof(BVHNode));
+
+        // Readers only ever see a complete file, the rename replaces the old one in one step. Concurrent writers, in this
+        // run or another, each write their own temporary file, and the last rename wins.
+        static std::atomic<uint64_t> temp_count { 0 };
+        std::string temp_path = path + "." + std::to_string(process_tag()) + "." + std::to_string(temp_count++) + ".tmp";
+        {
+            std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+            if (!file) throw std::runtime_error("Cannot open BVH cache file " + temp_path);
+
+            static const char padding[CACHE_ALIGNMENT] = {};
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(padding, header.node_offset - sizeof(header));
+            file.write(reinterpret_cast<const char*>(nodes.data()), nodes.size() * sizeof(BVHNode));
+            file.write(padding, header.index_offset - (header.node_offset + nodes.size() * sizeof(BVHNode)));
+            file.write(reinterpret_cast<const char*>(indices.data()), indices.size() * sizeof(uint32_t));
+            if (!file) throw std::runtime_error("Cannot write BVH cache file " + temp_path);
+        }
+
+        std::error_code error;
+        std::filesystem::rename(temp_path, path, error);
+        if (error)
+        {
+            std::filesystem::remove(temp_path, error);
+            throw std::runtime_error("Cannot replace BVH cache file " + path);
+        }
+    }
+
+    /** Read-only view of a whole file. The memory stays valid for as long as the returned pointer is held. */
+    static std::shared_ptr<const void> map_file(const std::string& path, size_t& out_size)
+    {
+#if PBR_HAS_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return nullptr;
+
+        struct stat info;
+        if (::fstat(fd, &info) != 0 || info.st_size <= 0)
+        {
+            ::close(fd);
+            return nullptr;
+        }
+
+        size_t size = (size_t) info.st_size;
+        void* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // The mapping keeps its own reference to the file
+        ::close(fd);
+        if (data == MAP_FAILED) return nullptr;
+
+        out_size = size;
+        return std::shared_ptr<const void>(data, [size](const void* p) { ::munmap(const_cast<void*>(p), size); });
+#else
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file) return nullptr;
+
+        auto contents = std::make_shared<std::vector<char>>((size_t) file.tellg());
+        file.seekg(0);
+        if (!file.read(contents->data(), contents->size())) return nullptr;
+
+        out_size = contents->size();
+        return std::shared_ptr<const void>(contents, contents->data());
+#endif
+    }
+
+    bool BVH::load(const std::string& path, uint64_t key, size_t primitive_count)
+    {
+        size_t size = 0;
+        std::shared_ptr<const void> file = map_file(path, size);
+        if (!file || size < sizeof(CacheHeader)) return false;
+
+        const char* bytes = static_cast<const char*>(file.get());
+        CacheHeader header;
+        std::memcpy(&header, bytes, sizeof(header));
+
+        if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0
+            || header.version != BVH_CACHE_VERSION
+            || header.byte_order != CACHE_BYTE_ORDER
+            || header.node_size != sizeof(BVHNode)
+            || header.key != key)
+        {
+            return false;
+        }
+
+        // Offsets come from the file, check them before pointing into it
+        if (header.node_offset % CACHE_ALIGNMENT != 0 || header.index_offset % CACHE_ALIGNMENT != 0
+            || header.node_count > size / sizeof(BVHNode) || header.index_count > size / sizeof(uint32_t)
+            || header.node_offset + header.node_count * sizeof(BVHNode) > size
+            || header.index_offset + header.index_count * sizeof(uint32_t) > size)
+        {
+            return false;
+        }
+
+        // So do the offsets and indices in the nodes, a file that does not match its key would send traversal anywhere
+        const BVHNode* file_nodes = reinterpret_cast<const BVHNode*>(bytes + header.node_offset);
+        const uint32_t* file_indices = reinterpret_cast<const uint32_t*>(bytes + header.index_offset);
+        if (!valid_hierarchy(file_nodes, header.node_count, file_indices, header.index_count, primitive_count)) return false;
+
+        batch_size = header.batch_size;
+        nodes.view(file_nodes, header.node_count, file);
+        indices.view(file_indices, header.index_count, file);
+        return true;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+    // Cached build
+    ///////////////////////////////////////////////////////////////////////////////
+
+    static std::string& cache_directory()
+    {
+        static std::string directory;
+        return directory;
+    }
+
+    void set_bvh_cache_directory(const std::string& directory)
+    {
+        cache_directory() = directory;
+    }
+
+    const std::string& bvh_cache_directory()
+    {
+        return cache_directory();
+    }
+
+    /** Mixes 64-bit words, a word at a time so that hashing the bounds costs far less than building over them */
+    struct KeyHasher
+    {
+        uint64_t state = 0xcbf29ce484222325ull;
+
+        inline void add(uint64_t word)
+        {
+            state = (state ^ word) * 0x9e3779b97f4a7c15ull;
+            state ^= state >> 29;
+        }
+
+        inline void add(double value)
+        {
+            uint64_t word;
+            std::memcpy(&word, &value, sizeof(word));
+            add(word);
+        }
+    };
+
+    uint64_t bvh_cache_key(const std::vector<AABB>& bounds, uint32_t batch_size, BVHBuildMethod method)
+    {
+        KeyHasher hasher;
+        hasher.add((uint64_t) BVH_CACHE_VERSION);
+        hasher.add((uint64_t) batch_size);
+        hasher.add((uint64_t) method);
+        hasher.add((uint64_t) PBR_BVH_BINS);
+        hasher.add((uint64_t) PBR_BVH_MAX_LEAF_SIZE);
+        hasher.add((uint64_t) PBR_BVH_MAX_DEPTH);
+        hasher.add((double) PBR_BVH_TRAVERSAL_COST);
+        hasher.add((double) PBR_BVH_INTERSECTION_COST);
+        hasher.add((uint64_t) PBR_BVH_TREELET_LEAVES);
+        hasher.add((uint64_t) PBR_BVH_TREELET_ROUNDS);
+        hasher.add((double) PBR_BVH_SPATIAL_MAX_DUPLICATION);
+        hasher.add((double) PBR_BVH_SPATIAL_ALPHA);
+        hasher.add((uint64_t) PBR_BVH_LAYOUT);
+        hasher.add((uint64_t) bounds.size());
+        for (const auto& box : bounds)
+        {
+            hasher.add(box.min.x);
+            hasher.add(box.min.y);
+            hasher.add(box.min.z);
+            hasher.add(box.max.x);
+            hasher.add(box.max.y);
+            hasher.add(box.max.z);
+        }
+        return hasher.state;
+    }
+
+    uint64_t bvh_cache_hash(const void* data, size_t size, uint64_t seed)
+    {
+        KeyHasher hasher;
+        hasher.add(seed);
+        hasher.add((uint64_t) size);
+        const char* bytes = static_cast<const char*>(data);
+        for (size_t i = 0; i < size; i += sizeof(uint64_t))
+        {
+            uint64_t word = 0;
+            std::memcpy(&word, bytes + i, std::min(sizeof(uint64_t), size - i));
+            hasher.add(word);
+        }
+        return hasher.state;
+    }
+
+    /** Loads the file named by `key`, or calls `build` and writes the result to it */
+    template <class BuildFn>
+    static bool build_through_cache(BVH& bvh, uint64_t key, size_t primitive_count, BuildFn&& build)
+    {
+        const std::string& directory = bvh_cache_directory();
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016" PRIx64 ".bvh", key);
+        std::string path = (std::filesystem::path(directory) / name).string();
+
+        if (bvh.load(path, key, primitive_count)) return true;
+
+        build();
+        try
+        {
+            std::filesystem::create_directories(directory);
+            bvh.save(path, key);
+        }
+        catch (const std::exception& e)
+        {
+            LOG_INFO("Could not cache the BVH: %s", e.what());
+        }
+        return false;
+    }
+
+    bool build_cached(BVH& bvh, const std::vector<AABB>& bounds, uint32_t batch_size, BVHBuildMethod method)
+    {
+        if (bvh_cache_directory().empty() || bounds.empty())
+        {
+            bvh.build(bounds, batch_size, method);
+            return false;
+        }
+
+        return build_through_cache(bvh, bvh_cache_key(bounds, batch_size, method), bounds.size(),
+                                   [&]() { bvh.build(bounds, batch_size, method); });
+    }
+
+    bool build_cached(BVH& bvh, const std::vector<AABB>& bounds, const BVH::SplitFn& split, uint64_t geometry_key,
+                      uint32_t batch_size)
+    {
+        if (bvh_cache_directory().empty() || bounds.empty())
+        {
+            bvh.build_spatial(bounds, split, batch_size);
+            return false;
+        }
+
+        uint64_t key = bvh_cache_hash(&geometry_key, sizeof(geometry_key), bvh_cache_key(bounds, batch_size, BVHBuildMethod::SPATIAL));
+        return build_through_cache(bvh, key, bounds.size(), [&]() { bvh.build_spatial(bounds, split, batch_size); });
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+    // TESTS
+    ///////////////////////////////////////////////////////////////////////////////
+
+    TEST_CASE("accel::BVH::cache")
+    {
+        std::mt19937 gen(9);
+        std::uniform_real_distribution<> position(-50.0, 50.0);
+        std::vector<AABB> bounds(5000);
+        for (auto& box : bounds)
+        {
+            Vec center { position(gen), position(gen), position(gen) };
+            box = { center - Vec { 0.5 }, center + Vec { 0.5 } };
+        }
+
+        auto directory = std::filesystem::temp_directory_path() / "pbr_bvh_cache_test";
+        std::filesystem::remove_all(directory);
+        std::filesystem::create_directories(directory);
+        std::string path = (directory / "test.bvh").string();
+
+        BVH built;
+        built.build(bounds, 4);
+        uint64_t key = bvh_cache_key(bounds, 4, PBR_BVH_BUILD_METHOD);
+        built.save(path, key);
+
+        SUBCASE("round trip maps the same hierarchy")
+        {
+            BVH loaded;
+            REQUIRE(loaded.load(path, key, bounds.size()));
+            CHECK(loaded.nodes.is_view());
+            REQUIRE(loaded.nodes.size() == built.nodes.size());
+            REQUIRE(loaded.indices.size() == built.indices.size());
+            CHECK(std::memcmp(loaded.nodes.data(), built.nodes.data(), built.nodes.size() * sizeof(BVHNode)) == 0);
+            CHECK(std::memcmp(loaded.indices.data(), built.indices.data(), built.indices.size() * sizeof(uint32_t)) == 0);
+            CHECK(loaded.sah_cost() == built.sah_cost());
+        }
+
+        SUBCASE("different scenes or settings have different keys")
+        {
+            std::vector<AABB> moved = bounds;
+            moved[1234].max.x += 1e-9;
+            CHECK(bvh_cache_key(moved, 4, PBR_BVH_BUILD_METHOD) != key);
+            CHECK(bvh_cache_key(bounds, 1, PBR_BVH_BUILD_METHOD) != key);
+            CHECK(bvh_cache_key(bounds, 4, BVHBuildMethod::FULL_SWEEP) != key);
+
+            BVH loaded;
+            CHECK_FALSE(loaded.load(path, key + 1, bounds.size()));
+            CHECK(loaded.empty());
+        }
+
+        SUBCASE("other versions are rejected")
+        {
+            uint32_t version = BVH_CACHE_VERSION + 1;
+            std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+            file.seekp(offsetof(CacheHeader, version));
+            file.write(reinterpret_cast<const char*>(&version), sizeof(version));
+            file.close();
+
+            BVH loaded;
+            CHECK_FALSE(loaded.load(path, key, bounds.size()));
+        }
+
+        SUBCASE("corrupt nodes and indices are rejected")
+        {
+            auto corrupt = [&](uint64_t offset, uint32_t value) {
+                built.save(path, key);
+                std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+                file.seekp(offset);
+                file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+                file.close();
+
+                BVH loaded;
+                return loaded.load(path, key, bounds.size());
+            };
+
+            CacheHeader header {};
+            header.node_offset = align_up(sizeof(CacheHeader));
+            header.index_offset = align_up(header.node_offset + built.nodes.size() * sizeof(BVHNode));
+            uint64_t root_offset = header.node_offset + offsetof(BVHNode, offset);
+            uint32_t leaf = std::find_if(built.nodes.begin(), built.nodes.end(), [](const BVHNode& n) { return n.is_leaf(); }) - built.nodes.begin();
+            uint64_t leaf_offset = header.node_offset + leaf * sizeof(BVHNode) + offsetof(BVHNode, offset);
+
+            CHECK_FALSE(corrupt(root_offset, built.nodes.size()));
+            CHECK_FALSE(corrupt(root_offset, 0));
+            CHECK_FALSE(corrupt(leaf_offset, built.indices.size()));
+            CHECK_FALSE(corrupt(header.index_offset, bounds.size()));
+            CHECK(corrupt(header.index_offset, built.indices[0]));
+        }
+
+        SUBCASE("hierarchies of every build method pass the checks")
+        {
+            for (BVHBuildMethod method : { BVHBuildMethod::FULL_SWEEP, BVHBuildMethod::BINNED, BVHBuildMethod::MORTON,
+                                           BVHBuildMethod::MORTON_TREELETS, BVHBuildMethod::SPATIAL })
+            {
+                BVH other, loaded;
+                other.build(bounds, 4, method);
+                other.save(path, key);
+                CHECK(loaded.load(path, key, bounds.size()));
+            }
+        }
+
+        SUBCASE("build_cached writes once and maps afterwards")
+        {
+            set_bvh_cache_directory(directory.string());
+            BVH first, second;
+            CHECK_FALSE(build_cached(first, bounds, 4));
+            CHECK(build_cached(second, bounds, 4));
+            CHECK(second.nodes.is_view());
+            CHECK(second.sah_cost() == first.sah_cost());
+
+            // Changing a mapped hierarchy copies it first, the file stays as it was
+            second.nodes.mutable_data()[0].count = 1;
+            CHECK_FALSE(second.nodes.is_view());
+            BVH third;
+            CHECK(build_cached(third, bounds, 4));
+            CHECK(third.nodes.front().count == first.nodes.front().count);
+            set_bvh_cache_directory("");
+        }
+
+        SUBCASE("scene hierarchies mapped from the cache stay mapped")
+        {
+            set_bvh_cache_directory(directory.string());
+            auto material = std::make_shared<Material>(PBR_COLOR_WHITE, PBR_COLOR_BLACK, new DiffuseBRDF);
+            Scene scene;
+            for (const auto& box : bounds) scene.push_back(Actor { material, SphereGeometry { box.centroid(), 0.5 } });
+
+            BVHAccelerator first, second;
+            first.build(scene);
+            second.build(scene);
+            CHECK(second.bvh().nodes.is_view());
+            CHECK(second.bvh().indices.is_view());
+            set_bvh_cache_directory("");
+        }
+
+        std::filesystem::remove_all(directory);
+    }
+}
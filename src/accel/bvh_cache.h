@@ -0,0 +1,49 @@
+#pragma once
+
+#include "bvh.h"
+#include <string>
+
+///////////////////////////////////////////////////////////////////////////////
+// On-disk cache of built hierarchies. A hierarchy only depends on the bounds
+// of its primitives and on the build settings, so a hash of those names the
+// file. Files are mapped straight into the BVH arrays on later runs.
+///////////////////////////////////////////////////////////////////////////////
+
+namespace pbr
+{
+    /** Layout version of cache files. Bump it whenever BVHNode or the file header change. */
+    constexpr uint32_t BVH_CACHE_VERSION = 1;
+
+    /** Set the directory that build_cached() keeps hierarchies in. Empty turns the cache off, which is the default. */
+    void set_bvh_cache_directory(const std::string& directory);
+
+    const std::string& bvh_cache_directory();
+
+    /** Hash of everything a build depends on: the primitive bounds, the batch size, the method and the PBR_BVH_* settings. */
+    uint64_t bvh_cache_key(const std::vector<AABB>& bounds, uint32_t batch_size, BVHBuildMethod method);
+
+    /*!
+    * @brief Same as BVH::build, but through the cache directory when one is set
+    *
+    * A file with a matching key and version is mapped into `bvh` without a copy. Otherwise the hierarchy is
+    * built and written, replacing whatever file was there. Failing to write only logs, the built BVH is still used.
+    *
+    * @return bool Indicates if the hierarchy was loaded from the cache
+    */
+    bool build_cached(BVH& bvh, const std::vector<AABB>& bounds, uint32_t batch_size = 1,
+                      BVHBuildMethod method = PBR_BVH_BUILD_METHOD);
+
+    /*!
+    * @brief Same as BVH::build_spatial, but through the cache directory when one is set
+    *
+    * The cut bounds depend on more than the primitive bounds, so the caller hashes whatever `split` reads into
+    * `geometry_key`, for example with bvh_cache_hash().
+    *
+    * @return bool Indicates if the hierarchy was loaded from the cache
+    */
+    bool build_cached(BVH& bvh, const std::vector<AABB>& bounds, const BVH::SplitFn& split, uint64_t geometry_key,
+                      uint32_t batch_size = 1);
+
+    /** Hash of `size` bytes of raw data, starting from `seed` so that several arrays can be chained */
+    uint64_t bvh_cache_hash(const void* data, size_t size, uint64_t seed = 0);
+}
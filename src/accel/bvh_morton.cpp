@@ -0,0 +1,536 @@
+#include "bvh.h"
+
+#include <array>
+
+///////////////////////////////////////////////////////////////////////////////
+// Linear BVH. Centroids are quantized to 21 bits per axis and sorted along the
+// Morton curve, after which each node splits its range where the codes first
+// differ. That takes one binary search per node and no SAH evaluation.
+//
+// Treelet restructuring (Karras and Aila, "Fast Parallel Construction of
+// High-Quality Bounding Volume Hierarchies", 2013) then takes the top few
+// nodes under every node and picks their best topology by brute force.
+///////////////////////////////////////////////////////////////////////////////
+
+namespace pbr
+{
+    static constexpr int MORTON_BITS_PER_AXIS = 21;
+
+    static_assert(PBR_BVH_TREELET_LEAVES >= 3 && PBR_BVH_TREELET_LEAVES <= 8, "Treelets need 3 to 8 leaves");
+
+    /** Spread the low 21 bits of `v` out to every third bit */
+    static inline uint64_t spread_bits(uint64_t v)
+    {
+        v &= 0x1fffff;
+        v = (v | v << 32) & 0x1f00000000ffffull;
+        v = (v | v << 16) & 0x1f0000ff0000ffull;
+        v = (v | v << 8) & 0x100f00f00f00f00full;
+        v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+        v = (v | v << 2) & 0x1249249249249249ull;
+        return v;
+    }
+
+    /** Axis that a bit of a Morton code belongs to. x is the highest bit of each triple. */
+    static inline int morton_axis(int bit)
+    {
+        return 2 - bit % 3;
+    }
+
+    /*!
+    * @brief Sort 64-bit keys along with their values, 8 bits per pass
+    *
+    * Blocks of the input are counted and scattered in parallel. Passes where all keys share the same digit are skipped,
+    * which drops the top byte of 63-bit Morton codes and most high bytes of small scenes.
+    */
+    static void radix_sort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values)
+    {
+        constexpr size_t BLOCK_SIZE = 1 << 16;
+        size_t count = keys.size();
+        size_t blocks = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+        std::vector<uint64_t> sorted_keys(count);
+        std::vector<uint32_t> sorted_values(count);
+        std::vector<std::array<uint32_t, 256>> offsets(blocks);
+
+        for (int shift = 0; shift < 64; shift += 8)
+        {
+#if PBR_USE_THREADS
+#pragma omp parallel for if (blocks > 1)
+#endif
+            for (size_t b = 0; b < blocks; ++b)
+            {
+                auto& histogram = offsets[b];
+                histogram.fill(0);
+                size_t end = std::min(count, (b + 1) * BLOCK_SIZE);
+                for (size_t i = b * BLOCK_SIZE; i < end; ++i)
+                {
+                    ++histogram[(keys[i] >> shift) & 0xff];
+                }
+            }
+
+            // Digit by digit, then block by block, which keeps equal digits in their input order
+            size_t total = 0;
+            bool one_digit = false;
+            for (int digit = 0; digit < 256; ++digit)
+            {
+                size_t digit_start = total;
+                for (auto& histogram : offsets)
+                {
+                    uint32_t n = histogram[digit];
+                    histogram[digit] = total;
+                    total += n;
+                }
+                one_digit |= total - digit_start == count;
+            }
+            if (one_digit) continue;
+
+#if PBR_USE_THREADS
+#pragma omp parallel for if (blocks > 1)
+#endif
+            for (size_t b = 0; b < blocks; ++b)
+            {
+                auto& offset = offsets[b];
+                size_t end = std::min(count, (b + 1) * BLOCK_SIZE);
+                for (size_t i = b * BLOCK_SIZE; i < end; ++i)
+                {
+                    uint32_t to = offset[(keys[i] >> shift) & 0xff]++;
+                    sorted_keys[to] = keys[i];
+                    sorted_values[to] = values[i];
+                }
+            }
+
+            keys.swap(sorted_keys);
+            values.swap(sorted_values);
+        }
+    }
+
+    void BVH::build_morton(const std::vector<AABB>& bounds)
+    {
+        size_t count = bounds.size();
+        bool parallel = count >= PARALLEL_BUILD_THRESHOLD;
+
+        AABB centroid_bounds;
+        for (const auto& box : bounds)
+        {
+            centroid_bounds.expand(box.centroid());
+        }
+
+        // Each axis is stretched over the whole grid, flat axes all land in cell 0
+        constexpr double CELLS = 1 << MORTON_BITS_PER_AXIS;
+        double scale[3];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            double extent = axis_of(centroid_bounds.max, axis) - axis_of(centroid_bounds.min, axis);
+            scale[axis] = (extent > 0) ? CELLS / extent : 0;
+        }
+
+        std::vector<uint64_t> codes(count);
+        std::vector<uint32_t> order(count);
+#if PBR_USE_THREADS
+#pragma omp parallel for if (parallel)
+#endif
+        for (size_t i = 0; i < count; ++i)
+        {
+            Point centroid = bounds[i].centroid();
+            uint64_t cell[3];
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                double offset = (axis_of(centroid, axis) - axis_of(centroid_bounds.min, axis)) * scale[axis];
+                cell[axis] = std::min<uint64_t>(CELLS - 1, (uint64_t) offset);
+            }
+            codes[i] = spread_bits(cell[0]) << 2 | spread_bits(cell[1]) << 1 | spread_bits(cell[2]);
+            order[i] = i;
+        }
+
+        radix_sort(codes, order);
+        indices.assign(std::move(order));
+
+        std::vector<BVHNode> built;
+        built.reserve(2 * count);
+#if PBR_USE_THREADS
+#pragma omp parallel if (parallel)
+#pragma omp single
+#endif
+        emit_morton(bounds, codes, 0, count, 0, built);
+        nodes.assign(std::move(built));
+    }
+
+    void BVH::emit_morton(const std::vector<AABB>& bounds, const std::vector<uint64_t>& codes, uint32_t begin, uint32_t end,
+                          int depth, std::vector<BVHNode>& out) const
+    {
+        uint32_t node_index = out.size();
+        out.emplace_back();
+
+        uint32_t count = end - begin;
+        auto bounds_of = [&](uint32_t from, uint32_t to) {
+            AABB box;
+            for (uint32_t i = from; i < to; ++i)
+            {
+                box.expand(bounds[indices[i]]);
+            }
+            return box;
+        };
+        auto make_leaf = [&](const AABB& box) {
+            out[node_index].bounds = box;
+            out[node_index].offset = begin;
+            out[node_index].count = count;
+        };
+
+        if (count == 1) return make_leaf(bounds_of(begin, end));
+
+        // The codes are sorted, so the highest bit where the first and last code differ splits the range in two.
+        // Past the same depth limit as the other builds, and for equal codes, split in the middle of the range.
+        uint32_t mid;
+        int axis = 0;
+        uint64_t differ = codes[begin] ^ codes[end - 1];
+        if (differ != 0 && depth < PBR_BVH_MAX_DEPTH - 32)
+        {
+            int bit = 63;
+            while (!(differ >> bit & 1)) --bit;
+
+            uint64_t mask = 1ull << bit;
+            mid = std::partition_point(codes.begin() + begin, codes.begin() + end,
+                                       [mask](uint64_t code) { return !(code & mask); }) - codes.begin();
+            axis = morton_axis(bit);
+        }
+        else
+        {
+            if (count <= PBR_BVH_MAX_LEAF_SIZE) return make_leaf(bounds_of(begin, end));
+            mid = begin + count / 2;
+        }
+
+        // Small nodes become leaves when the SAH prefers testing everything to one more split
+        if (count <= PBR_BVH_MAX_LEAF_SIZE)
+        {
+            auto batches = [this](uint32_t n) { return (double) ((n + batch_size - 1) / batch_size); };
+
+            AABB left = bounds_of(begin, mid);
+            AABB right = bounds_of(mid, end);
+            AABB box = left;
+            box.expand(right);
+
+            double split_cost = PBR_BVH_TRAVERSAL_COST + PBR_BVH_INTERSECTION_COST
+                              * (left.surface_area() * batches(mid - begin) + right.surface_area() * batches(end - mid))
+                              / std::max(box.surface_area(), 1e-300);
+            if (PBR_BVH_INTERSECTION_COST * batches(count) <= split_cost) return make_leaf(box);
+        }
+
+        uint32_t second;
+        if (count >= PARALLEL_BUILD_THRESHOLD)
+        {
+            // As in build_binned(), the right subtree goes to its own array and is moved in place after
+            std::vector<BVHNode> right_nodes;
+            right_nodes.reserve(2 * (end - mid));
+#if PBR_USE_THREADS
+#pragma omp task default(shared) firstprivate(mid, end, depth)
+#endif
+            emit_morton(bounds, codes, mid, end, depth + 1, right_nodes);
+
+            emit_morton(bounds, codes, begin, mid, depth + 1, out);
+#if PBR_USE_THREADS
+#pragma omp taskwait
+#endif
+
+            second = out.size();
+            for (auto& node : right_nodes)
+            {
+                if (!node.is_leaf()) node.offset += second;
+            }
+            out.insert(out.end(), right_nodes.begin(), right_nodes.end());
+        }
+        else
+        {
+            emit_morton(bounds, codes, begin, mid, depth + 1, out);
+            second = out.size();
+            emit_morton(bounds, codes, mid, end, depth + 1, out);
+        }
+
+        AABB box = out[node_index + 1].bounds;
+        box.expand(out[second].bounds);
+        out[node_index].bounds = box;
+        out[node_index].offset = second;
+        out[node_index].count = 0;
+        out[node_index].axis = axis;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+    // Treelet restructuring
+    ///////////////////////////////////////////////////////////////////////////////
+
+    /** A node with explicit children, so that topologies can change in place */
+    struct TreeletNode
+    {
+        AABB bounds;
+        uint32_t child[2];
+
+        /** First primitive and primitive count of leaves, count is 0 for interior nodes */
+        uint32_t offset;
+        uint16_t count;
+
+        /** Primitives in the subtree */
+        uint32_t prims;
+
+        /** Nodes on the longest path down to a leaf, 1 for leaves */
+        uint32_t height;
+
+        /** SAH cost of the subtree, scaled by the surface area of the root */
+        double cost;
+
+        inline bool is_leaf() const { return count > 0; }
+    };
+
+    /** Restructures the treelets of a tree, bottom-up so that subtrees are final by the time their parents look at them */
+    class TreeletOptimizer
+    {
+    public:
+        std::vector<TreeletNode> tree;
+
+        TreeletOptimizer(uint32_t batch_size, uint32_t parallel_threshold)
+            : _batch_size(batch_size), _parallel_threshold(parallel_threshold)
+        {
+        }
+
+        inline double leaf_cost(const AABB& box, uint32_t count) const
+        {
+            return PBR_BVH_INTERSECTION_COST * ((count + _batch_size - 1) / _batch_size) * box.surface_area();
+        }
+
+        /** Restructure every treelet under `node` whose root has at least `min_prims` primitives, and then the one at `node` */
+        void restructure(uint32_t node, uint32_t min_prims)
+        {
+            // Nothing changes below a small subtree, so its costs are still up to date
+            if (tree[node].is_leaf() || tree[node].prims < min_prims) return;
+
+            uint32_t left = tree[node].child[0];
+            uint32_t right = tree[node].child[1];
+            if (tree[node].prims >= _parallel_threshold)
+            {
+#if PBR_USE_THREADS
+#pragma omp task default(shared) firstprivate(right)
+#endif
+                restructure(right, min_prims);
+
+                restructure(left, min_prims);
+#if PBR_USE_THREADS
+#pragma omp taskwait
+#endif
+            }
+            else
+            {
+                restructure(left, min_prims);
+                restructure(right, min_prims);
+            }
+
+            // The children may have changed below, which changes the cost of this node too
+            TreeletNode& t = tree[node];
+            t.height = 1 + std::max(tree[left].height, tree[right].height);
+            t.cost = PBR_BVH_TRAVERSAL_COST * t.bounds.surface_area() + tree[left].cost + tree[right].cost;
+
+            optimize_treelet(node);
+        }
+
+    private:
+        uint32_t _batch_size;
+        uint32_t _parallel_threshold;
+
+        /** Index of the only bit set in `set` */
+        static inline int bit_index(int set)
+        {
+            int index = 0;
+            while (set >>= 1) ++index;
+            return index;
+        }
+
+        /** Replace the treelet under `root` with the topology of lowest SAH cost over the same leaves */
+        void optimize_treelet(uint32_t root)
+        {
+            constexpr int MAX_LEAVES = PBR_BVH_TREELET_LEAVES;
+            constexpr int MAX_SUBSETS = 1 << MAX_LEAVES;
+
+            // Grow the treelet by opening up its largest leaf, which has the most to gain, until it is full.
+            // The interior nodes that were opened are reused for the new topology.
+            uint32_t leaves[MAX_LEAVES] = { tree[root].child[0], tree[root].child[1] };
+            uint32_t interior[MAX_LEAVES - 1] = { root };
+            int leaf_count = 2;
+            int interior_count = 1;
+            while (leaf_count < MAX_LEAVES)
+            {
+                int largest = -1;
+                double largest_area = -1;
+                for (int i = 0; i < leaf_count; ++i)
+                {
+                    const TreeletNode& node = tree[leaves[i]];
+                    double area = node.bounds.surface_area();
+                    if (!node.is_leaf() && area > largest_area)
+                    {
+                        largest = i;
+                        largest_area = area;
+                    }
+                }
+                if (largest < 0) break;
+
+                uint32_t opened = leaves[largest];
+                interior[interior_count++] = opened;
+                leaves[largest] = tree[opened].child[0];
+                leaves[leaf_count++] = tree[opened].child[1];
+            }
+
+            // Two or three leaves only have one topology, up to the order of the children
+            if (leaf_count < 4) return;
+
+            // Best cost of a subtree over each subset of the leaves. A subset only splits into smaller
+            // subsets, so going up in numeric order visits every split after both of its halves.
+            int full = (1 << leaf_count) - 1;
+            AABB boxes[MAX_SUBSETS];
+            double cost[MAX_SUBSETS];
+            uint32_t height[MAX_SUBSETS];
+            uint8_t split[MAX_SUBSETS];
+            for (int set = 1; set <= full; ++set)
+            {
+                int lowest = set & -set;
+                if (set == lowest)
+                {
+                    const TreeletNode& leaf = tree[leaves[bit_index(set)]];
+                    boxes[set] = leaf.bounds;
+                    cost[set] = leaf.cost;
+                    height[set] = leaf.height;
+                    continue;
+                }
+
+                boxes[set] = boxes[set ^ lowest];
+                boxes[set].expand(boxes[lowest]);
+
+                // Each split is visited once, from the half that holds the lowest leaf. That half is the lowest
+                // leaf plus any proper subset of the others.
+                double best = PBR_INF;
+                int best_part = 0;
+                int rest = set ^ lowest;
+                for (int sub = (rest - 1) & rest; ; sub = (sub - 1) & rest)
+                {
+                    int part = lowest | sub;
+                    double c = cost[part] + cost[set ^ part];
+
+                    // Selects rather than a branch, which would be mispredicted all the time
+                    best_part = (c < best) ? part : best_part;
+                    best = std::min(c, best);
+                    if (sub == 0) break;
+                }
+
+                cost[set] = PBR_BVH_TRAVERSAL_COST * boxes[set].surface_area() + best;
+                height[set] = 1 + std::max(height[best_part], height[set ^ best_part]);
+                split[set] = best_part;
+            }
+
+            // Keep the treelet unless the new one is cheaper. Deeper treelets are only allowed up to the depth where the
+            // builds stop using the SAH, so that the hierarchy stays within the traversal stack.
+            constexpr uint32_t HEIGHT_LIMIT = PBR_BVH_MAX_DEPTH - 32;
+            if (!(cost[full] < tree[root].cost)) return;
+            if (height[full] > std::max(tree[root].height, HEIGHT_LIMIT)) return;
+
+            int next_interior = 0;
+            auto rebuild = [&](auto& self, int set) -> uint32_t {
+                if ((set & (set - 1)) == 0) return leaves[bit_index(set)];
+
+                uint32_t index = interior[next_interior++];
+                uint32_t left = self(self, split[set]);
+                uint32_t right = self(self, set ^ split[set]);
+
+                TreeletNode& node = tree[index];
+                node.bounds = boxes[set];
+                node.child[0] = left;
+                node.child[1] = right;
+                node.count = 0;
+                node.prims = tree[left].prims + tree[right].prims;
+                node.height = height[set];
+                node.cost = cost[set];
+                return index;
+            };
+            rebuild(rebuild, full);
+        }
+    };
+
+    void BVH::restructure_treelets()
+    {
+        if (nodes.size() < 3) return;
+
+        TreeletOptimizer optimizer(batch_size, PARALLEL_BUILD_THRESHOLD);
+        std::vector<TreeletNode>& tree = optimizer.tree;
+        tree.resize(nodes.size());
+
+        // Children come after their parent in depth-first order, so a reverse pass sees them first
+        for (uint32_t i = nodes.size(); i-- > 0;)
+        {
+            const BVHNode& node = nodes[i];
+            TreeletNode& t = tree[i];
+            t.bounds = node.bounds;
+            t.offset = node.offset;
+            t.count = node.count;
+            if (node.is_leaf())
+            {
+                t.prims = node.count;
+                t.height = 1;
+                t.cost = optimizer.leaf_cost(node.bounds, node.count);
+            }
+            else
+            {
+                const TreeletNode& left = tree[i + 1];
+                const TreeletNode& right = tree[node.offset];
+                t.child[0] = i + 1;
+                t.child[1] = node.offset;
+                t.prims = left.prims + right.prims;
+                t.height = 1 + std::max(left.height, right.height);
+                t.cost = PBR_BVH_TRAVERSAL_COST * node.bounds.surface_area() + left.cost + right.cost;
+            }
+        }
+
+        // Small subtrees have little to gain. As in the paper, roots need as many primitives as a treelet has leaves in
+        // the first round, and twice as many in each round after, which skips most of the nodes near the leaves.
+        bool parallel = tree[0].prims >= PARALLEL_BUILD_THRESHOLD;
+        uint32_t min_prims = PBR_BVH_TREELET_LEAVES;
+        for (int round = 0; round < PBR_BVH_TREELET_ROUNDS; ++round, min_prims *= 2)
+        {
+#if PBR_USE_THREADS
+#pragma omp parallel if (parallel)
+#pragma omp single
+#endif
+            optimizer.restructure(0, min_prims);
+        }
+
+        // Should not happen given the height limit, but a tree that is too deep would overflow the traversal stack
+        if (tree[0].height > PBR_BVH_MAX_DEPTH) return;
+
+        // Back to depth-first order. Children are put in order along the axis that separates their centers the most,
+        // which is the axis traversal picks the near child by.
+        std::vector<BVHNode> out;
+        out.reserve(tree.size());
+        auto emit = [&](auto& self, uint32_t index) -> uint32_t {
+            const TreeletNode& t = tree[index];
+            uint32_t node_index = out.size();
+            out.push_back(BVHNode { t.bounds, t.offset, t.count, 0 });
+            if (t.is_leaf()) return node_index;
+
+            Point a = tree[t.child[0]].bounds.centroid();
+            Point b = tree[t.child[1]].bounds.centroid();
+            int axis = 0;
+            double separation = -1;
+            for (int i = 0; i < 3; ++i)
+            {
+                double d = std::abs(axis_of(b, i) - axis_of(a, i));
+                if (d > separation)
+                {
+                    separation = d;
+                    axis = i;
+                }
+            }
+            bool swap = axis_of(b, axis) < axis_of(a, axis);
+
+            self(self, t.child[swap ? 1 : 0]);
+            uint32_t second = self(self, t.child[swap ? 0 : 1]);
+            out[node_index].offset = second;
+            out[node_index].axis = axis;
+            return node_index;
+        };
+        emit(emit, 0);
+        nodes.assign(std::move(out));
+    }
+}
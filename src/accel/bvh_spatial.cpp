@@ -0,0 +1,554 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <random>
+
+///////////////////////////////////////////////////////////////////////////////
+// Spatial split BVH. Every node weighs the best binned object split against
+// splits of space into bins, where a primitive that crosses a bin boundary is
+// cut into a piece for each bin it touches. Cutting space lets siblings stop overlapping
+// where long primitives would otherwise stretch both of them, at the price of
+// referencing the cut primitives from both sides.
+///////////////////////////////////////////////////////////////////////////////
+
+namespace pbr
+{
+    static_assert(PBR_BVH_SPATIAL_MAX_DUPLICATION >= 0, "The reference budget cannot be negative");
+
+    class SpatialSplitBuilder
+    {
+    public:
+        /** Bounds of the part of a primitive that a node holds, and the index of the primitive */
+        struct Ref
+        {
+            AABB bounds;
+            uint32_t index;
+        };
+
+        SpatialSplitBuilder(const std::vector<AABB>& bounds, const BVH::SplitFn& split, uint32_t batch_size,
+                            uint32_t parallel_threshold)
+            : _split(split), _batch_size(batch_size), _parallel_threshold(parallel_threshold)
+        {
+            AABB root;
+            for (const auto& box : bounds) root.expand(box);
+            _root_area = root.surface_area();
+        }
+
+        /*!
+        * @brief Appends the subtree over `refs` to `out` in depth-first order, and the indices of its leaves to `out_indices`
+        *
+        * Node offsets are relative to the start of `out`, and leaf offsets to the start of `out_indices`. `refs` is used up.
+        *
+        * @param budget Number of references the subtree may add by cutting primitives
+        */
+        void build(std::vector<Ref>& refs, size_t budget, int depth, std::vector<BVHNode>& out, std::vector<uint32_t>& out_indices) const
+        {
+            uint32_t node_index = out.size();
+            out.emplace_back();
+
+            AABB node_bounds;
+            AABB centroid_bounds;
+            for (const auto& ref : refs)
+            {
+                node_bounds.expand(ref.bounds);
+                centroid_bounds.expand(ref.bounds.centroid());
+            }
+            out[node_index].bounds = node_bounds;
+
+            uint32_t count = refs.size();
+            auto make_leaf = [&]() {
+                out[node_index].offset = out_indices.size();
+                out[node_index].count = count;
+                for (const auto& ref : refs) out_indices.push_back(ref.index);
+            };
+
+            if (count == 1) return make_leaf();
+
+            ObjectBins object_bins(centroid_bounds, count);
+            Split split;
+
+            // Same depth limit as the other builds, past it splits are at the median
+            if (depth < PBR_BVH_MAX_DEPTH - 32)
+            {
+                split = find_object_split(refs, object_bins);
+
+                // Only cut primitives where the children of the object split overlap by a noticeable area
+                AABB overlap = (split.axis >= 0) ? split.left.intersection(split.right) : node_bounds;
+                if (budget > 0 && overlap.surface_area() > PBR_BVH_SPATIAL_ALPHA * _root_area)
+                {
+                    Split spatial = find_spatial_split(refs, node_bounds);
+                    if (spatial.cost < split.cost) split = spatial;
+                }
+
+                if (split.axis >= 0)
+                {
+                    double area = node_bounds.surface_area();
+                    double split_cost = PBR_BVH_TRAVERSAL_COST + PBR_BVH_INTERSECTION_COST * split.cost / std::max(area, 1e-300);
+
+                    double leaf_cost = PBR_BVH_INTERSECTION_COST * batches(count);
+                    if (count <= PBR_BVH_MAX_LEAF_SIZE && leaf_cost <= split_cost) return make_leaf();
+                }
+            }
+
+            std::vector<Ref> left, right;
+            size_t duplicates = 0;
+            if (split.spatial)
+            {
+                duplicates = partition_spatial(refs, split, budget, left, right);
+            }
+            else if (split.axis >= 0)
+            {
+                for (const auto& ref : refs)
+                {
+                    bool is_left = object_bins.bin_of(ref.bounds.centroid(), split.axis) < split.bin;
+                    (is_left ? left : right).push_back(ref);
+                }
+            }
+
+            if (left.empty() || right.empty())
+            {
+                // Too deep, all centroids coincide, or every cut primitive was kept on one side
+                if (count <= PBR_BVH_MAX_LEAF_SIZE) return make_leaf();
+
+                split.axis = centroid_bounds.longest_axis();
+                duplicates = 0;
+                uint32_t mid = count / 2;
+                std::nth_element(refs.begin(), refs.begin() + mid, refs.end(), [axis = split.axis](const Ref& a, const Ref& b) {
+                    return axis_of(a.bounds.centroid(), axis) < axis_of(b.bounds.centroid(), axis);
+                });
+                left.assign(refs.begin(), refs.begin() + mid);
+                right.assign(refs.begin() + mid, refs.end());
+            }
+
+            // The children hold everything now, free this level before going deeper
+            std::vector<Ref>().swap(refs);
+
+            // What is left of the budget goes to the children by their size
+            size_t remaining = budget - duplicates;
+            size_t left_budget = remaining * left.size() / (left.size() + right.size());
+            size_t right_budget = remaining - left_budget;
+
+            uint32_t second;
+            if (left.size() + right.size() >= _parallel_threshold)
+            {
+                // As in the binned build, the right subtree goes to its own arrays and is moved in place afterwards
+                std::vector<BVHNode> right_nodes;
+                std::vector<uint32_t> right_indices;
+                right_nodes.reserve(2 * right.size());
+                right_indices.reserve(right.size());
+#if PBR_USE_THREADS
+#pragma omp task default(shared) firstprivate(right_budget, depth)
+#endif
+                build(right, right_budget, depth + 1, right_nodes, right_indices);
+
+                build(left, left_budget, depth + 1, out, out_indices);
+#if PBR_USE_THREADS
+#pragma omp taskwait
+#endif
+
+                second = out.size();
+                uint32_t first_index = out_indices.size();
+                for (auto& node : right_nodes)
+                {
+                    node.offset += node.is_leaf() ? first_index : second;
+                }
+                out.insert(out.end(), right_nodes.begin(), right_nodes.end());
+                out_indices.insert(out_indices.end(), right_indices.begin(), right_indices.end());
+            }
+            else
+            {
+                build(left, left_budget, depth + 1, out, out_indices);
+                second = out.size();
+                build(right, right_budget, depth + 1, out, out_indices);
+            }
+
+            out[node_index].offset = second;
+            out[node_index].count = 0;
+            out[node_index].axis = split.axis;
+        }
+
+    private:
+        const BVH::SplitFn& _split;
+        uint32_t _batch_size;
+        uint32_t _parallel_threshold;
+        double _root_area;
+
+        /** Best split of a node. `cost` is the sum of area times batches over both children, without the traversal step. */
+        struct Split
+        {
+            double cost = PBR_INF;
+            int axis = -1;
+            bool spatial = false;
+
+            /** First bin on the right of an object split */
+            int bin = 0;
+
+            /** Plane of a spatial split */
+            double position = 0;
+
+            AABB left, right;
+            uint32_t left_count = 0, right_count = 0;
+        };
+
+        /** Bins of centroids along each axis, the same during evaluation and partitioning */
+        struct ObjectBins
+        {
+            int bins;
+            Point min;
+            double scale[3];
+
+            ObjectBins(const AABB& centroid_bounds, uint32_t count) : bins(std::min<int>(PBR_BVH_BINS, count)), min(centroid_bounds.min)
+            {
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    double extent = axis_of(centroid_bounds.max, axis) - axis_of(centroid_bounds.min, axis);
+                    scale[axis] = (extent > 0) ? bins / extent : 0;
+                }
+            }
+
+            inline int bin_of(const Point& centroid, int axis) const
+            {
+                return std::min(bins - 1, (int) ((axis_of(centroid, axis) - axis_of(min, axis)) * scale[axis]));
+            }
+        };
+
+        inline double batches(uint32_t n) const
+        {
+            return (double) ((n + _batch_size - 1) / _batch_size);
+        }
+
+        /** Cuts the part of a primitive within `box` at a plane. Either side comes out empty if the plane misses the primitive. */
+        inline void split_at(uint32_t index, AABB box, int axis, double position, AABB& left, AABB& right) const
+        {
+            AABB left_half = box;
+            set_axis(left_half.max, axis, position);
+            AABB right_half = box;
+            set_axis(right_half.min, axis, position);
+
+            left = left_half;
+            right = right_half;
+            if (_split) _split(index, box, axis, position, left, right);
+            left = left.intersection(left_half);
+            right = right.intersection(right_half);
+        }
+
+        Split find_object_split(const std::vector<Ref>& refs, const ObjectBins& object_bins) const
+        {
+            int bins = object_bins.bins;
+            AABB bin_bounds[3][PBR_BVH_BINS];
+            uint32_t bin_count[3][PBR_BVH_BINS] = {};
+            for (const auto& ref : refs)
+            {
+                Point centroid = ref.bounds.centroid();
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    int bin = object_bins.bin_of(centroid, axis);
+                    bin_bounds[axis][bin].expand(ref.bounds);
+                    ++bin_count[axis][bin];
+                }
+            }
+
+            Split best;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                if (object_bins.scale[axis] == 0) continue;
+
+                // Split b puts bins [0, b) on the left and [b, bins) on the right
+                AABB right_bounds[PBR_BVH_BINS];
+                uint32_t right_count[PBR_BVH_BINS];
+                AABB right;
+                uint32_t in_right = 0;
+                for (int b = bins - 1; b > 0; --b)
+                {
+                    right.expand(bin_bounds[axis][b]);
+                    in_right += bin_count[axis][b];
+                    right_bounds[b] = right;
+                    right_count[b] = in_right;
+                }
+
+                AABB left;
+                uint32_t in_left = 0;
+                for (int b = 1; b < bins; ++b)
+                {
+                    left.expand(bin_bounds[axis][b - 1]);
+                    in_left += bin_count[axis][b - 1];
+                    if (in_left == 0 || right_count[b] == 0) continue;
+
+                    double cost = left.surface_area() * batches(in_left) + right_bounds[b].surface_area() * batches(right_count[b]);
+                    if (cost < best.cost)
+                    {
+                        best.cost = cost;
+                        best.axis = axis;
+                        best.bin = b;
+                        best.left = left;
+                        best.right = right_bounds[b];
+                        best.left_count = in_left;
+                        best.right_count = right_count[b];
+                    }
+                }
+            }
+            return best;
+        }
+
+        /** Bins space along each axis. A reference counts towards the bin it starts in and the one it ends in, and is cut
+         *  at each bin boundary it crosses, adding each piece to the bounds of its bin. */
+        Split find_spatial_split(const std::vector<Ref>& refs, const AABB& node_bounds) const
+        {
+            // As with object bins, small nodes get fewer. Their primitives tend to cross most bins, and each crossing is a cut.
+            int bins = std::min<int>(PBR_BVH_BINS, refs.size());
+
+            Split best;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                double lo = axis_of(node_bounds.min, axis);
+                double extent = axis_of(node_bounds.max, axis) - lo;
+                if (!(extent > 0)) continue;
+
+                double width = extent / bins;
+                auto bin_of = [&](double x) { return std::clamp((int) ((x - lo) / width), 0, bins - 1); };
+
+                AABB bin_bounds[PBR_BVH_BINS];
+                uint32_t entries[PBR_BVH_BINS] = {};
+                uint32_t exits[PBR_BVH_BINS] = {};
+                for (const auto& ref : refs)
+                {
+                    int first = bin_of(axis_of(ref.bounds.min, axis));
+                    int last = bin_of(axis_of(ref.bounds.max, axis));
+                    ++entries[first];
+                    ++exits[last];
+
+                    if (first == last)
+                    {
+                        bin_bounds[first].expand(ref.bounds);
+                        continue;
+                    }
+
+                    AABB rest = ref.bounds;
+                    for (int b = first; b < last && !rest.empty(); ++b)
+                    {
+                        AABB piece;
+                        split_at(ref.index, rest, axis, lo + (b + 1) * width, piece, rest);
+                        bin_bounds[b].expand(piece);
+                    }
+                    bin_bounds[last].expand(rest);
+                }
+
+                AABB right_bounds[PBR_BVH_BINS];
+                uint32_t right_count[PBR_BVH_BINS];
+                AABB right;
+                uint32_t in_right = 0;
+                for (int b = bins - 1; b > 0; --b)
+                {
+                    right.expand(bin_bounds[b]);
+                    in_right += exits[b];
+                    right_bounds[b] = right;
+                    right_count[b] = in_right;
+                }
+
+                AABB left;
+                uint32_t in_left = 0;
+                for (int b = 1; b < bins; ++b)
+                {
+                    left.expand(bin_bounds[b - 1]);
+                    in_left += entries[b - 1];
+                    if (in_left == 0 || right_count[b] == 0) continue;
+
+                    double cost = left.surface_area() * batches(in_left) + right_bounds[b].surface_area() * batches(right_count[b]);
+                    if (cost < best.cost)
+                    {
+                        best.cost = cost;
+                        best.axis = axis;
+                        best.spatial = true;
+                        best.position = lo + b * width;
+                        best.left = left;
+                        best.right = right_bounds[b];
+                        best.left_count = in_left;
+                        best.right_count = right_count[b];
+                    }
+                }
+            }
+            return best;
+        }
+
+        /*!
+        * @brief Sorts references to the sides of a spatial split, and cuts those that cross the plane
+        *
+        * A crossing reference is kept whole on one side instead if that is cheaper, or once the budget is used up.
+        * The costs are estimated with the children as the split evaluation saw them.
+        *
+        * @return size_t Number of references added
+        */
+        size_t partition_spatial(const std::vector<Ref>& refs, const Split& split, size_t budget,
+                                 std::vector<Ref>& left, std::vector<Ref>& right) const
+        {
+            int axis = split.axis;
+            double left_area = split.left.surface_area();
+            double right_area = split.right.surface_area();
+            double cut_cost = left_area * batches(split.left_count) + right_area * batches(split.right_count);
+
+            size_t duplicates = 0;
+            for (const auto& ref : refs)
+            {
+                if (axis_of(ref.bounds.max, axis) <= split.position)
+                {
+                    left.push_back(ref);
+                    continue;
+                }
+                if (axis_of(ref.bounds.min, axis) >= split.position)
+                {
+                    right.push_back(ref);
+                    continue;
+                }
+
+                AABB whole_left = split.left;
+                whole_left.expand(ref.bounds);
+                AABB whole_right = split.right;
+                whole_right.expand(ref.bounds);
+                double left_cost = whole_left.surface_area() * batches(split.left_count)
+                                 + right_area * batches(std::max(split.right_count, 1u) - 1);
+                double right_cost = left_area * batches(std::max(split.left_count, 1u) - 1)
+                                  + whole_right.surface_area() * batches(split.right_count);
+
+                if (duplicates < budget && cut_cost < std::min(left_cost, right_cost))
+                {
+                    Ref left_ref { AABB {}, ref.index };
+                    Ref right_ref { AABB {}, ref.index };
+                    split_at(ref.index, ref.bounds, axis, split.position, left_ref.bounds, right_ref.bounds);
+                    bool in_left = !left_ref.bounds.empty();
+                    bool in_right = !right_ref.bounds.empty();
+                    if (in_left) left.push_back(left_ref);
+                    if (in_right) right.push_back(right_ref);
+                    if (in_left && in_right) ++duplicates;
+
+                    // The cut found nothing on either side, only possible through rounding. Keep the whole reference.
+                    if (!in_left && !in_right) left.push_back(ref);
+                }
+                else
+                {
+                    (left_cost <= right_cost ? left : right).push_back(ref);
+                }
+            }
+            return duplicates;
+        }
+    };
+
+    void BVH::build_spatial(const std::vector<AABB>& bounds, const SplitFn& split, uint32_t batch_size_)
+    {
+        batch_size = batch_size_;
+        nodes.clear();
+        indices.clear();
+        if (bounds.empty()) return;
+
+        std::vector<SpatialSplitBuilder::Ref> refs(bounds.size());
+        for (size_t i = 0; i < bounds.size(); ++i)
+        {
+            refs[i] = { bounds[i], (uint32_t) i };
+        }
+
+        size_t budget = (size_t) (PBR_BVH_SPATIAL_MAX_DUPLICATION * bounds.size());
+        std::vector<BVHNode> built;
+        std::vector<uint32_t> order;
+        built.reserve(2 * bounds.size());
+        order.reserve(bounds.size() + budget);
+
+        SpatialSplitBuilder builder(bounds, split, batch_size, PARALLEL_BUILD_THRESHOLD);
+#if PBR_USE_THREADS
+#pragma omp parallel if (bounds.size() >= PARALLEL_BUILD_THRESHOLD)
+#pragma omp single
+#endif
+        builder.build(refs, budget, 0, built, order);
+
+        nodes.assign(std::move(built));
+        indices.assign(std::move(order));
+
+        if (PBR_BVH_LAYOUT != BVHLayout::DEPTH_FIRST) reorder(PBR_BVH_LAYOUT);
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+    // TESTS
+    ///////////////////////////////////////////////////////////////////////////////
+
+    TEST_CASE("accel::BVH::spatial_build")
+    {
+        // Long thin boxes in every direction overlap a lot, which is where cutting them pays off
+        std::mt19937 gen(8);
+        std::uniform_real_distribution<> position(-100.0, 100.0);
+        std::uniform_real_distribution<> length(10.0, 80.0);
+        std::uniform_int_distribution<> axis(0, 2);
+        std::vector<AABB> bounds(20000);
+        for (auto& box : bounds)
+        {
+            Vec center { position(gen), position(gen), position(gen) };
+            Vec half { 0.2 };
+            set_axis(half, axis(gen), length(gen));
+            box = { center - half, center + half };
+        }
+
+        BVH binned, spatial;
+        binned.build(bounds, 1, BVHBuildMethod::BINNED);
+        spatial.build(bounds, 1, BVHBuildMethod::SPATIAL);
+
+        // Every primitive is in a leaf, possibly cut into several, and every box contains its children
+        std::vector<int> seen(bounds.size(), 0);
+        for (uint32_t i = 0; i < spatial.nodes.size(); ++i)
+        {
+            const BVHNode& node = spatial.nodes[i];
+            if (node.is_leaf())
+            {
+                CHECK(node.count <= PBR_BVH_MAX_LEAF_SIZE);
+                for (uint32_t j = node.offset; j < node.offset + node.count; ++j)
+                {
+                    REQUIRE(j < spatial.indices.size());
+                    ++seen[spatial.indices[j]];
+                    CHECK(!node.bounds.intersection(bounds[spatial.indices[j]]).empty());
+                }
+            }
+            else
+            {
+                REQUIRE(node.offset < spatial.nodes.size());
+                CHECK(node.bounds.intersection(spatial.nodes[i + 1].bounds).surface_area() == spatial.nodes[i + 1].bounds.surface_area());
+                CHECK(node.bounds.intersection(spatial.nodes[node.offset].bounds).surface_area() == spatial.nodes[node.offset].bounds.surface_area());
+            }
+        }
+        CHECK(std::count(seen.begin(), seen.end(), 0) == 0);
+
+        // Some primitives were cut, within the budget, and the tree got cheaper for it
+        CHECK(spatial.indices.size() > bounds.size());
+        CHECK(spatial.indices.size() <= bounds.size() * (1 + PBR_BVH_SPATIAL_MAX_DUPLICATION));
+        CHECK(spatial.sah_cost() < binned.sah_cost());
+
+        // Every ray finds the same closest box either way
+        std::uniform_real_distribution<> direction(-1.0, 1.0);
+        for (int i = 0; i < 500; ++i)
+        {
+            Ray ray { Vec { position(gen), position(gen), position(gen) }, normalize(Vec { direction(gen), direction(gen), direction(gen) }) };
+            Vec inv_dir { 1 / ray.direction.x, 1 / ray.direction.y, 1 / ray.direction.z };
+            auto closest = [&](const BVH& bvh) {
+                double tmax = PBR_INF;
+                bvh.intersect(ray, tmax, [&](uint32_t first, uint32_t count, double& tmax) {
+                    bool hit = false;
+                    for (uint32_t j = first; j < first + count; ++j)
+                    {
+                        // Entry distance of the box
+                        const AABB& box = bounds[bvh.indices[j]];
+                        double entry = 0;
+                        double exit = tmax;
+                        for (int a = 0; a < 3; ++a)
+                        {
+                            double t0 = (axis_of(box.min, a) - axis_of(ray.origin, a)) * axis_of(inv_dir, a);
+                            double t1 = (axis_of(box.max, a) - axis_of(ray.origin, a)) * axis_of(inv_dir, a);
+                            entry = std::max(entry, std::min(t0, t1));
+                            exit = std::min(exit, std::max(t0, t1));
+                        }
+                        if (entry > exit || entry >= tmax) continue;
+                        tmax = entry;
+                        hit = true;
+                    }
+                    return hit;
+                });
+                return tmax;
+            };
+            CHECK(closest(spatial) == closest(binned));
+        }
+    }
+}
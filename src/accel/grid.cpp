@@ -0,0 +1,374 @@
+#include "grid.h"
+
+#include <debug.h>
+#include <random>
+
+namespace pbr
+{
+    /** Smallest power of two that is at least n */
+    static uint64_t next_power_of_two(uint64_t n)
+    {
+        uint64_t p = 1;
+        while (p < n) p <<= 1;
+        return p;
+    }
+
+    /** Side of cubic cells such that about `cells` of them cover a box. Axes thinner than a cell get a single one. */
+    static double cell_side_for(const Vec& extent, double cells)
+    {
+        bool flat[3] = { false, false, false };
+        double side = 0;
+        for (int round = 0; round < 3; ++round)
+        {
+            double volume = 1;
+            int dims = 0;
+            for (int a = 0; a < 3; ++a)
+            {
+                if (flat[a]) continue;
+                volume *= axis_of(extent, a);
+                ++dims;
+            }
+            side = std::pow(volume / cells, 1.0 / dims);
+
+            bool changed = false;
+            for (int a = 0; a < 3; ++a)
+            {
+                if (!flat[a] && axis_of(extent, a) < side && dims > 1)
+                {
+                    flat[a] = true;
+                    changed = true;
+                    --dims;
+                }
+            }
+            if (!changed) break;
+        }
+        return side;
+    }
+
+    void Grid::build(const std::vector<AABB>& boxes, GridStorage storage_)
+    {
+        storage = storage_;
+        cell_start.clear();
+        slots.clear();
+        filter.clear();
+        indices.clear();
+        bounds = AABB {};
+
+        size_t count = 0;
+        for (const auto& box : boxes)
+        {
+            if (box.empty()) continue;
+            bounds.expand(box);
+            ++count;
+        }
+        if (count == 0)
+        {
+            resolution[0] = resolution[1] = resolution[2] = 0;
+            return;
+        }
+
+        // Pad the bounds so that primitives on the boundary are inside, and flat scenes still have cells of some thickness
+        Vec extent = bounds.extent();
+        double pad = 1e-4 * std::max({ extent.x, extent.y, extent.z, 1e-6 });
+        bounds.min = bounds.min - Vec { pad };
+        bounds.max = bounds.max + Vec { pad };
+        extent = bounds.extent();
+
+        auto set_resolution = [&](double side) {
+            for (int a = 0; a < 3; ++a)
+            {
+                double cells = std::ceil(axis_of(extent, a) / side);
+                resolution[a] = (int) std::clamp(cells, 1.0, (double) PBR_GRID_MAX_RESOLUTION);
+                set_axis(cell_size, a, axis_of(extent, a) / resolution[a]);
+                set_axis(inv_cell_size, a, resolution[a] / axis_of(extent, a));
+            }
+        };
+
+        double side = cell_side_for(extent, PBR_GRID_DENSITY * count);
+        set_resolution(side);
+        if (storage == GridStorage::HASHED)
+        {
+            // Give the occupied part of the bounds PBR_GRID_DENSITY cells per primitive, rather than all of it. The share
+            // of cells that hold a center is compared with what an even spread would fill, since it fills only part of them too.
+            std::vector<bool> filled(cell_count(), false);
+            uint64_t filled_count = 0;
+            for (const auto& box : boxes)
+            {
+                if (box.empty()) continue;
+                int cell[3];
+                for (int a = 0; a < 3; ++a)
+                {
+                    int c = (int) ((axis_of(box.centroid(), a) - axis_of(bounds.min, a)) * axis_of(inv_cell_size, a));
+                    cell[a] = std::clamp(c, 0, resolution[a] - 1);
+                }
+                uint64_t key = (uint64_t) cell[0] + (uint64_t) resolution[0] * ((uint64_t) cell[1] + (uint64_t) resolution[1] * cell[2]);
+                filled_count += !filled[key];
+                filled[key] = true;
+            }
+
+            double even = 1 - std::exp(-(double) count / cell_count());
+            double occupancy = std::min((double) filled_count / cell_count() / even, 1.0);
+            side *= std::cbrt(occupancy);
+            set_resolution(side);
+        }
+
+        // Primitives listed once per cell they overlap, which grows with their size over the cell size
+        auto count_references = [&]() {
+            uint64_t references = 0;
+            for (const auto& box : boxes)
+            {
+                if (box.empty()) continue;
+                int lo[3], hi[3];
+                cell_range(box, lo, hi);
+                references += (uint64_t) (hi[0] - lo[0] + 1) * (hi[1] - lo[1] + 1) * (hi[2] - lo[2] + 1);
+            }
+            return references;
+        };
+
+        // Positions in `indices` are 32 bits, so large primitives over fine cells get larger cells rather than wrap around
+        uint64_t references = count_references();
+        if (references > UINT32_MAX)
+        {
+            LOG_INFO("Grid cells of side %g give %llu references, using larger cells", side, (unsigned long long) references);
+        }
+        while (references > UINT32_MAX && cell_count() > 1)
+        {
+            side *= std::max(std::cbrt((double) references / UINT32_MAX), 1.25);
+            set_resolution(side);
+            references = count_references();
+        }
+
+        // Calls back with the key of every cell that each primitive overlaps
+        auto for_each_cell = [&](auto&& fn) {
+            for (uint32_t i = 0; i < boxes.size(); ++i)
+            {
+                if (boxes[i].empty()) continue;
+                int lo[3], hi[3];
+                cell_range(boxes[i], lo, hi);
+                for (int z = lo[2]; z <= hi[2]; ++z)
+                {
+                    for (int y = lo[1]; y <= hi[1]; ++y)
+                    {
+                        uint64_t row = (uint64_t) resolution[0] * ((uint64_t) y + (uint64_t) resolution[1] * z);
+                        for (int x = lo[0]; x <= hi[0]; ++x)
+                        {
+                            fn(row + x, i);
+                        }
+                    }
+                }
+            }
+        };
+
+        if (storage == GridStorage::DENSE)
+        {
+            // Count, turn the counts into starts, and fill each cell from its start
+            cell_start.assign(cell_count() + 1, 0);
+            for_each_cell([&](uint64_t cell, uint32_t) { ++cell_start[cell + 1]; });
+            for (uint64_t c = 0; c < cell_count(); ++c)
+            {
+                cell_start[c + 1] += cell_start[c];
+            }
+
+            indices.resize(cell_start[cell_count()]);
+            std::vector<uint32_t> cursor(cell_start.begin(), cell_start.end() - 1);
+            for_each_cell([&](uint64_t cell, uint32_t i) { indices[cursor[cell]++] = i; });
+            return;
+        }
+
+        // No more cells are occupied than there are references, so a table twice that size never fills up
+        auto insert = [](std::vector<Slot>& table, uint64_t cell) -> Slot& {
+            uint64_t mask = table.size() - 1;
+            for (uint64_t i = hash(cell) & mask;; i = (i + 1) & mask)
+            {
+                if (table[i].cell == cell) return table[i];
+                if (table[i].cell == EMPTY)
+                {
+                    table[i].cell = cell;
+                    return table[i];
+                }
+            }
+        };
+
+        std::vector<Slot> counts(next_power_of_two(2 * references), Slot { EMPTY, 0, 0 });
+        uint64_t occupied = 0;
+        for_each_cell([&](uint64_t cell, uint32_t) {
+            Slot& slot = insert(counts, cell);
+            occupied += slot.count == 0;
+            ++slot.count;
+        });
+
+        // Move the occupied cells into a table sized for them, and give each its range
+        slots.assign(next_power_of_two(2 * occupied), Slot { EMPTY, 0, 0 });
+        filter.assign(std::max<uint64_t>(next_power_of_two(PBR_GRID_FILTER_BITS * occupied) / 64, 1), 0);
+        uint32_t first = 0;
+        for (const Slot& slot : counts)
+        {
+            if (slot.cell == EMPTY) continue;
+            uint64_t bit = filter_hash(slot.cell) & (filter.size() * 64 - 1);
+            filter[bit / 64] |= 1ull << (bit % 64);
+            Slot& moved = insert(slots, slot.cell);
+            moved.first = first;
+            first += slot.count;
+        }
+
+        indices.resize(references);
+        for_each_cell([&](uint64_t cell, uint32_t i) {
+            Slot& slot = insert(slots, cell);
+            indices[slot.first + slot.count++] = i;
+        });
+    }
+
+    void Grid::cell_range(const AABB& box, int lo[3], int hi[3]) const
+    {
+        // Widen by a little, a primitive that rounds into the wrong cell could be skipped by a ray that ends there
+        for (int a = 0; a < 3; ++a)
+        {
+            double offset = axis_of(bounds.min, a);
+            double inv = axis_of(inv_cell_size, a);
+            lo[a] = std::clamp((int) std::floor((axis_of(box.min, a) - offset) * inv - 1e-6), 0, resolution[a] - 1);
+            hi[a] = std::clamp((int) std::floor((axis_of(box.max, a) - offset) * inv + 1e-6), 0, resolution[a] - 1);
+        }
+    }
+
+    uint64_t Grid::occupied_cells() const
+    {
+        uint64_t occupied = 0;
+        if (storage == GridStorage::DENSE)
+        {
+            for (uint64_t c = 0; c + 1 < cell_start.size(); ++c)
+            {
+                occupied += cell_start[c + 1] > cell_start[c];
+            }
+        }
+        else
+        {
+            for (const Slot& slot : slots)
+            {
+                occupied += slot.cell != EMPTY;
+            }
+        }
+        return occupied;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+    // TESTS
+    ///////////////////////////////////////////////////////////////////////////////
+
+    TEST_CASE("accel::Grid::build")
+    {
+        std::mt19937 gen(17);
+        std::uniform_real_distribution<> position(-10.0, 10.0);
+        std::uniform_real_distribution<> size(0.0, 1.5);
+
+        std::vector<AABB> boxes;
+        for (int i = 0; i < 300; ++i)
+        {
+            Vec center { position(gen), position(gen), position(gen) };
+            Vec half { size(gen), size(gen), size(gen) };
+            boxes.push_back(AABB { center - half, center + half });
+        }
+        boxes.push_back(AABB {});
+
+        for (GridStorage storage : { GridStorage::DENSE, GridStorage::HASHED })
+        {
+            Grid grid;
+            grid.build(boxes, storage);
+            REQUIRE_FALSE(grid.empty());
+            CHECK(grid.occupied_cells() <= grid.cell_count());
+
+            // Every cell lists exactly the boxes that overlap it, and the empty box is nowhere
+            for (int z = 0; z < grid.resolution[2]; ++z)
+            {
+                for (int y = 0; y < grid.resolution[1]; ++y)
+                {
+                    for (int x = 0; x < grid.resolution[0]; ++x)
+                    {
+                        AABB cell;
+                        cell.min = grid.bounds.min + Vec { x * grid.cell_size.x, y * grid.cell_size.y, z * grid.cell_size.z };
+                        cell.max = cell.min + grid.cell_size;
+
+                        int coords[3] = { x, y, z };
+                        uint32_t first = 0, count = 0;
+                        grid.find_cell(coords, first, count);
+                        std::vector<bool> listed(boxes.size(), false);
+                        for (uint32_t k = first; k < first + count; ++k)
+                        {
+                            listed[grid.indices[k]] = true;
+                        }
+
+                        for (size_t i = 0; i < boxes.size(); ++i)
+                        {
+                            AABB overlap = boxes[i].intersection(cell);
+                            // Boxes that only touch a cell may be listed either way
+                            bool inside = !overlap.empty() && overlap.extent().x > 1e-9 && overlap.extent().y > 1e-9 && overlap.extent().z > 1e-9;
+                            if (inside) CHECK(listed[i]);
+                            if (overlap.empty()) CHECK_FALSE(listed[i]);
+                        }
+                    }
+                }
+            }
+        }
+
+        // Flat and empty inputs
+        Grid flat;
+        flat.build({ AABB { Vec { -5, 0, -5 }, Vec { 5, 0, 5 } }, AABB { Vec { 1, 0, 1 }, Vec { 2, 0, 2 } } });
+        CHECK(flat.resolution[1] == 1);
+        CHECK(flat.indices.size() >= 2);
+
+        Grid none;
+        none.build({});
+        CHECK(none.empty());
+        double tmax = PBR_INF;
+        CHECK_FALSE(none.intersect(Ray { Vec { 0 }, Vec { 1, 0, 0 } }, tmax, [](uint32_t, uint32_t, double&) { return true; }));
+    }
+
+    TEST_CASE("accel::Grid::traversal_order")
+    {
+        // A row of unit boxes along x, one per cell
+        std::vector<AABB> boxes;
+        for (int i = 0; i < 10; ++i)
+        {
+            boxes.push_back(AABB { Vec { i + 0.25, 0.25, 0.25 }, Vec { i + 0.75, 0.75, 0.75 } });
+        }
+        Grid grid;
+        grid.build(boxes, GridStorage::HASHED);
+
+        for (double dx : { 1.0, -1.0 })
+        {
+            Ray ray { Vec { dx > 0 ? -5.0 : 15.0, 0.5, 0.5 }, Vec { dx, 0.01, -0.01 } };
+            // Boxes may span two cells, so only the order of the first visits is checked
+            std::vector<int> first_visit(boxes.size(), -1);
+            int step = 0;
+            double tmax = PBR_INF;
+            grid.intersect(ray, tmax, [&](uint32_t first, uint32_t count, double&) {
+                for (uint32_t k = first; k < first + count; ++k)
+                {
+                    if (first_visit[grid.indices[k]] < 0) first_visit[grid.indices[k]] = step;
+                }
+                ++step;
+                return false;
+            });
+            for (size_t i = 0; i < boxes.size(); ++i)
+            {
+                REQUIRE(first_visit[i] >= 0);
+                if (i > 0) CHECK((dx > 0) == (first_visit[i - 1] <= first_visit[i]));
+            }
+
+            // A hit in front of the far side of a cell ends the walk there
+            int calls = 0;
+            tmax = PBR_INF;
+            grid.intersect(ray, tmax, [&](uint32_t first, uint32_t, double& tmax) {
+                if (++calls < 3) return false;
+                const AABB& box = boxes[grid.indices[first]];
+                tmax = ((dx > 0 ? box.min.x : box.max.x) - ray.origin.x) / dx;
+                return true;
+            });
+            CHECK(calls == 3);
+
+            // A blocker stops an occlusion query at once
+            calls = 0;
+            CHECK(grid.occluded(ray, PBR_INF, [&](uint32_t, uint32_t) { return ++calls == 2; }));
+            CHECK(calls == 2);
+        }
+    }
+}
@@ -0,0 +1,261 @@
+#pragma once
+
+#include "aabb.h"
+#include <config.h>
+#include <stats.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace pbr
+{
+    /** How Grid stores the lists of its cells. */
+    enum class GridStorage
+    {
+        /** Every cell has an entry, found by its index. Cells are sized so that there are PBR_GRID_DENSITY of them per
+         *  primitive over the bounds of the scene, which suits primitives that fill the bounds evenly */
+        DENSE,
+
+        /** Only cells that overlap a primitive have an entry, in a hash table keyed by the cell index. Cells are sized
+         *  so that there are PBR_GRID_DENSITY of them per primitive over the part of the bounds that primitives occupy,
+         *  and memory grows with the occupied cells rather than with the volume. Clusters of primitives spread over a
+         *  large space get finer cells than in a dense grid, at the cost of more steps through the empty space */
+        HASHED,
+    };
+
+    /*!
+    * @brief Uniform grid over a set of primitive bounds, traversed with a 3D-DDA
+    *
+    * Amanatides and Woo, "A Fast Voxel Traversal Algorithm for Ray Tracing", 1987. Like the BVH the grid only knows
+    * about boxes: each cell lists the primitives whose bounds overlap it as a range of `indices`, and callers supply
+    * the primitive test as a callback. A primitive that overlaps several cells is listed, and tested, in each of them.
+    */
+    struct Grid
+    {
+        /** Cell range of a hashed cell. An empty slot has `cell` set to EMPTY. */
+        struct Slot
+        {
+            uint64_t cell;
+            uint32_t first;
+            uint32_t count;
+        };
+
+        static constexpr uint64_t EMPTY = ~0ull;
+
+        GridStorage storage = GridStorage::DENSE;
+
+        /** Bounds of all primitives, slightly enlarged */
+        AABB bounds;
+
+        /** Number of cells along each axis */
+        int resolution[3] = { 0, 0, 0 };
+
+        Vec cell_size;
+        Vec inv_cell_size;
+
+        /** DENSE: start of the range of every cell in `indices`, plus one past the end of the last one */
+        std::vector<uint32_t> cell_start;
+
+        /** HASHED: open addressing table of the occupied cells with linear probing, a power of two in size */
+        std::vector<Slot> slots;
+
+        /** HASHED: one bit per hash of a cell, set for the hashes of occupied cells. Most empty cells that a ray steps
+         *  through are turned away here, from a few bits per occupied cell that stay in cache, before the table is probed. */
+        std::vector<uint64_t> filter;
+
+        /** Primitive indices, grouped by cell. Primitives that overlap several cells appear once per cell. */
+        std::vector<uint32_t> indices;
+
+        /*!
+        * @brief Bin the primitives into cells
+        *
+        * @param bounds Bounds of each primitive. Empty boxes are left out.
+        * @param storage Dense array or hash table of cells, which also decides how the cells are sized
+        */
+        void build(const std::vector<AABB>& bounds, GridStorage storage = GridStorage::DENSE);
+
+        inline bool empty() const { return indices.empty(); }
+
+        inline uint64_t cell_count() const
+        {
+            return (uint64_t) resolution[0] * resolution[1] * resolution[2];
+        }
+
+        /** Number of cells with at least one primitive */
+        uint64_t occupied_cells() const;
+
+        inline size_t memory_bytes() const
+        {
+            return cell_start.size() * sizeof(uint32_t) + slots.size() * sizeof(Slot) + filter.size() * sizeof(uint64_t)
+                + indices.size() * sizeof(uint32_t);
+        }
+
+        /** Range of a cell in `indices`, given its coordinates. Returns false for empty cells. */
+        inline bool find_cell(const int cell[3], uint32_t& first, uint32_t& count) const
+        {
+            uint64_t key = (uint64_t) cell[0] + (uint64_t) resolution[0] * ((uint64_t) cell[1] + (uint64_t) resolution[1] * cell[2]);
+            if (storage == GridStorage::DENSE)
+            {
+                first = cell_start[key];
+                count = cell_start[key + 1] - first;
+                return count > 0;
+            }
+
+            uint64_t bit = filter_hash(key) & (filter.size() * 64 - 1);
+            if ((filter[bit / 64] & (1ull << (bit % 64))) == 0) return false;
+
+            uint64_t mask = slots.size() - 1;
+            for (uint64_t i = hash(key) & mask;; i = (i + 1) & mask)
+            {
+                const Slot& slot = slots[i];
+                if (slot.cell == key)
+                {
+                    first = slot.first;
+                    count = slot.count;
+                    return true;
+                }
+                if (slot.cell == EMPTY) return false;
+            }
+        }
+
+        /*!
+        * @brief Find the closest hits along a ray, visiting the cells it crosses from front to back
+        *
+        * @param ray Ray to traverse the grid with
+        * @param tmax Closest hit so far, shrunk by the cell callback as hits are found
+        * @param cell Callback with signature bool(uint32_t first, uint32_t count, double& tmax)
+        *             that tests positions [first, first + count) of `indices`
+        * @return bool Indicates if any cell callback reported a hit
+        */
+        template <class CellFn>
+        bool intersect(const Ray& ray, double& tmax, CellFn&& cell) const
+        {
+            bool hit = false;
+            uint32_t visited = 0;
+            traverse(ray, tmax, visited, [&](uint32_t first, uint32_t count, double& tmax) {
+                hit |= cell(first, count, tmax);
+                return false;
+            });
+            PBR_STAT_ADD(NODES_VISITED, visited);
+            return hit;
+        }
+
+        /*!
+        * @brief Check whether any primitive blocks the ray segment [0, tmax]
+        *
+        * @param ray Ray to traverse the grid with
+        * @param tmax Far end of the segment
+        * @param cell Callback with signature bool(uint32_t first, uint32_t count) that returns true if a primitive
+        *             at positions [first, first + count) of `indices` blocks the segment
+        * @return bool Indicates if any cell callback reported a hit, the traversal stops at the first one
+        */
+        template <class CellFn>
+        bool occluded(const Ray& ray, double tmax, CellFn&& cell) const
+        {
+            uint32_t visited = 0;
+            bool blocked = traverse(ray, tmax, visited, [&](uint32_t first, uint32_t count, double&) {
+                return cell(first, count);
+            });
+            PBR_STAT_ADD(OCCLUSION_NODES_VISITED, visited);
+            return blocked;
+        }
+
+    private:
+        static inline uint64_t hash(uint64_t key)
+        {
+            // Fibonacci hashing, the high bits are the well mixed ones
+            return (key * 0x9E3779B97F4A7C15ull) >> 20;
+        }
+
+        /** A second hash for `filter`, independent of the slot a cell lands in */
+        static inline uint64_t filter_hash(uint64_t key)
+        {
+            return (key * 0xC2B2AE3D27D4EB4Full) >> 20;
+        }
+
+        /** Cell coordinates of the cells that a box overlaps, inclusive */
+        void cell_range(const AABB& box, int lo[3], int hi[3]) const;
+
+        /*!
+        * @brief Walk the cells along the ray until the callback returns true or no cell can hold a hit closer than tmax
+        *
+        * A hit found in a cell may lie in a later cell, when the primitive spans both. The walk only stops once the
+        * closest hit so far is before the far side of the current cell, so that no cell it skips can hold a closer one.
+        * Visited cells are counted into `visited`.
+        */
+        template <class CellFn>
+        bool traverse(const Ray& ray, double& tmax, uint32_t& visited, CellFn&& visit) const
+        {
+            if (indices.empty()) return false;
+
+            // Clip the ray to the grid
+            Vec inv_dir { 1 / ray.direction.x, 1 / ray.direction.y, 1 / ray.direction.z };
+            double tnear = 0;
+            double tfar = tmax;
+            for (int a = 0; a < 3; ++a)
+            {
+                double t0 = (axis_of(bounds.min, a) - axis_of(ray.origin, a)) * axis_of(inv_dir, a);
+                double t1 = (axis_of(bounds.max, a) - axis_of(ray.origin, a)) * axis_of(inv_dir, a);
+                tnear = std::max(tnear, std::min(t0, t1));
+                tfar = std::min(tfar, std::max(t0, t1));
+            }
+            if (tnear > tfar) return false;
+
+            int cell[3], step[3], end[3];
+            double tnext[3], tdelta[3];
+            Point entry = ray.origin + ray.direction * tnear;
+            for (int a = 0; a < 3; ++a)
+            {
+                double d = axis_of(ray.direction, a);
+                double offset = axis_of(bounds.min, a);
+                int c = (int) ((axis_of(entry, a) - offset) * axis_of(inv_cell_size, a));
+                cell[a] = std::clamp(c, 0, resolution[a] - 1);
+
+                // Parameters of the first cell boundary crossed along each axis, and of the distance between boundaries
+                if (d > 0)
+                {
+                    step[a] = 1;
+                    end[a] = resolution[a];
+                    tnext[a] = (offset + (cell[a] + 1) * axis_of(cell_size, a) - axis_of(ray.origin, a)) / d;
+                    tdelta[a] = axis_of(cell_size, a) / d;
+                }
+                else if (d < 0)
+                {
+                    step[a] = -1;
+                    end[a] = -1;
+                    tnext[a] = (offset + cell[a] * axis_of(cell_size, a) - axis_of(ray.origin, a)) / d;
+                    tdelta[a] = -axis_of(cell_size, a) / d;
+                }
+                else
+                {
+                    step[a] = 0;
+                    end[a] = -1;
+                    tnext[a] = PBR_INF;
+                    tdelta[a] = 0;
+                }
+            }
+
+            bool stop = false;
+            while (true)
+            {
+                ++visited;
+                uint32_t first, count;
+                if (find_cell(cell, first, count) && visit(first, count, tmax))
+                {
+                    stop = true;
+                    break;
+                }
+
+                int a = (tnext[0] < tnext[1]) ? (tnext[0] < tnext[2] ? 0 : 2) : (tnext[1] < tnext[2] ? 1 : 2);
+                if (tnext[a] >= std::min(tmax, tfar)) break;
+
+                cell[a] += step[a];
+                if (cell[a] == end[a]) break;
+                tnext[a] += tdelta[a];
+            }
+            return stop;
+        }
+    };
+}
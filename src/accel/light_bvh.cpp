@@ -0,0 +1,372 @@
+#include "light_bvh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+
+namespace pbr
+{
+    // Cosine and sine of the difference of two angles in [0, pi], clamped at zero degrees
+    static inline double cos_sub_clamped(double sin_a, double cos_a, double sin_b, double cos_b)
+    {
+        if (cos_a > cos_b) return 1;
+        return cos_a * cos_b + sin_a * sin_b;
+    }
+
+    static inline double sin_sub_clamped(double sin_a, double cos_a, double sin_b, double cos_b)
+    {
+        if (cos_a > cos_b) return 0;
+        return sin_a * cos_b - cos_a * sin_b;
+    }
+
+    static inline double sin_of(double cos)
+    {
+        return std::sqrt(std::max(0., 1 - cos * cos));
+    }
+
+    /** Rotate a vector about a unit axis (Rodrigues' formula) */
+    static Vec rotate(const Vec& v, const Vec& axis, double angle)
+    {
+        double c = std::cos(angle), s = std::sin(angle);
+        return v * c + cross(axis, v) * s + axis * (dot(axis, v) * (1 - c));
+    }
+
+    void LightBounds::merge(const LightBounds& other)
+    {
+        if (other.power == 0 && other.bounds.empty()) return;
+        if (power == 0 && bounds.empty())
+        {
+            *this = other;
+            return;
+        }
+
+        bounds.expand(other.bounds);
+        power += other.power;
+        cos_theta_e = std::min(cos_theta_e, other.cos_theta_e);
+
+        // Smallest cone around both cones of normals
+        double theta_a = std::acos(std::clamp(cos_theta_o, -1., 1.));
+        double theta_b = std::acos(std::clamp(other.cos_theta_o, -1., 1.));
+        double theta_d = std::acos(std::clamp(dot(axis, other.axis), -1., 1.));
+        if (std::min(theta_d + theta_b, PBR_PI) <= theta_a) return;
+        if (std::min(theta_d + theta_a, PBR_PI) <= theta_b)
+        {
+            axis = other.axis;
+            cos_theta_o = other.cos_theta_o;
+            return;
+        }
+
+        double theta_o = (theta_a + theta_d + theta_b) / 2;
+        Vec turn = cross(axis, other.axis);
+        if (theta_o >= PBR_PI || turn.sqlen() == 0)
+        {
+            cos_theta_o = -1;
+            return;
+        }
+        axis = normalize(rotate(axis, normalize(turn), theta_o - theta_a));
+        cos_theta_o = std::cos(theta_o);
+    }
+
+    double LightBounds::importance(const Point& point, const Vec& normal) const
+    {
+        // Nearby groups would get an unbounded importance, the distance is kept to at least half the diagonal
+        Point center = bounds.centroid();
+        Vec to_light = center - point;
+        double half_diagonal = bounds.extent().len() / 2;
+        double distance2 = to_light.sqlen();
+        double d2 = std::max(distance2, half_diagonal * half_diagonal);
+        Vec wi = (distance2 > 0) ? to_light / std::sqrt(distance2) : Vec { 0, 0, 1 };
+
+        // Half-angle of a cone from the point around the box, the whole sphere if the point is inside
+        double cos_theta_b = -1;
+        if (distance2 > half_diagonal * half_diagonal) cos_theta_b = std::sqrt(1 - half_diagonal * half_diagonal / distance2);
+        double sin_theta_b = sin_of(cos_theta_b);
+
+        // Angle between the cone of normals and the direction towards the point, less the spread of both
+        double cos_theta_w = dot(axis, wi * -1);
+        double sin_theta_w = sin_of(cos_theta_w);
+        double sin_theta_o = sin_of(cos_theta_o);
+        double cos_theta_x = cos_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+        double sin_theta_x = sin_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+        double cos_theta = cos_sub_clamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+        if (cos_theta <= cos_theta_e) return 0;
+
+        double importance = power * cos_theta / d2;
+
+        // Light arriving at the surface from below its horizon is of no use. The cone around the box is loose for
+        // large boxes close by, so boxes entirely below the tangent plane are first turned away exactly.
+        if (normal.sqlen() > 0)
+        {
+            Vec half = bounds.extent() * 0.5;
+            double reach = std::abs(normal.x) * half.x + std::abs(normal.y) * half.y + std::abs(normal.z) * half.z;
+            if (dot(normal, to_light) + reach <= 0) return 0;
+
+            double cos_theta_i = dot(normal, wi);
+            double cos_i = cos_sub_clamped(sin_of(cos_theta_i), cos_theta_i, sin_theta_b, cos_theta_b);
+            importance *= std::max(0., cos_i);
+        }
+        return std::max(0., importance);
+    }
+
+    double LightBounds::orientation_measure() const
+    {
+        double theta_o = std::acos(std::clamp(cos_theta_o, -1., 1.));
+        double theta_e = std::acos(std::clamp(cos_theta_e, -1., 1.));
+        double theta_w = std::min(theta_o + theta_e, PBR_PI);
+        double sin_theta_o = std::sin(theta_o);
+        return 2 * PBR_PI * (1 - cos_theta_o)
+            + PBR_PI / 2 * (2 * theta_w * sin_theta_o - std::cos(theta_o - 2 * theta_w) - 2 * theta_o * sin_theta_o + cos_theta_o);
+    }
+
+    void LightBVH::build(const std::vector<LightBounds>& lights)
+    {
+        nodes.clear();
+        trails.assign(lights.size(), 0);
+        if (lights.empty()) return;
+
+        nodes.reserve(2 * lights.size() - 1);
+        std::vector<uint32_t> ids(lights.size());
+        std::iota(ids.begin(), ids.end(), 0);
+        build_recursive(lights, ids, 0, ids.size(), 0, 0);
+    }
+
+    uint32_t LightBVH::build_recursive(const std::vector<LightBounds>& lights, std::vector<uint32_t>& ids, size_t begin,
+                                       size_t end, int depth, uint64_t trail)
+    {
+        uint32_t index = (uint32_t) nodes.size();
+        nodes.emplace_back();
+
+        LightBounds bounds;
+        AABB centroids;
+        for (size_t i = begin; i < end; ++i)
+        {
+            bounds.merge(lights[ids[i]]);
+            centroids.expand(lights[ids[i]].bounds.centroid());
+        }
+
+        if (end - begin == 1)
+        {
+            nodes[index] = { bounds, ids[begin], true };
+            trails[ids[begin]] = trail;
+            return index;
+        }
+
+        // Binned surface area orientation heuristic along the longest axis of the centroids: power times area times
+        // the measure of the emission cone on each side. The paths to the leaves are 64 bits, so deep trees fall back
+        // to halving the count, which keeps the remaining depth logarithmic.
+        constexpr int BINS = 12;
+        int axis = centroids.longest_axis();
+        double lo = axis_of(centroids.min, axis);
+        double extent = axis_of(centroids.max, axis) - lo;
+        size_t mid = begin + (end - begin) / 2;
+        bool split = false;
+
+        if (extent > 0 && depth < 32)
+        {
+            LightBounds bins[BINS];
+            auto bin_of = [&](uint32_t id) {
+                int b = (int) (BINS * (axis_of(lights[id].bounds.centroid(), axis) - lo) / extent);
+                return std::clamp(b, 0, BINS - 1);
+            };
+            for (size_t i = begin; i < end; ++i) bins[bin_of(ids[i])].merge(lights[ids[i]]);
+
+            auto cost = [](const LightBounds& b) { return b.power * b.bounds.surface_area() * b.orientation_measure(); };
+            double best_cost = PBR_INF;
+            int best = -1;
+            for (int s = 1; s < BINS; ++s)
+            {
+                LightBounds below, above;
+                for (int b = 0; b < s; ++b) below.merge(bins[b]);
+                for (int b = s; b < BINS; ++b) above.merge(bins[b]);
+                if (below.power == 0 || above.power == 0) continue;
+
+                double c = cost(below) + cost(above);
+                if (c < best_cost)
+                {
+                    best_cost = c;
+                    best = s;
+                }
+            }
+
+            if (best > 0)
+            {
+                auto first_above = std::partition(ids.begin() + begin, ids.begin() + end, [&](uint32_t id) { return bin_of(id) < best; });
+                mid = first_above - ids.begin();
+                split = mid > begin && mid < end;
+            }
+        }
+
+        if (!split)
+        {
+            if (depth >= 63) throw std::runtime_error("Light hierarchy too deep for the paths to its leaves");
+            mid = begin + (end - begin) / 2;
+            std::nth_element(ids.begin() + begin, ids.begin() + mid, ids.begin() + end, [&](uint32_t a, uint32_t b) {
+                return axis_of(lights[a].bounds.centroid(), axis) < axis_of(lights[b].bounds.centroid(), axis);
+            });
+        }
+
+        build_recursive(lights, ids, begin, mid, depth + 1, trail);
+        uint32_t second = build_recursive(lights, ids, mid, end, depth + 1, trail | (1ull << depth));
+        nodes[index] = { bounds, second, false };
+        return index;
+    }
+
+    double LightBVH::first_child_chance(uint32_t node, const Point& point, const Vec& normal) const
+    {
+        double first = nodes[node + 1].bounds.importance(point, normal);
+        double second = nodes[nodes[node].offset].bounds.importance(point, normal);
+        if (first + second <= 0) return -1;
+        return first / (first + second);
+    }
+
+    bool LightBVH::sample(const Point& point, const Vec& normal, double u, uint32_t& light, double& pdf) const
+    {
+        if (nodes.empty()) return false;
+
+        uint32_t node = 0;
+        pdf = 1;
+        while (!nodes[node].leaf)
+        {
+            double chance = first_child_chance(node, point, normal);
+            if (chance < 0) return false;
+
+            // Take a child and rescale u to [0, 1) within its share, so that one number serves the whole descent
+            if (u < chance)
+            {
+                u = std::min(u / chance, 1 - 1e-12);
+                pdf *= chance;
+                node = node + 1;
+            }
+            else
+            {
+                u = std::min((u - chance) / (1 - chance), 1 - 1e-12);
+                pdf *= 1 - chance;
+                node = nodes[node].offset;
+            }
+        }
+        light = nodes[node].offset;
+        return true;
+    }
+
+    double LightBVH::pdf(const Point& point, const Vec& normal, uint32_t light) const
+    {
+        if (nodes.empty()) return 0;
+
+        uint64_t trail = trails[light];
+        uint32_t node = 0;
+        double pdf = 1;
+        for (int depth = 0; !nodes[node].leaf; ++depth)
+        {
+            double chance = first_child_chance(node, point, normal);
+            if (chance < 0) return 0;
+
+            if (trail & (1ull << depth))
+            {
+                pdf *= 1 - chance;
+                node = nodes[node].offset;
+            }
+            else
+            {
+                pdf *= chance;
+                node = node + 1;
+            }
+        }
+        return pdf;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+    // TESTS
+    ///////////////////////////////////////////////////////////////////////////////
+
+    static LightBounds sphere_light(const Vec& center, double radius, double power)
+    {
+        LightBounds light;
+        light.bounds = { center - Vec { radius }, center + Vec { radius } };
+        light.cos_theta_o = -1;
+        light.cos_theta_e = 0;
+        light.power = power;
+        return light;
+    }
+
+    TEST_CASE("accel::LightBounds::merge")
+    {
+        LightBounds a, b;
+        a.bounds = { Vec { 0, 0, 0 }, Vec { 1, 1, 1 } };
+        a.axis = { 0, 0, 1 };
+        a.cos_theta_o = 1;
+        a.cos_theta_e = 0;
+        a.power = 1;
+        b = a;
+        b.bounds = { Vec { 2, 0, 0 }, Vec { 3, 1, 1 } };
+        b.axis = { 1, 0, 0 };
+
+        LightBounds merged;
+        merged.merge(a);
+        merged.merge(b);
+        CHECK(merged.power == 2);
+        CHECK(merged.bounds.max.x == 3);
+
+        // Two narrow cones at right angles are held by one of 45 degrees between them
+        CHECK(merged.cos_theta_o == doctest::Approx(std::cos(PBR_PI / 4)));
+        CHECK(merged.axis.x == doctest::Approx(std::sqrt(0.5)));
+        CHECK(merged.axis.z == doctest::Approx(std::sqrt(0.5)));
+
+        merged.merge(sphere_light(Vec { 0, 0, 0 }, 1, 1));
+        CHECK(merged.cos_theta_o == -1);
+    }
+
+    TEST_CASE("accel::LightBVH::sample")
+    {
+        std::mt19937 gen(1);
+        std::uniform_real_distribution<> position(-50, 50);
+        std::uniform_real_distribution<> power(0.5, 2);
+        std::vector<LightBounds> lights;
+        for (int i = 0; i < 200; ++i) lights.push_back(sphere_light(Vec { position(gen), position(gen), position(gen) }, 0.1, power(gen)));
+
+        LightBVH bvh;
+        bvh.build(lights);
+        CHECK(bvh.nodes.size() == 2 * lights.size() - 1);
+
+        // The chances of all the lights add up to one, and sampling picks each with its chance
+        Point point { 10, 0, 0 };
+        Vec normal { 0, 0, 0 };
+        double total = 0;
+        for (uint32_t i = 0; i < lights.size(); ++i) total += bvh.pdf(point, normal, i);
+        CHECK(total == doctest::Approx(1));
+
+        std::vector<int> counts(lights.size(), 0);
+        std::uniform_real_distribution<> uniform;
+        const int samples = 200000;
+        for (int s = 0; s < samples; ++s)
+        {
+            uint32_t light;
+            double pdf;
+            REQUIRE(bvh.sample(point, normal, uniform(gen), light, pdf));
+            CHECK(pdf == doctest::Approx(bvh.pdf(point, normal, light)));
+            ++counts[light];
+        }
+        for (uint32_t i = 0; i < lights.size(); ++i)
+        {
+            double expected = samples * bvh.pdf(point, normal, i);
+            CHECK(std::abs(counts[i] - expected) <= 5 * std::sqrt(expected) + 1);
+        }
+
+        // Lights below the horizon of a surface are never picked. A descent can still end in a node whose children
+        // both turn out to be below it, which sample() reports as a miss, and pdf() as a chance of 0 for their lights.
+        Vec up { 0, 1, 0 };
+        int picked = 0;
+        for (int s = 0; s < 1000; ++s)
+        {
+            uint32_t light;
+            double pdf;
+            if (!bvh.sample(Point { 0, 0, 0 }, up, uniform(gen), light, pdf)) continue;
+            CHECK(lights[light].bounds.max.y > 0);
+            ++picked;
+        }
+        CHECK(picked > 900);
+        uint32_t light;
+        double pdf;
+        CHECK_FALSE(bvh.sample(Point { 0, 60, 0 }, up, 0.5, light, pdf));
+    }
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "aabb.h"
+#include <config.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace pbr
+{
+    /*!
+    * @brief Bounds of one emitter or a group of them, as seen by the lights they may send to a point
+    *
+    * Conty Estevez and Kulla, "Importance Sampling of Many Lights with Adaptive Tree Splitting", 2018. Besides the box,
+    * a cone around `axis` holds the normals of all the emitting surfaces, and light leaves each surface within
+    * `cos_theta_e` of its normal. A sphere has normals everywhere, so its cone is the whole sphere of directions.
+    */
+    struct LightBounds
+    {
+        AABB bounds;
+
+        /** Axis of the cone of surface normals */
+        Vec axis { 0, 0, 1 };
+
+        /** Cosine of the half-angle of the cone of normals, -1 for every direction */
+        double cos_theta_o = 1;
+
+        /** Cosine of the largest angle to its normal at which a surface emits, 0 for a diffuse emitter */
+        double cos_theta_e = 1;
+
+        /** Emitted power, or any measure proportional to it */
+        double power = 0;
+
+        /** Grow to hold another emitter or group. Merging into default bounds yields the other bounds. */
+        void merge(const LightBounds& other);
+
+        /*!
+        * @brief Estimate of the light the emitters could send to a point, as large as any of them can
+        *
+        * The power over the squared distance to the center of the box, times the largest cosines between the light
+        * and the cone, and between the light and the normal, over all directions from the point into the box.
+        *
+        * @param point Point that receives the light
+        * @param normal Normal of the surface at the point, or a zero vector for a point that takes light from all sides
+        * @return double 0 when no emitter can light the point
+        */
+        double importance(const Point& point, const Vec& normal) const;
+
+        /** Measure of the cone of directions that light leaves in, from the surface area orientation heuristic */
+        double orientation_measure() const;
+    };
+
+    /** A node of a LightBVH, stored in depth-first order. The first child of an interior node directly follows it. */
+    struct LightBVHNode
+    {
+        LightBounds bounds;
+
+        /** Index of the second child for interior nodes, or of the light for leaves */
+        uint32_t offset;
+
+        bool leaf;
+    };
+
+    /*!
+    * @brief Binary hierarchy over emitters, that picks one for a point in time logarithmic in their number
+    *
+    * Each leaf holds one emitter. Sampling goes down from the root and at each node takes a child with a chance in
+    * proportion to its importance, so that emitters that are close, bright and facing the point are picked the most.
+    * The chance of picking an emitter is the product of the choices on its way down, which pdf() retraces from the
+    * bits of its path.
+    */
+    class LightBVH
+    {
+    public:
+        /** Build over the bounds of each emitter, which are referred to by their position in `lights` */
+        void build(const std::vector<LightBounds>& lights);
+
+        bool empty() const { return nodes.empty(); }
+
+        /*!
+        * @brief Pick an emitter for a point, in proportion to the importance of the nodes along the way
+        *
+        * @param point Point to pick an emitter for
+        * @param normal Normal of the surface at the point, or a zero vector
+        * @param u Uniform number in [0, 1)
+        * @param light Position of the emitter in the lights of build()
+        * @param pdf Chance of picking it
+        * @return bool False if no emitter can light the point
+        */
+        bool sample(const Point& point, const Vec& normal, double u, uint32_t& light, double& pdf) const;
+
+        /** Chance that sample() picks the emitter for the point */
+        double pdf(const Point& point, const Vec& normal, uint32_t light) const;
+
+        size_t memory_bytes() const
+        {
+            return nodes.size() * sizeof(LightBVHNode) + trails.size() * sizeof(uint64_t);
+        }
+
+        std::vector<LightBVHNode> nodes;
+
+        /** Path to the leaf of each emitter, bit i set where the path takes the second child at depth i */
+        std::vector<uint64_t> trails;
+
+    private:
+        uint32_t build_recursive(const std::vector<LightBounds>& lights, std::vector<uint32_t>& ids, size_t begin,
+                                 size_t end, int depth, uint64_t trail);
+
+        /** Chance of taking the first child of an interior node, 0 and 1 included, or a negative number if neither can light the point */
+        double first_child_chance(uint32_t node, const Point& point, const Vec& normal) const;
+    };
+}
@@ -0,0 +1,126 @@
+#include "quantized_bvh.h"
+
+#include <random>
+
+namespace pbr
+{
+    /** A grid value decoded the same way as the traversal does, a product that is exact and one rounding */
+    static inline float decode(float origin, float scale, int q)
+    {
+        return origin + (float) q * scale;
+    }
+
+    QuantizedBVHNode::QuantizedBVHNode(const WideBVHNode<WIDTH>& node)
+    {
+        size = node.size;
+        for (int i = 0; i < WIDTH; ++i)
+        {
+            child[i] = node.child[i];
+            count[i] = (uint8_t) node.count[i];
+        }
+
+        for (int a = 0; a < 3; ++a)
+        {
+            float node_lo = std::numeric_limits<float>::infinity();
+            float node_hi = -std::numeric_limits<float>::infinity();
+            for (int i = 0; i < size; ++i)
+            {
+                node_lo = std::min(node_lo, node.lo[a][i]);
+                node_hi = std::max(node_hi, node.hi[a][i]);
+            }
+            if (size == 0) node_lo = node_hi = 0;
+
+            // The smallest power of two that fits the node in 255 steps, up to the rounding of the decoded far end
+            int e;
+            std::frexp(std::max((double) node_hi - node_lo, 1e-30) / 255, &e);
+            e = std::clamp(e, -126, 127);
+            while (e < 127 && decode(node_lo, scale_of(e), 255) < node_hi) ++e;
+
+            origin[a] = node_lo;
+            exponent[a] = (int8_t) e;
+            float scale = scale_of(e);
+
+            // Round outwards, and step further out where the decoded value still lands inside
+            for (int i = 0; i < WIDTH; ++i)
+            {
+                if (i >= size)
+                {
+                    lo[a][i] = 255;
+                    hi[a][i] = 0;
+                    continue;
+                }
+
+                int q_lo = std::clamp((int) std::floor(((double) node.lo[a][i] - node_lo) / scale), 0, 255);
+                while (q_lo > 0 && decode(node_lo, scale, q_lo) > node.lo[a][i]) --q_lo;
+
+                int q_hi = std::clamp((int) std::ceil(((double) node.hi[a][i] - node_lo) / scale), 0, 255);
+                while (q_hi < 255 && decode(node_lo, scale, q_hi) < node.hi[a][i]) ++q_hi;
+
+                lo[a][i] = (uint8_t) q_lo;
+                hi[a][i] = (uint8_t) q_hi;
+            }
+        }
+    }
+
+    AABB QuantizedBVHNode::child_bounds(int i) const
+    {
+        float min[3], max[3];
+        for (int a = 0; a < 3; ++a)
+        {
+            min[a] = decode(origin[a], scale_of(exponent[a]), lo[a][i]);
+            max[a] = decode(origin[a], scale_of(exponent[a]), hi[a][i]);
+        }
+        return { Vec { min[0], min[1], min[2] }, Vec { max[0], max[1], max[2] } };
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+    // TESTS
+    ///////////////////////////////////////////////////////////////////////////////
+
+    TEST_CASE("accel::QuantizedBVHNode::conservative")
+    {
+        std::mt19937 gen(13);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+        // Far from the origin, with boxes from large to flat
+        for (float offset : { 0.0f, -3.0f, 1e4f })
+        {
+            for (float size : { 100.0f, 1.0f, 1e-3f, 0.0f })
+            {
+                WideBVHNode<4> wide;
+                wide.size = 3;
+                for (int i = 0; i < 4; ++i)
+                {
+                    wide.child[i] = i;
+                    wide.count[i] = i;
+                    for (int a = 0; a < 3; ++a)
+                    {
+                        float lo = offset + unit(gen) * 50;
+                        wide.lo[a][i] = lo;
+                        wide.hi[a][i] = lo + unit(gen) * size;
+                    }
+                }
+
+                QuantizedBVHNode node(wide);
+                CHECK(node.size == 3);
+                for (int i = 0; i < 3; ++i)
+                {
+                    CHECK(node.child[i] == (uint32_t) i);
+                    CHECK(node.count[i] == i);
+
+                    AABB box = node.child_bounds(i);
+                    for (int a = 0; a < 3; ++a)
+                    {
+                        CHECK(axis_of(box.min, a) <= wide.lo[a][i]);
+                        CHECK(axis_of(box.max, a) >= wide.hi[a][i]);
+                    }
+                }
+
+                // Unused slots are never hit
+                WideRay ray(Ray { Vec { offset - 10 }, Vec { 1, 1, 1 } });
+                float tnear[4];
+                CHECK((node.intersect(ray, 1e30f, tnear) & 0x8) == 0);
+            }
+        }
+    }
+}
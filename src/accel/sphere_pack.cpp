@@ -0,0 +1,241 @@
+#include "sphere_pack.h"
+
+#include <core/simd.h>
+#include <limits>
+
+namespace pbr
+{
+    // The packed test is a filter in front of the exact test, so it may let near misses through but must
+    // never drop a hit. These relative tolerances cover the single precision rounding of every term.
+    static constexpr float DISCRIMINANT_TOLERANCE = 1e-4f;
+    static constexpr float ROOT_TOLERANCE = 1e-3f;
+
+    void SpherePack::build(const std::vector<const Actor*>& actors)
+    {
+        size = actors.size();
+
+        // Pad by one full batch so that a kernel starting at any lane can load WIDTH values
+        size_t padded = size + WIDTH;
+        cx.assign(padded, 0.f);
+        cy.assign(padded, 0.f);
+        cz.assign(padded, 0.f);
+        r2.assign(padded, 0.f);
+
+        for (uint32_t i = 0; i < size; ++i)
+        {
+            if (auto sphere = std::get_if<SphereGeometry>(&actors[i]->geometry))
+            {
+                cx[i] = sphere->center.x;
+                cy[i] = sphere->center.y;
+                cz[i] = sphere->center.z;
+                r2[i] = sphere->radius * sphere->radius;
+            }
+            else
+            {
+                r2[i] = std::numeric_limits<float>::infinity();
+            }
+        }
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+    // Kernels
+    // For each lane, solve a t^2 + 2 b t + c = 0 with b = oc.d and c = oc.oc - r^2,
+    // and keep it if the roots may overlap [0, tmax].
+    ///////////////////////////////////////////////////////////////////////////////
+
+    using Kernel = uint32_t (*)(const SpherePack&, const PackedRay&, uint32_t, float);
+
+    static uint32_t kernel_scalar(const SpherePack& pack, const PackedRay& ray, uint32_t first, float tmax)
+    {
+        uint32_t mask = 0;
+        for (uint32_t lane = 0; lane < SpherePack::WIDTH; ++lane)
+        {
+            uint32_t i = first + lane;
+            float ocx = ray.ox - pack.cx[i];
+            float ocy = ray.oy - pack.cy[i];
+            float ocz = ray.oz - pack.cz[i];
+
+            float b = ocx * ray.dx + ocy * ray.dy + ocz * ray.dz;
+            float oc2 = ocx * ocx + ocy * ocy + ocz * ocz;
+            float c = oc2 - pack.r2[i];
+
+            float disc = b * b - ray.a * c;
+            float tol = DISCRIMINANT_TOLERANCE * (b * b + ray.a * (oc2 + pack.r2[i]));
+            float sq = std::sqrt(std::max(disc, 0.f));
+            float slack = ROOT_TOLERANCE * (std::abs(b) + sq);
+
+            bool hit = (disc >= -tol) && (sq - b >= -slack) && (-b - sq <= ray.a * tmax + slack);
+            mask |= (uint32_t) hit << lane;
+        }
+        return mask;
+    }
+
+#if PBR_SIMD_X86
+    PBR_TARGET_SSE4
+    static uint32_t kernel_sse4(const SpherePack& pack, const PackedRay& ray, uint32_t first, float tmax)
+    {
+        const __m128 ox = _mm_set1_ps(ray.ox), oy = _mm_set1_ps(ray.oy), oz = _mm_set1_ps(ray.oz);
+        const __m128 dx = _mm_set1_ps(ray.dx), dy = _mm_set1_ps(ray.dy), dz = _mm_set1_ps(ray.dz);
+        const __m128 a = _mm_set1_ps(ray.a);
+        const __m128 far = _mm_set1_ps(ray.a * tmax);
+        const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+        uint32_t mask = 0;
+        for (uint32_t lane = 0; lane < SpherePack::WIDTH; lane += 4)
+        {
+            uint32_t i = first + lane;
+            __m128 r2 = _mm_loadu_ps(&pack.r2[i]);
+            __m128 ocx = _mm_sub_ps(ox, _mm_loadu_ps(&pack.cx[i]));
+            __m128 ocy = _mm_sub_ps(oy, _mm_loadu_ps(&pack.cy[i]));
+            __m128 ocz = _mm_sub_ps(oz, _mm_loadu_ps(&pack.cz[i]));
+
+            __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, dx), _mm_mul_ps(ocy, dy)), _mm_mul_ps(ocz, dz));
+            __m128 oc2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz));
+            __m128 c = _mm_sub_ps(oc2, r2);
+
+            __m128 bb = _mm_mul_ps(b, b);
+            __m128 disc = _mm_sub_ps(bb, _mm_mul_ps(a, c));
+            __m128 tol = _mm_mul_ps(_mm_set1_ps(DISCRIMINANT_TOLERANCE), _mm_add_ps(bb, _mm_mul_ps(a, _mm_add_ps(oc2, r2))));
+            __m128 sq = _mm_sqrt_ps(_mm_max_ps(disc, _mm_setzero_ps()));
+            __m128 slack = _mm_mul_ps(_mm_set1_ps(ROOT_TOLERANCE), _mm_add_ps(_mm_and_ps(b, abs_mask), sq));
+
+            __m128 hit = _mm_cmpge_ps(disc, _mm_sub_ps(_mm_setzero_ps(), tol));
+            hit = _mm_and_ps(hit, _mm_cmpge_ps(_mm_sub_ps(sq, b), _mm_sub_ps(_mm_setzero_ps(), slack)));
+            hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_sub_ps(_mm_sub_ps(_mm_setzero_ps(), b), sq), _mm_add_ps(far, slack)));
+            mask |= (uint32_t) _mm_movemask_ps(hit) << lane;
+        }
+        return mask;
+    }
+
+    PBR_TARGET_AVX2
+    static uint32_t kernel_avx2(const SpherePack& pack, const PackedRay& ray, uint32_t first, float tmax)
+    {
+        static_assert(SpherePack::WIDTH == 8, "The AVX2 kernel tests exactly one batch of 8 lanes");
+
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 a = _mm256_set1_ps(ray.a);
+        const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+
+        __m256 r2 = _mm256_loadu_ps(&pack.r2[first]);
+        __m256 ocx = _mm256_sub_ps(_mm256_set1_ps(ray.ox), _mm256_loadu_ps(&pack.cx[first]));
+        __m256 ocy = _mm256_sub_ps(_mm256_set1_ps(ray.oy), _mm256_loadu_ps(&pack.cy[first]));
+        __m256 ocz = _mm256_sub_ps(_mm256_set1_ps(ray.oz), _mm256_loadu_ps(&pack.cz[first]));
+
+        __m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, _mm256_set1_ps(ray.dx)),
+                                               _mm256_mul_ps(ocy, _mm256_set1_ps(ray.dy))),
+                                 _mm256_mul_ps(ocz, _mm256_set1_ps(ray.dz)));
+        __m256 oc2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)), _mm256_mul_ps(ocz, ocz));
+        __m256 c = _mm256_sub_ps(oc2, r2);
+
+        __m256 bb = _mm256_mul_ps(b, b);
+        __m256 disc = _mm256_sub_ps(bb, _mm256_mul_ps(a, c));
+        __m256 tol = _mm256_mul_ps(_mm256_set1_ps(DISCRIMINANT_TOLERANCE), _mm256_add_ps(bb, _mm256_mul_ps(a, _mm256_add_ps(oc2, r2))));
+        __m256 sq = _mm256_sqrt_ps(_mm256_max_ps(disc, zero));
+        __m256 slack = _mm256_mul_ps(_mm256_set1_ps(ROOT_TOLERANCE), _mm256_add_ps(_mm256_and_ps(b, abs_mask), sq));
+
+        __m256 hit = _mm256_cmp_ps(disc, _mm256_sub_ps(zero, tol), _CMP_GE_OQ);
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_sub_ps(sq, b), _mm256_sub_ps(zero, slack), _CMP_GE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_sub_ps(_mm256_sub_ps(zero, b), sq),
+                                               _mm256_add_ps(_mm256_set1_ps(ray.a * tmax), slack), _CMP_LE_OQ));
+        return _mm256_movemask_ps(hit);
+    }
+#endif
+
+    struct KernelChoice
+    {
+        Kernel kernel;
+        const char* name;
+    };
+
+    static KernelChoice choose_kernel()
+    {
+#if PBR_SIMD_X86
+        if (simd::has_avx2()) return { kernel_avx2, "avx2" };
+        if (simd::has_sse4()) return { kernel_sse4, "sse4" };
+#endif
+        return { kernel_scalar, "scalar" };
+    }
+
+    static const KernelChoice KERNEL = choose_kernel();
+
+    uint32_t SpherePack::intersect(const PackedRay& ray, uint32_t first, float tmax) const
+    {
+        uint32_t mask = KERNEL.kernel(*this, ray, first, tmax);
+
+        // Drop the padding lanes
+        if (first + WIDTH > size) mask &= (1u << (size - first)) - 1;
+        return mask;
+    }
+
+    const char* SpherePack::kernel_name()
+    {
+        return KERNEL.name;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+    // TESTS
+    ///////////////////////////////////////////////////////////////////////////////
+
+    TEST_CASE("accel::SpherePack::kernels_are_conservative")
+    {
+        std::mt19937 gen(3);
+        std::uniform_real_distribution<> dist(-1.0, 1.0);
+
+        auto material = std::make_shared<Material>(PBR_COLOR_WHITE, PBR_COLOR_BLACK, new DiffuseBRDF);
+        Scene scene;
+        for (int i = 0; i < 21; ++i)
+        {
+            Vec center { dist(gen) * 5, dist(gen) * 5, dist(gen) * 5 };
+            scene.push_back(Actor { material, SphereGeometry { center, 0.5 + dist(gen) * 0.4 } });
+        }
+        scene.push_back(Actor { material, QuadGeometry { Vec { 0 }, Vec { 1, 0, 0 }, Vec { 0, 1, 0 } } });
+
+        std::vector<const Actor*> actors;
+        for (const auto& actor : scene) actors.push_back(&actor);
+
+        SpherePack pack;
+        pack.build(actors);
+
+        std::vector<Kernel> kernels = { kernel_scalar };
+#if PBR_SIMD_X86
+        if (simd::has_sse4()) kernels.push_back(kernel_sse4);
+        if (simd::has_avx2()) kernels.push_back(kernel_avx2);
+#endif
+
+        int candidates = 0, false_positives = 0;
+        for (int r = 0; r < 500; ++r)
+        {
+            Ray ray { Vec { dist(gen), dist(gen), dist(gen) } * 8, Vec { dist(gen), dist(gen), dist(gen) } };
+            PackedRay packed(ray);
+
+            for (uint32_t first = 0; first < pack.size; first += SpherePack::WIDTH)
+            {
+                uint32_t expected = 0;
+                for (uint32_t lane = 0; lane < SpherePack::WIDTH && first + lane < pack.size; ++lane)
+                {
+                    HitResult hit;
+                    expected |= (uint32_t) actors[first + lane]->intersect(ray, hit) << lane;
+                }
+
+                uint32_t valid = (first + SpherePack::WIDTH > pack.size) ? (1u << (pack.size - first)) - 1 : 0xFF;
+                for (Kernel kernel : kernels)
+                {
+                    // Every exact hit must be a candidate
+                    uint32_t mask = kernel(pack, packed, first, 1e20f) & valid;
+                    CHECK((expected & ~mask) == 0);
+
+                    for (uint32_t lane = 0; lane < SpherePack::WIDTH; ++lane)
+                    {
+                        bool is_sphere = first + lane < 21;
+                        candidates += is_sphere && (mask >> lane & 1);
+                        false_positives += is_sphere && (mask >> lane & 1) && !(expected >> lane & 1);
+                    }
+                }
+            }
+        }
+
+        // Away from grazing rays the filter should agree with the exact test
+        CHECK(candidates > 0);
+        CHECK(false_positives <= candidates / 100);
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <scene/scene.h>
+
+namespace pbr
+{
+    /** Single precision copy of a ray, shared by all the lanes of a packed test. */
+    struct PackedRay
+    {
+        float ox, oy, oz;
+        float dx, dy, dz;
+
+        /** dot(direction, direction) */
+        float a;
+
+        explicit PackedRay(const Ray& ray)
+            : ox(ray.origin.x), oy(ray.origin.y), oz(ray.origin.z),
+              dx(ray.direction.x), dy(ray.direction.y), dz(ray.direction.z),
+              a(ray.direction.sqlen()) {}
+    };
+
+    /*!
+    * @brief Structure-of-arrays copy of the spheres in a list of actors, for testing one ray against several spheres at once
+    *
+    * Lane i of the pack mirrors actor i of the list it was built from. The packed test runs in single precision
+    * and is conservative: it only rejects lanes that certainly miss, and candidates are confirmed with the
+    * exact double precision test on the actor. Actors that are not spheres always come out as candidates.
+    */
+    struct SpherePack
+    {
+        /** Number of lanes tested by one call to intersect() */
+        static constexpr uint32_t WIDTH = 8;
+
+        /** Number of lanes, the arrays below are padded past it by WIDTH */
+        uint32_t size = 0;
+
+        std::vector<float> cx, cy, cz;
+
+        /** Squared radius, +inf for actors that are not spheres */
+        std::vector<float> r2;
+
+        void build(const std::vector<const Actor*>& actors);
+
+        /*!
+        * @brief Test a ray against lanes [first, first + WIDTH)
+        *
+        * @param ray Ray in single precision
+        * @param first First lane to test
+        * @param tmax Far end of the ray segment
+        * @return uint32_t Bitmask with bit i set if lane first + i may be hit. Lanes past the end are never set.
+        */
+        uint32_t intersect(const PackedRay& ray, uint32_t first, float tmax) const;
+
+        /** Name of the kernel picked at startup for this CPU */
+        static const char* kernel_name();
+    };
+}
@@ -0,0 +1,106 @@
+#include "wide_bvh.h"
+#include "quantized_bvh.h"
+
+#include <algorithm>
+
+namespace pbr
+{
+    template <int N, class Node>
+    void WideBVH<N, Node>::build(const BVH& binary)
+    {
+        nodes.clear();
+        if (binary.empty()) return;
+
+        // Every wide node replaces at least one interior binary node
+        nodes.reserve(binary.nodes.size() / 2 + 1);
+        collapse(binary, 0);
+    }
+
+    template <int N, class Node>
+    uint32_t WideBVH<N, Node>::collapse(const BVH& binary, uint32_t root)
+    {
+        uint32_t node_index = nodes.size();
+        nodes.emplace_back();
+
+        const BVHNode& node = binary.nodes[root];
+        uint32_t children[N];
+        int size = 0;
+        if (node.is_leaf())
+        {
+            children[size++] = root;
+        }
+        else
+        {
+            children[size++] = root + 1;
+            children[size++] = node.offset;
+        }
+
+        // Open up the interior child with the largest surface area until the node is full
+        while (size < N)
+        {
+            int best = -1;
+            double best_area = -1;
+            for (int i = 0; i < size; ++i)
+            {
+                const BVHNode& child = binary.nodes[children[i]];
+                if (!child.is_leaf() && child.bounds.surface_area() > best_area)
+                {
+                    best = i;
+                    best_area = child.bounds.surface_area();
+                }
+            }
+            if (best < 0) break;
+
+            uint32_t opened = children[best];
+            children[best] = opened + 1;
+            children[size++] = binary.nodes[opened].offset;
+        }
+
+        // Keep the children in spatial order along the split axis
+        int axis = node.is_leaf() ? 0 : node.split_axis();
+        std::sort(children, children + size, [&](uint32_t a, uint32_t b) {
+            return axis_of(binary.nodes[a].bounds.centroid(), axis) < axis_of(binary.nodes[b].bounds.centroid(), axis);
+        });
+
+        // Children are collapsed first, `nodes` may grow in the meantime
+        WideBVHNode<N> wide;
+        wide.size = size;
+        for (int i = 0; i < N; ++i)
+        {
+            wide.child[i] = 0;
+            wide.count[i] = 0;
+            for (int a = 0; a < 3; ++a)
+            {
+                wide.lo[a][i] = std::numeric_limits<float>::infinity();
+                wide.hi[a][i] = -std::numeric_limits<float>::infinity();
+            }
+        }
+
+        for (int i = 0; i < size; ++i)
+        {
+            const BVHNode& child = binary.nodes[children[i]];
+            for (int a = 0; a < 3; ++a)
+            {
+                wide.lo[a][i] = std::nextafter((float) axis_of(child.bounds.min, a), -std::numeric_limits<float>::infinity());
+                wide.hi[a][i] = std::nextafter((float) axis_of(child.bounds.max, a), std::numeric_limits<float>::infinity());
+            }
+
+            if (child.is_leaf())
+            {
+                wide.child[i] = child.offset;
+                wide.count[i] = child.count;
+            }
+            else
+            {
+                wide.child[i] = collapse(binary, children[i]);
+            }
+        }
+
+        nodes[node_index] = Node(wide);
+        return node_index;
+    }
+
+    template struct WideBVH<4>;
+    template struct WideBVH<8>;
+    template struct WideBVH<4, QuantizedBVHNode>;
+}
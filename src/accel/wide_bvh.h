@@ -0,0 +1,256 @@
+#pragma once
+
+#include "bvh.h"
+#include <core/simd.h>
+
+#include <cstring>
+#include <limits>
+
+namespace pbr
+{
+    /** Single precision copy of a ray for the box tests of a wide BVH. */
+    struct WideRay
+    {
+        float origin[3];
+        float inv_dir[3];
+
+        /** Whether the direction is negative along each axis, which picks the near and far planes of the boxes */
+        bool neg[3];
+
+        explicit WideRay(const Ray& ray)
+        {
+            double dir[3] = { ray.direction.x, ray.direction.y, ray.direction.z };
+            double org[3] = { ray.origin.x, ray.origin.y, ray.origin.z };
+            for (int a = 0; a < 3; ++a)
+            {
+                // Keep the reciprocal finite, so that no 0 * inf turns into a NaN in the slab test
+                double d = (std::abs(dir[a]) < 1e-20) ? std::copysign(1e-20, dir[a]) : dir[a];
+                origin[a] = (float) org[a];
+                inv_dir[a] = (float) (1 / d);
+                neg[a] = d < 0;
+            }
+        }
+    };
+
+    /*!
+    * @brief A node of a BVH with up to N children, with the child boxes stored by axis so that one slab test covers all of them
+    *
+    * Boxes are rounded outwards to single precision. Unused slots have empty boxes, which no ray overlaps.
+    */
+    template <int N>
+    struct alignas(64) WideBVHNode
+    {
+        /** Child bounds along each axis, lo[axis][child] and hi[axis][child] */
+        alignas(32) float lo[3][N];
+        alignas(32) float hi[3][N];
+
+        /** Index of the child node, or of the first primitive for leaf children */
+        uint32_t child[N];
+
+        /** Number of primitives of leaf children, 0 for interior children and unused slots */
+        uint16_t count[N];
+
+        /** Number of children in use */
+        uint8_t size;
+
+        /** Slack on the far distance, for the rounding of the single precision slab test */
+        static constexpr float ROUNDING = 1.000001f;
+
+        /*!
+        * @brief Slab test of a ray against the boxes of all children at once
+        *
+        * @param ray Ray to test
+        * @param tmax Far end of the ray segment
+        * @param tnear Output entry distance of the ray into each child box
+        * @return uint32_t Bit i is set if the segment [0, tmax] overlaps child i
+        */
+        PBR_FORCE_INLINE uint32_t intersect(const WideRay& ray, float tmax, float tnear[N]) const
+        {
+#if PBR_VECTOR_EXTENSIONS
+            using V = typename simd::Lanes<N>::type;
+            V tn = V {};
+            V tf = V {} + tmax;
+            for (int a = 0; a < 3; ++a)
+            {
+                V near, far;
+                std::memcpy(&near, ray.neg[a] ? hi[a] : lo[a], sizeof(V));
+                std::memcpy(&far, ray.neg[a] ? lo[a] : hi[a], sizeof(V));
+                V t0 = (near - ray.origin[a]) * ray.inv_dir[a];
+                V t1 = (far - ray.origin[a]) * ray.inv_dir[a];
+                tn = (t0 > tn) ? t0 : tn;
+                tf = (t1 < tf) ? t1 : tf;
+            }
+            auto overlap = tn <= tf * ROUNDING;
+            std::memcpy(tnear, &tn, sizeof(V));
+
+            uint32_t mask = 0;
+            for (int i = 0; i < N; ++i)
+            {
+                mask |= (overlap[i] ? 1u : 0u) << i;
+            }
+            return mask;
+#else
+            uint32_t mask = 0;
+            for (int i = 0; i < N; ++i)
+            {
+                float tn = 0;
+                float tf = tmax;
+                for (int a = 0; a < 3; ++a)
+                {
+                    float t0 = ((ray.neg[a] ? hi[a][i] : lo[a][i]) - ray.origin[a]) * ray.inv_dir[a];
+                    float t1 = ((ray.neg[a] ? lo[a][i] : hi[a][i]) - ray.origin[a]) * ray.inv_dir[a];
+                    tn = std::max(t0, tn);
+                    tf = std::min(t1, tf);
+                }
+                tnear[i] = tn;
+                mask |= (tn <= tf * ROUNDING ? 1u : 0u) << i;
+            }
+            return mask;
+#endif
+        }
+    };
+
+    /*!
+    * @brief BVH with up to N children per node, collapsed from a binary BVH
+    *
+    * Leaves are those of the binary hierarchy, so primitive ranges refer to the same `indices`.
+    * Traversal visits the children that a ray overlaps front to back, by the distance at which it enters their boxes.
+    *
+    * Nodes other than WideBVHNode, such as QuantizedBVHNode, are converted from one and have the same members
+    * `size`, `child` and `count` and the same intersect().
+    */
+    template <int N, class Node = WideBVHNode<N>>
+    struct WideBVH
+    {
+        static_assert(N >= 2 && N <= 16, "Child masks are 16 bits wide");
+
+        std::vector<Node> nodes;
+
+        /** Collapse a built binary hierarchy. Its leaf ranges stay valid for this one. */
+        void build(const BVH& binary);
+
+        inline bool empty() const { return nodes.empty(); }
+
+        inline size_t memory_bytes() const
+        {
+            return nodes.size() * sizeof(Node);
+        }
+
+        /*!
+        * @brief Find the closest leaf hits along a ray
+        *
+        * @param ray Ray to traverse the hierarchy with
+        * @param tmax Closest hit so far, shrunk by the leaf callback as hits are found
+        * @param leaf Callback with signature bool(uint32_t first, uint32_t count, double& tmax), as for BVH::intersect
+        * @return bool Indicates if any leaf callback reported a hit
+        */
+        template <class LeafFn>
+        PBR_FORCE_INLINE bool intersect(const Ray& ray, double& tmax, LeafFn&& leaf) const
+        {
+            if (nodes.empty()) return false;
+
+            struct Entry
+            {
+                uint32_t index;
+                uint32_t count;
+                float tnear;
+            };
+
+            WideRay wide_ray(ray);
+            Entry stack[PBR_BVH_MAX_DEPTH * N];
+            int top = 0;
+            stack[top++] = { 0, 0, 0.0f };
+
+            uint32_t visited = 0;
+            bool hit = false;
+
+            while (top > 0)
+            {
+                Entry entry = stack[--top];
+                // The slack also covers rounding tmax to single precision
+                float ftmax = (float) tmax * Node::ROUNDING;
+
+                // Skip what lies behind a hit that was found after it was pushed
+                if (entry.tnear > ftmax) continue;
+
+                if (entry.count > 0)
+                {
+                    hit |= leaf(entry.index, entry.count, tmax);
+                    continue;
+                }
+
+                const Node& node = nodes[entry.index];
+                ++visited;
+
+                float tnear[N];
+                uint32_t mask = node.intersect(wide_ray, ftmax, tnear);
+
+                // Push far to near by entry distance, so that the nearest child is popped first
+                int pushed = top;
+                for (int i = 0; i < node.size; ++i)
+                {
+                    if (!(mask & (1u << i))) continue;
+
+                    Entry child = { node.child[i], node.count[i], tnear[i] };
+                    int j = top++;
+                    for (; j > pushed && stack[j - 1].tnear < child.tnear; --j)
+                    {
+                        stack[j] = stack[j - 1];
+                    }
+                    stack[j] = child;
+                }
+            }
+
+            PBR_STAT_ADD(NODES_VISITED, visited);
+            return hit;
+        }
+
+        /*!
+        * @brief Find whether any leaf reports a hit along a ray, stopping at the first one
+        *
+        * @param ray Ray to traverse the hierarchy with
+        * @param tmax Far end of the ray segment
+        * @param leaf Callback with signature bool(uint32_t first, uint32_t count), as for BVH::occluded
+        * @return bool Indicates if any leaf callback reported a hit
+        */
+        template <class LeafFn>
+        PBR_FORCE_INLINE bool occluded(const Ray& ray, double tmax, LeafFn&& leaf) const
+        {
+            if (nodes.empty()) return false;
+
+            WideRay wide_ray(ray);
+            float ftmax = (float) tmax * Node::ROUNDING;
+
+            uint32_t stack[PBR_BVH_MAX_DEPTH * N];
+            int top = 0;
+            stack[top++] = 0;
+
+            uint32_t visited = 0;
+            bool hit = false;
+
+            while (top > 0 && !hit)
+            {
+                const Node& node = nodes[stack[--top]];
+                ++visited;
+
+                float tnear[N];
+                uint32_t mask = node.intersect(wide_ray, ftmax, tnear);
+
+                // Leaves are tested right away, any hit ends the query
+                for (int i = 0; i < node.size && !hit; ++i)
+                {
+                    if (!(mask & (1u << i))) continue;
+
+                    if (node.count[i] > 0) hit = leaf(node.child[i], node.count[i]);
+                    else stack[top++] = node.child[i];
+                }
+            }
+
+            PBR_STAT_ADD(OCCLUSION_NODES_VISITED, visited);
+            return hit;
+        }
+
+    private:
+        uint32_t collapse(const BVH& binary, uint32_t root);
+    };
+}
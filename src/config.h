@@ -3,12 +3,41 @@
 ///////////////////////////////////////////////////////////////////////////////
 // Renderer
 
-#define PBR_MAX_RECURSION_DEPTH 4
+// Bounces after which a path is cut off. Russian roulette ends nearly all paths well before
+#define PBR_MAX_PATH_DEPTH 64
+
+// Bounces before Russian roulette starts to end paths, with a chance that falls with their throughput
+#define PBR_RUSSIAN_ROULETTE_DEPTH 3
+
+// How paths find emitters, see LightStrategy
+#define PBR_LIGHT_STRATEGY LightStrategy::MIS
+
+// How light sampling picks an emitter, EmitterSelection::UNIFORM, POWER or LIGHT_BVH
+#define PBR_EMITTER_SELECTION EmitterSelection::LIGHT_BVH
 #define PBR_SAMPLES_PER_PIXEL 64
 
 #define PBR_STRATIFIED_SAMPLE 1
 #define PBR_DEBUG_LEVEL 1
 
+// Count rays and visited nodes for the stats printed after a render. Off by default, since the counters sit in every
+// traversal loop. The benchmarks and debug builds turn it on
+#ifndef PBR_COLLECT_STATS
+    #define PBR_COLLECT_STATS 0
+#endif
+
+// Camera rays of a pixel traced together, up to 16. 1 traces them one at a time
+#define PBR_PACKET_SIZE 8
+
+// Trace all the samples of an image row together, one bounce at a time, in streams of this many rays. 0 traces each path on its own
+#define PBR_RAY_STREAM_SIZE 0
+
+// Samples per pixel of each preview pass, rendered with a linear scan of the scene while the acceleration structure of
+// a new scene builds in the background. The samples count towards the final image. 0 builds first, then renders
+#define PBR_PREVIEW_SAMPLES 1
+
+// Threads that render the preview, the build gets the rest
+#define PBR_PREVIEW_THREADS 1
+
 ///////////////////////////////////////////////////////////////////////////////
 // Scene and camera
 
@@ -18,6 +47,53 @@
 #define PBR_CAMERA_POSITION Vec { 0, 2.5, 6 }
 #define PBR_CAMERA_FOV_DEG  45
 
+///////////////////////////////////////////////////////////////////////////////
+// Acceleration
+
+// LinearAccelerator, BVHAccelerator, BVH4Accelerator, BVH8Accelerator, QuantizedBVH4Accelerator, DenseGridAccelerator or HashedGridAccelerator
+#define PBR_ACTIVE_ACCELERATOR_CLASS BVHAccelerator
+#define PBR_USE_SIMD 1
+
+// BVHBuildMethod::BINNED, FULL_SWEEP, MORTON, MORTON_TREELETS or SPATIAL
+#define PBR_BVH_BUILD_METHOD      BVHBuildMethod::BINNED
+#define PBR_BVH_BINS              32
+#define PBR_BVH_MAX_LEAF_SIZE     8
+#define PBR_BVH_MAX_DEPTH         64
+#define PBR_BVH_TRAVERSAL_COST    1.0
+#define PBR_BVH_INTERSECTION_COST 1.0
+
+// Treelet restructuring of BVHBuildMethod::MORTON_TREELETS: leaves per treelet, at most 8, and passes over the tree
+#define PBR_BVH_TREELET_LEAVES 7
+#define PBR_BVH_TREELET_ROUNDS 1
+
+// Spatial splits of BVHBuildMethod::SPATIAL: extra references that cut primitives may add, as a fraction of the primitive
+// count, and how much the children of the best object split must overlap, relative to the root area, before cuts are tried
+#define PBR_BVH_SPATIAL_MAX_DUPLICATION 0.5
+#define PBR_BVH_SPATIAL_ALPHA           1e-5
+
+// Node order of built hierarchies, BVHLayout::DEPTH_FIRST or HOT_CHILD_FIRST, and whether traversal prefetches the far child
+#define PBR_BVH_LAYOUT   BVHLayout::HOT_CHILD_FIRST
+#define PBR_BVH_PREFETCH 1
+
+// Build method of the hierarchy inside each triangle mesh, unless one is given when the mesh is loaded, and whether
+// loaded meshes leave the build to the first ray that enters their bounds, for a faster first frame
+#define PBR_MESH_BVH_BUILD_METHOD BVHBuildMethod::BINNED
+#define PBR_MESH_LAZY_BUILD       1
+
+// Refit hierarchies are built again once moving actors make their SAH cost this many times the cost right after the build.
+// Those builds use the fast Morton builder by default, so that they do not stand out as slow frames.
+#define PBR_BVH_REFIT_REBUILD_RATIO  1.5
+#define PBR_BVH_REFIT_REBUILD_METHOD BVHBuildMethod::MORTON
+
+// Uniform grids: cells per primitive, over the whole bounds for dense grids and over the occupied part for hashed
+// ones, bits of the occupancy filter of hashed grids per occupied cell, and the most cells along any axis
+#define PBR_GRID_DENSITY        2.0
+#define PBR_GRID_FILTER_BITS    8
+#define PBR_GRID_MAX_RESOLUTION 4096
+
+// Built hierarchies are kept here and mapped on later runs, empty to always rebuild
+#define PBR_BVH_CACHE_DIRECTORY "bvh_cache"
+
 ///////////////////////////////////////////////////////////////////////////////
 // Preset colors
 
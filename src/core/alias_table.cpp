@@ -0,0 +1,139 @@
+#include "alias_table.h"
+#include "base.h"
+
+#include <cmath>
+#include <stdexcept>
+
+namespace pbr
+{
+    void AliasTable::build(const std::vector<double>& weights)
+    {
+        double total = 0;
+        for (double w : weights)
+        {
+            if (!(w >= 0) || !std::isfinite(w)) throw std::invalid_argument("Alias table weights must be finite and non-negative");
+            total += w;
+        }
+        if (!weights.empty() && total <= 0) throw std::invalid_argument("Alias table weights are all zero");
+
+        size_t n = weights.size();
+        _bins.assign(n, Bin { 1, 0, 0 });
+
+        // Weights scaled so that a bin holds 1, split into the bins that have room to spare and those that overflow
+        std::vector<double> scaled(n);
+        std::vector<uint32_t> under, over;
+        uint32_t heaviest = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (weights[i] > weights[heaviest]) heaviest = (uint32_t) i;
+            _bins[i].pdf = weights[i] / total;
+            _bins[i].alias = (uint32_t) i;
+            scaled[i] = _bins[i].pdf * n;
+            (scaled[i] < 1 ? under : over).push_back((uint32_t) i);
+        }
+
+        // Fill each bin with room to spare from one that overflows, which may then have room to spare itself
+        while (!under.empty() && !over.empty())
+        {
+            uint32_t small = under.back();
+            under.pop_back();
+            uint32_t large = over.back();
+
+            _bins[small].threshold = scaled[small];
+            _bins[small].alias = large;
+            scaled[large] -= 1 - scaled[small];
+            if (scaled[large] < 1)
+            {
+                over.pop_back();
+                under.push_back(large);
+            }
+        }
+
+        // Whatever is left is full up to rounding. Rounding can also leave a bin of zero weight here, which must still
+        // never pick its own index, so it hands all of itself to one that can be picked.
+        for (uint32_t i : under)
+        {
+            _bins[i].threshold = (weights[i] > 0) ? 1 : 0;
+            if (weights[i] == 0) _bins[i].alias = heaviest;
+        }
+        for (uint32_t i : over) _bins[i].threshold = 1;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+    // TESTS
+    ///////////////////////////////////////////////////////////////////////////////
+
+    TEST_CASE("core::AliasTable::sample")
+    {
+        std::vector<double> weights { 1, 0, 7, 2, 0.5, 20, 0, 3, 0.01, 4 };
+        double total = 0;
+        for (double w : weights) total += w;
+
+        AliasTable table;
+        table.build(weights);
+        REQUIRE(table.size() == weights.size());
+        for (uint32_t i = 0; i < weights.size(); ++i) CHECK(table.pdf(i) == doctest::Approx(weights[i] / total));
+
+        // Chi-square test of the counts against the weights, with 7 degrees of freedom for the 8 indices that can be
+        // picked. The 0.1% critical value is 24.3.
+        std::mt19937 gen(1);
+        std::uniform_real_distribution<> uniform;
+        const int samples = 1000000;
+        std::vector<int> counts(weights.size(), 0);
+        for (int s = 0; s < samples; ++s) ++counts[table.sample(uniform(gen))];
+
+        double chi2 = 0;
+        for (uint32_t i = 0; i < weights.size(); ++i)
+        {
+            double expected = samples * weights[i] / total;
+            if (weights[i] == 0)
+            {
+                CHECK(counts[i] == 0);
+                continue;
+            }
+            chi2 += (counts[i] - expected) * (counts[i] - expected) / expected;
+        }
+        CHECK(chi2 < 24.3);
+
+        // The ends of [0, 1) stay in range
+        CHECK(table.sample(0) < weights.size());
+        CHECK(table.sample(std::nextafter(1.0, 0.0)) < weights.size());
+    }
+
+    TEST_CASE("core::AliasTable::build")
+    {
+        AliasTable table;
+        table.build({ 5 });
+        CHECK(table.sample(0.3) == 0);
+        CHECK(table.pdf(0) == 1);
+
+        // Equal weights keep every bin to itself
+        table.build({ 2, 2, 2, 2 });
+        for (uint32_t i = 0; i < 4; ++i) CHECK(table.sample((i + 0.5) / 4) == i);
+
+        table.build({});
+        CHECK(table.empty());
+
+        // Neither end of the bin of a zero weight picks it, whatever rounding left over
+        std::mt19937 gen(2);
+        std::uniform_real_distribution<> uniform;
+        for (int trial = 0; trial < 1000; ++trial)
+        {
+            std::vector<double> weights(2 + trial % 30);
+            for (double& w : weights) w = (uniform(gen) < 0.4) ? 0 : uniform(gen);
+            weights.back() = 0.1;
+            table.build(weights);
+            for (uint32_t i = 0; i < weights.size(); ++i)
+            {
+                double lo = (double) i / weights.size();
+                double hi = std::nextafter((double) (i + 1) / weights.size(), 0.0);
+                CHECK(weights[table.sample(lo)] > 0);
+                CHECK(weights[table.sample(hi)] > 0);
+            }
+        }
+
+        CHECK_THROWS_AS(table.build({ 1, -1 }), std::invalid_argument);
+        CHECK_THROWS_AS(table.build({ 0, 0 }), std::invalid_argument);
+        CHECK_THROWS_AS(table.build({ 1, std::nan("") }), std::invalid_argument);
+    }
+}
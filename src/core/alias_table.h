@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace pbr
+{
+    /*!
+    * @brief Picks an index with a chance in proportion to its weight, in constant time
+    *
+    * Walker's alias method, built with Vose's algorithm ("A Linear Algorithm For Generating Random Numbers With a
+    * Given Distribution", 1991). Every index owns an equal bin of [0, 1). A bin keeps the share `threshold` of itself
+    * for its own index and hands the rest to a single `alias`, so one uniform number and one table read pick an index.
+    */
+    class AliasTable
+    {
+    public:
+        /** Build over non-negative weights. Indices with zero weight are never picked. Throws std::invalid_argument
+         *  if a weight is negative or not finite, or if they are all zero. */
+        void build(const std::vector<double>& weights);
+
+        bool empty() const { return _bins.empty(); }
+        size_t size() const { return _bins.size(); }
+
+        /*!
+        * @brief Pick an index
+        *
+        * @param u Uniform number in [0, 1)
+        * @return uint32_t Index picked with chance pdf()
+        */
+        uint32_t sample(double u) const
+        {
+            double scaled = u * _bins.size();
+            size_t i = (size_t) scaled;
+            if (i >= _bins.size()) i = _bins.size() - 1;
+            const Bin& bin = _bins[i];
+            return (scaled - i < bin.threshold) ? (uint32_t) i : bin.alias;
+        }
+
+        /** Chance that sample() picks the index, its weight over the sum of the weights */
+        double pdf(uint32_t index) const { return _bins[index].pdf; }
+
+        size_t memory_bytes() const { return _bins.size() * sizeof(Bin); }
+
+    private:
+        struct Bin
+        {
+            /** Share of the bin that picks its own index */
+            double threshold;
+
+            /** Chance of picking the index of the bin */
+            double pdf;
+
+            /** Index picked by the rest of the bin */
+            uint32_t alias;
+        };
+
+        std::vector<Bin> _bins;
+    };
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+namespace pbr
+{
+    /*!
+    * @brief Contiguous array that either owns its elements or views elements owned by something else
+    *
+    * A view lets large read-only data, such as a memory-mapped file, be used in place without a copy.
+    * Reads work the same way for both. Writes go through mutable_data(), which first copies a view into owned storage.
+    */
+    template <class T>
+    class Buffer
+    {
+    public:
+        Buffer() = default;
+
+        Buffer(const Buffer& other) { *this = other; }
+
+        Buffer(Buffer&& other) noexcept { *this = std::move(other); }
+
+        Buffer& operator=(const Buffer& other)
+        {
+            _owned = other._owned;
+            _owner = other._owner;
+            if (_owner) set(other._data, other._size);
+            else sync();
+            return *this;
+        }
+
+        Buffer& operator=(Buffer&& other) noexcept
+        {
+            _owned = std::move(other._owned);
+            _owner = std::move(other._owner);
+            if (_owner) set(other._data, other._size);
+            else sync();
+            other.sync();
+            return *this;
+        }
+
+        /*!
+        * @brief Use elements owned elsewhere, dropping the current contents
+        *
+        * @param data First element
+        * @param size Number of elements
+        * @param owner Keeps the elements alive for as long as this buffer, or any copy of it, views them
+        */
+        void view(const T* data, size_t size, std::shared_ptr<const void> owner)
+        {
+            _owned = std::vector<T>();
+            _owner = std::move(owner);
+            set(data, size);
+        }
+
+        /** Take over the elements of a vector. */
+        void assign(std::vector<T>&& elements)
+        {
+            _owner.reset();
+            _owned = std::move(elements);
+            sync();
+        }
+
+        inline bool is_view() const { return _owner != nullptr; }
+
+        inline size_t size() const { return _size; }
+        inline bool empty() const { return _size == 0; }
+
+        inline const T* data() const { return _data; }
+        inline const T& operator[](size_t i) const { return _data[i]; }
+        inline const T& front() const { return _data[0]; }
+        inline const T* begin() const { return _data; }
+        inline const T* end() const { return _data + _size; }
+
+        /** Writable elements. Copies a view first, so plain reads go through the const accessors above instead. */
+        inline T* mutable_data() { detach(); return _owned.data(); }
+
+        void clear() { _owner.reset(); _owned.clear(); sync(); }
+        void shrink_to_fit() { detach(); _owned.shrink_to_fit(); sync(); }
+        void reserve(size_t n) { detach(); _owned.reserve(n); sync(); }
+        void resize(size_t n) { detach(); _owned.resize(n); sync(); }
+
+        template <class... Args>
+        T& emplace_back(Args&&... args)
+        {
+            detach();
+            T& element = _owned.emplace_back(std::forward<Args>(args)...);
+            sync();
+            return element;
+        }
+
+    private:
+        std::vector<T> _owned;
+        std::shared_ptr<const void> _owner;
+
+        // Where reads go, either into `_owned` or into the viewed elements
+        const T* _data = nullptr;
+        size_t _size = 0;
+
+        inline void set(const T* data, size_t size)
+        {
+            _data = data;
+            _size = size;
+        }
+
+        inline void sync()
+        {
+            set(_owned.data(), _owned.size());
+        }
+
+        /** Copy viewed elements into owned storage before they are changed */
+        inline void detach()
+        {
+            if (!_owner) return;
+            _owned.assign(_data, _data + _size);
+            _owner.reset();
+            sync();
+        }
+    };
+}
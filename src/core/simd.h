@@ -0,0 +1,62 @@
+#pragma once
+
+#include <config.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// SIMD support. Kernels are compiled for each instruction set with target
+// attributes and picked at runtime, so the binary still runs on older CPUs.
+///////////////////////////////////////////////////////////////////////////////
+
+#if PBR_USE_SIMD && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define PBR_SIMD_X86 1
+    #include <immintrin.h>
+
+    #define PBR_TARGET_SSE4 __attribute__((target("sse4.1")))
+    #define PBR_TARGET_AVX2 __attribute__((target("avx2")))
+
+    // Compile the function for AVX2 and for the baseline, the loader picks one for the CPU
+    #define PBR_TARGET_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+    #define PBR_SIMD_X86 0
+    #define PBR_TARGET_CLONES
+#endif
+
+#if defined(__GNUC__)
+    #define PBR_VECTOR_EXTENSIONS 1
+
+    // Inlined into the caller even across target attributes, so that kernels pick up the instruction set of the caller
+    #define PBR_FORCE_INLINE inline __attribute__((always_inline))
+#else
+    #define PBR_VECTOR_EXTENSIONS 0
+    #define PBR_FORCE_INLINE inline
+#endif
+
+namespace pbr::simd
+{
+#if PBR_VECTOR_EXTENSIONS
+    /** N values as one GCC vector value. Arithmetic and comparisons apply per lane, in whatever registers the target has. */
+    template <int N, class T = float>
+    struct Lanes
+    {
+        typedef T type __attribute__((vector_size(sizeof(T) * N)));
+    };
+#endif
+
+    inline bool has_sse4()
+    {
+#if PBR_SIMD_X86
+        return __builtin_cpu_supports("sse4.1");
+#else
+        return false;
+#endif
+    }
+
+    inline bool has_avx2()
+    {
+#if PBR_SIMD_X86
+        return __builtin_cpu_supports("avx2");
+#else
+        return false;
+#endif
+    }
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "math_definitions.h"
+
+namespace pbr
+{
+    /** Affine transform, stored as a row-major 3x4 matrix whose last column is the translation. */
+    struct Transform
+    {
+        double m[3][4] = {
+            { 1, 0, 0, 0 },
+            { 0, 1, 0, 0 },
+            { 0, 0, 1, 0 },
+        };
+
+        static Transform translate(const Vec& offset)
+        {
+            Transform t;
+            t.m[0][3] = offset.x;
+            t.m[1][3] = offset.y;
+            t.m[2][3] = offset.z;
+            return t;
+        }
+
+        static Transform scale(const Vec& factor)
+        {
+            Transform t;
+            t.m[0][0] = factor.x;
+            t.m[1][1] = factor.y;
+            t.m[2][2] = factor.z;
+            return t;
+        }
+
+        /** Rotation by `degrees` counter-clockwise about `axis`. */
+        static Transform rotate(const Vec& axis, double degrees)
+        {
+            Vec a = normalize(axis);
+            double theta = PBR_DEG_TO_RAD(degrees);
+            double c = std::cos(theta), s = std::sin(theta), k = 1 - c;
+
+            Transform t;
+            t.m[0][0] = a.x * a.x * k + c;       t.m[0][1] = a.x * a.y * k - a.z * s; t.m[0][2] = a.x * a.z * k + a.y * s;
+            t.m[1][0] = a.y * a.x * k + a.z * s; t.m[1][1] = a.y * a.y * k + c;       t.m[1][2] = a.y * a.z * k - a.x * s;
+            t.m[2][0] = a.z * a.x * k - a.y * s; t.m[2][1] = a.z * a.y * k + a.x * s; t.m[2][2] = a.z * a.z * k + c;
+            return t;
+        }
+
+        /** Composition, the result applies `other` first and then this transform. */
+        Transform operator*(const Transform& other) const
+        {
+            Transform r;
+            for (int i = 0; i < 3; ++i)
+            {
+                for (int j = 0; j < 4; ++j)
+                {
+                    r.m[i][j] = m[i][0] * other.m[0][j] + m[i][1] * other.m[1][j] + m[i][2] * other.m[2][j];
+                }
+                r.m[i][3] += m[i][3];
+            }
+            return r;
+        }
+
+        Transform inverse() const
+        {
+            // Invert the linear part with cofactors, then undo the translation
+            double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+                       - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+                       + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+            double inv_det = 1 / det;
+
+            Transform r;
+            r.m[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * inv_det;
+            r.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv_det;
+            r.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+            r.m[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * inv_det;
+            r.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+            r.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv_det;
+            r.m[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * inv_det;
+            r.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv_det;
+            r.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+
+            Vec t = r.vector({ m[0][3], m[1][3], m[2][3] });
+            r.m[0][3] = -t.x;
+            r.m[1][3] = -t.y;
+            r.m[2][3] = -t.z;
+            return r;
+        }
+
+        inline Point point(const Point& p) const
+        {
+            return vector(p) + Vec { m[0][3], m[1][3], m[2][3] };
+        }
+
+        inline Vec vector(const Vec& v) const
+        {
+            return {
+                m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+                m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+                m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z
+            };
+        }
+
+        /** Multiply by the transpose of the linear part. Normals go from object to world space this way with the world-to-object transform. */
+        inline Vec transpose_vector(const Vec& v) const
+        {
+            return {
+                m[0][0] * v.x + m[1][0] * v.y + m[2][0] * v.z,
+                m[0][1] * v.x + m[1][1] * v.y + m[2][1] * v.z,
+                m[0][2] * v.x + m[1][2] * v.y + m[2][2] * v.z
+            };
+        }
+
+        /** Transform a ray. The ray parameter t of any point is the same in both spaces. */
+        inline Ray ray(const Ray& r) const
+        {
+            return { point(r.origin), vector(r.direction) };
+        }
+    };
+
+    ///////////////////////////////////////////////////////////////////////////////
+    // TESTS
+    ///////////////////////////////////////////////////////////////////////////////
+
+    TEST_CASE("math::Transform::inverse")
+    {
+        Transform t = Transform::translate({ 1, 2, 3 }) * Transform::rotate({ 0, 1, 1 }, 30) * Transform::scale({ 2, 1, 0.5 });
+        Transform inv = t.inverse();
+
+        Point p { 0.3, -1.2, 4.0 };
+        Point q = inv.point(t.point(p));
+        CHECK(q.x == doctest::Approx(p.x));
+        CHECK(q.y == doctest::Approx(p.y));
+        CHECK(q.z == doctest::Approx(p.z));
+
+        Vec r = Transform::rotate({ 0, 0, 1 }, 90).vector({ 1, 0, 0 });
+        CHECK(r.x == doctest::Approx(0));
+        CHECK(r.y == doctest::Approx(1));
+    }
+}
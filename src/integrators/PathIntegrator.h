@@ -1,62 +1,367 @@
 #pragma once
 
 #include <scene/scene.h>
+#include <scene/emitters.h>
+#include <accel/accelerator.h>
 #include <config.h>
+#include <debug.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#ifdef _OPENMP
+    #include <omp.h>
+#endif
 
 namespace pbr
 {
+    /** How paths find the light of emitters */
+    enum class LightStrategy
+    {
+        /** Only when a bounce sampled from the BRDF happens to hit one */
+        BRDF,
+
+        /** Also by sampling a direction towards an emitter at every bounce that is not off a mirror, with a shadow ray
+         *  to check that nothing blocks it. Light from the emitters that the EmitterList samples is then only counted
+         *  this way, and ignored where a bounce hits them. */
+        EMITTERS,
+
+        /** Both, with the light that each finds weighed by the power heuristic of the densities of the two (Veach and
+         *  Guibas, "Optimally Combining Sampling Techniques for Monte Carlo Rendering", 1995). Light sampling wins for
+         *  small emitters and BRDF sampling for large or nearby ones, where cone samples mostly land at grazing angles. */
+        MIS,
+    };
+
     struct PathIntegrator
     {
+        LightStrategy light_strategy = PBR_LIGHT_STRATEGY;
+
         void set_scene(const Scene* scene)
         {
+            wait_for_accelerator();
+            p_scene = scene;
+            _emitters.build(*scene);
+            p_accelerator = std::make_unique<PBR_ACTIVE_ACCELERATOR_CLASS>();
+            build_accelerator();
+        }
+
+        /*!
+        * @brief Start building the acceleration structure for a scene on a background thread, and return at once
+        *
+        * Until the build is done, rays are traced with a LinearAccelerator over the scene, which needs no build, so
+        * that a preview can be rendered meanwhile. The switch to the built structure is one atomic store: every query
+        * uses one structure or the other, and they find the same hits.
+        *
+        * @param scene Scene to trace rays against
+        * @param reserved_threads OpenMP threads left out of the build, for the preview
+        */
+        void set_scene_in_background(const Scene* scene, int reserved_threads)
+        {
+            wait_for_accelerator();
             p_scene = scene;
+            _emitters.build(*scene);
+            _linear.build(*scene);
+            p_active.store(&_linear, std::memory_order_release);
+            p_accelerator = std::make_unique<PBR_ACTIVE_ACCELERATOR_CLASS>();
+
+#ifdef _OPENMP
+            int build_threads = std::max(1, omp_get_max_threads() - reserved_threads);
+#else
+            int build_threads = 1;
+#endif
+            _build_thread = std::thread([this, build_threads] {
+#ifdef _OPENMP
+                // Only changes the teams that this thread starts
+                omp_set_num_threads(build_threads);
+#endif
+                (void) build_threads;
+                build_accelerator();
+            });
         }
 
-        // TODO: Convert the following recursive function into an iterative function
+        /** Whether rays are traced with the acceleration structure, rather than the linear fallback of set_scene_in_background() */
+        bool accelerator_ready() const
+        {
+            return p_active.load(std::memory_order_acquire) == p_accelerator.get();
+        }
+
+        /** Block until a build started by set_scene_in_background() is done */
+        void wait_for_accelerator()
+        {
+            if (_build_thread.joinable()) _build_thread.join();
+        }
+
+        ~PathIntegrator()
+        {
+            wait_for_accelerator();
+        }
+
+        /** Bring the acceleration structure up to date after actors of the scene moved in place, see set_sphere() */
+        void update_scene()
+        {
+            auto start = std::chrono::steady_clock::now();
+            bool rebuilt = p_accelerator->update(*p_scene);
+            _emitters.build(*p_scene);
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            LOG_INFO("%s the acceleration structure in %.1f ms", rebuilt ? "Rebuilt" : "Refit", elapsed * 1000);
+        }
+
+        const Scene* scene() const { return p_scene; }
+
+        /** Emitters that light sampling picks from, to choose how it picks them */
+        EmitterList& emitters() { return _emitters; }
+
+        /*!
+        * @brief Radiance arriving along a ray, from a path followed until it leaves the scene, is ended by Russian
+        * roulette, or reaches PBR_MAX_PATH_DEPTH bounces
+        *
+        * @param ray Ray to trace
+        * @param depth Bounces already taken by the path that the ray continues
+        */
         Radiance trace_ray(const Ray& ray, int depth)
         {
-            if (depth >= PBR_MAX_RECURSION_DEPTH) return PBR_COLOR_WHITE;
+            if (depth >= PBR_MAX_PATH_DEPTH) return Radiance {};
 
             HitResult hit;
-            if (intersect_scene(ray, hit))
-            {
-                auto brdf = hit.actor->material->brdf;
-                Ray sampled_ray = brdf->sample(ray, hit);
-                Colorf coeff = brdf->eval(ray, hit, sampled_ray);
-                return hit.actor->material->emission + coeff * trace_ray(sampled_ray, depth + 1);
-            }
+            if (intersect_scene(ray, hit)) return trace_path(ray, hit, depth);
             else return PBR_BACKGROUND_COLOR;
         }
 
-    private:
-        const Scene* p_scene;
+        /*!
+        * @brief Trace a packet of coherent camera rays, such as the samples of one pixel
+        *
+        * The first hits are found for all rays together, and each path goes on alone from its first bounce.
+        *
+        * @param rays Camera rays
+        * @param count Number of rays, at most BaseAccelerator::MAX_PACKET_SIZE
+        * @param out_radiance Radiance along each ray
+        */
+        void trace_packet(const Ray* rays, int count, Radiance* out_radiance)
+        {
+            HitResult hits[BaseAccelerator::MAX_PACKET_SIZE];
+            bool does_hit[BaseAccelerator::MAX_PACKET_SIZE];
+            accelerator().intersect_packet(rays, count, hits, does_hit);
 
-        bool intersect_scene(const Ray& ray, HitResult& out_hit) const
+            for (int i = 0; i < count; ++i)
+            {
+                if (PBR_MAX_PATH_DEPTH <= 0) out_radiance[i] = Radiance {};
+                else if (does_hit[i]) out_radiance[i] = trace_path(rays[i], hits[i], 0);
+                else out_radiance[i] = PBR_BACKGROUND_COLOR;
+            }
+        }
+
+        /*!
+        * @brief Trace a batch of camera rays breadth-first, one bounce of all the paths at a time
+        *
+        * The rays of each bounce point every which way, and are found as streams of `stream_size` rays with
+        * BaseAccelerator::intersect_stream. Each path gets the same radiance as it would from trace_ray().
+        *
+        * @param rays Camera rays
+        * @param stream_size Number of rays handed to the accelerator at once
+        * @param out_radiance Radiance along each ray
+        */
+        void trace_stream(const std::vector<Ray>& rays, size_t stream_size, std::vector<Radiance>& out_radiance)
         {
-            bool does_hit = false;
-            HitResult closest_hit;
-            for (const auto& actor : *p_scene)
+            out_radiance.assign(rays.size(), Radiance {});
+
+            // Weight and last bounce of each path so far, and the path each ray of the bounce belongs to
+            std::vector<Colorf> throughput(rays.size(), PBR_COLOR_WHITE);
+            std::vector<Bounce> last_bounce(rays.size());
+            std::vector<uint32_t> path(rays.size());
+            for (uint32_t i = 0; i < path.size(); ++i) path[i] = i;
+
+            std::vector<Ray> bounce = rays;
+            std::vector<HitResult> hits;
+            std::unique_ptr<bool[]> does_hit;
+            for (int depth = 0; !bounce.empty() && depth < PBR_MAX_PATH_DEPTH; ++depth)
             {
-                HitResult hit;
-                if (actor.intersect(ray, hit))
+                hits.resize(bounce.size());
+                does_hit.reset(new bool[bounce.size()]);
+                for (size_t first = 0; first < bounce.size(); first += stream_size)
                 {
-                    if (does_hit)
-                    {
-                        if (hit.param < closest_hit.param)
-                        {
-                            closest_hit = hit;
-                        }
-                    }
-                    else
+                    size_t count = std::min(stream_size, bounce.size() - first);
+                    accelerator().intersect_stream(&bounce[first], count, &hits[first], &does_hit[first]);
+                }
+
+                // Paths that go on are moved to the front, in the same order
+                size_t next = 0;
+                for (size_t k = 0; k < bounce.size(); ++k)
+                {
+                    uint32_t p = path[k];
+                    if (!does_hit[k])
                     {
-                        closest_hit = hit;
-                        does_hit = true;
+                        out_radiance[p] = out_radiance[p] + throughput[p] * PBR_BACKGROUND_COLOR;
+                        continue;
                     }
+
+                    Ray ray = bounce[k];
+                    if (!scatter(ray, hits[k], depth, throughput[p], out_radiance[p], last_bounce[p])) continue;
+
+                    bounce[next] = ray;
+                    path[next] = p;
+                    ++next;
                 }
+                bounce.resize(next);
+                path.resize(next);
             }
+        }
 
-            out_hit = closest_hit;
-            return does_hit;
+        /** Whether anything blocks the ray before the ray parameter tmax. For shadow and visibility rays, no hit attributes are computed. */
+        bool occluded(const Ray& ray, double tmax) const
+        {
+            return accelerator().occluded(ray, tmax);
+        }
+
+    private:
+        const Scene* p_scene = nullptr;
+        std::unique_ptr<BaseAccelerator> p_accelerator;
+
+        /** Emitters that light sampling picks from */
+        EmitterList _emitters;
+
+        /** Structure that queries go to, `p_accelerator` once it is built, or `_linear` while it builds in the background */
+        std::atomic<const BaseAccelerator*> p_active { nullptr };
+        LinearAccelerator _linear;
+        std::thread _build_thread;
+
+        const BaseAccelerator& accelerator() const
+        {
+            return *p_active.load(std::memory_order_acquire);
+        }
+
+        /** Build `p_accelerator` for `p_scene`, and send queries to it */
+        void build_accelerator()
+        {
+            auto start = std::chrono::steady_clock::now();
+            p_accelerator->build(*p_scene);
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            LOG_INFO("Built the acceleration structure in %.1f ms", elapsed * 1000);
+            p_accelerator->log_build_info();
+            p_active.store(p_accelerator.get(), std::memory_order_release);
+        }
+
+        bool intersect_scene(const Ray& ray, HitResult& out_hit) const
+        {
+            return accelerator().intersect(ray, out_hit);
+        }
+
+        /** trace_ray() for a ray whose first hit is already known */
+        Radiance trace_path(Ray ray, HitResult hit, int depth)
+        {
+            Radiance radiance;
+            Colorf throughput = PBR_COLOR_WHITE;
+            Bounce bounce;
+            while (scatter(ray, hit, depth, throughput, radiance, bounce))
+            {
+                if (++depth >= PBR_MAX_PATH_DEPTH) break;
+                if (!intersect_scene(ray, hit)) return radiance + throughput * PBR_BACKGROUND_COLOR;
+            }
+            return radiance;
+        }
+
+        /** How the ray that reaches a hit was sampled, which decides how much of the light emitted there the path counts */
+        struct Bounce
+        {
+            /** Whether the bounce that sampled the ray sampled the emitters as well */
+            bool lights_sampled = false;
+
+            /** Density per unit solid angle of the ray, as a BRDF sample */
+            double pdf = 0;
+
+            /** Normal of the surface that the ray left */
+            Vec normal;
+        };
+
+        /*!
+        * @brief Take one bounce of a path at a hit
+        *
+        * Adds the light emitted at the hit to `radiance`, in full unless the bounce before also sampled the emitters,
+        * and the light reaching the hit from a sampled emitter. Then samples the BRDF for the next ray of the path and
+        * weighs `throughput` by it. Past PBR_RUSSIAN_ROULETTE_DEPTH bounces the path goes on with a chance of its
+        * largest throughput component, at most 0.95, and survivors are weighted up by its inverse. Paths that carry
+        * little light end early while the image stays unbiased.
+        *
+        * @param ray Ray that found the hit, replaced by the next ray of the path
+        * @param hit Hit to bounce off
+        * @param depth Bounces taken before this one
+        * @param throughput Weight of the path so far
+        * @param radiance Light gathered by the path so far
+        * @param bounce How `ray` was sampled, replaced by how the next ray is
+        * @return bool Indicates if the path goes on
+        */
+        bool scatter(Ray& ray, const HitResult& hit, int depth, Colorf& throughput, Radiance& radiance, Bounce& bounce)
+        {
+            const Material& material = *hit.actor->material;
+            radiance = radiance + throughput * material.emission * emission_weight(ray, hit, bounce);
+
+            bounce.lights_sampled = light_strategy != LightStrategy::BRDF && !material.brdf->is_delta() && !_emitters.empty();
+            if (bounce.lights_sampled) radiance = radiance + throughput * sample_lights(ray, hit);
+
+            Ray sampled_ray = material.brdf->sample(ray, hit);
+            throughput = throughput * material.brdf->eval(ray, hit, sampled_ray);
+            if (bounce.lights_sampled && light_strategy == LightStrategy::MIS)
+            {
+                bounce.pdf = material.brdf->pdf(ray, hit, sampled_ray);
+                bounce.normal = hit.normal;
+            }
+            ray = sampled_ray;
+
+            if (depth + 1 < PBR_RUSSIAN_ROULETTE_DEPTH) return true;
+
+            double survival = std::min(0.95, std::max({ throughput.x, throughput.y, throughput.z }));
+            if (survival <= 0 || sampler().sample() >= survival) return false;
+            throughput = throughput / survival;
+            return true;
+        }
+
+        /** Share of the light emitted at the hit that the path counts, given how the ray that reached it was sampled */
+        double emission_weight(const Ray& ray, const HitResult& hit, const Bounce& bounce) const
+        {
+            if (!bounce.lights_sampled || !_emitters.sampled(hit.actor)) return 1;
+            if (light_strategy != LightStrategy::MIS) return 0;
+
+            // The ray starts at the point that sampled the emitters
+            return power_heuristic(bounce.pdf, _emitters.pdf(ray.origin, bounce.normal, hit.actor));
+        }
+
+        /** Light reflected along the ray at the hit from one direction towards an emitter, with a shadow ray to check that it is visible */
+        Radiance sample_lights(const Ray& ray, const HitResult& hit) const
+        {
+            UniformRNG& rng = sampler();
+            LightSample light;
+            if (!_emitters.sample(hit.point, hit.normal, rng.sample(), rng.sample(), rng.sample(), light)) return Radiance {};
+
+            double cosine = dot(hit.normal, light.direction);
+            if (cosine <= 0) return Radiance {};
+
+            // Stop short of the emitter, which would block the ray itself
+            Ray shadow_ray { hit.point, light.direction };
+            if (occluded(shadow_ray, light.distance * (1 - PBR_EPSILON))) return Radiance {};
+
+            BaseBRDF& brdf = *hit.actor->material->brdf;
+            double weight = 1;
+            if (light_strategy == LightStrategy::MIS) weight = power_heuristic(light.pdf, brdf.pdf(ray, hit, shadow_ray));
+            return light.emission * brdf.f(ray, hit, shadow_ray) * (weight * cosine / light.pdf);
+        }
+
+        /** Weight of a sample with density `f` under one strategy, against density `g` under the other */
+        static double power_heuristic(double f, double g)
+        {
+            double sum = f * f + g * g;
+            return (sum > 0) ? (f * f) / sum : 0;
+        }
+
+        /** Random numbers for light sampling and Russian roulette. The integrator is shared by the render threads, so each has its own. */
+        static UniformRNG& sampler()
+        {
+            thread_local UniformRNG rng;
+            return rng;
         }
     };
 }
@@ -4,7 +4,10 @@
 void entry()
 {
     using namespace pbr;
-    
+
+    // Reuse hierarchies built by earlier runs
+    set_bvh_cache_directory(PBR_BVH_CACHE_DIRECTORY);
+
     // Setup the camera
     Camera camera;
     camera.position = PBR_CAMERA_POSITION;
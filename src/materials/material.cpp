@@ -8,7 +8,10 @@ namespace pbr
     Basis BaseBRDF::get_basis(const HitResult& hit) const
     {
         Vec w = hit.normal;
-        Vec u = normalize(cross(w, Vec { 0, 1, 0 }));
+
+        // Flat surfaces have normals exactly along the y-axis, pick another helper axis for those
+        Vec up = (std::abs(w.y) > 0.999) ? Vec { 1, 0, 0 } : Vec { 0, 1, 0 };
+        Vec u = normalize(cross(w, up));
         Vec v = normalize(cross(u, w));
         return { u, v, w };
     }
@@ -74,6 +77,17 @@ namespace pbr
         return albedo * (A + B);
     }
 
+    Colorf DiffuseBRDF::f(const Ray& in, const HitResult& hit, const Ray& out)
+    {
+        // eval() is f * cos / pdf for the cos / pi of sample()
+        return eval(in, hit, out) / PBR_PI;
+    }
+
+    double DiffuseBRDF::pdf(const Ray& in, const HitResult& hit, const Ray& out)
+    {
+        return std::max(0., dot(hit.normal, out.direction)) / PBR_PI;
+    }
+
     Ray SpecularBRDF::sample(const Ray& in, const HitResult& hit)
     {
         Ray refl;
@@ -86,4 +100,16 @@ namespace pbr
     {
         return PBR_COLOR_WHITE;
     }
+
+    Colorf SpecularBRDF::f(const Ray& in, const HitResult& hit, const Ray& out)
+    {
+        // Zero everywhere but along the reflection
+        return PBR_COLOR_BLACK;
+    }
+
+    double SpecularBRDF::pdf(const Ray& in, const HitResult& hit, const Ray& out)
+    {
+        // Only the reflection itself has any chance, and no other strategy samples it
+        return 0;
+    }
 }
@@ -6,6 +6,8 @@
     struct NAME##BRDF : public BaseBRDF { \
         virtual Ray sample(const Ray& in, const HitResult& hit) override; \
         virtual Colorf eval(const Ray& in, const HitResult& hit, const Ray& out) override; \
+        virtual Colorf f(const Ray& in, const HitResult& hit, const Ray& out) override; \
+        virtual double pdf(const Ray& in, const HitResult& hit, const Ray& out) override; \
     };
 
 namespace pbr
@@ -22,6 +24,15 @@ namespace pbr
         virtual Ray sample(const Ray& in, const HitResult& hit) = 0;
         virtual Colorf eval(const Ray& in, const HitResult& hit, const Ray& out) = 0;
 
+        /** Value of the BRDF for a pair of directions that need not come from sample(), as for light sampling */
+        virtual Colorf f(const Ray& in, const HitResult& hit, const Ray& out) = 0;
+
+        /** Density per unit solid angle with which sample() picks the direction of `out` */
+        virtual double pdf(const Ray& in, const HitResult& hit, const Ray& out) = 0;
+
+        /** Whether sample() picks a single direction, which no other sampling strategy can find, like a mirror */
+        virtual bool is_delta() const { return false; }
+
         virtual ~BaseBRDF() = default;
 
     protected:
@@ -31,7 +42,16 @@ namespace pbr
 
     /*! @brief Lambertian diffuse BRDF (constant) with cos-weighted hemisphere sampling */
     PBR_DECLARE_MATERIAL(Diffuse);
-    PBR_DECLARE_MATERIAL(Specular);
+
+    /*! @brief Perfect mirror */
+    struct SpecularBRDF : public BaseBRDF
+    {
+        virtual Ray sample(const Ray& in, const HitResult& hit) override;
+        virtual Colorf eval(const Ray& in, const HitResult& hit, const Ray& out) override;
+        virtual Colorf f(const Ray& in, const HitResult& hit, const Ray& out) override;
+        virtual double pdf(const Ray& in, const HitResult& hit, const Ray& out) override;
+        virtual bool is_delta() const override { return true; }
+    };
 
     /** Structure that represents the surface material. */
     struct Material
@@ -1,16 +1,29 @@
 #pragma once
 
 #include "config.h"
+#include "stats.h"
 
 #include "core/base.h"
 #include "core/units.h"
 #include "core/math_definitions.h"
+#include "core/transform.h"
+#include "core/simd.h"
+#include "core/alias_table.h"
 
 #include "materials/radiometry.h"
 #include "materials/material.h"
 
 #include "scene/camera.h"
+#include "scene/mesh.h"
 #include "scene/scene.h"
+#include "scene/emitters.h"
+
+#include "accel/aabb.h"
+#include "accel/bvh.h"
+#include "accel/wide_bvh.h"
+#include "accel/sphere_pack.h"
+#include "accel/accelerator.h"
+#include "accel/light_bvh.h"
 
 #include "integrators/PathIntegrator.h"
 
@@ -1,10 +1,14 @@
 #pragma once
 
 #include <stb_image_write.h>
+#include <algorithm>
+#include <vector>
 #include "materials/radiometry.h"
 #include "scene/camera.h"
+#include "accel/accelerator.h"
 #include "config.h"
 #include "debug.h"
+#include "stats.h"
 
 namespace pbr
 {
@@ -42,7 +46,23 @@ namespace pbr
     public:
         void render(const Scene* scene, const Camera& camera, Image& outImage)
         {
-            integrator.set_scene(scene);
+            // Radiance summed over the samples rendered so far, and their number, for every pixel
+            size_t pixels = (size_t) outImage.rows() * PBR_OUTPUT_IMAGE_COLUMNS;
+            std::vector<Colorf> sum(pixels);
+            std::vector<int> done(pixels, 0);
+
+            // Later frames of the same scene only bring the acceleration structure up to date
+            if (integrator.scene() == scene) integrator.update_scene();
+#if PBR_PREVIEW_SAMPLES > 0
+            else
+            {
+                integrator.set_scene_in_background(scene, PBR_PREVIEW_THREADS);
+                preview(camera, outImage, sum, done);
+                integrator.wait_for_accelerator();
+            }
+#else
+            else integrator.set_scene(scene);
+#endif
 
             UniformRNG rng;
 
@@ -54,47 +74,146 @@ namespace pbr
 #endif
             for (int row = 0; row < outImage.rows(); ++row)
             {
-
-                // Iterate over all cols
+#if PBR_RAY_STREAM_SIZE > 0
+                // Every sample of the row that the preview left is traced together, bounce by bounce
+                std::vector<Ray> rays;
+                rays.reserve((size_t) outImage.cols() * PBR_SAMPLES_PER_PIXEL);
                 for (int col = 0; col < outImage.cols(); ++col)
                 {
-                    Colorf color;
-                    for (int i = 0; i < PBR_SAMPLES_PER_PIXEL; ++i)
+                    for (int i = done[row * PBR_OUTPUT_IMAGE_COLUMNS + col]; i < PBR_SAMPLES_PER_PIXEL; ++i)
                     {
-                        auto sample = rng.sample_disk();
-
-#if PBR_STRATIFIED_SAMPLE
-                        // Split the pixel into four quadrants for stratified sampling
-                        // Modulo operations to choose these quadrants
-                        double center_x = (1. / 2.) * ((i % 2) * 2 - 1);
-                        double center_y = (1. / 2.) * (((i % 4) < 2) ? 1 : -1);
-                        double deviation_x = sample.x / 2.;
-                        double deviation_y = sample.y / 2.;
-#else
-                        double center_x = 0;
-                        double center_y = 0;
-                        double deviation_x = sample.x;
-                        double deviation_y = sample.y;
-
-#endif
-
-                        // Normalize (row + deviation, col + deviation) to (x, y) where x and y are between -1 and 1.
-                        double x = ((col + center_x + deviation_x) / PBR_OUTPUT_IMAGE_COLUMNS) * 2 - 1;
-                        double y = ((row + center_y + deviation_y) / PBR_OUTPUT_IMAGE_ROWS) * 2 - 1;
-                        Ray ray = camera.get_ray(x, y);
-                        color = color + integrator.trace_ray(ray, 0) / (PBR_SAMPLES_PER_PIXEL);
+                        rays.push_back(primary_ray(camera, rng, row, col, i));
                     }
+                }
 
-                    outImage[row * PBR_OUTPUT_IMAGE_COLUMNS + col] = to_colori(color);
+                std::vector<Radiance> radiance;
+                integrator.trace_stream(rays, PBR_RAY_STREAM_SIZE, radiance);
+                size_t next = 0;
+                for (int col = 0; col < outImage.cols(); ++col)
+                {
+                    size_t p = row * PBR_OUTPUT_IMAGE_COLUMNS + col;
+                    for (; done[p] < PBR_SAMPLES_PER_PIXEL; ++done[p]) sum[p] = sum[p] + radiance[next++];
+                    outImage[p] = to_colori(sum[p] / (PBR_SAMPLES_PER_PIXEL));
                 }
+#else
+                // Iterate over all cols
+                for (int col = 0; col < outImage.cols(); ++col)
+                {
+                    size_t p = row * PBR_OUTPUT_IMAGE_COLUMNS + col;
+                    sum[p] = sum[p] + trace_samples(camera, rng, row, col, done[p], PBR_SAMPLES_PER_PIXEL - done[p]);
+                    outImage[p] = to_colori(sum[p] / (PBR_SAMPLES_PER_PIXEL));
+                }
+#endif
 
                 // Not adding a critical section here, accurate progress reporting is not super important
                 progress++;
                 LOG_DEBUG("Rendering %f%%", progress * 100 / (double) outImage.rows());
             }
+
+#if PBR_COLLECT_STATS
+            stats::print();
+#endif
         }
 
     private:
         Integrator integrator {};
+
+        static_assert(PBR_PACKET_SIZE <= BaseAccelerator::MAX_PACKET_SIZE, "Packets are limited by the accelerators");
+
+        /*!
+        * @brief Render passes of PBR_PREVIEW_SAMPLES samples per pixel into the image until the acceleration structure is built
+        *
+        * Runs on PBR_PREVIEW_THREADS threads, the others are left to the build. Rays are traced through the linear
+        * fallback of the integrator until it switches over, and through the acceleration structure after, so a row
+        * started before the switch is finished rather than thrown away. Every sample goes into `sum` and `done` for the
+        * main pass to carry on from.
+        */
+        void preview(const Camera& camera, Image& outImage, std::vector<Colorf>& sum, std::vector<int>& done)
+        {
+            UniformRNG rng;
+
+            int passes = 0;
+            for (int first = 0; first < PBR_SAMPLES_PER_PIXEL && !integrator.accelerator_ready(); first += PBR_PREVIEW_SAMPLES)
+            {
+                int count = std::min(PBR_PREVIEW_SAMPLES, PBR_SAMPLES_PER_PIXEL - first);
+#if PBR_USE_THREADS
+#pragma omp parallel for num_threads(PBR_PREVIEW_THREADS) private(rng)
+#endif
+                for (int row = 0; row < outImage.rows(); ++row)
+                {
+                    // Rows left over once the structure is ready are faster to render in the main pass
+                    if (integrator.accelerator_ready()) continue;
+
+                    for (int col = 0; col < outImage.cols(); ++col)
+                    {
+                        size_t p = row * PBR_OUTPUT_IMAGE_COLUMNS + col;
+                        sum[p] = sum[p] + trace_samples(camera, rng, row, col, first, count);
+                        done[p] = first + count;
+                        outImage[p] = to_colori(sum[p] / done[p]);
+                    }
+                }
+                ++passes;
+            }
+
+            LOG_INFO("Rendered %d preview passes while the acceleration structure built", passes);
+        }
+
+        /** Sum of the radiance of samples [first, first + count) of the pixel at (row, col) */
+        Colorf trace_samples(const Camera& camera, UniformRNG& rng, int row, int col, int first, int count)
+        {
+            Colorf color;
+#if PBR_PACKET_SIZE > 1
+            // The samples of a pixel are nearly parallel, so their first hits are found together
+            for (int end = first + count; first < end; first += PBR_PACKET_SIZE)
+            {
+                int n = std::min(PBR_PACKET_SIZE, end - first);
+                Ray rays[PBR_PACKET_SIZE];
+                for (int i = 0; i < n; ++i)
+                {
+                    rays[i] = primary_ray(camera, rng, row, col, first + i);
+                }
+
+                Radiance radiance[PBR_PACKET_SIZE];
+                integrator.trace_packet(rays, n, radiance);
+                for (int i = 0; i < n; ++i)
+                {
+                    color = color + radiance[i];
+                }
+            }
+#else
+            for (int i = first; i < first + count; ++i)
+            {
+                Ray ray = primary_ray(camera, rng, row, col, i);
+                color = color + integrator.trace_ray(ray, 0);
+            }
+#endif
+            return color;
+        }
+
+        /** Camera ray through sample i of the pixel at (row, col) */
+        Ray primary_ray(const Camera& camera, UniformRNG& rng, int row, int col, int i) const
+        {
+            auto sample = rng.sample_disk();
+
+#if PBR_STRATIFIED_SAMPLE
+            // Split the pixel into four quadrants for stratified sampling
+            // Modulo operations to choose these quadrants
+            double center_x = (1. / 2.) * ((i % 2) * 2 - 1);
+            double center_y = (1. / 2.) * (((i % 4) < 2) ? 1 : -1);
+            double deviation_x = sample.x / 2.;
+            double deviation_y = sample.y / 2.;
+#else
+            double center_x = 0;
+            double center_y = 0;
+            double deviation_x = sample.x;
+            double deviation_y = sample.y;
+
+#endif
+
+            // Normalize (row + deviation, col + deviation) to (x, y) where x and y are between -1 and 1.
+            double x = ((col + center_x + deviation_x) / PBR_OUTPUT_IMAGE_COLUMNS) * 2 - 1;
+            double y = ((row + center_y + deviation_y) / PBR_OUTPUT_IMAGE_ROWS) * 2 - 1;
+            return camera.get_ray(x, y);
+        }
     };
 }
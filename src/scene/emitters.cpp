@@ -0,0 +1,249 @@
+#include "emitters.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace pbr
+{
+    bool sample_sphere_cone(const SphereGeometry& sphere, const Point& point, double u1, double u2,
+                            Vec& direction, double& distance, double& pdf)
+    {
+        Vec to_center = sphere.center - point;
+        double d2 = to_center.sqlen();
+        double r2 = sphere.radius * sphere.radius;
+        if (d2 <= r2) return false;
+
+        // 1 - cos_max in a form that keeps its precision for small or far spheres, where cos_max is close to 1
+        double sin2_max = r2 / d2;
+        double cos_max = std::sqrt(std::max(0., 1 - sin2_max));
+        double one_minus_cos_max = sin2_max / (1 + cos_max);
+
+        double cos_theta = 1 - u1 * one_minus_cos_max;
+        double sin_theta = std::sqrt(std::max(0., 1 - cos_theta * cos_theta));
+        double phi = 2 * PBR_PI * u2;
+
+        // Basis around the axis of the cone
+        double d = std::sqrt(d2);
+        Vec w = to_center / d;
+        Vec up = (std::abs(w.y) > 0.999) ? Vec { 1, 0, 0 } : Vec { 0, 1, 0 };
+        Vec u = normalize(cross(w, up));
+        Vec v = cross(w, u);
+        direction = normalize(u * (sin_theta * std::cos(phi)) + v * (sin_theta * std::sin(phi)) + w * cos_theta);
+
+        // Near root of |point + t * direction - center| = radius
+        distance = d * cos_theta - std::sqrt(std::max(0., r2 - d2 * sin_theta * sin_theta));
+        pdf = 1 / (2 * PBR_PI * one_minus_cos_max);
+        return true;
+    }
+
+    double sphere_cone_pdf(const SphereGeometry& sphere, const Point& point)
+    {
+        double d2 = (sphere.center - point).sqlen();
+        double r2 = sphere.radius * sphere.radius;
+        if (d2 <= r2) return 0;
+
+        double sin2_max = r2 / d2;
+        double cos_max = std::sqrt(std::max(0., 1 - sin2_max));
+        return 1 / (2 * PBR_PI * sin2_max / (1 + cos_max));
+    }
+
+    /** Spheres emit from normals in every direction, each a diffuse surface with the power of pi times its area times its mean emitted radiance */
+    static double emitter_power(const Actor& actor)
+    {
+        const auto& sphere = std::get<SphereGeometry>(actor.geometry);
+        const Colorf& emission = actor.material->emission;
+        return PBR_PI * 4 * PBR_PI * sphere.radius * sphere.radius * (emission.x + emission.y + emission.z) / 3;
+    }
+
+    void EmitterList::build(const Scene& scene)
+    {
+        _emitters.clear();
+        _index.clear();
+        for (const auto& actor : scene)
+        {
+            const Colorf& emission = actor.material->emission;
+            if (emission.x <= 0 && emission.y <= 0 && emission.z <= 0) continue;
+            if (!std::holds_alternative<SphereGeometry>(actor.geometry)) continue;
+
+            _index[&actor] = (uint32_t) _emitters.size();
+            _emitters.push_back(&actor);
+        }
+
+        // The hierarchy takes far longer to build than the emitters to collect, so neither is built unless picked
+        _powers.build({});
+        _bvh.build({});
+        build_selection();
+    }
+
+    void EmitterList::set_selection(EmitterSelection selection)
+    {
+        _selection = selection;
+        build_selection();
+    }
+
+    void EmitterList::build_selection()
+    {
+        if (_selection == EmitterSelection::POWER && _powers.empty())
+        {
+            std::vector<double> powers(_emitters.size());
+            for (size_t i = 0; i < _emitters.size(); ++i) powers[i] = emitter_power(*_emitters[i]);
+            _powers.build(powers);
+        }
+        else if (_selection == EmitterSelection::LIGHT_BVH && _bvh.empty())
+        {
+            std::vector<LightBounds> lights(_emitters.size());
+            for (size_t i = 0; i < _emitters.size(); ++i)
+            {
+                lights[i].bounds = std::get<SphereGeometry>(_emitters[i]->geometry).bounds();
+                lights[i].cos_theta_o = -1;
+                lights[i].cos_theta_e = 0;
+                lights[i].power = emitter_power(*_emitters[i]);
+            }
+            _bvh.build(lights);
+        }
+    }
+
+    bool EmitterList::sample(const Point& point, const Vec& normal, double u_pick, double u1, double u2, LightSample& out) const
+    {
+        if (_emitters.empty()) return false;
+
+        uint32_t i = 0;
+        double pick_pdf = 0;
+        switch (_selection)
+        {
+            case EmitterSelection::UNIFORM:
+                i = (uint32_t) std::min((size_t) (u_pick * _emitters.size()), _emitters.size() - 1);
+                pick_pdf = 1. / _emitters.size();
+                break;
+            case EmitterSelection::POWER:
+                i = _powers.sample(u_pick);
+                pick_pdf = _powers.pdf(i);
+                break;
+            case EmitterSelection::LIGHT_BVH:
+                if (!_bvh.sample(point, normal, u_pick, i, pick_pdf)) return false;
+                break;
+        }
+
+        const Actor& actor = *_emitters[i];
+        const auto& sphere = std::get<SphereGeometry>(actor.geometry);
+        if (!sample_sphere_cone(sphere, point, u1, u2, out.direction, out.distance, out.pdf)) return false;
+
+        out.emission = actor.material->emission;
+        out.pdf *= pick_pdf;
+        return true;
+    }
+
+    double EmitterList::pdf(const Point& point, const Vec& normal, const Actor* actor) const
+    {
+        auto found = _index.find(actor);
+        if (found == _index.end()) return 0;
+
+        double pick_pdf = 0;
+        switch (_selection)
+        {
+            case EmitterSelection::UNIFORM: pick_pdf = 1. / _emitters.size(); break;
+            case EmitterSelection::POWER: pick_pdf = _powers.pdf(found->second); break;
+            case EmitterSelection::LIGHT_BVH: pick_pdf = _bvh.pdf(point, normal, found->second); break;
+        }
+        return sphere_cone_pdf(std::get<SphereGeometry>(actor->geometry), point) * pick_pdf;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+    // TESTS
+    ///////////////////////////////////////////////////////////////////////////////
+
+    TEST_CASE("scene::sample_sphere_cone")
+    {
+        SphereGeometry sphere { Vec { 0, 0, -10 }, 2 };
+        Point point { 0, 0, 0 };
+
+        // Every sample hits the near side of the sphere
+        std::mt19937 gen(1);
+        std::uniform_real_distribution<> uniform;
+        for (int i = 0; i < 1000; ++i)
+        {
+            Vec direction;
+            double distance, pdf;
+            REQUIRE(sample_sphere_cone(sphere, point, uniform(gen), uniform(gen), direction, distance, pdf));
+            CHECK(direction.len() == doctest::Approx(1));
+
+            double t = 0;
+            REQUIRE(sphere.intersect(Ray { point, direction }, t));
+            CHECK(distance == doctest::Approx(t).epsilon(1e-6));
+        }
+
+        // The density integrates to one over the cone
+        Vec direction;
+        double distance, pdf;
+        sample_sphere_cone(sphere, point, 0.5, 0.5, direction, distance, pdf);
+        double cos_max = std::sqrt(1 - 0.04);
+        CHECK(pdf * 2 * PBR_PI * (1 - cos_max) == doctest::Approx(1));
+        CHECK(sphere_cone_pdf(sphere, point) == doctest::Approx(pdf));
+
+        CHECK(sphere_cone_pdf(sphere, Point { 0, 0, -9 }) == 0);
+        CHECK_FALSE(sample_sphere_cone(sphere, Point { 0, 0, -9 }, 0.5, 0.5, direction, distance, pdf));
+    }
+
+    TEST_CASE("scene::EmitterList")
+    {
+        auto light = std::make_shared<Material>(PBR_COLOR_WHITE, Colorf { 2, 2, 2 }, new DiffuseBRDF);
+        auto dark = std::make_shared<Material>(PBR_COLOR_WHITE, PBR_COLOR_BLACK, new DiffuseBRDF);
+        Scene scene {
+            Actor { light, SphereGeometry { Vec { 0, 5, 0 }, 1 } },
+            Actor { dark, SphereGeometry { Vec { 3, 0, 0 }, 1 } },
+            Actor { light, PlaneGeometry { Vec { 0, -1, 0 }, Vec { 0, 1, 0 } } },
+            Actor { light, SphereGeometry { Vec { 0, -5, 0 }, 1 } },
+        };
+
+        EmitterList emitters;
+        emitters.set_selection(EmitterSelection::UNIFORM);
+        emitters.build(scene);
+        CHECK(emitters.size() == 2);
+        CHECK(emitters.sampled(&scene[0]));
+        CHECK_FALSE(emitters.sampled(&scene[1]));
+        CHECK_FALSE(emitters.sampled(&scene[2]));
+        CHECK(emitters.sampled(&scene[3]));
+
+        LightSample up, down;
+        Vec normal { 0, 0, 0 };
+        REQUIRE(emitters.sample(Point { 0, 0, 0 }, normal, 0.25, 0.5, 0.5, up));
+        REQUIRE(emitters.sample(Point { 0, 0, 0 }, normal, 0.75, 0.5, 0.5, down));
+        CHECK(up.direction.y > 0);
+        CHECK(down.direction.y < 0);
+        CHECK(up.emission.x == 2);
+
+        // Half the chance of picking either one
+        double cos_max = std::sqrt(1 - 1. / 25);
+        CHECK(up.pdf * 2 * 2 * PBR_PI * (1 - cos_max) == doctest::Approx(1));
+        CHECK(emitters.pdf(Point { 0, 0, 0 }, normal, &scene[0]) == doctest::Approx(up.pdf));
+        CHECK(emitters.pdf(Point { 0, 0, 0 }, normal, &scene[1]) == 0);
+
+        // A four times larger sphere of the same emission is picked four times as often by power
+        scene[3].geometry = SphereGeometry { Vec { 0, -5, 0 }, 2 };
+        emitters.set_selection(EmitterSelection::POWER);
+        emitters.build(scene);
+        CHECK(emitters.light_bvh().empty());
+        int picked_up = 0;
+        const int samples = 10000;
+        for (int s = 0; s < samples; ++s)
+        {
+            REQUIRE(emitters.sample(Point { 0, 0, 0 }, normal, (s + 0.5) / samples, 0.5, 0.5, up));
+            picked_up += up.direction.y > 0;
+            double cone = sphere_cone_pdf(std::get<SphereGeometry>(scene[up.direction.y > 0 ? 0 : 3].geometry), Point { 0, 0, 0 });
+            CHECK(up.pdf == doctest::Approx(cone * (up.direction.y > 0 ? 0.2 : 0.8)));
+        }
+        CHECK(picked_up == doctest::Approx(0.2 * samples).epsilon(0.01));
+
+        // The hierarchy only picks the emitter above a surface facing up, and sample() and pdf() agree on its chance
+        emitters.set_selection(EmitterSelection::LIGHT_BVH);
+        CHECK_FALSE(emitters.light_bvh().empty());
+        Vec up_normal { 0, 1, 0 };
+        for (double u : { 0.1, 0.5, 0.9 })
+        {
+            REQUIRE(emitters.sample(Point { 0, 0, 0 }, up_normal, u, 0.5, 0.5, up));
+            CHECK(up.direction.y > 0);
+            CHECK(emitters.pdf(Point { 0, 0, 0 }, up_normal, &scene[0]) == doctest::Approx(up.pdf));
+        }
+        CHECK(emitters.pdf(Point { 0, 0, 0 }, up_normal, &scene[3]) == 0);
+    }
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "scene.h"
+#include <accel/light_bvh.h>
+#include <core/alias_table.h>
+
+#include <unordered_map>
+#include <vector>
+
+namespace pbr
+{
+    /** Direction from a shaded point towards an emitter, picked by EmitterList::sample(). */
+    struct LightSample
+    {
+        /** Unit direction towards the emitter */
+        Vec direction;
+
+        /** Ray parameter of the emitter surface along `direction`, where the shadow ray ends */
+        double distance;
+
+        /** Radiance that the emitter sends back along `direction` */
+        Colorf emission;
+
+        /** Density of the direction per unit solid angle, including the chance of picking the emitter */
+        double pdf;
+    };
+
+    /*!
+    * @brief Sample a direction uniformly in the cone that a sphere subtends from a point outside it
+    *
+    * Every direction in the cone hits the sphere, so no sample is wasted on misses however small or far the sphere is.
+    * The density is 1 / (2 pi (1 - cos_max)) per unit solid angle, where cos_max is the cosine of the half-angle of the cone.
+    *
+    * @param sphere Sphere to sample
+    * @param point Point to sample the sphere from
+    * @param u1 Uniform number in [0, 1) for the angle to the axis of the cone
+    * @param u2 Uniform number in [0, 1) for the angle around it
+    * @param direction Unit direction towards the sphere
+    * @param distance Distance along `direction` to the near side of the sphere
+    * @param pdf Density of `direction` per unit solid angle
+    * @return bool False if the point is inside the sphere, which sees it in every direction
+    */
+    bool sample_sphere_cone(const SphereGeometry& sphere, const Point& point, double u1, double u2,
+                            Vec& direction, double& distance, double& pdf);
+
+    /** Density per unit solid angle of the directions of sample_sphere_cone() from the point, 0 if it is inside the sphere */
+    double sphere_cone_pdf(const SphereGeometry& sphere, const Point& point);
+
+    /** How EmitterList picks the emitter to sample */
+    enum class EmitterSelection
+    {
+        /** Every emitter with the same chance, wherever the point is */
+        UNIFORM,
+
+        /** In proportion to the power of each emitter, wherever the point is, from an AliasTable in constant time */
+        POWER,
+
+        /** Descending a LightBVH, in proportion to how much light each emitter could send to the point */
+        LIGHT_BVH,
+    };
+
+    /*!
+    * @brief Actors of a scene with nonzero emission that light sampling can aim at
+    *
+    * Only spheres are sampled. Emitters of other shapes are still found when a bounce happens to hit them.
+    */
+    class EmitterList
+    {
+    public:
+        /** Collect the emitters of the scene, and build the alias table or light hierarchy if the selection needs one */
+        void build(const Scene& scene);
+
+        EmitterSelection selection() const { return _selection; }
+
+        /** Change how emitters are picked, building what the new selection needs over the collected emitters. Not while sampling. */
+        void set_selection(EmitterSelection selection);
+
+        bool empty() const { return _emitters.empty(); }
+        size_t size() const { return _emitters.size(); }
+
+        /** Whether light sampling accounts for the light of the actor, so paths that hit it must not count it again */
+        bool sampled(const Actor* actor) const { return _index.count(actor) > 0; }
+
+        /*!
+        * @brief Pick one emitter, as set by selection(), and sample a direction towards it
+        *
+        * @param point Point to sample the emitters from
+        * @param normal Normal of the surface at the point, or a zero vector if light may come from any side
+        * @param u_pick Uniform number in [0, 1) that picks the emitter
+        * @param u1, u2 Uniform numbers in [0, 1) for the direction, see sample_sphere_cone()
+        * @param out Direction, distance, emission and density of the sample
+        * @return bool False if there is nothing to sample, no emitter can light the point, or it is inside the picked one
+        */
+        bool sample(const Point& point, const Vec& normal, double u_pick, double u1, double u2, LightSample& out) const;
+
+        /** Density per unit solid angle with which sample() picks a direction from the point that reaches the emitter */
+        double pdf(const Point& point, const Vec& normal, const Actor* actor) const;
+
+        const LightBVH& light_bvh() const { return _bvh; }
+
+    private:
+        /** Build the structure that `_selection` picks from, unless it is already built */
+        void build_selection();
+
+        EmitterSelection _selection = PBR_EMITTER_SELECTION;
+        std::vector<const Actor*> _emitters;
+
+        // Only the one that `_selection` needs is built, the other stays empty
+        AliasTable _powers;
+        LightBVH _bvh;
+
+        /** Position of every emitter in `_emitters` */
+        std::unordered_map<const Actor*, uint32_t> _index;
+    };
+}
@@ -0,0 +1,510 @@
+#include "mesh.h"
+#include <accel/bvh_cache.h>
+#include <debug.h>
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cstdlib>
+#include <random>
+#include <thread>
+
+namespace pbr
+{
+    ///////////////////////////////////////////////////////////////////////////////
+    // Ray-triangle intersection
+    ///////////////////////////////////////////////////////////////////////////////
+
+    /*!
+    * @brief Per-ray setup for the watertight ray-triangle test
+    *
+    * Woop, Benthin and Wald, "Watertight Ray/Triangle Intersection", JCGT 2013. The ray is sheared so that it
+    * points along +z, which turns the test into a 2D edge function test that has no gaps along shared edges.
+    */
+    struct WatertightRay
+    {
+        Point origin;
+        int kx, ky, kz;
+        double sx, sy, sz;
+
+        explicit WatertightRay(const Ray& ray) : origin(ray.origin)
+        {
+            const Vec& d = ray.direction;
+            Vec abs_d { std::abs(d.x), std::abs(d.y), std::abs(d.z) };
+            kz = (abs_d.x > abs_d.y) ? ((abs_d.x > abs_d.z) ? 0 : 2) : ((abs_d.y > abs_d.z) ? 1 : 2);
+            kx = (kz + 1) % 3;
+            ky = (kx + 1) % 3;
+
+            // Keep the winding of the edge functions when the dominant axis points backwards
+            if (axis_of(d, kz) < 0) std::swap(kx, ky);
+
+            sx = axis_of(d, kx) / axis_of(d, kz);
+            sy = axis_of(d, ky) / axis_of(d, kz);
+            sz = 1 / axis_of(d, kz);
+        }
+
+        bool intersect(const Point& p0, const Point& p1, const Point& p2, double tmax,
+                       double& t, double& b1, double& b2) const
+        {
+            Vec a = p0 - origin;
+            Vec b = p1 - origin;
+            Vec c = p2 - origin;
+
+            double az = axis_of(a, kz), bz = axis_of(b, kz), cz = axis_of(c, kz);
+            double ax = axis_of(a, kx) - sx * az, ay = axis_of(a, ky) - sy * az;
+            double bx = axis_of(b, kx) - sx * bz, by = axis_of(b, ky) - sy * bz;
+            double cx = axis_of(c, kx) - sx * cz, cy = axis_of(c, ky) - sy * cz;
+
+            // Scaled barycentrics, each is the edge function of the edge opposite to a vertex
+            double u = cx * by - cy * bx;
+            double v = ax * cy - ay * cx;
+            double w = bx * ay - by * ax;
+            if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0)) return false;
+
+            double det = u + v + w;
+            if (det == 0) return false;
+
+            double inv_det = 1 / det;
+            t = (u * az + v * bz + w * cz) * sz * inv_det;
+            if (t <= PBR_EPSILON || t >= tmax) return false;
+
+            b1 = v * inv_det;
+            b2 = w * inv_det;
+            return true;
+        }
+    };
+
+    /*!
+    * @brief Bounds of the parts of a triangle on either side of a plane, within a box
+    *
+    * The parts are bounded by the vertices on their side and the points where edges cross the plane, which get the
+    * coordinate of the plane exactly, so that the parts meet without a gap. Cutting the bounds of each part down to
+    * the box keeps the result conservative without clipping the triangle to the box first.
+    */
+    static void split_triangle(const Point* vertices[3], const AABB& box, int axis, double position, AABB& left, AABB& right)
+    {
+        left = AABB {};
+        right = AABB {};
+        for (int i = 0; i < 3; ++i)
+        {
+            const Point& a = *vertices[i];
+            const Point& b = *vertices[(i + 1) % 3];
+            double pa = axis_of(a, axis);
+            double pb = axis_of(b, axis);
+            if (pa <= position) left.expand(a);
+            if (pa >= position) right.expand(a);
+
+            if ((pa < position && pb > position) || (pa > position && pb < position))
+            {
+                Point p = a + (b - a) * ((position - pa) / (pb - pa));
+                set_axis(p, axis, position);
+                left.expand(p);
+                right.expand(p);
+            }
+        }
+        left = left.intersection(box);
+        right = right.intersection(box);
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+    // TriangleMesh
+    ///////////////////////////////////////////////////////////////////////////////
+
+    void TriangleMesh::build(BVHBuildMethod method)
+    {
+        std::vector<AABB> bounds(triangle_count());
+        for (size_t i = 0; i < bounds.size(); ++i)
+        {
+            bounds[i].expand(positions[indices[3 * i]]);
+            bounds[i].expand(positions[indices[3 * i + 1]]);
+            bounds[i].expand(positions[indices[3 * i + 2]]);
+        }
+
+        if (method != BVHBuildMethod::SPATIAL)
+        {
+            build_cached(bvh, bounds, 1, method);
+            _built.store(true, std::memory_order_release);
+            return;
+        }
+
+        auto split = [this](uint32_t triangle, const AABB& box, int axis, double position, AABB& left, AABB& right) {
+            const uint32_t* v = &indices[3 * triangle];
+            const Point* vertices[3] = { &positions[v[0]], &positions[v[1]], &positions[v[2]] };
+            split_triangle(vertices, box, axis, position, left, right);
+        };
+        uint64_t geometry_key = bvh_cache_hash(positions.data(), positions.size() * sizeof(Point));
+        geometry_key = bvh_cache_hash(indices.data(), indices.size() * sizeof(uint32_t), geometry_key);
+        build_cached(bvh, bounds, split, geometry_key);
+        _built.store(true, std::memory_order_release);
+
+        LOG_INFO("Mesh BVH with spatial splits: %zu triangles, %zu references (+%.1f%%)", triangle_count(),
+                 reference_count(), 100.0 * (reference_count() - triangle_count()) / std::max<size_t>(triangle_count(), 1));
+    }
+
+    void TriangleMesh::build_lazily(BVHBuildMethod method)
+    {
+        _lazy_method = method;
+        _lazy_bounds = AABB {};
+        for (const auto& p : positions) _lazy_bounds.expand(p);
+    }
+
+    void TriangleMesh::ensure_built() const
+    {
+        if (built() || _lazy_bounds.empty()) return;
+
+        std::call_once(_build_once, [this] {
+            // The mesh itself is not const, only the queries are. Someone may have called build() in the meantime.
+            if (!built()) const_cast<TriangleMesh*>(this)->build(_lazy_method);
+        });
+    }
+
+    bool TriangleMesh::build_for(const Ray& ray, double tmax) const
+    {
+        Vec inv_dir { 1 / ray.direction.x, 1 / ray.direction.y, 1 / ray.direction.z };
+        if (!_lazy_bounds.intersect(ray.origin, inv_dir, tmax)) return false;
+
+        ensure_built();
+        return true;
+    }
+
+    AABB TriangleMesh::bounds() const
+    {
+        if (!built() && !_lazy_bounds.empty()) return _lazy_bounds;
+        if (bvh.empty())
+        {
+            AABB box;
+            for (const auto& p : positions) box.expand(p);
+            return box;
+        }
+        return bvh.nodes.front().bounds;
+    }
+
+    bool TriangleMesh::intersect(const Ray& ray, double& tmax, uint32_t& triangle, Point2D& barycentric) const
+    {
+        if (!built() && !build_for(ray, tmax)) return false;
+
+        WatertightRay wray(ray);
+        return bvh.intersect(ray, tmax, [&](uint32_t first, uint32_t count, double& tmax) {
+            bool hit = false;
+            for (uint32_t i = first; i < first + count; ++i)
+            {
+                uint32_t tri = bvh.indices[i];
+                const uint32_t* v = &indices[3 * tri];
+
+                double t, b1, b2;
+                if (wray.intersect(positions[v[0]], positions[v[1]], positions[v[2]], tmax, t, b1, b2))
+                {
+                    tmax = t;
+                    triangle = tri;
+                    barycentric = { b1, b2 };
+                    hit = true;
+                }
+            }
+            return hit;
+        });
+    }
+
+    bool TriangleMesh::occluded(const Ray& ray, double tmax) const
+    {
+        if (!built() && !build_for(ray, tmax)) return false;
+
+        WatertightRay wray(ray);
+        return bvh.occluded(ray, tmax, [&](uint32_t first, uint32_t count) {
+            for (uint32_t i = first; i < first + count; ++i)
+            {
+                const uint32_t* v = &indices[3 * bvh.indices[i]];
+
+                double t, b1, b2;
+                if (wray.intersect(positions[v[0]], positions[v[1]], positions[v[2]], tmax, t, b1, b2)) return true;
+            }
+            return false;
+        });
+    }
+
+    Vec TriangleMesh::normal(uint32_t triangle) const
+    {
+        const uint32_t* v = &indices[3 * triangle];
+        const Point& p0 = positions[v[0]];
+        return normalize(cross(positions[v[1]] - p0, positions[v[2]] - p0));
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+    // OBJ loading
+    ///////////////////////////////////////////////////////////////////////////////
+
+    std::shared_ptr<TriangleMesh> load_obj(const std::string& path, BVHBuildMethod method)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            throw std::runtime_error("Could not open OBJ file " + path);
+        }
+        return load_obj(file, method);
+    }
+
+    std::shared_ptr<TriangleMesh> load_obj(std::istream& stream, BVHBuildMethod method)
+    {
+        auto mesh = std::make_shared<TriangleMesh>();
+
+        std::string line;
+        std::vector<uint32_t> face;
+        size_t line_number = 0;
+        while (std::getline(stream, line))
+        {
+            ++line_number;
+            const char* s = line.c_str();
+            while (*s == ' ' || *s == '\t') ++s;
+
+            if (s[0] == 'v' && (s[1] == ' ' || s[1] == '\t'))
+            {
+                // A short or malformed line must not turn into zeros
+                double xyz[3];
+                const char* p = s + 1;
+                for (double& value : xyz)
+                {
+                    char* end = nullptr;
+                    value = std::strtod(p, &end);
+                    if (end == p)
+                    {
+                        throw std::runtime_error("Invalid vertex position in OBJ file on line " + std::to_string(line_number));
+                    }
+                    p = end;
+                }
+                mesh->positions.emplace_back(xyz[0], xyz[1], xyz[2]);
+            }
+            else if (s[0] == 'f' && (s[1] == ' ' || s[1] == '\t'))
+            {
+                // Each vertex is "v", "v/vt", "v//vn" or "v/vt/vn", only v is used
+                face.clear();
+                const char* p = s + 1;
+                while (true)
+                {
+                    char* end = nullptr;
+                    long index = std::strtol(p, &end, 10);
+                    if (end == p) break;
+
+                    // Indices are 1-based, negative ones count back from the latest vertex
+                    long resolved = (index < 0) ? (long) mesh->positions.size() + index : index - 1;
+                    if (index == 0 || resolved < 0 || resolved >= (long) mesh->positions.size())
+                    {
+                        throw std::runtime_error("Invalid vertex index in OBJ face on line " + std::to_string(line_number));
+                    }
+                    face.push_back(resolved);
+
+                    // Skip texture and normal indices
+                    p = end;
+                    while (*p != '\0' && *p != ' ' && *p != '\t') ++p;
+                }
+
+                for (size_t i = 2; i < face.size(); ++i)
+                {
+                    mesh->indices.push_back(face[0]);
+                    mesh->indices.push_back(face[i - 1]);
+                    mesh->indices.push_back(face[i]);
+                }
+            }
+        }
+
+        if (PBR_MESH_LAZY_BUILD) mesh->build_lazily(method);
+        else mesh->build(method);
+        return mesh;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+    // TESTS
+    ///////////////////////////////////////////////////////////////////////////////
+
+    TEST_CASE("scene::load_obj")
+    {
+        std::istringstream obj(
+            "# unit square in the xy-plane, split into two faces\n"
+            "v 0 0 0\n"
+            "v 1 0 0\n"
+            "v 1 1 0\n"
+            "v 0 1 0\n"
+            "vn 0 0 1\n"
+            "f 1//1 2//1 3//1\n"
+            "f -4/1/1 -2/1/1 -1/1/1\n"
+            "f 1 2 3 4\n"
+        );
+
+        auto mesh = load_obj(obj);
+        CHECK(mesh->positions.size() == 4);
+        CHECK(mesh->triangle_count() == 4);
+        CHECK(mesh->indices[3] == 0);
+        CHECK(mesh->indices[4] == 2);
+        CHECK(mesh->indices[5] == 3);
+
+        std::istringstream bad("v 0 0 0\nf 1 2 3\n");
+        CHECK_THROWS(load_obj(bad));
+
+        std::istringstream short_vertex("v 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 3\n");
+        CHECK_THROWS(load_obj(short_vertex));
+        std::istringstream malformed_vertex("v 0 x 0\n");
+        CHECK_THROWS(load_obj(malformed_vertex));
+    }
+
+    TEST_CASE("scene::TriangleMesh::intersect")
+    {
+        auto mesh = std::make_shared<TriangleMesh>();
+        mesh->positions = { { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 } };
+        mesh->indices = { 0, 1, 2, 0, 2, 3 };
+        mesh->build();
+
+        double tmax = PBR_INF;
+        uint32_t triangle;
+        Point2D bary;
+        REQUIRE(mesh->intersect(Ray { Vec { 0.75, 0.25, 2 }, Vec { 0, 0, -1 } }, tmax, triangle, bary));
+        CHECK(tmax == doctest::Approx(2));
+        CHECK(triangle == 0);
+        CHECK(bary.x == doctest::Approx(0.5));  // weight of (1, 0, 0)
+        CHECK(bary.y == doctest::Approx(0.25)); // weight of (1, 1, 0)
+        CHECK(mesh->normal(triangle) == Vec { 0, 0, 1 });
+
+        // Rays through the shared edge and a shared vertex must not slip through
+        for (Vec target : { Vec { 0.5, 0.5, 0 }, Vec { 0.3, 0.3, 0 }, Vec { 0, 0, 0 } })
+        {
+            tmax = PBR_INF;
+            Vec origin { 0.2, 0.7, 3 };
+            CHECK(mesh->intersect(Ray { origin, target - origin }, tmax, triangle, bary));
+        }
+
+        tmax = PBR_INF;
+        CHECK_FALSE(mesh->intersect(Ray { Vec { 1.5, 0.5, 2 }, Vec { 0, 0, -1 } }, tmax, triangle, bary));
+    }
+
+    TEST_CASE("scene::TriangleMesh::occluded")
+    {
+        auto mesh = std::make_shared<TriangleMesh>();
+        mesh->positions = { { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 } };
+        mesh->indices = { 0, 1, 2, 0, 2, 3 };
+        mesh->build();
+
+        Ray ray { Vec { 0.75, 0.25, 2 }, Vec { 0, 0, -1 } };
+        CHECK(mesh->occluded(ray, PBR_INF));
+        CHECK(mesh->occluded(ray, 2.5));
+
+        // The segment ends in front of the mesh
+        CHECK_FALSE(mesh->occluded(ray, 1.5));
+        CHECK_FALSE(mesh->occluded(Ray { Vec { 1.5, 0.5, 2 }, Vec { 0, 0, -1 } }, PBR_INF));
+    }
+
+    TEST_CASE("scene::TriangleMesh::build_lazily")
+    {
+        std::mt19937 gen(5);
+        std::uniform_real_distribution<> position(-5.0, 5.0);
+        TriangleMesh eager;
+        for (uint32_t i = 0; i < 3000; ++i)
+        {
+            Vec corner { position(gen), position(gen), position(gen) };
+            eager.positions.insert(eager.positions.end(), { corner, corner + Vec { 0.5, 0, 0 }, corner + Vec { 0, 0.5, 0.2 } });
+            eager.indices.insert(eager.indices.end(), { 3 * i, 3 * i + 1, 3 * i + 2 });
+        }
+        TriangleMesh lazy = eager;
+        eager.build();
+        lazy.build_lazily();
+
+        CHECK_FALSE(lazy.built());
+        CHECK(lazy.bounds().min == eager.bounds().min);
+        CHECK(lazy.bounds().max == eager.bounds().max);
+
+        // Rays that miss the bounds, or end before them, leave the mesh unbuilt
+        double tmax = PBR_INF;
+        uint32_t triangle;
+        Point2D bary;
+        CHECK_FALSE(lazy.intersect(Ray { Vec { 0, 20, 0 }, Vec { 1, 0, 0 } }, tmax, triangle, bary));
+        CHECK_FALSE(lazy.occluded(Ray { Vec { 0, 0, 20 }, Vec { 0, 0, -1 } }, 10));
+        CHECK_FALSE(lazy.built());
+
+        // Threads that all reach the mesh at once build it once between them, and find what the eager build finds
+        std::vector<Ray> rays;
+        for (int i = 0; i < 2000; ++i)
+        {
+            Vec origin = Vec { position(gen), position(gen), 20 };
+            rays.push_back(Ray { origin, Vec { position(gen), position(gen), 0 } - origin });
+        }
+        std::vector<int> mismatches(4, 0);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t)
+        {
+            threads.emplace_back([&, t] {
+                for (const Ray& ray : rays)
+                {
+                    double eager_t = PBR_INF, lazy_t = PBR_INF;
+                    uint32_t eager_triangle = 0, lazy_triangle = 0;
+                    Point2D b;
+                    bool eager_hit = eager.intersect(ray, eager_t, eager_triangle, b);
+                    bool lazy_hit = lazy.intersect(ray, lazy_t, lazy_triangle, b);
+                    mismatches[t] += eager_hit != lazy_hit || eager_t != lazy_t || eager_triangle != lazy_triangle;
+                    mismatches[t] += eager.occluded(ray, 20) != lazy.occluded(ray, 20);
+                }
+            });
+        }
+        for (auto& thread : threads) thread.join();
+
+        CHECK(lazy.built());
+        CHECK(lazy.bvh.nodes.size() == eager.bvh.nodes.size());
+        for (int t = 0; t < 4; ++t) CHECK(mismatches[t] == 0);
+
+        // Copies build a lazy mesh first, rather than read a hierarchy that another thread may be building
+        TriangleMesh pending;
+        pending.positions = eager.positions;
+        pending.indices = eager.indices;
+        pending.build_lazily();
+        REQUIRE_FALSE(pending.built());
+        TriangleMesh copy = pending;
+        CHECK(pending.built());
+        CHECK(copy.built());
+        CHECK(copy.bvh.nodes.size() == eager.bvh.nodes.size());
+    }
+
+    TEST_CASE("scene::TriangleMesh::spatial_splits")
+    {
+        // Long thin triangles crossing each other at all angles, like the beams and slats of a building
+        std::mt19937 gen(4);
+        std::uniform_real_distribution<> position(-10.0, 10.0);
+        std::normal_distribution<> normal;
+        TriangleMesh binned;
+        for (uint32_t i = 0; i < 2000; ++i)
+        {
+            Vec center { position(gen), position(gen), position(gen) };
+            Vec along = normalize(Vec { normal(gen), normal(gen), normal(gen) }) * 8;
+            Vec across = normalize(Vec { normal(gen), normal(gen), normal(gen) }) * 0.05;
+            binned.positions.insert(binned.positions.end(), { center - along, center + along, center + across });
+            binned.indices.insert(binned.indices.end(), { 3 * i, 3 * i + 1, 3 * i + 2 });
+        }
+        TriangleMesh spatial = binned;
+        binned.build(BVHBuildMethod::BINNED);
+        spatial.build(BVHBuildMethod::SPATIAL);
+
+        CHECK(binned.reference_count() == binned.triangle_count());
+        CHECK(spatial.reference_count() > spatial.triangle_count());
+        CHECK(spatial.reference_count() <= spatial.triangle_count() * (1 + PBR_BVH_SPATIAL_MAX_DUPLICATION));
+        CHECK(spatial.bvh.sah_cost() < binned.bvh.sah_cost());
+        CHECK(spatial.bounds().surface_area() == doctest::Approx(binned.bounds().surface_area()));
+
+        // Cut triangles are still found in full, by closest-hit and occlusion queries alike
+        int hits = 0;
+        for (int i = 0; i < 2000; ++i)
+        {
+            Vec origin = normalize(Vec { normal(gen), normal(gen), normal(gen) }) * 30;
+            Vec target { position(gen), position(gen), position(gen) };
+            Ray ray { origin, normalize(target - origin) };
+
+            double binned_t = PBR_INF, spatial_t = PBR_INF;
+            uint32_t binned_triangle = 0, spatial_triangle = 0;
+            Point2D bary;
+            bool binned_hit = binned.intersect(ray, binned_t, binned_triangle, bary);
+            bool spatial_hit = spatial.intersect(ray, spatial_t, spatial_triangle, bary);
+            REQUIRE(binned_hit == spatial_hit);
+            hits += binned_hit;
+            if (!binned_hit) continue;
+
+            CHECK(spatial_t == binned_t);
+            CHECK(spatial_triangle == binned_triangle);
+            CHECK(spatial.occluded(ray, binned_t * 1.001));
+            CHECK_FALSE(spatial.occluded(ray, binned_t * 0.999));
+        }
+        CHECK(hits > 100);
+    }
+}
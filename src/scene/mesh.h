@@ -0,0 +1,119 @@
+#pragma once
+
+#include <core/math_definitions.h>
+#include <accel/bvh.h>
+
+#include <atomic>
+#include <iosfwd>
+#include <mutex>
+
+namespace pbr
+{
+    /*!
+    * @brief Indexed triangle mesh with its own bounding volume hierarchy
+    *
+    * Triangle i uses positions[indices[3i]], positions[indices[3i + 1]] and positions[indices[3i + 2]].
+    * Call build() after filling in the data, and before tracing rays against the mesh, or build_lazily() to leave
+    * the build to the first ray that needs it.
+    */
+    struct TriangleMesh
+    {
+        std::vector<Point> positions;
+        std::vector<uint32_t> indices;
+
+        /** Hierarchy over the triangles, in the same space as the positions */
+        BVH bvh;
+
+        TriangleMesh() = default;
+
+        /** Copies the data and the hierarchy. A lazy mesh is built first, so the copy cannot race a build on another thread. */
+        TriangleMesh(const TriangleMesh& other)
+        {
+            other.ensure_built();
+            positions = other.positions;
+            indices = other.indices;
+            bvh = other.bvh;
+            _built.store(other.built(), std::memory_order_relaxed);
+            _lazy_method = other._lazy_method;
+            _lazy_bounds = other._lazy_bounds;
+        }
+
+        inline size_t triangle_count() const { return indices.size() / 3; }
+
+        /** Triangle references in the leaves of the hierarchy. More than triangle_count() once spatial splits cut triangles. */
+        inline size_t reference_count() const { return bvh.indices.size(); }
+
+        inline size_t memory_bytes() const
+        {
+            return positions.size() * sizeof(Point) + indices.size() * sizeof(uint32_t) + bvh.memory_bytes();
+        }
+
+        /*!
+        * @brief Build the acceleration structure over the triangles
+        *
+        * @param method BVHBuildMethod::SPATIAL cuts the triangles themselves for its spatial splits. It suits meshes
+        *               with long thin triangles, such as buildings, at several times the build time of the others.
+        */
+        void build(BVHBuildMethod method = PBR_MESH_BVH_BUILD_METHOD);
+
+        /*!
+        * @brief Leave build() to the first ray that enters the bounds of the mesh, for a faster start
+        *
+        * Only the bounds are computed here. Meshes that no ray reaches are never built. The first query that needs the
+        * hierarchy builds it while concurrent queries on other threads wait for it, so a large mesh that comes into
+        * view can stall a frame, and its build runs on the one thread that got there first.
+        */
+        void build_lazily(BVHBuildMethod method = PBR_MESH_BVH_BUILD_METHOD);
+
+        /** Whether the hierarchy is there, false for a lazy mesh until a ray needed it */
+        inline bool built() const { return _built.load(std::memory_order_acquire); }
+
+        AABB bounds() const;
+
+        /*!
+        * @brief Find the closest triangle along the ray
+        *
+        * @param ray Ray to test against the mesh
+        * @param tmax Far end of the ray segment, set to the distance of the hit
+        * @param triangle Index of the triangle that was hit
+        * @param barycentric Weights of the second and third vertex of that triangle at the hit
+        * @return bool Indicates if the ray hits the mesh closer than tmax
+        */
+        bool intersect(const Ray& ray, double& tmax, uint32_t& triangle, Point2D& barycentric) const;
+
+        /** Whether any triangle blocks the ray before tmax. Stops at the first one found. */
+        bool occluded(const Ray& ray, double tmax) const;
+
+        /** Unit normal of a triangle, following the winding order of its vertices. */
+        Vec normal(uint32_t triangle) const;
+
+    private:
+        /** Build a lazy mesh that was not built yet, or wait for the thread that builds it */
+        void ensure_built() const;
+
+        /** Build a lazy mesh if the ray enters its bounds before tmax. Returns false if the ray misses them, whether or not it was built. */
+        bool build_for(const Ray& ray, double tmax) const;
+
+        // The state of a lazy build. It happens in const queries, through meshes shared as const between actors.
+        mutable std::once_flag _build_once;
+        std::atomic<bool> _built { false };
+        BVHBuildMethod _lazy_method = PBR_MESH_BVH_BUILD_METHOD;
+        AABB _lazy_bounds;
+    };
+
+    /*!
+    * @brief Load the faces of a Wavefront OBJ file as a triangle mesh
+    *
+    * The file is read one line at a time. Only vertex positions and faces are used, polygons are split into fans.
+    * The acceleration structure for the mesh is built before returning, or left to the first ray that enters the
+    * mesh with PBR_MESH_LAZY_BUILD, see TriangleMesh::build_lazily().
+    *
+    * @param path Path to the .obj file
+    * @param method How to build the hierarchy of this mesh, see TriangleMesh::build()
+    * @return std::shared_ptr<TriangleMesh> Mesh with its hierarchy built, or ready to build
+    */
+    std::shared_ptr<TriangleMesh> load_obj(const std::string& path, BVHBuildMethod method = PBR_MESH_BVH_BUILD_METHOD);
+
+    /** Load OBJ data from a stream, see load_obj(const std::string&, BVHBuildMethod). */
+    std::shared_ptr<TriangleMesh> load_obj(std::istream& stream, BVHBuildMethod method = PBR_MESH_BVH_BUILD_METHOD);
+}
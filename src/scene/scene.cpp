@@ -1,5 +1,7 @@
 #include "scene.h"
 
+#include <stdexcept>
+
 ///////////////////////////////////////////////////////////////////////////////
 // Scene description.
 ///////////////////////////////////////////////////////////////////////////////
@@ -72,9 +74,9 @@ namespace pbr
                 Colorf { 0.0, 0.0, 0.0 },  // Emission
                 new DiffuseBRDF
             ),
-            SphereGeometry {
-                Vec { 0.0, -1e5, 0.0 },  // Position
-                1e5                      // Radius
+            PlaneGeometry {
+                Vec { 0.0, 0.0, 0.0 },   // Point on the plane
+                Vec { 0.0, 1.0, 0.0 }    // Normal
             }
         }
     };
@@ -133,6 +135,8 @@ namespace pbr
             }
         },
 
+        // The room spans x in [-5, 5], y in [0, 5] and z in [-1.5, 10]. The front wall is behind the
+        // camera, it closes the room like the old sphere walls did by stretching out to infinity.
         // Floor
         Actor {
             std::make_shared<Material>(
@@ -140,9 +144,10 @@ namespace pbr
                 Colorf { 0.0, 0.0, 0.0 },  // Emission
                 new DiffuseBRDF
             ),
-            SphereGeometry {
-                Vec { 0.0, -1e5, 0.0 },  // Position
-                1e5                      // Radius
+            QuadGeometry {
+                Vec { -5.0, 0.0, -1.5 }, // Corner
+                Vec { 0.0, 0.0, 11.5 },  // Edge
+                Vec { 10.0, 0.0, 0.0 }   // Edge
             }
         },
 
@@ -153,9 +158,10 @@ namespace pbr
                 Colorf { 0.0, 0.0, 0.0 },  // Emission
                 new DiffuseBRDF
             ),
-            SphereGeometry {
-                Vec { 0.0, 0.0, -1e5 - 1.5 },  // Position
-                1e5                      // Radius
+            QuadGeometry {
+                Vec { -5.0, 0.0, -1.5 }, // Corner
+                Vec { 10.0, 0.0, 0.0 },  // Edge
+                Vec { 0.0, 5.0, 0.0 }   // Edge
             }
         },
 
@@ -166,9 +172,10 @@ namespace pbr
                 Colorf { 0.0, 0.0, 0.0 },  // Emission
                 new DiffuseBRDF
             ),
-            SphereGeometry {
-                Vec { -1e5 - 5, 0.0, 0.0 },  // Position
-                1e5                      // Radius
+            QuadGeometry {
+                Vec { -5.0, 0.0, -1.5 }, // Corner
+                Vec { 0.0, 5.0, 0.0 },  // Edge
+                Vec { 0.0, 0.0, 11.5 }   // Edge
             }
         },
 
@@ -179,9 +186,10 @@ namespace pbr
                 Colorf { 0.0, 0.0, 0.0 },  // Emission
                 new DiffuseBRDF
             ),
-            SphereGeometry {
-                Vec { 1e5 + 5, 0.0, 0.0 },  // Position
-                1e5                      // Radius
+            QuadGeometry {
+                Vec { 5.0, 0.0, -1.5 }, // Corner
+                Vec { 0.0, 0.0, 11.5 },  // Edge
+                Vec { 0.0, 5.0, 0.0 }   // Edge
             }
         },
 
@@ -192,10 +200,99 @@ namespace pbr
                 Colorf { 0.0, 0.0, 0.0 },  // Emission
                 new DiffuseBRDF
             ),
-            SphereGeometry {
-                Vec { 0.0, 1e5 + 5, 0.0 },  // Position
-                1e5                      // Radius
+            QuadGeometry {
+                Vec { -5.0, 5.0, -1.5 }, // Corner
+                Vec { 10.0, 0.0, 0.0 },  // Edge
+                Vec { 0.0, 0.0, 11.5 }   // Edge
+            }
+        },
+
+        // Front
+        Actor {
+            std::make_shared<Material>(
+                Colorf { 1.0, 1.0, 1.0 }, // Color
+                Colorf { 0.0, 0.0, 0.0 },  // Emission
+                new DiffuseBRDF
+            ),
+            QuadGeometry {
+                Vec { -5.0, 0.0, 10.0 }, // Corner
+                Vec { 0.0, 5.0, 0.0 },  // Edge
+                Vec { 10.0, 0.0, 0.0 }   // Edge
             }
         }
     };
+
+    void set_sphere(Scene& scene, size_t index, const SphereGeometry& sphere)
+    {
+        auto* shape = std::get_if<SphereGeometry>(&scene.at(index).geometry);
+        if (!shape) throw std::invalid_argument("Actor " + std::to_string(index) + " is not a sphere");
+        *shape = sphere;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+    // TESTS
+    ///////////////////////////////////////////////////////////////////////////////
+
+    TEST_CASE("scene::QuadGeometry::intersect")
+    {
+        QuadGeometry quad { Vec { -1, 0, -1 }, Vec { 0, 0, 2 }, Vec { 2, 0, 0 } };
+        double t;
+
+        CHECK(quad.intersect(Ray { Vec { 0.5, 1, 0.5 }, Vec { 0, -1, 0 } }, t));
+        CHECK(t == 1);
+        CHECK(quad.normal_at(Vec { 0.5, 0, 0.5 }) == Vec { 0, 1, 0 });
+
+        // Outside the edges, behind the origin and parallel to the surface
+        CHECK_FALSE(quad.intersect(Ray { Vec { 1.5, 1, 0 }, Vec { 0, -1, 0 } }, t));
+        CHECK_FALSE(quad.intersect(Ray { Vec { 0, 1, 0 }, Vec { 0, 1, 0 } }, t));
+        CHECK_FALSE(quad.intersect(Ray { Vec { 0, 1, 0 }, Vec { 1, 0, 0 } }, t));
+    }
+
+    TEST_CASE("scene::InstanceGeometry::intersect")
+    {
+        auto mesh = std::make_shared<TriangleMesh>();
+        mesh->positions = { { -1, -1, 0 }, { 1, -1, 0 }, { 0, 1, 0 } };
+        mesh->indices = { 0, 1, 2 };
+        mesh->build();
+
+        // Stand the triangle up facing +x, twice as large, and move it to x = 5
+        Transform to_world = Transform::translate({ 5, 0, 0 }) * Transform::rotate({ 0, 1, 0 }, 90) * Transform::scale({ 2, 2, 2 });
+        auto material = std::make_shared<Material>(PBR_COLOR_WHITE, PBR_COLOR_BLACK, new DiffuseBRDF);
+        Actor actor { material, InstanceGeometry { mesh, to_world } };
+
+        AABB bounds = actor.bounds();
+        CHECK(bounds.min.x == doctest::Approx(5));
+        CHECK(bounds.max.y == doctest::Approx(2));
+
+        HitResult hit;
+        REQUIRE(actor.intersect(Ray { Vec { 0, 1.5, 0 }, Vec { 1, 0, 0 } }, hit));
+        CHECK(hit.param == doctest::Approx(5));
+        CHECK(hit.point.y == doctest::Approx(1.5));
+
+        // The ray comes from behind the winding normal, which is turned towards it
+        CHECK(hit.normal.x == doctest::Approx(-1));
+        REQUIRE(actor.intersect(Ray { Vec { 10, 1.5, 0 }, Vec { -1, 0, 0 } }, hit));
+        CHECK(hit.normal.x == doctest::Approx(1));
+
+        // Inside the scaled triangle but outside the original one
+        CHECK_FALSE(actor.intersect(Ray { Vec { 0, 2.5, 0 }, Vec { 1, 0, 0 } }, hit));
+    }
+
+    TEST_CASE("scene::MeshGeometry::normal")
+    {
+        auto mesh = std::make_shared<TriangleMesh>();
+        mesh->positions = { { -1, -1, 0 }, { 1, -1, 0 }, { 0, 1, 0 } };
+        mesh->indices = { 0, 1, 2 };
+        mesh->build();
+
+        auto material = std::make_shared<Material>(PBR_COLOR_WHITE, PBR_COLOR_BLACK, new DiffuseBRDF);
+        Actor actor { material, MeshGeometry { mesh } };
+
+        // Open meshes are seen from both sides, and the normal always faces the ray
+        HitResult hit;
+        REQUIRE(actor.intersect(Ray { Vec { 0, 0, 2 }, Vec { 0, 0, -1 } }, hit));
+        CHECK(hit.normal == Vec { 0, 0, 1 });
+        REQUIRE(actor.intersect(Ray { Vec { 0, 0, -2 }, Vec { 0, 0, 1 } }, hit));
+        CHECK(hit.normal == Vec { 0, 0, -1 });
+    }
 }
@@ -2,6 +2,10 @@
 
 #include <core/math_definitions.h>
 #include <materials/material.h>
+#include <accel/aabb.h>
+#include "mesh.h"
+
+#include <variant>
 
 namespace pbr
 {
@@ -11,7 +15,25 @@ namespace pbr
         Vec center;
         double radius;
 
-        bool intersect(const Ray& ray, Vec& point) const
+        /** Whether the sphere blocks the ray before tmax, without computing the hit point. */
+        bool occludes(const Ray& ray, double tmax) const
+        {
+            double t;
+            return intersect(ray, t) && t < tmax;
+        }
+
+        Vec normal_at(const Point& point) const
+        {
+            return normalize(point - center);
+        }
+
+        AABB bounds() const
+        {
+            return { center - Vec { radius }, center + Vec { radius } };
+        }
+
+        /** Ray parameter of the hit in front of the ray origin. The point and normal are left for the closest hit. */
+        bool intersect(const Ray& ray, double& t) const
         {
             // For intersection, solve
             // |(o + t*dir) - position| = radius
@@ -31,15 +53,14 @@ namespace pbr
             double t1 = (-1 * B + D) / (2 * A);
             double t2 = (-1 * B - D) / (2 * A);
 
-            // returns distance, 0 if nohit
             if (t1 > PBR_EPSILON && t1 < t2)
             {
-                point = ray.origin + ray.direction * t1;
+                t = t1;
                 return true;
             }
             else if (t2 > PBR_EPSILON)
             {
-                point = ray.origin + ray.direction * t2;
+                t = t2;
                 return true;
             }
             else
@@ -49,22 +70,190 @@ namespace pbr
         }
     };
 
+    /** Structure that represents an infinite plane through `point`, facing `normal`. */
+    struct PlaneGeometry
+    {
+        Point point;
+        Direction normal;
+
+        PlaneGeometry(const Point& point_, const Direction& normal_)
+            : point(point_), normal(normalize(normal_)) {}
+
+        /** Whether the plane blocks the ray before tmax, without computing the hit point. */
+        bool occludes(const Ray& ray, double tmax) const
+        {
+            double t;
+            return intersect(ray, t) && t < tmax;
+        }
+
+        Vec normal_at(const Point&) const
+        {
+            return normal;
+        }
+
+        /** Planes are unbounded, this box covers all of space. */
+        AABB bounds() const
+        {
+            return { Vec { -PBR_INF }, Vec { PBR_INF } };
+        }
+
+        /** Ray parameter of the hit in front of the ray origin */
+        bool intersect(const Ray& ray, double& t) const
+        {
+            // Solve (o + t*dir - point).n = 0
+            double denom = dot(ray.direction, normal);
+            if (denom == 0) return false; // parallel to the plane
+
+            t = dot(point - ray.origin, normal) / denom;
+            return t > PBR_EPSILON;
+        }
+    };
+
+    /*!
+    * @brief Structure that represents a parallelogram with one corner at `corner` and sides `edge_u` and `edge_v`
+    *
+    * Axis-aligned rectangles are the common case, with `edge_u` and `edge_v` along two of the axes.
+    * The surface faces along cross(edge_u, edge_v).
+    */
+    struct QuadGeometry
+    {
+        Point corner;
+        Vec edge_u, edge_v;
+
+        QuadGeometry(const Point& corner_, const Vec& edge_u_, const Vec& edge_v_)
+            : corner(corner_), edge_u(edge_u_), edge_v(edge_v_)
+        {
+            Vec n = cross(edge_u, edge_v);
+            normal = normalize(n);
+            w = n / n.sqlen();
+        }
+
+        /** Ray parameter of the hit in front of the ray origin */
+        bool intersect(const Ray& ray, double& t) const
+        {
+            Point p;
+            return solve(ray, t, p);
+        }
+
+        /** Whether the quad blocks the ray before tmax. */
+        bool occludes(const Ray& ray, double tmax) const
+        {
+            double t;
+            Point p;
+            return solve(ray, t, p) && t < tmax;
+        }
+
+        Vec normal_at(const Point&) const
+        {
+            return normal;
+        }
+
+        AABB bounds() const
+        {
+            AABB box;
+            box.expand(corner);
+            box.expand(corner + edge_u);
+            box.expand(corner + edge_v);
+            box.expand(corner + edge_u + edge_v);
+
+            // Pad flat axes so that the box has volume
+            box.min = box.min - Vec { PBR_EPSILON };
+            box.max = box.max + Vec { PBR_EPSILON };
+            return box;
+        }
+
+    private:
+        Direction normal;
+
+        /** n / |n|^2 for n = cross(edge_u, edge_v), projects hits onto the edges */
+        Vec w;
+
+        /** Ray parameter and point of the hit in front of the ray origin. The point is needed for the edge test anyway. */
+        bool solve(const Ray& ray, double& t, Point& p) const
+        {
+            double denom = dot(ray.direction, normal);
+            if (denom == 0) return false; // parallel to the quad
+
+            t = dot(corner - ray.origin, normal) / denom;
+            if (t <= PBR_EPSILON) return false;
+
+            // Express the hit in the (edge_u, edge_v) frame and check that both coordinates are in [0, 1]
+            p = ray.origin + ray.direction * t;
+            Vec h = p - corner;
+            double a = dot(w, cross(h, edge_v));
+            double b = dot(w, cross(edge_u, h));
+            return a >= 0 && a <= 1 && b >= 0 && b <= 1;
+        }
+    };
+
+    /** Structure that represents a triangle mesh placed in the scene as it is. The mesh can be shared between actors. */
+    struct MeshGeometry
+    {
+        std::shared_ptr<const TriangleMesh> mesh;
+
+        AABB bounds() const
+        {
+            return mesh->bounds();
+        }
+    };
+
+    /*!
+    * @brief Structure that represents a transformed copy of a shared triangle mesh
+    *
+    * The mesh and its hierarchy stay in object space and are never copied, so thousands of instances
+    * of one mesh cost a transform each. Rays are moved into object space to search the mesh.
+    */
+    struct InstanceGeometry
+    {
+        std::shared_ptr<const TriangleMesh> mesh;
+
+        InstanceGeometry(std::shared_ptr<const TriangleMesh> mesh_, const Transform& to_world)
+            : mesh(std::move(mesh_)), to_object(to_world.inverse()), world_bounds(mesh->bounds().transformed(to_world)) {}
+
+        AABB bounds() const
+        {
+            return world_bounds;
+        }
+
+        /** World-to-object transform */
+        Transform to_object;
+
+    private:
+        AABB world_bounds;
+    };
+
+    /** All the shapes an actor can have. */
+    using Geometry = std::variant<SphereGeometry, PlaneGeometry, QuadGeometry, MeshGeometry, InstanceGeometry>;
+
     struct Actor;
 
-    /** Information required from each intersection. */
+    /*!
+    * @brief Information required from each intersection
+    *
+    * The closest-hit search only records `param`, `actor` and, for meshes, `primitive` and `barycentric`.
+    * Actor::finish_hit fills in the point and normal once, for the closest hit.
+    */
     struct HitResult
     {
         double param;
         Vec point;
+
+        /** Geometric normal of the surface */
         Vec normal;
         const Actor* actor;
+
+        /** Triangle that was hit, for meshes */
+        uint32_t primitive = 0;
+
+        /** Weights of the second and third vertex of the triangle, for meshes */
+        Point2D barycentric;
     };
 
     /** An object that can be placed in the scene. Contains material and geometry for the object. */
     struct Actor
     {
         std::shared_ptr<Material> material;
-        SphereGeometry geometry;
+        Geometry geometry;
 
         /*!
         * @brief Calculate ray intersection with the geometry for this actor
@@ -75,25 +264,145 @@ namespace pbr
         */
         bool intersect(const Ray& ray, HitResult& hit) const
         {
-            Vec point;
-            if (geometry.intersect(ray, point))
-            {
-                hit.param = (point - ray.origin).len() / ray.direction.len();
-                hit.point = point;
-                hit.actor = this;
-                hit.normal = normalize(hit.point - geometry.center);
-                return true;
-            }
-            else
-            {
-                return false;
-            }
+            double tmax = PBR_INF;
+            if (!find_hit(ray, tmax, hit)) return false;
+
+            finish_hit(ray, hit);
+            return true;
+        }
+
+        /*!
+        * @brief One step of a closest-hit search, which leaves the point and normal for finish_hit()
+        *
+        * @param ray Ray that will intersect this object
+        * @param tmax Closest hit so far, shrunk to this actor's hit if it is closer
+        * @param hit Gets the parameter, actor and primitive of a closer hit, and is left alone otherwise
+        * @return bool Indicates if the ray hits this actor closer than tmax
+        */
+        bool find_hit(const Ray& ray, double& tmax, HitResult& hit) const
+        {
+            return std::visit([&](const auto& shape) { return find_shape_hit(shape, ray, tmax, hit); }, geometry);
+        }
+
+        /** Compute the point and normal of a hit found by find_hit(). Called on `hit.actor` once the closest hit is known. */
+        void finish_hit(const Ray& ray, HitResult& hit) const
+        {
+            hit.point = ray.origin + ray.direction * hit.param;
+            hit.normal = std::visit([&](const auto& shape) { return shape_normal(shape, ray, hit); }, geometry);
+        }
+
+        /*!
+        * @brief Check whether the actor blocks the ray, without computing any hit attributes
+        *
+        * @param ray Ray to test
+        * @param tmax Far end of the segment, in units of the ray parameter
+        * @return bool Indicates if the ray hits this actor closer than tmax
+        */
+        bool occluded(const Ray& ray, double tmax) const
+        {
+            return std::visit([&](const auto& shape) { return occludes_shape(shape, ray, tmax); }, geometry);
+        }
+
+        AABB bounds() const
+        {
+            return std::visit([](const auto& shape) { return shape.bounds(); }, geometry);
+        }
+
+        /** Unbounded actors (planes) cannot be placed in a bounding volume hierarchy. */
+        bool bounded() const
+        {
+            return !std::holds_alternative<PlaneGeometry>(geometry);
+        }
+
+    private:
+        /** Analytic shapes only solve for the ray parameter */
+        template <class Shape>
+        bool find_shape_hit(const Shape& shape, const Ray& ray, double& tmax, HitResult& hit) const
+        {
+            double t;
+            if (!shape.intersect(ray, t) || t >= tmax) return false;
+
+            tmax = t;
+            hit.param = t;
+            hit.actor = this;
+            return true;
+        }
+
+        /** Meshes search their own hierarchy up to tmax, which also prunes it */
+        bool find_shape_hit(const MeshGeometry& shape, const Ray& ray, double& tmax, HitResult& hit) const
+        {
+            if (!shape.mesh->intersect(ray, tmax, hit.primitive, hit.barycentric)) return false;
+
+            hit.param = tmax;
+            hit.actor = this;
+            return true;
+        }
+
+        /** Instances search their mesh in object space. t is the same in both spaces. */
+        bool find_shape_hit(const InstanceGeometry& shape, const Ray& ray, double& tmax, HitResult& hit) const
+        {
+            if (!shape.mesh->intersect(shape.to_object.ray(ray), tmax, hit.primitive, hit.barycentric)) return false;
+
+            hit.param = tmax;
+            hit.actor = this;
+            return true;
+        }
+
+        template <class Shape>
+        Vec shape_normal(const Shape& shape, const Ray&, const HitResult& hit) const
+        {
+            return shape.normal_at(hit.point);
+        }
+
+        /** Triangle normals follow the winding, and open meshes are seen from both sides, so it is turned towards the ray */
+        static Vec facing_ray(const Vec& normal, const Ray& ray)
+        {
+            return dot(normal, ray.direction) > 0 ? normal * -1 : normal;
+        }
+
+        Vec shape_normal(const MeshGeometry& shape, const Ray& ray, const HitResult& hit) const
+        {
+            return facing_ray(shape.mesh->normal(hit.primitive), ray);
+        }
+
+        /** Only the normal needs to come back from object space */
+        Vec shape_normal(const InstanceGeometry& shape, const Ray& ray, const HitResult& hit) const
+        {
+            return facing_ray(normalize(shape.to_object.transpose_vector(shape.mesh->normal(hit.primitive))), ray);
+        }
+
+        template <class Shape>
+        bool occludes_shape(const Shape& shape, const Ray& ray, double tmax) const
+        {
+            return shape.occludes(ray, tmax);
+        }
+
+        bool occludes_shape(const MeshGeometry& shape, const Ray& ray, double tmax) const
+        {
+            return shape.mesh->occluded(ray, tmax);
+        }
+
+        bool occludes_shape(const InstanceGeometry& shape, const Ray& ray, double tmax) const
+        {
+            return shape.mesh->occluded(shape.to_object.ray(ray), tmax);
         }
     };
 
     /** Scene alias for convenience. */
     using Scene = std::vector<Actor>;
 
+    /*!
+    * @brief Move or resize the sphere of an actor in place, for scenes animated frame by frame
+    *
+    * Accelerators built over the scene pick the change up in BaseAccelerator::update(), which is cheaper than a build.
+    * Throws std::invalid_argument if the actor is not a sphere.
+    *
+    * @param scene Scene that holds the actor
+    * @param index Position of the actor in the scene
+    * @param sphere New center and radius
+    */
+    void set_sphere(Scene& scene, size_t index, const SphereGeometry& sphere);
+
     //// These are externs and defined in scene.cpp because we're going to pass pointers and such
     //// So I don't want this to be defined in each translation unit separately.
 
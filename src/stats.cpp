@@ -0,0 +1,75 @@
+#include "stats.h"
+#include "debug.h"
+
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+namespace pbr::stats
+{
+    static const char* NAMES[COUNTER_COUNT] = {
+        "Closest-hit queries",
+        "BVH nodes visited",
+        "Occlusion queries",
+        "Occluded rays",
+        "BVH nodes visited (any-hit)",
+        "Rays traced in packets",
+        "BVH nodes visited (packets)",
+        "Rays traced in streams",
+        "BVH nodes visited (streams)",
+    };
+
+    // Counters of live threads, and the totals of threads that have exited
+    static std::mutex registry_mutex;
+    static std::vector<ThreadCounters*> registry;
+    static uint64_t retired[COUNTER_COUNT] {};
+
+    ThreadCounters::ThreadCounters()
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        registry.push_back(this);
+    }
+
+    ThreadCounters::~ThreadCounters()
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for (int i = 0; i < COUNTER_COUNT; ++i)
+        {
+            retired[i] += values[i].load(std::memory_order_relaxed);
+        }
+        registry.erase(std::remove(registry.begin(), registry.end(), this), registry.end());
+    }
+
+    uint64_t total(Counter counter)
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        uint64_t sum = retired[counter];
+        for (const auto* counters : registry)
+        {
+            sum += counters->values[counter].load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for (int i = 0; i < COUNTER_COUNT; ++i)
+        {
+            retired[i] = 0;
+            for (auto* counters : registry)
+            {
+                counters->values[i].store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void print()
+    {
+        LOG_INFO("Statistics:");
+        for (int i = 0; i < COUNTER_COUNT; ++i)
+        {
+            LOG_INFO("  %-28s %llu", NAMES[i], (unsigned long long) total((Counter) i));
+        }
+    }
+}
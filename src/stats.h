@@ -0,0 +1,64 @@
+#pragma once
+
+#include "config.h"
+#include <atomic>
+#include <cstdint>
+
+///////////////////////////////////////////////////////////////////////////////
+// Render statistics. Every thread counts into its own slots, so counting
+// never contends. The totals are summed over all threads when printed.
+///////////////////////////////////////////////////////////////////////////////
+
+namespace pbr::stats
+{
+    enum Counter
+    {
+        CLOSEST_HIT_QUERIES,
+        NODES_VISITED,
+        OCCLUSION_QUERIES,
+        OCCLUDED_RAYS,
+        OCCLUSION_NODES_VISITED,
+        PACKET_RAYS,
+        PACKET_NODES_VISITED,
+        STREAM_RAYS,
+        STREAM_NODES_VISITED,
+
+        COUNTER_COUNT
+    };
+
+    struct ThreadCounters
+    {
+        std::atomic<uint64_t> values[COUNTER_COUNT] {};
+
+        ThreadCounters();
+        ~ThreadCounters();
+    };
+
+    inline ThreadCounters& local()
+    {
+        thread_local ThreadCounters counters;
+        return counters;
+    }
+
+    /** Add to a counter of this thread. Only this thread writes to it, so a relaxed load and store suffice. */
+    inline void add(Counter counter, uint64_t n)
+    {
+        auto& value = local().values[counter];
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    /** Sum of a counter over all threads. */
+    uint64_t total(Counter counter);
+
+    /** Zero every counter of every thread. Only call when no thread is counting. */
+    void reset();
+
+    /** Log the totals of all counters. */
+    void print();
+}
+
+#if PBR_COLLECT_STATS
+    #define PBR_STAT_ADD(COUNTER, N) pbr::stats::add(pbr::stats::COUNTER, N)
+#else
+    #define PBR_STAT_ADD(COUNTER, N)
+#endif
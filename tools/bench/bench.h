@@ -0,0 +1,222 @@
+#pragma once
+
+#include <pbr.h>
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+
+namespace bench
+{
+    using namespace pbr;
+
+    /** Wall-clock stopwatch, started on construction. */
+    struct Timer
+    {
+        using Clock = std::chrono::steady_clock;
+        Clock::time_point start = Clock::now();
+
+        double seconds() const
+        {
+            return std::chrono::duration<double>(Clock::now() - start).count();
+        }
+    };
+
+    /** A procedural scene of `count` randomly placed spheres inside a cube of side `extent`. */
+    inline Scene make_random_spheres(size_t count, double extent = 100.0, unsigned seed = 1)
+    {
+        std::mt19937 gen(seed);
+        std::uniform_real_distribution<> position(-extent / 2, extent / 2);
+
+        // Keep the density roughly constant so that larger scenes are not just more occluded
+        double mean_radius = extent / (4 * std::cbrt((double) count));
+        std::uniform_real_distribution<> radius(0.25 * mean_radius, 1.75 * mean_radius);
+
+        auto material = std::make_shared<Material>(PBR_COLOR_WHITE, PBR_COLOR_BLACK, new DiffuseBRDF);
+
+        Scene scene;
+        scene.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            Vec center { position(gen), position(gen), position(gen) };
+            scene.push_back(Actor { material, SphereGeometry { center, radius(gen) } });
+        }
+        return scene;
+    }
+
+    /** A bumpy UV sphere of radius about 1.5 centered at (0, 1.5, 0), with 2 * rings * segments triangles. */
+    inline std::shared_ptr<TriangleMesh> make_bumpy_sphere(int rings, int segments)
+    {
+        auto mesh = std::make_shared<TriangleMesh>();
+        for (int r = 0; r <= rings; ++r)
+        {
+            double theta = PBR_PI * r / rings;
+            for (int s = 0; s < segments; ++s)
+            {
+                double phi = 2 * PBR_PI * s / segments;
+                double radius = 1.5 + 0.05 * std::sin(12 * theta) * std::sin(12 * phi);
+                mesh->positions.emplace_back(
+                    radius * std::sin(theta) * std::cos(phi),
+                    1.5 + radius * std::cos(theta),
+                    radius * std::sin(theta) * std::sin(phi)
+                );
+            }
+        }
+
+        for (int r = 0; r < rings; ++r)
+        {
+            for (int s = 0; s < segments; ++s)
+            {
+                uint32_t a = r * segments + s;
+                uint32_t b = r * segments + (s + 1) % segments;
+                uint32_t c = a + segments;
+                uint32_t d = b + segments;
+                mesh->indices.insert(mesh->indices.end(), { a, b, c, b, d, c });
+            }
+        }
+
+        mesh->build();
+        return mesh;
+    }
+
+    /** Rays from random points on a sphere of radius `distance` aimed at random points near the origin. */
+    inline std::vector<Ray> make_random_rays(size_t count, double distance, unsigned seed = 2)
+    {
+        std::mt19937 gen(seed);
+        std::normal_distribution<> normal;
+        std::uniform_real_distribution<> target(-distance / 4, distance / 4);
+
+        std::vector<Ray> rays;
+        rays.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            Vec origin = normalize(Vec { normal(gen), normal(gen), normal(gen) }) * distance;
+            Vec to = { target(gen), target(gen), target(gen) };
+            rays.push_back(Ray { origin, normalize(to - origin) });
+        }
+        return rays;
+    }
+
+    /** Trace all rays through the accelerator and return the throughput in rays per second. */
+    inline double measure_rays_per_second(const BaseAccelerator& accelerator, const std::vector<Ray>& rays)
+    {
+        size_t hits = 0;
+        Timer timer;
+        for (const auto& ray : rays)
+        {
+            HitResult hit;
+            hits += accelerator.intersect(ray, hit);
+        }
+        double elapsed = timer.seconds();
+
+        // Keep the loop from being optimized away
+        if (hits > rays.size()) std::printf("unreachable\n");
+        return rays.size() / elapsed;
+    }
+
+    /** Render the scene single-threaded at a reduced resolution and return the wall-clock time in seconds. */
+    inline double measure_render_seconds(const Scene& scene, int rows, int cols, int spp)
+    {
+        Camera camera;
+        camera.position = PBR_CAMERA_POSITION;
+        camera.look_at = PBR_CAMERA_LOOKAT;
+        camera.fov = PBR_CAMERA_FOV_DEG;
+        camera.calculate_basis((double) cols / rows);
+
+        PathIntegrator integrator;
+        UniformRNG rng;
+
+        Timer timer;
+        integrator.set_scene(&scene);
+
+        Colorf sum;
+        for (int row = 0; row < rows; ++row)
+        {
+            for (int col = 0; col < cols; ++col)
+            {
+                for (int i = 0; i < spp; ++i)
+                {
+                    auto sample = rng.sample_disk();
+                    double x = ((col + 0.5 + sample.x / 2) / cols) * 2 - 1;
+                    double y = ((row + 0.5 + sample.y / 2) / rows) * 2 - 1;
+                    sum = sum + integrator.trace_ray(camera.get_ray(x, y), 0);
+                }
+            }
+        }
+        double elapsed = timer.seconds();
+
+        if (sum.x < 0) std::printf("unreachable\n");
+        return elapsed;
+    }
+
+    /** Camera at the configured position and target, for an image of rows x cols pixels */
+    inline Camera make_camera(int rows, int cols)
+    {
+        Camera camera;
+        camera.position = PBR_CAMERA_POSITION;
+        camera.look_at = PBR_CAMERA_LOOKAT;
+        camera.fov = PBR_CAMERA_FOV_DEG;
+        camera.calculate_basis((double) cols / rows);
+        return camera;
+    }
+
+    /** Mean radiance of every pixel over `spp` samples, single-threaded */
+    inline std::vector<Colorf> render_radiance(PathIntegrator& integrator, const Camera& camera, int rows, int cols, int spp)
+    {
+        UniformRNG rng;
+        std::vector<Colorf> image((size_t) rows * cols);
+        for (int row = 0; row < rows; ++row)
+        {
+            for (int col = 0; col < cols; ++col)
+            {
+                Colorf sum;
+                for (int i = 0; i < spp; ++i)
+                {
+                    auto sample = rng.sample_disk();
+                    double x = ((col + 0.5 + sample.x / 2) / cols) * 2 - 1;
+                    double y = ((row + 0.5 + sample.y / 2) / rows) * 2 - 1;
+                    sum = sum + integrator.trace_ray(camera.get_ray(x, y), 0);
+                }
+                image[(size_t) row * cols + col] = sum / spp;
+            }
+        }
+        return image;
+    }
+
+    /** Root mean square error over the channels of all pixels */
+    inline double image_rmse(const std::vector<Colorf>& image, const std::vector<Colorf>& reference)
+    {
+        double squared = 0;
+        for (size_t i = 0; i < image.size(); ++i)
+        {
+            Colorf d = image[i] - reference[i];
+            squared += d.x * d.x + d.y * d.y + d.z * d.z;
+        }
+        return std::sqrt(squared / (3 * image.size()));
+    }
+
+    // Individual benchmarks, selected by name from the command line
+    void bvh_scaling();
+    void cornell_walls();
+    void mesh_preview();
+    void instancing();
+    void wide_bvh();
+    void occlusion();
+    void build_scaling();
+    void bvh_cache();
+    void deferred_hits();
+    void packets();
+    void streams();
+    void morton_build();
+    void refit();
+    void quantized();
+    void spatial_splits();
+    void node_layout();
+    void grid();
+    void lazy_build();
+    void preview();
+    void roulette();
+    void next_event();
+    void mis();
+    void many_lights();
+}
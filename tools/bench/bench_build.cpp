@@ -0,0 +1,64 @@
+#include "bench.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace bench
+{
+    /** Build time, node count and SAH cost of the full sweep and binned builders, from 1k to 10M primitives. */
+    void build_scaling()
+    {
+#ifdef _OPENMP
+        int max_threads = omp_get_max_threads();
+#else
+        int max_threads = 1;
+#endif
+        std::vector<int> thread_counts;
+        for (int threads = 1; threads < max_threads; threads *= 2) thread_counts.push_back(threads);
+        thread_counts.push_back(max_threads);
+        std::printf("OpenMP threads: %d\n", max_threads);
+
+        std::printf("%10s %12s %8s %12s %10s %10s\n", "prims", "method", "threads", "build (ms)", "nodes", "SAH cost");
+
+        for (size_t count : { 1000, 10000, 100000, 1000000, 10000000 })
+        {
+            // Small boxes of random size, like the triangles of a scanned mesh
+            std::mt19937 gen(9);
+            std::uniform_real_distribution<> position(-100.0, 100.0);
+            std::uniform_real_distribution<> size(0.0, 200.0 / std::cbrt((double) count));
+            std::vector<AABB> bounds(count);
+            for (auto& box : bounds)
+            {
+                Vec corner { position(gen), position(gen), position(gen) };
+                box = { corner, corner + Vec { size(gen), size(gen), size(gen) } };
+            }
+
+            // The full sweep is single-threaded and too slow past a million primitives
+            if (count <= 1000000)
+            {
+                BVH bvh;
+                Timer timer;
+                bvh.build(bounds, 1, BVHBuildMethod::FULL_SWEEP);
+                double ms = timer.seconds() * 1000;
+                std::printf("%10zu %12s %8d %12.1f %10zu %10.2f\n", count, "full sweep", 1, ms, bvh.nodes.size(), bvh.sah_cost());
+            }
+
+            for (int threads : thread_counts)
+            {
+#ifdef _OPENMP
+                omp_set_num_threads(threads);
+#endif
+                BVH bvh;
+                Timer timer;
+                bvh.build(bounds, 1, BVHBuildMethod::BINNED);
+                double ms = timer.seconds() * 1000;
+                std::printf("%10zu %12s %8d %12.1f %10zu %10.2f\n", count, "binned", threads, ms, bvh.nodes.size(), bvh.sah_cost());
+            }
+        }
+
+#ifdef _OPENMP
+        omp_set_num_threads(max_threads);
+#endif
+    }
+}
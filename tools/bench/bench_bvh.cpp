@@ -0,0 +1,34 @@
+#include "bench.h"
+
+namespace bench
+{
+    /** Rays per second against actor count, linear scan versus SAH BVH. */
+    void bvh_scaling()
+    {
+        std::printf("Sphere kernel: %s\n", SpherePack::kernel_name());
+        std::printf("%10s %12s %14s %14s %10s\n", "actors", "build (ms)", "linear (r/s)", "bvh (r/s)", "speedup");
+
+        for (size_t count : { 10, 100, 1000, 10000, 50000 })
+        {
+            Scene scene = make_random_spheres(count);
+
+            // The linear scan gets fewer rays for large scenes so that the run stays short
+            size_t linear_rays = std::max<size_t>(200, 2000000 / count);
+            auto rays = make_random_rays(std::max<size_t>(linear_rays, 100000), 150.0);
+            std::vector<Ray> linear_subset(rays.begin(), rays.begin() + linear_rays);
+
+            LinearAccelerator linear;
+            linear.build(scene);
+
+            Timer build_timer;
+            BVHAccelerator bvh;
+            bvh.build(scene);
+            double build_ms = build_timer.seconds() * 1000;
+
+            double linear_rps = measure_rays_per_second(linear, linear_subset);
+            double bvh_rps = measure_rays_per_second(bvh, rays);
+
+            std::printf("%10zu %12.2f %14.0f %14.0f %9.1fx\n", count, build_ms, linear_rps, bvh_rps, bvh_rps / linear_rps);
+        }
+    }
+}
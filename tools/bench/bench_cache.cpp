@@ -0,0 +1,59 @@
+#include "bench.h"
+
+#include <filesystem>
+
+namespace bench
+{
+    /** Time to build a BVH against writing it to the cache and mapping it back, from 100k to 4M primitives. */
+    void bvh_cache()
+    {
+        auto directory = std::filesystem::temp_directory_path() / "pbr_bench_bvh_cache";
+        std::filesystem::create_directories(directory);
+        std::string path = (directory / "bench.bvh").string();
+
+        std::printf("%10s %10s %12s %10s %10s %12s %10s\n",
+                    "prims", "key (ms)", "build (ms)", "save (ms)", "map (ms)", "+touch (ms)", "file (MB)");
+
+        for (size_t count : { 100000, 1000000, 4000000 })
+        {
+            std::mt19937 gen(9);
+            std::uniform_real_distribution<> position(-100.0, 100.0);
+            std::uniform_real_distribution<> size(0.0, 200.0 / std::cbrt((double) count));
+            std::vector<AABB> bounds(count);
+            for (auto& box : bounds)
+            {
+                Vec corner { position(gen), position(gen), position(gen) };
+                box = { corner, corner + Vec { size(gen), size(gen), size(gen) } };
+            }
+
+            Timer key_timer;
+            uint64_t key = bvh_cache_key(bounds, 1, PBR_BVH_BUILD_METHOD);
+            double key_ms = key_timer.seconds() * 1000;
+
+            BVH built;
+            Timer build_timer;
+            built.build(bounds);
+            double build_ms = build_timer.seconds() * 1000;
+
+            Timer save_timer;
+            built.save(path, key);
+            double save_ms = save_timer.seconds() * 1000;
+
+            BVH loaded;
+            Timer map_timer;
+            bool ok = loaded.load(path, key, bounds.size());
+            double map_ms = map_timer.seconds() * 1000;
+
+            // Reading every node once pulls the whole file in, as the first frames of a render would
+            double cost = loaded.sah_cost();
+            double touch_ms = map_timer.seconds() * 1000;
+            if (!ok || cost != built.sah_cost()) std::printf("cache mismatch\n");
+
+            double mb = std::filesystem::file_size(path) / 1e6;
+            std::printf("%10zu %10.1f %12.1f %10.1f %10.3f %12.1f %10.1f\n",
+                        count, key_ms, build_ms, save_ms, map_ms, touch_ms, mb);
+        }
+
+        std::filesystem::remove_all(directory);
+    }
+}
@@ -0,0 +1,62 @@
+#include "bench.h"
+
+namespace bench
+{
+    /** Closest hit by a linear scan over overlapping spheres, with hit attributes computed for every candidate or for the winner only. */
+    void deferred_hits()
+    {
+        std::printf("%10s %14s %16s %16s %9s\n", "spheres", "hits per ray", "eager (r/s)", "deferred (r/s)", "speedup");
+
+        std::vector<Ray> rays = make_random_rays(200000, 20.0);
+        for (size_t count : { 16, 64, 256, 1024 })
+        {
+            // Spheres about as wide as the gaps between their centers, so most rays pass through many of them
+            std::mt19937 gen(4);
+            std::uniform_real_distribution<> position(-5.0, 5.0);
+            double radius = 10.0 / std::cbrt((double) count);
+            auto material = std::make_shared<Material>(PBR_COLOR_WHITE, PBR_COLOR_BLACK, new DiffuseBRDF);
+            Scene scene;
+            for (size_t i = 0; i < count; ++i)
+            {
+                scene.push_back(Actor { material, SphereGeometry { Vec { position(gen), position(gen), position(gen) }, radius } });
+            }
+
+            // Every candidate gets its point and normal, like a search that keeps whole HitResults
+            size_t candidates = 0;
+            double eager_sum = 0;
+            Timer eager_timer;
+            for (const auto& ray : rays)
+            {
+                HitResult closest;
+                closest.param = PBR_INF;
+                for (const auto& actor : scene)
+                {
+                    HitResult hit;
+                    if (actor.intersect(ray, hit))
+                    {
+                        ++candidates;
+                        if (hit.param < closest.param) closest = hit;
+                    }
+                }
+                eager_sum += closest.normal.x;
+            }
+            double eager_rps = rays.size() / eager_timer.seconds();
+
+            LinearAccelerator linear;
+            linear.build(scene);
+            double deferred_sum = 0;
+            Timer deferred_timer;
+            for (const auto& ray : rays)
+            {
+                HitResult hit;
+                if (linear.intersect(ray, hit)) deferred_sum += hit.normal.x;
+            }
+            double deferred_rps = rays.size() / deferred_timer.seconds();
+
+            if (std::abs(eager_sum - deferred_sum) > 1e-6 * rays.size()) std::printf("Searches disagree\n");
+
+            std::printf("%10zu %14.1f %16.0f %16.0f %8.2fx\n", count, (double) candidates / rays.size(),
+                        eager_rps, deferred_rps, deferred_rps / eager_rps);
+        }
+    }
+}
@@ -0,0 +1,235 @@
+#include "bench.h"
+
+#include <memory>
+#include <unordered_set>
+
+namespace bench
+{
+    /** Spheres of nearly the same radius spread evenly over a cube, like the particles of a simulation. */
+    static Scene make_particles(size_t count, double extent = 100.0)
+    {
+        std::mt19937 gen(3);
+        std::uniform_real_distribution<> position(-extent / 2, extent / 2);
+        double mean_radius = extent / (4 * std::cbrt((double) count));
+        std::uniform_real_distribution<> radius(0.9 * mean_radius, 1.1 * mean_radius);
+
+        auto material = std::make_shared<Material>(PBR_COLOR_WHITE, PBR_COLOR_BLACK, new DiffuseBRDF);
+        Scene scene;
+        scene.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            scene.push_back(Actor { material, SphereGeometry { Vec { position(gen), position(gen), position(gen) }, radius(gen) } });
+        }
+        return scene;
+    }
+
+    /** Similar spheres in a few clusters, each spread over `spread_ratio` of the extent, with the rest of the bounds left empty. */
+    static Scene make_clusters(size_t count, int clusters, double spread_ratio, double extent = 100.0)
+    {
+        std::mt19937 gen(4);
+        std::uniform_real_distribution<> position(-extent / 2, extent / 2);
+        std::normal_distribution<> spread(0, extent * spread_ratio);
+        double radius = extent * spread_ratio / ( std::cbrt((double) count / clusters));
+
+        std::vector<Vec> centers;
+        for (int i = 0; i < clusters; ++i) centers.push_back(Vec { position(gen), position(gen), position(gen) });
+
+        auto material = std::make_shared<Material>(PBR_COLOR_WHITE, PBR_COLOR_BLACK, new DiffuseBRDF);
+        Scene scene;
+        scene.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            Vec center = centers[i % clusters] + Vec { spread(gen), spread(gen), spread(gen) };
+            scene.push_back(Actor { material, SphereGeometry { center, radius } });
+        }
+        return scene;
+    }
+
+    /** Mostly small spheres with a few much larger ones among them, which a grid lists in many cells each. */
+    static Scene make_mixed_sizes(size_t count, double extent = 100.0)
+    {
+        std::mt19937 gen(5);
+        std::uniform_real_distribution<> position(-extent / 2, extent / 2);
+        std::uniform_real_distribution<> unit(0.0, 1.0);
+        double mean_radius = extent / (4 * std::cbrt((double) count));
+
+        auto material = std::make_shared<Material>(PBR_COLOR_WHITE, PBR_COLOR_BLACK, new DiffuseBRDF);
+        Scene scene;
+        scene.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            double r = (unit(gen) < 0.01) ? mean_radius * (10 + 20 * unit(gen)) : mean_radius * (0.5 + unit(gen));
+            scene.push_back(Actor { material, SphereGeometry { Vec { position(gen), position(gen), position(gen) }, r } });
+        }
+        return scene;
+    }
+
+    /** What the choice of structure is made from, all cheap to gather before building anything */
+    struct SceneStatistics
+    {
+        size_t bounded = 0;
+
+        /** Fraction of the cells of a grid with one cell per actor that hold an actor center */
+        double occupancy = 0;
+    };
+
+    static SceneStatistics gather_statistics(const Scene& scene)
+    {
+        SceneStatistics statistics;
+        AABB bounds;
+        for (const auto& actor : scene)
+        {
+            if (!actor.bounded()) continue;
+            bounds.expand(actor.bounds());
+            ++statistics.bounded;
+        }
+        if (statistics.bounded == 0) return statistics;
+
+        // Centers of an even spread land in about 1 - 1/e of the cells, clusters in far fewer
+        Vec extent = bounds.extent();
+        double side = std::cbrt(std::max(extent.x * extent.y * extent.z, 1e-30) / statistics.bounded);
+        std::unordered_set<uint64_t> occupied;
+        occupied.reserve(statistics.bounded);
+        for (const auto& actor : scene)
+        {
+            if (!actor.bounded()) continue;
+            Vec p = (actor.bounds().centroid() - bounds.min) / side;
+            occupied.insert((uint64_t) p.x | ((uint64_t) p.y << 21) | ((uint64_t) p.z << 42));
+        }
+        statistics.occupancy = (double) occupied.size() / statistics.bounded;
+        return statistics;
+    }
+
+    enum class Structure
+    {
+        BVH,
+        DENSE_GRID,
+        HASHED_GRID,
+    };
+
+    static const char* structure_name(Structure structure)
+    {
+        switch (structure)
+        {
+            case Structure::BVH: return "bvh";
+            case Structure::DENSE_GRID: return "dense grid";
+            case Structure::HASHED_GRID: return "hashed grid";
+        }
+        return "";
+    }
+
+    /*!
+    * @brief The structure expected to take the least time to build and then trace `rays` rays, from the scene statistics alone
+    *
+    * Grids build several times faster than a hierarchy, and trace faster through actors that fill the bounds evenly,
+    * even when some are much larger than the rest, at the cost of memory for the cells those overlap. Empty space
+    * costs a grid a step per cell where a hierarchy skips it at once, so for clustered actors the grids only win
+    * when there are too few rays to pay for the hierarchy. Dense grids pile tight clusters into a few crowded cells,
+    * which hashed grids split up.
+    */
+    static Structure pick_structure(const SceneStatistics& statistics, size_t rays)
+    {
+        if (statistics.bounded < 10000) return Structure::BVH;
+        if (statistics.occupancy >= 0.3) return Structure::DENSE_GRID;
+        if (rays > statistics.bounded) return Structure::BVH;
+        return (statistics.occupancy >= 0.01) ? Structure::DENSE_GRID : Structure::HASHED_GRID;
+    }
+
+    static std::unique_ptr<BaseAccelerator> make_structure(Structure structure)
+    {
+        switch (structure)
+        {
+            case Structure::BVH: return std::make_unique<BVHAccelerator>();
+            case Structure::DENSE_GRID: return std::make_unique<DenseGridAccelerator>();
+            case Structure::HASHED_GRID: return std::make_unique<HashedGridAccelerator>();
+        }
+        return nullptr;
+    }
+
+    /** Build and trace time of the BVH and both grids on sphere clouds, and which of them the scene statistics pick. */
+    void grid()
+    {
+        struct Case
+        {
+            const char* name;
+            std::function<Scene()> make;
+        };
+        const Case cases[] = {
+            { "particles", [] { return make_particles(100000); } },
+            { "particles", [] { return make_particles(1000000); } },
+            { "spheres", [] { return make_random_spheres(1000000); } },
+            { "mixed", [] { return make_mixed_sizes(1000000); } },
+            { "clusters", [] { return make_clusters(1000000, 16, 1.0 / 40); } },
+            { "tight", [] { return make_clusters(1000000, 4, 1.0 / 200); } },
+        };
+
+        // Rays traced per build, a 320 x 180 preview at one sample per pixel and a 1280 x 720 render at 16. Both are
+        // extrapolated from the speed on the measured rays.
+        const size_t budgets[] = { 320 * 180, 1280 * 720 * 16 };
+        const size_t ray_count = 200000;
+
+        std::printf("Rays are aimed at random actors. Totals are the build plus tracing %zu and %zu rays.\n", budgets[0], budgets[1]);
+        std::printf("%10s %8s %10s %12s %10s %8s %10s %10s %14s %14s\n", "scene", "actors", "occupancy",
+                    "structure", "build ms", "MB", "cells/ray", "rays/s", "preview ms", "render ms");
+
+        int right[2] = { 0, 0 };
+        for (const auto& c : cases)
+        {
+            Scene scene = c.make();
+            SceneStatistics statistics = gather_statistics(scene);
+
+            // Aim at the actors, as a camera framing the data would, rather than at empty space
+            std::mt19937 gen(6);
+            std::uniform_int_distribution<size_t> pick(0, scene.size() - 1);
+            std::vector<Ray> rays = make_random_rays(ray_count, 150.0);
+            for (auto& ray : rays)
+            {
+                ray.direction = normalize(scene[pick(gen)].bounds().centroid() - ray.origin);
+            }
+
+            Structure picked[2], best[2];
+            double picked_total[2] = { 0, 0 };
+            double best_total[2] = { PBR_INF, PBR_INF };
+            for (int b = 0; b < 2; ++b) picked[b] = pick_structure(statistics, budgets[b]);
+
+            for (Structure structure : { Structure::BVH, Structure::DENSE_GRID, Structure::HASHED_GRID })
+            {
+                auto accelerator = make_structure(structure);
+                Timer build_timer;
+                accelerator->build(scene);
+                double build = build_timer.seconds();
+
+                // Best of three runs, the counters are the same for each
+                double rps = 0;
+                for (int run = 0; run < 3; ++run)
+                {
+                    stats::reset();
+                    rps = std::max(rps, measure_rays_per_second(*accelerator, rays));
+                }
+                double visited = (double) stats::total(stats::NODES_VISITED) / ray_count;
+
+                char totals[2][32];
+                for (int b = 0; b < 2; ++b)
+                {
+                    double total = build + budgets[b] / rps;
+                    if (total < best_total[b])
+                    {
+                        best_total[b] = total;
+                        best[b] = structure;
+                    }
+                    if (structure == picked[b]) picked_total[b] = total;
+                    std::snprintf(totals[b], sizeof(totals[b]), "%.1f%s", total * 1000, structure == picked[b] ? " *" : "  ");
+                }
+
+                std::printf("%10s %8zu %10.2f %12s %10.1f %8.1f %10.1f %10.0f %14s %14s\n", c.name, scene.size(),
+                            statistics.occupancy, structure_name(structure), build * 1000,
+                            accelerator->memory_bytes() / 1e6, visited, rps, totals[0], totals[1]);
+            }
+
+            for (int b = 0; b < 2; ++b) right[b] += picked[b] == best[b];
+            std::printf("%10s fastest for the preview is the %s, the pick takes %.2fx its time. For the render the %s, %.2fx.\n", "",
+                        structure_name(best[0]), picked_total[0] / best_total[0], structure_name(best[1]), picked_total[1] / best_total[1]);
+        }
+        std::printf("Picks marked *. They were the fastest structure in %d and %d of %zu scenes.\n", right[0], right[1], std::size(cases));
+    }
+}
@@ -0,0 +1,49 @@
+#include "bench.h"
+
+namespace bench
+{
+    /** Memory and rays/sec for up to 100k instances of one mesh under a two-level hierarchy. */
+    void instancing()
+    {
+        auto mesh = make_bumpy_sphere(50, 50);
+        auto material = std::make_shared<Material>(PBR_COLOR_WHITE, PBR_COLOR_BLACK, new DiffuseBRDF);
+        std::printf("Shared mesh: %zu triangles, %.2f MB\n", mesh->triangle_count(), mesh->memory_bytes() / 1e6);
+
+        std::printf("%10s %12s %12s %14s %16s %14s\n",
+                    "instances", "actors (MB)", "top (MB)", "bytes/instance", "if copied (MB)", "rays/s");
+
+        for (size_t count : { 1000, 10000, 100000 })
+        {
+            // Keep the density of instances constant as the count grows
+            double extent = 20 * std::cbrt((double) count);
+            std::mt19937 gen(5);
+            std::uniform_real_distribution<> unit(0.0, 1.0);
+
+            Scene scene;
+            scene.reserve(count);
+            for (size_t i = 0; i < count; ++i)
+            {
+                Vec position = Vec { unit(gen), unit(gen), unit(gen) } * extent - Vec { extent / 2 };
+                Vec axis { unit(gen) - 0.5, unit(gen) - 0.5, unit(gen) - 0.5 };
+                Transform to_world = Transform::translate(position)
+                                   * Transform::rotate(axis, 360 * unit(gen))
+                                   * Transform::scale(Vec { 0.5 + unit(gen) });
+                scene.push_back(Actor { material, InstanceGeometry { mesh, to_world } });
+            }
+
+            BVHAccelerator accelerator;
+            accelerator.build(scene);
+
+            size_t actor_bytes = scene.size() * sizeof(Actor);
+            size_t top_bytes = accelerator.memory_bytes();
+            double per_instance = (double) (actor_bytes + top_bytes) / count;
+            double copied = (double) count * mesh->memory_bytes();
+
+            auto rays = make_random_rays(100000, extent);
+            double rps = measure_rays_per_second(accelerator, rays);
+
+            std::printf("%10zu %12.2f %12.2f %14.0f %16.0f %14.0f\n",
+                        count, actor_bytes / 1e6, top_bytes / 1e6, per_instance, copied / 1e6, rps);
+        }
+    }
+}
@@ -0,0 +1,302 @@
+#include "bench.h"
+
+#include <cerrno>
+#include <cstring>
+
+#if defined(__linux__)
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+namespace bench
+{
+    // Caches of a current server core
+    static constexpr size_t L1_BYTES = 48 << 10;
+    static constexpr int L1_WAYS = 12;
+    static constexpr size_t L2_BYTES = 2 << 20;
+    static constexpr int L2_WAYS = 16;
+
+    /** Set-associative cache with LRU replacement, fed the addresses a traversal reads */
+    class CacheModel
+    {
+    public:
+        static constexpr size_t LINE = 64;
+
+        uint64_t accesses = 0;
+        uint64_t misses = 0;
+
+        CacheModel(size_t bytes, int ways) : _ways(ways), _sets(bytes / (LINE * ways)), _tags(_sets * ways, ~0ull), _ages(_sets * ways, 0) {}
+
+        /** Returns true on a hit. A miss brings the line in, in place of the least recently used one of its set. */
+        bool access(uint64_t line)
+        {
+            ++accesses;
+            ++_clock;
+            size_t set = line % _sets;
+            uint64_t* tags = &_tags[set * _ways];
+            uint64_t* ages = &_ages[set * _ways];
+
+            int oldest = 0;
+            for (int w = 0; w < _ways; ++w)
+            {
+                if (tags[w] == line)
+                {
+                    ages[w] = _clock;
+                    return true;
+                }
+                if (ages[w] < ages[oldest]) oldest = w;
+            }
+
+            ++misses;
+            tags[oldest] = line;
+            ages[oldest] = _clock;
+            return false;
+        }
+
+        double miss_rate() const { return accesses ? (double) misses / accesses : 0; }
+
+    private:
+        int _ways;
+        size_t _sets;
+        std::vector<uint64_t> _tags;
+        std::vector<uint64_t> _ages;
+        uint64_t _clock = 0;
+    };
+
+    /** L1 data cache read misses and accesses from the hardware counters, where the kernel lets us read them */
+    class HardwareCounters
+    {
+    public:
+        HardwareCounters()
+        {
+#if defined(__linux__)
+            _misses = open(PERF_COUNT_HW_CACHE_RESULT_MISS);
+            _accesses = open(PERF_COUNT_HW_CACHE_RESULT_ACCESS);
+            if (_misses < 0 || _accesses < 0) _error = std::strerror(errno);
+#else
+            _error = "not on Linux";
+#endif
+        }
+
+        ~HardwareCounters()
+        {
+#if defined(__linux__)
+            if (_misses >= 0) ::close(_misses);
+            if (_accesses >= 0) ::close(_accesses);
+#endif
+        }
+
+        bool available() const { return _error == nullptr; }
+
+        const char* error() const { return _error; }
+
+        void start()
+        {
+#if defined(__linux__)
+            if (!available()) return;
+            for (int fd : { _misses, _accesses })
+            {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+#endif
+        }
+
+        /** L1 miss rate since start() */
+        double stop()
+        {
+#if defined(__linux__)
+            if (!available()) return 0;
+            uint64_t misses = 0, accesses = 0;
+            ioctl(_misses, PERF_EVENT_IOC_DISABLE, 0);
+            ioctl(_accesses, PERF_EVENT_IOC_DISABLE, 0);
+            if (::read(_misses, &misses, sizeof(misses)) != sizeof(misses) || ::read(_accesses, &accesses, sizeof(accesses)) != sizeof(accesses))
+            {
+                return 0;
+            }
+            return accesses ? (double) misses / accesses : 0;
+#else
+            return 0;
+#endif
+        }
+
+    private:
+        int _misses = -1;
+        int _accesses = -1;
+        const char* _error = nullptr;
+
+#if defined(__linux__)
+        static int open(uint64_t result)
+        {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16);
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+#endif
+    };
+
+    /** Same visiting order as BVH::intersect, but reports the cache lines of every node it reads to the models */
+    static uint64_t trace_lines(const BVH& bvh, const Scene& scene, const Ray& ray, CacheModel& l1, CacheModel& l2)
+    {
+        Vec inv_dir { 1 / ray.direction.x, 1 / ray.direction.y, 1 / ray.direction.z };
+        bool dir_neg[3] = { inv_dir.x < 0, inv_dir.y < 0, inv_dir.z < 0 };
+
+        uint32_t stack[PBR_BVH_MAX_DEPTH];
+        int top = 0;
+        uint32_t current = 0;
+        double tmax = PBR_INF;
+        uint64_t lines = 0;
+        HitResult hit;
+
+        while (true)
+        {
+            const BVHNode& node = bvh.nodes[current];
+            uint64_t first = (uint64_t) &node / CacheModel::LINE;
+            uint64_t last = ((uint64_t) &node + sizeof(BVHNode) - 1) / CacheModel::LINE;
+            for (uint64_t line = first; line <= last; ++line)
+            {
+                if (!l1.access(line)) l2.access(line);
+                ++lines;
+            }
+
+            if (node.bounds.intersect(ray.origin, inv_dir, tmax))
+            {
+                if (node.is_leaf())
+                {
+                    for (uint32_t i = node.offset; i < node.offset + node.count; ++i)
+                    {
+                        scene[bvh.indices[i]].find_hit(ray, tmax, hit);
+                    }
+                }
+                else
+                {
+                    uint32_t near = current + 1;
+                    uint32_t far = node.offset;
+                    if (dir_neg[node.split_axis()] != node.high_first()) std::swap(near, far);
+                    stack[top++] = far;
+                    current = near;
+                    continue;
+                }
+            }
+
+            if (top == 0) break;
+            current = stack[--top];
+        }
+        return lines;
+    }
+
+    /** Cache behavior and traversal speed of the node layouts on 1M spheres. */
+    void node_layout()
+    {
+        Scene scene = make_random_spheres(1000000);
+        auto rays = make_random_rays(200000, 150.0);
+
+        std::vector<AABB> bounds(scene.size());
+        for (size_t i = 0; i < scene.size(); ++i) bounds[i] = scene[i].bounds();
+
+        BVH built;
+        built.build(bounds, 1, BVHBuildMethod::BINNED);
+
+        HardwareCounters counters;
+        std::printf("Modelled caches: %zu KiB %d-way L1, %zu MiB %d-way L2, node reads only. Prefetching is %s.\n",
+                    L1_BYTES >> 10, L1_WAYS, L2_BYTES >> 20, L2_WAYS, PBR_BVH_PREFETCH ? "on" : "off");
+        if (!counters.available()) std::printf("Hardware L1 counters unavailable: %s\n", counters.error());
+        std::printf("%16s %10s %10s %12s %12s %12s %14s %14s %12s\n", "layout", "nodes/ray", "lines/ray", "L1 miss %", "L2 miss %",
+                    "hw L1 miss %", "rays/s", "shadow rays/s", "speedup");
+
+        struct Layout
+        {
+            const char* name;
+            BVHLayout layout;
+        };
+        const Layout layouts[] = {
+            { "depth-first", BVHLayout::DEPTH_FIRST },
+            { "hot-child-first", BVHLayout::HOT_CHILD_FIRST },
+        };
+
+        double base_rps = 0;
+        double base_shadow_rps = 0;
+        for (const auto& layout : layouts)
+        {
+            BVH bvh = built;
+            bvh.reorder(layout.layout);
+
+            // Best of three runs. The miss rate of the hardware comes from the last one.
+            double rps = 0;
+            double hw_miss = 0;
+            for (int run = 0; run < 3; ++run)
+            {
+                stats::reset();
+                size_t hits = 0;
+                counters.start();
+                Timer timer;
+                for (const auto& ray : rays)
+                {
+                    double tmax = PBR_INF;
+                    HitResult hit;
+                    hits += bvh.intersect(ray, tmax, [&](uint32_t first, uint32_t count, double& tmax) {
+                        bool any = false;
+                        for (uint32_t i = first; i < first + count; ++i)
+                        {
+                            any |= scene[bvh.indices[i]].find_hit(ray, tmax, hit);
+                        }
+                        return any;
+                    });
+                }
+                rps = std::max(rps, rays.size() / timer.seconds());
+                hw_miss = counters.stop();
+                if (hits > rays.size()) std::printf("unreachable\n");
+            }
+
+            // Occlusion queries take the first child first whatever the ray, which is where putting the hot one first can pay off
+            double shadow_rps = 0;
+            for (int run = 0; run < 3; ++run)
+            {
+                size_t blocked = 0;
+                Timer timer;
+                for (const auto& ray : rays)
+                {
+                    blocked += bvh.occluded(ray, PBR_INF, [&](uint32_t first, uint32_t count) {
+                        for (uint32_t i = first; i < first + count; ++i)
+                        {
+                            if (scene[bvh.indices[i]].occluded(ray, PBR_INF)) return true;
+                        }
+                        return false;
+                    });
+                }
+                shadow_rps = std::max(shadow_rps, rays.size() / timer.seconds());
+                if (blocked > rays.size()) std::printf("unreachable\n");
+            }
+            double nodes = (double) stats::total(stats::NODES_VISITED) / rays.size();
+            if (layout.layout == BVHLayout::DEPTH_FIRST)
+            {
+                base_rps = rps;
+                base_shadow_rps = shadow_rps;
+            }
+
+            CacheModel l1(L1_BYTES, L1_WAYS);
+            CacheModel l2(L2_BYTES, L2_WAYS);
+            uint64_t lines = 0;
+            for (const auto& ray : rays) lines += trace_lines(bvh, scene, ray, l1, l2);
+
+            char hw[16] = "-";
+            if (counters.available()) std::snprintf(hw, sizeof(hw), "%.2f", 100 * hw_miss);
+            char speedup[16] = "-";
+            if (layout.layout != BVHLayout::DEPTH_FIRST)
+            {
+                std::snprintf(speedup, sizeof(speedup), "%.2fx/%.2fx", rps / base_rps, shadow_rps / base_shadow_rps);
+            }
+
+            std::printf("%16s %10.1f %10.1f %12.2f %12.2f %12s %14.0f %14.0f %12s\n", layout.name, nodes, (double) lines / rays.size(),
+                        100 * l1.miss_rate(), 100 * l2.miss_rate(), hw, rps, shadow_rps, speedup);
+        }
+    }
+}
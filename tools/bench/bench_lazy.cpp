@@ -0,0 +1,99 @@
+#include "bench.h"
+
+namespace bench
+{
+    /** A `side` x `side` field of separate bumpy sphere meshes on a ground plane, each with its own hierarchy to build. */
+    static Scene make_mesh_field(int side, int rings, bool lazy, std::vector<std::shared_ptr<TriangleMesh>>& meshes)
+    {
+        auto prototype = make_bumpy_sphere(rings, rings);
+        auto material = std::make_shared<Material>(Colorf { 0.8, 0.8, 0.8 }, PBR_COLOR_BLACK, new DiffuseBRDF);
+
+        Scene scene;
+        meshes.clear();
+        for (int z = 0; z < side; ++z)
+        {
+            for (int x = 0; x < side; ++x)
+            {
+                auto mesh = std::make_shared<TriangleMesh>();
+                Vec offset { 4.0 * (x - side / 2), 0, -4.0 * z };
+                for (const auto& p : prototype->positions) mesh->positions.push_back(p + offset);
+                mesh->indices = prototype->indices;
+                meshes.push_back(mesh);
+                scene.push_back(Actor { material, MeshGeometry { mesh } });
+            }
+        }
+        scene.push_back(Actor { material, PlaneGeometry { Vec { 0, 0, 0 }, Vec { 0, 1, 0 } } });
+
+        // The meshes are built here, or left to the rays, after the scene is made so that both cases time the same work
+        for (auto& mesh : meshes)
+        {
+            if (lazy) mesh->build_lazily();
+            else mesh->build();
+        }
+        return scene;
+    }
+
+    /** Time to the first pixel and to a whole preview frame with mesh hierarchies built upfront or by the first ray to reach each. */
+    void lazy_build()
+    {
+        constexpr int ROWS = 90, COLS = 160, SPP = 1;
+        std::printf("%dx%d preview at %d spp from the front of the field, single thread. Times include building the meshes.\n",
+                    COLS, ROWS, SPP);
+        std::printf("%8s %10s %8s %16s %12s %14s %10s\n", "meshes", "triangles", "build", "first pixel ms", "frame ms",
+                    "meshes built", "speedup");
+
+        for (int side : { 8, 16 })
+        {
+            double upfront_first = 0;
+            for (bool lazy : { false, true })
+            {
+                Timer timer;
+                std::vector<std::shared_ptr<TriangleMesh>> meshes;
+                Scene scene = make_mesh_field(side, 120, lazy, meshes);
+
+                Camera camera;
+                camera.position = Vec { 0, 2, 6 };
+                camera.look_at = Vec { 0, 1.5, 0 };
+                camera.fov = PBR_CAMERA_FOV_DEG;
+                camera.calculate_basis((double) COLS / ROWS);
+
+                PathIntegrator integrator;
+                integrator.set_scene(&scene);
+                UniformRNG rng;
+
+                // Pixels in the order the renderer fills them in, the first one is done when its samples are
+                double first_pixel = 0;
+                Colorf sum;
+                for (int row = 0; row < ROWS; ++row)
+                {
+                    for (int col = 0; col < COLS; ++col)
+                    {
+                        for (int i = 0; i < SPP; ++i)
+                        {
+                            auto sample = rng.sample_disk();
+                            double x = ((col + 0.5 + sample.x / 2) / COLS) * 2 - 1;
+                            double y = ((row + 0.5 + sample.y / 2) / ROWS) * 2 - 1;
+                            sum = sum + integrator.trace_ray(camera.get_ray(x, y), 0);
+                        }
+                        if (first_pixel == 0) first_pixel = timer.seconds();
+                    }
+                }
+                double frame = timer.seconds();
+                if (sum.x < 0) std::printf("unreachable\n");
+
+                size_t built = 0, triangles = 0;
+                for (const auto& mesh : meshes)
+                {
+                    built += mesh->built();
+                    triangles += mesh->triangle_count();
+                }
+                if (!lazy) upfront_first = first_pixel;
+
+                char speedup[16] = "-";
+                if (lazy) std::snprintf(speedup, sizeof(speedup), "%.1fx", upfront_first / first_pixel);
+                std::printf("%8zu %10zu %8s %16.1f %12.1f %14zu %10s\n", meshes.size(), triangles, lazy ? "lazy" : "upfront",
+                            first_pixel * 1000, frame * 1000, built, speedup);
+            }
+        }
+    }
+}
@@ -0,0 +1,141 @@
+#include "bench.h"
+
+namespace bench
+{
+    /** A floor with scattered blocking spheres, lit by `count` small emitters of widely varied power over a large area. */
+    static Scene make_many_lights(size_t count, double extent = 200.0)
+    {
+        std::mt19937 gen(7);
+        std::uniform_real_distribution<> position(-extent / 2, extent / 2);
+        std::uniform_real_distribution<> unit(0.0, 1.0);
+
+        auto floor = std::make_shared<Material>(Colorf { 0.7, 0.7, 0.7 }, PBR_COLOR_BLACK, new DiffuseBRDF);
+        auto ball = std::make_shared<Material>(Colorf { 0.5, 0.5, 0.6 }, PBR_COLOR_BLACK, new DiffuseBRDF);
+
+        Scene scene;
+        scene.reserve(count + 201);
+        scene.push_back(Actor { floor, PlaneGeometry { Vec { 0, 0, 0 }, Vec { 0, 1, 0 } } });
+        for (int i = 0; i < 200; ++i)
+        {
+            double r = 0.5 + 1.5 * unit(gen);
+            scene.push_back(Actor { ball, SphereGeometry { Vec { position(gen), r, position(gen) }, r } });
+        }
+
+        // Powers spread over two orders of magnitude, like a city of street lamps, windows and signs
+        for (size_t i = 0; i < count; ++i)
+        {
+            Colorf color { 0.5 + 0.5 * unit(gen), 0.5 + 0.5 * unit(gen), 0.5 + 0.5 * unit(gen) };
+            double strength = std::pow(100.0, unit(gen));
+            auto light = std::make_shared<Material>(PBR_COLOR_WHITE, color * strength, new DiffuseBRDF);
+            Vec center { position(gen), 0.5 + 4 * unit(gen), position(gen) };
+            scene.push_back(Actor { light, SphereGeometry { center, 0.2 + 0.3 * unit(gen) } });
+        }
+        return scene;
+    }
+
+    /** Mean over points of the floor of the noise of one light sample of direct light, relative to its mean, and the time per sample */
+    static std::pair<double, double> direct_light_noise(const EmitterList& emitters, const BaseAccelerator& accelerator,
+                                                       const std::vector<Point>& points, int samples)
+    {
+        Vec up { 0, 1, 0 };
+        UniformRNG rng;
+        double noise = 0;
+        int lit = 0;
+        Timer timer;
+        for (const auto& point : points)
+        {
+            double sum = 0, squares = 0;
+            for (int i = 0; i < samples; ++i)
+            {
+                LightSample light;
+                if (!emitters.sample(point, up, rng.sample(), rng.sample(), rng.sample(), light)) continue;
+                double cosine = dot(up, light.direction);
+                if (cosine <= 0 || accelerator.occluded(Ray { point, light.direction }, light.distance * (1 - PBR_EPSILON))) continue;
+
+                double value = (light.emission.x + light.emission.y + light.emission.z) / 3 * cosine / light.pdf;
+                sum += value;
+                squares += value * value;
+            }
+            double mean = sum / samples;
+            if (mean <= 0) continue;
+            noise += std::sqrt(std::max(0., squares / samples - mean * mean)) / mean;
+            ++lit;
+        }
+        double seconds = timer.seconds() / ((double) points.size() * samples);
+        return { noise / std::max(lit, 1), seconds };
+    }
+
+    /** Error and time of uniform and power-proportional emitter selection against the light hierarchy as the number of emitters grows. */
+    void many_lights()
+    {
+        constexpr int ROWS = 36, COLS = 64, REFERENCE_SPP = 1024;
+        const EmitterSelection selections[] = { EmitterSelection::UNIFORM, EmitterSelection::POWER, EmitterSelection::LIGHT_BVH };
+        const char* names[] = { "uniform", "power", "hierarchy" };
+
+        std::printf("%dx%d, single thread, MIS. Errors are against %d spp with the light hierarchy.\n", COLS, ROWS, REFERENCE_SPP);
+        std::printf("%8s %10s %10s %10s %6s %10s %10s %10s %10s %12s %10s\n", "emitters", "build ms", "nodes", "MB", "spp",
+                    "uniform s", "RMSE", "power s", "RMSE", "hierarchy s", "RMSE");
+
+        Camera camera;
+        camera.position = Vec { 0, 6, 14 };
+        camera.look_at = Vec { 0, 0, 0 };
+        camera.fov = PBR_CAMERA_FOV_DEG;
+        camera.calculate_basis((double) COLS / ROWS);
+
+        for (size_t count : { 1000, 10000, 100000 })
+        {
+            Scene scene = make_many_lights(count);
+            PathIntegrator integrator;
+            integrator.set_scene(&scene);
+            integrator.light_strategy = LightStrategy::MIS;
+
+            // Timed on its own, the integrator builds it along with the accelerator
+            EmitterList emitters;
+            emitters.set_selection(EmitterSelection::LIGHT_BVH);
+            Timer build_timer;
+            emitters.build(scene);
+            double build = build_timer.seconds();
+            const LightBVH& bvh = emitters.light_bvh();
+
+            // Direct light at points of the floor in view, the part of the image that the choice of emitter decides
+            BVHAccelerator accelerator;
+            accelerator.build(scene);
+            std::mt19937 gen(8);
+            std::uniform_real_distribution<> spread(-10, 10);
+            std::vector<Point> points;
+            for (int i = 0; i < 500; ++i) points.push_back(Point { spread(gen), 0, spread(gen) });
+
+            double noise[3], sample_seconds[3];
+            for (int k = 0; k < 3; ++k)
+            {
+                emitters.set_selection(selections[k]);
+                std::tie(noise[k], sample_seconds[k]) = direct_light_noise(emitters, accelerator, points, 1000);
+            }
+            std::printf("%8zu direct light at the floor, noise per sample relative to the mean:", count);
+            for (int k = 0; k < 3; ++k)
+            {
+                std::printf(" %s %.2f in %.2f us (%.1fx fewer samples)%s", names[k], noise[k], sample_seconds[k] * 1e6,
+                            (noise[0] * noise[0]) / (noise[k] * noise[k]), k < 2 ? "," : "\n");
+            }
+
+            integrator.emitters().set_selection(EmitterSelection::LIGHT_BVH);
+            std::vector<Colorf> reference = render_radiance(integrator, camera, ROWS, COLS, REFERENCE_SPP);
+
+            for (int spp : { 1, 4, 16, 64 })
+            {
+                double error[3], seconds[3];
+                for (int k = 0; k < 3; ++k)
+                {
+                    integrator.emitters().set_selection(selections[k]);
+                    Timer timer;
+                    std::vector<Colorf> image = render_radiance(integrator, camera, ROWS, COLS, spp);
+                    seconds[k] = timer.seconds();
+                    error[k] = image_rmse(image, reference);
+                }
+                std::printf("%8zu %10.2f %10zu %10.2f %6d %10.3f %10.4f %10.3f %10.4f %12.3f %10.4f\n", count, build * 1000,
+                            bvh.nodes.size(), bvh.memory_bytes() / 1e6, spp, seconds[0], error[0], seconds[1], error[1],
+                            seconds[2], error[2]);
+            }
+        }
+    }
+}
@@ -0,0 +1,46 @@
+#include "bench.h"
+
+#include <cstdlib>
+
+namespace bench
+{
+    /** Build time and preview render speed for a large triangle mesh. Set PBR_BENCH_OBJ to use a model from disk. */
+    void mesh_preview()
+    {
+        Timer build_timer;
+        std::shared_ptr<TriangleMesh> mesh;
+        if (const char* path = std::getenv("PBR_BENCH_OBJ"))
+        {
+            mesh = load_obj(path);
+            std::printf("Model: %s\n", path);
+        }
+        else
+        {
+            mesh = make_bumpy_sphere(708, 708);
+            std::printf("Model: procedural bumpy sphere\n");
+        }
+        double build_s = build_timer.seconds();
+
+        std::printf("%zu triangles, %zu BVH nodes, load + build %.2f s\n",
+                    mesh->triangle_count(), mesh->bvh.nodes.size(), build_s);
+
+        Scene scene = {
+            Actor {
+                std::make_shared<Material>(Colorf { 0.8, 0.8, 0.8 }, PBR_COLOR_BLACK, new DiffuseBRDF),
+                MeshGeometry { mesh }
+            },
+            Actor {
+                std::make_shared<Material>(Colorf { 0.5, 0.5, 0.5 }, PBR_COLOR_BLACK, new DiffuseBRDF),
+                PlaneGeometry { Vec { 0.0, 0.0, 0.0 }, Vec { 0.0, 1.0, 0.0 } }
+            },
+        };
+
+        constexpr int ROWS = 180, COLS = 320;
+        for (int spp : { 1, 4 })
+        {
+            double seconds = measure_render_seconds(scene, ROWS, COLS, spp);
+            std::printf("%dx%d at %d spp: %.3f s per frame, %.0f paths/s (single thread)\n",
+                        COLS, ROWS, spp, seconds, ROWS * COLS * spp / seconds);
+        }
+    }
+}
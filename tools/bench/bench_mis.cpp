@@ -0,0 +1,77 @@
+#include "bench.h"
+
+namespace bench
+{
+    /** A diffuse floor and spheres under a broad dim emitter close overhead and a tiny bright one, each the hard case of one strategy. */
+    static Scene make_emitter_sizes()
+    {
+        auto gray = std::make_shared<Material>(Colorf { 0.7, 0.7, 0.7 }, PBR_COLOR_BLACK, new DiffuseBRDF);
+        auto blue = std::make_shared<Material>(Colorf { 0.2, 0.3, 0.8 }, PBR_COLOR_BLACK, new DiffuseBRDF);
+        auto broad = std::make_shared<Material>(PBR_COLOR_WHITE, Colorf { 0.8, 0.8, 0.8 }, new DiffuseBRDF);
+        auto tiny = std::make_shared<Material>(PBR_COLOR_WHITE, Colorf { 4000, 3000, 2000 }, new DiffuseBRDF);
+
+        return Scene {
+            Actor { gray, PlaneGeometry { Vec { 0, 0, 0 }, Vec { 0, 1, 0 } } },
+            Actor { blue, SphereGeometry { Vec { -1.5, 1, 0 }, 1 } },
+            Actor { gray, SphereGeometry { Vec { 1.5, 1, 0 }, 1 } },
+            Actor { broad, SphereGeometry { Vec { 0, 26, -2 }, 20 } },
+            Actor { tiny, SphereGeometry { Vec { 0, 4.5, 4 }, 0.03 } },
+        };
+    }
+
+    /** Error against render time of BRDF sampling, light sampling and both combined with multiple importance sampling. */
+    void mis()
+    {
+        constexpr int ROWS = 36, COLS = 64, REFERENCE_SPP = 4096;
+        std::printf("%dx%d, single thread. Errors are against %d spp with MIS.\n", COLS, ROWS, REFERENCE_SPP);
+        Camera camera = make_camera(ROWS, COLS);
+
+        struct Case
+        {
+            const char* name;
+            Scene scene;
+        };
+        Case cases[] = {
+            { "rtweekend", PBR_SCENE_RTWEEKEND },
+            { "cornell", PBR_SCENE_CORNELL },
+            { "sizes", make_emitter_sizes() },
+        };
+
+        struct Strategy
+        {
+            const char* name;
+            LightStrategy strategy;
+        };
+        const Strategy strategies[] = {
+            { "brdf", LightStrategy::BRDF },
+            { "lights", LightStrategy::EMITTERS },
+            { "mis", LightStrategy::MIS },
+        };
+
+        for (auto& c : cases)
+        {
+            PathIntegrator integrator;
+            integrator.set_scene(&c.scene);
+            integrator.light_strategy = LightStrategy::MIS;
+            std::vector<Colorf> reference = render_radiance(integrator, camera, ROWS, COLS, REFERENCE_SPP);
+
+            std::printf("%s\n%6s", c.name, "spp");
+            for (const auto& s : strategies) std::printf(" %10s %8s", s.name, "RMSE");
+            std::printf("\n");
+
+            for (int spp : { 1, 4, 16, 64, 256 })
+            {
+                std::printf("%6d", spp);
+                for (const auto& s : strategies)
+                {
+                    integrator.light_strategy = s.strategy;
+                    Timer timer;
+                    std::vector<Colorf> image = render_radiance(integrator, camera, ROWS, COLS, spp);
+                    double seconds = timer.seconds();
+                    std::printf(" %9.3fs %8.4f", seconds, image_rmse(image, reference));
+                }
+                std::printf("\n");
+            }
+        }
+    }
+}
@@ -0,0 +1,102 @@
+#include "bench.h"
+
+namespace bench
+{
+    /** Rays per second through a bare BVH over the spheres of the scene. */
+    static double bvh_rays_per_second(const BVH& bvh, const Scene& scene, const std::vector<Ray>& rays)
+    {
+        size_t hits = 0;
+        Timer timer;
+        for (const auto& ray : rays)
+        {
+            HitResult hit;
+            double tmax = PBR_INF;
+            hits += bvh.intersect(ray, tmax, [&](uint32_t first, uint32_t count, double& t) {
+                bool found = false;
+                for (uint32_t i = first; i < first + count; ++i)
+                {
+                    found |= scene[bvh.indices[i]].find_hit(ray, t, hit);
+                }
+                return found;
+            });
+        }
+        double elapsed = timer.seconds();
+
+        if (hits > rays.size()) std::printf("unreachable\n");
+        return rays.size() / elapsed;
+    }
+
+    /** Build time against traversal speed of the binned SAH, Morton and Morton with treelets builds, for scenes rebuilt every frame. */
+    void morton_build()
+    {
+        struct Method
+        {
+            const char* name;
+            BVHBuildMethod method;
+        };
+        const Method methods[] = {
+            { "binned", BVHBuildMethod::BINNED },
+            { "morton", BVHBuildMethod::MORTON },
+            { "treelets", BVHBuildMethod::MORTON_TREELETS },
+        };
+
+        std::printf("Frame time is one build plus tracing that many rays. Break-even is the number of rays per frame around\n"
+                    "which a build starts or stops beating the binned one.\n");
+        std::printf("%10s %10s %12s %10s %14s %12s %12s %14s\n", "actors", "method", "build (ms)", "SAH cost", "rays/s",
+                    "100k (ms)", "1M (ms)", "break-even");
+
+        for (size_t count : { 10000, 100000, 1000000 })
+        {
+            Scene scene = make_random_spheres(count);
+            std::vector<AABB> bounds;
+            bounds.reserve(count);
+            for (const auto& actor : scene) bounds.push_back(actor.bounds());
+
+            auto rays = make_random_rays(200000, 150.0);
+
+            double binned_ms = 0;
+            double binned_ray_ms = 0;
+            for (const auto& m : methods)
+            {
+                // Best of a few builds, the first one also pays for page faults
+                BVH bvh;
+                double build_ms = PBR_INF;
+                for (int run = 0; run < 3; ++run)
+                {
+                    Timer timer;
+                    bvh.build(bounds, 1, m.method);
+                    build_ms = std::min(build_ms, timer.seconds() * 1000);
+                }
+
+                double rps = bvh_rays_per_second(bvh, scene, rays);
+                double ray_ms = 1000 / rps;
+                if (m.method == BVHBuildMethod::BINNED)
+                {
+                    binned_ms = build_ms;
+                    binned_ray_ms = ray_ms;
+                }
+
+                // A faster build that traces slower wins up to some number of rays, a slower one that traces faster
+                // wins past it. Otherwise one of them always wins.
+                char break_even[32] = "-";
+                if (m.method != BVHBuildMethod::BINNED)
+                {
+                    bool faster_build = build_ms < binned_ms;
+                    bool faster_rays = ray_ms < binned_ray_ms;
+                    if (faster_build == faster_rays)
+                    {
+                        std::snprintf(break_even, sizeof(break_even), faster_build ? "always" : "never");
+                    }
+                    else
+                    {
+                        double rays = (binned_ms - build_ms) / (ray_ms - binned_ray_ms);
+                        std::snprintf(break_even, sizeof(break_even), "%s %.0f", faster_build ? "below" : "above", rays);
+                    }
+                }
+
+                std::printf("%10zu %10s %12.1f %10.2f %14.0f %12.1f %12.1f %14s\n", count, m.name, build_ms, bvh.sah_cost(),
+                            rps, build_ms + 1e5 * ray_ms, build_ms + 1e6 * ray_ms, break_even);
+            }
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#include "bench.h"
+
+namespace bench
+{
+    static double mean(const std::vector<Colorf>& image)
+    {
+        double sum = 0;
+        for (const auto& c : image) sum += c.x + c.y + c.z;
+        return sum / (3 * image.size());
+    }
+
+    /** Error and time against samples per pixel of paths that only find lights by bounces, and of paths that sample them. */
+    void next_event()
+    {
+        constexpr int ROWS = 36, COLS = 64, REFERENCE_SPP = 2048;
+        std::printf("%dx%d, single thread. Errors are against %d spp sampling the lights.\n", COLS, ROWS, REFERENCE_SPP);
+        Camera camera = make_camera(ROWS, COLS);
+
+        struct Case
+        {
+            const char* name;
+            const Scene* scene;
+        };
+        const Case cases[] = {
+            { "rtweekend", &PBR_SCENE_RTWEEKEND },
+            { "cornell", &PBR_SCENE_CORNELL },
+        };
+
+        for (const auto& c : cases)
+        {
+            PathIntegrator integrator;
+            integrator.set_scene(c.scene);
+
+            integrator.light_strategy = LightStrategy::EMITTERS;
+            std::vector<Colorf> reference = render_radiance(integrator, camera, ROWS, COLS, REFERENCE_SPP);
+            integrator.light_strategy = LightStrategy::BRDF;
+            std::vector<Colorf> brdf_reference = render_radiance(integrator, camera, ROWS, COLS, REFERENCE_SPP);
+
+            // Both converge to the same image, up to the noise left in the references
+            std::printf("%s: mean %.4f sampling lights, %.4f from bounces alone, RMSE between them %.4f\n", c.name, mean(reference),
+                        mean(brdf_reference), image_rmse(brdf_reference, reference));
+            std::printf("%6s %14s %12s %14s %12s\n", "spp", "bounces RMSE", "seconds", "lights RMSE", "seconds");
+
+            for (int spp : { 1, 4, 16, 64, 256 })
+            {
+                double error[2], seconds[2];
+                int k = 0;
+                for (LightStrategy strategy : { LightStrategy::BRDF, LightStrategy::EMITTERS })
+                {
+                    integrator.light_strategy = strategy;
+                    Timer timer;
+                    std::vector<Colorf> image = render_radiance(integrator, camera, ROWS, COLS, spp);
+                    seconds[k] = timer.seconds();
+                    error[k++] = image_rmse(image, reference);
+                }
+                std::printf("%6d %14.4f %12.3f %14.4f %12.3f\n", spp, error[0], seconds[0], error[1], seconds[1]);
+            }
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#include "bench.h"
+
+namespace bench
+{
+    /** Shadow rays between random points, answered with a closest-hit query or with the any-hit occlusion query. */
+    void occlusion()
+    {
+        std::printf("%10s %8s %10s %16s %16s %9s\n", "actors", "layout", "occluded", "closest (r/s)", "any-hit (r/s)", "speedup");
+
+        for (size_t count : { 1000, 10000, 100000 })
+        {
+            Scene scene = make_random_spheres(count);
+
+            // Segments between two random points in the scene, the ray parameter runs from 0 to 1
+            std::mt19937 gen(3);
+            std::uniform_real_distribution<> position(-50.0, 50.0);
+            std::vector<Ray> rays;
+            for (int i = 0; i < 200000; ++i)
+            {
+                Vec from { position(gen), position(gen), position(gen) };
+                Vec to { position(gen), position(gen), position(gen) };
+                rays.push_back(Ray { from, to - from });
+            }
+
+            BVHAccelerator binary;
+            BVH8Accelerator bvh8;
+            const std::pair<const char*, BaseAccelerator*> layouts[] = { { "binary", &binary }, { "bvh8", &bvh8 } };
+
+            for (const auto& [name, accelerator] : layouts)
+            {
+                accelerator->build(scene);
+
+                size_t blocked_closest = 0;
+                Timer closest_timer;
+                for (const auto& ray : rays)
+                {
+                    HitResult hit;
+                    blocked_closest += accelerator->intersect(ray, hit) && hit.param < 1;
+                }
+                double closest_rps = rays.size() / closest_timer.seconds();
+
+                size_t blocked_any = 0;
+                Timer any_timer;
+                for (const auto& ray : rays)
+                {
+                    blocked_any += accelerator->occluded(ray, 1);
+                }
+                double any_rps = rays.size() / any_timer.seconds();
+
+                if (blocked_any != blocked_closest) std::printf("Queries disagree: %zu versus %zu\n", blocked_any, blocked_closest);
+
+                std::printf("%10zu %8s %9.1f%% %16.0f %16.0f %8.1fx\n", count, name, 100.0 * blocked_any / rays.size(),
+                            closest_rps, any_rps, any_rps / closest_rps);
+            }
+        }
+    }
+}
@@ -0,0 +1,85 @@
+#include "bench.h"
+
+namespace bench
+{
+    /** Camera rays for a rows x cols image, spp jittered samples per pixel stored pixel by pixel, as the renderer makes them. */
+    static std::vector<Ray> make_camera_rays(const Camera& camera, int rows, int cols, int spp)
+    {
+        UniformRNG rng;
+        std::vector<Ray> rays;
+        rays.reserve((size_t) rows * cols * spp);
+        for (int row = 0; row < rows; ++row)
+        {
+            for (int col = 0; col < cols; ++col)
+            {
+                for (int i = 0; i < spp; ++i)
+                {
+                    auto sample = rng.sample_disk();
+                    double x = ((col + 0.5 + sample.x / 2) / cols) * 2 - 1;
+                    double y = ((row + 0.5 + sample.y / 2) / rows) * 2 - 1;
+                    rays.push_back(camera.get_ray(x, y));
+                }
+            }
+        }
+        return rays;
+    }
+
+    /** Primary-ray throughput of the binary BVH, one ray at a time against packets of 8 and 16 samples of a pixel. */
+    void packets()
+    {
+        std::printf("%10s %8s %12s %14s %10s\n", "actors", "packet", "nodes/ray", "rays/s", "speedup");
+
+        Camera camera;
+        camera.position = Vec { 0, 0, 120 };
+        camera.look_at = Vec { 0, 0, 0 };
+        camera.fov = 45;
+        camera.calculate_basis(1.0);
+        std::vector<Ray> rays = make_camera_rays(camera, 128, 128, 64);
+
+        for (size_t count : { 1000, 10000, 100000 })
+        {
+            Scene scene = make_random_spheres(count);
+            BVHAccelerator bvh;
+            bvh.build(scene);
+
+            double single_rps = 0;
+            for (int size : { 1, 8, 16 })
+            {
+                // Best of three runs, the counters are the same for each
+                double rps = 0;
+                for (int run = 0; run < 3; ++run)
+                {
+                    stats::reset();
+                    size_t hits = 0;
+                    Timer timer;
+                    if (size == 1)
+                    {
+                        for (const auto& ray : rays)
+                        {
+                            HitResult hit;
+                            hits += bvh.intersect(ray, hit);
+                        }
+                    }
+                    else
+                    {
+                        HitResult packet_hits[BaseAccelerator::MAX_PACKET_SIZE];
+                        bool does_hit[BaseAccelerator::MAX_PACKET_SIZE];
+                        for (size_t first = 0; first < rays.size(); first += size)
+                        {
+                            bvh.intersect_packet(&rays[first], size, packet_hits, does_hit);
+                            for (int i = 0; i < size; ++i) hits += does_hit[i];
+                        }
+                    }
+                    rps = std::max(rps, rays.size() / timer.seconds());
+                    if (hits > rays.size()) std::printf("unreachable\n");
+                }
+                if (size == 1) single_rps = rps;
+
+                // A packet visit is counted once for all of its rays, so this is the share of each ray
+                auto counter = (size == 1) ? stats::NODES_VISITED : stats::PACKET_NODES_VISITED;
+                double nodes = (double) stats::total(counter) / rays.size();
+                std::printf("%10zu %8d %12.1f %14.0f %9.2fx\n", count, size, nodes, rps, rps / single_rps);
+            }
+        }
+    }
+}
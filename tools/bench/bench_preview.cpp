@@ -0,0 +1,80 @@
+#include "bench.h"
+
+namespace bench
+{
+    /** Time to the first pixel and to the whole frame, with the scene built before rendering or while a preview renders. */
+    void preview()
+    {
+        constexpr int ROWS = 90, COLS = 160, SPP = 4;
+        std::printf("%dx%d frame at %d spp on one render thread, one preview sample per pass. Times include the build.\n",
+                    COLS, ROWS, SPP);
+        std::printf("%8s %10s %10s %16s %16s %18s %12s\n", "spheres", "build", "build ms", "first pixel ms",
+                    "preview samples", "preview pixels %", "frame ms");
+
+        for (size_t count : { 20000, 100000, 400000 })
+        {
+            Scene scene = make_random_spheres(count);
+
+            Camera camera;
+            camera.position = Vec { 0, 0, 120 };
+            camera.look_at = Vec { 0, 0, 0 };
+            camera.fov = PBR_CAMERA_FOV_DEG;
+            camera.calculate_basis((double) COLS / ROWS);
+
+            for (bool background : { false, true })
+            {
+                Timer timer;
+                PathIntegrator integrator;
+                if (background) integrator.set_scene_in_background(&scene, 1);
+                else integrator.set_scene(&scene);
+
+                UniformRNG rng;
+                auto trace = [&](int row, int col) {
+                    auto sample = rng.sample_disk();
+                    double x = ((col + 0.5 + sample.x / 2) / COLS) * 2 - 1;
+                    double y = ((row + 0.5 + sample.y / 2) / ROWS) * 2 - 1;
+                    return integrator.trace_ray(camera.get_ray(x, y), 0);
+                };
+
+                // Same order as Renderer: passes of one sample over the image until the switch, then the rest per pixel
+                std::vector<Colorf> sum((size_t) ROWS * COLS);
+                std::vector<int> done((size_t) ROWS * COLS, 0);
+                double first_pixel = 0;
+                size_t preview_samples = 0;
+                for (int pass = 0; pass < SPP && !integrator.accelerator_ready(); ++pass)
+                {
+                    for (int row = 0; row < ROWS && !integrator.accelerator_ready(); ++row)
+                    {
+                        for (int col = 0; col < COLS; ++col)
+                        {
+                            sum[row * COLS + col] = sum[row * COLS + col] + trace(row, col);
+                            ++done[row * COLS + col];
+                            ++preview_samples;
+                            if (first_pixel == 0) first_pixel = timer.seconds();
+                        }
+                    }
+                }
+                integrator.wait_for_accelerator();
+                double build = timer.seconds();
+
+                size_t previewed = 0;
+                for (int row = 0; row < ROWS; ++row)
+                {
+                    for (int col = 0; col < COLS; ++col)
+                    {
+                        previewed += done[row * COLS + col] > 0;
+                        for (; done[row * COLS + col] < SPP; ++done[row * COLS + col])
+                        {
+                            sum[row * COLS + col] = sum[row * COLS + col] + trace(row, col);
+                        }
+                        if (first_pixel == 0) first_pixel = timer.seconds();
+                    }
+                }
+                double frame = timer.seconds();
+
+                std::printf("%8zu %10s %10.1f %16.1f %16zu %18.1f %12.1f\n", count, background ? "background" : "upfront",
+                            build * 1000, first_pixel * 1000, preview_samples, 100.0 * previewed / (ROWS * COLS), frame * 1000);
+            }
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#include "bench.h"
+
+namespace bench
+{
+    /** Node memory per primitive and traversal speed of float BVH4 nodes against quantized ones, with the binary BVH for reference. */
+    void quantized()
+    {
+        std::printf("Node bytes only count the hierarchy. Total bytes add the indices, actor pointers and packed spheres.\n");
+        std::printf("%10s %10s %12s %12s %12s %14s %10s\n", "actors", "layout", "node B/prim", "total B/prim", "nodes/ray",
+                    "rays/s", "vs bvh4");
+
+        for (size_t count : { 10000, 100000, 1000000 })
+        {
+            Scene scene = make_random_spheres(count);
+            auto rays = make_random_rays(200000, 150.0);
+
+            BVHAccelerator binary;
+            BVH4Accelerator bvh4;
+            QuantizedBVH4Accelerator quantized;
+            binary.build(scene);
+            bvh4.build(scene);
+            quantized.build(scene);
+
+            struct Layout
+            {
+                const char* name;
+                const BaseAccelerator* accelerator;
+                size_t node_bytes;
+            };
+            const Layout layouts[] = {
+                { "binary", &binary, binary.bvh().nodes.size() * sizeof(BVHNode) },
+                { "bvh4", &bvh4, bvh4.wide_bvh().memory_bytes() },
+                { "quantized", &quantized, quantized.wide_bvh().memory_bytes() },
+            };
+
+            double bvh4_rps = 0;
+            for (const auto& layout : layouts)
+            {
+                // Best of three runs, the counters are the same for each
+                double rps = 0;
+                for (int run = 0; run < 3; ++run)
+                {
+                    stats::reset();
+                    rps = std::max(rps, measure_rays_per_second(*layout.accelerator, rays));
+                }
+                double nodes = (double) stats::total(stats::NODES_VISITED) / rays.size();
+                if (layout.accelerator == &bvh4) bvh4_rps = rps;
+
+                char relative[16] = "-";
+                if (layout.accelerator == &quantized) std::snprintf(relative, sizeof(relative), "%.2fx", rps / bvh4_rps);
+
+                std::printf("%10zu %10s %12.1f %12.1f %12.1f %14.0f %10s\n", count, layout.name, (double) layout.node_bytes / count,
+                            (double) layout.accelerator->memory_bytes() / count, nodes, rps, relative);
+            }
+        }
+    }
+}
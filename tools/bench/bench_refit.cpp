@@ -0,0 +1,73 @@
+#include "bench.h"
+
+namespace bench
+{
+    /** Per-frame cost of building again against refitting, for spheres that drift across the scene. */
+    void refit()
+    {
+        constexpr int FRAMES = 60;
+        constexpr size_t ACTORS = 100000;
+
+        auto rays = make_random_rays(100000, 150.0);
+
+        // Each sphere drifts along its own direction, a few radii per frame
+        auto make_velocities = [](size_t count) {
+            std::mt19937 gen(3);
+            std::uniform_real_distribution<> speed(-0.3, 0.3);
+            std::vector<Vec> velocities(count);
+            for (auto& v : velocities) v = Vec { speed(gen), speed(gen), speed(gen) };
+            return velocities;
+        };
+
+        std::printf("%zu spheres, %d frames, %zu rays per frame, rebuild past %.2fx the built SAH cost\n",
+                    ACTORS, FRAMES, rays.size() / 10, (double) PBR_BVH_REFIT_REBUILD_RATIO);
+        std::printf("%10s %14s %14s %10s %14s %12s\n", "mode", "mean (ms)", "worst (ms)", "rebuilds", "rays/s", "SAH cost");
+
+        for (bool refit : { false, true })
+        {
+            Scene scene = make_random_spheres(ACTORS);
+            auto velocities = make_velocities(scene.size());
+
+            BVHAccelerator accelerator;
+            accelerator.build(scene);
+
+            double total_ms = 0;
+            double worst_ms = 0;
+            double total_rays = 0;
+            double total_seconds = 0;
+            int rebuilds = 0;
+            for (int frame = 0; frame < FRAMES; ++frame)
+            {
+                for (size_t i = 0; i < scene.size(); ++i)
+                {
+                    auto sphere = std::get<SphereGeometry>(scene[i].geometry);
+                    sphere.center = sphere.center + velocities[i];
+                    set_sphere(scene, i, sphere);
+                }
+
+                Timer timer;
+                if (refit)
+                {
+                    rebuilds += accelerator.update(scene);
+                }
+                else
+                {
+                    accelerator.build(scene);
+                    ++rebuilds;
+                }
+                double ms = timer.seconds() * 1000;
+                total_ms += ms;
+                worst_ms = std::max(worst_ms, ms);
+
+                // A tenth of the rays per frame keeps the run short, the hierarchy is what changes
+                std::vector<Ray> subset(rays.begin() + (frame % 10) * rays.size() / 10, rays.begin() + (frame % 10 + 1) * rays.size() / 10);
+                double rps = measure_rays_per_second(accelerator, subset);
+                total_rays += subset.size();
+                total_seconds += subset.size() / rps;
+            }
+
+            std::printf("%10s %14.1f %14.1f %10d %14.0f %12.2f\n", refit ? "update" : "build",
+                        total_ms / FRAMES, worst_ms, rebuilds, total_rays / total_seconds, accelerator.bvh().sah_cost());
+        }
+    }
+}
@@ -0,0 +1,113 @@
+#include "bench.h"
+
+namespace bench
+{
+    /** The path tracer as it was before Russian roulette: recursive, and white once `max_depth` bounces are reached. */
+    static Radiance trace_recursive(const BaseAccelerator& accelerator, const Ray& ray, int depth, int max_depth)
+    {
+        if (depth >= max_depth) return PBR_COLOR_WHITE;
+
+        HitResult hit;
+        if (!accelerator.intersect(ray, hit)) return PBR_BACKGROUND_COLOR;
+
+        auto brdf = hit.actor->material->brdf;
+        Ray sampled_ray = brdf->sample(ray, hit);
+        Colorf coeff = brdf->eval(ray, hit, sampled_ray);
+        return hit.actor->material->emission + coeff * trace_recursive(accelerator, sampled_ray, depth + 1, max_depth);
+    }
+
+    /** Mean radiance of every pixel over `spp` samples */
+    static std::vector<Colorf> render_image(int rows, int cols, int spp, const std::function<Radiance(const Ray&)>& trace)
+    {
+        Camera camera;
+        camera.position = PBR_CAMERA_POSITION;
+        camera.look_at = PBR_CAMERA_LOOKAT;
+        camera.fov = PBR_CAMERA_FOV_DEG;
+        camera.calculate_basis((double) cols / rows);
+
+        UniformRNG rng;
+        std::vector<Colorf> image((size_t) rows * cols);
+        for (int row = 0; row < rows; ++row)
+        {
+            for (int col = 0; col < cols; ++col)
+            {
+                Colorf sum;
+                for (int i = 0; i < spp; ++i)
+                {
+                    auto sample = rng.sample_disk();
+                    double x = ((col + 0.5 + sample.x / 2) / cols) * 2 - 1;
+                    double y = ((row + 0.5 + sample.y / 2) / rows) * 2 - 1;
+                    sum = sum + trace(camera.get_ray(x, y));
+                }
+                image[(size_t) row * cols + col] = sum / spp;
+            }
+        }
+        return image;
+    }
+
+    /** Root mean square error over the channels of all pixels, and the error of the mean brightness */
+    static std::pair<double, double> image_error(const std::vector<Colorf>& image, const std::vector<Colorf>& reference)
+    {
+        double squared = 0, bias = 0;
+        for (size_t i = 0; i < image.size(); ++i)
+        {
+            Colorf d = image[i] - reference[i];
+            squared += d.x * d.x + d.y * d.y + d.z * d.z;
+            bias += d.x + d.y + d.z;
+        }
+        return { std::sqrt(squared / (3 * image.size())), bias / (3 * image.size()) };
+    }
+
+    /** Time and error at the same samples per pixel of the recursive integrator against the iterative one with Russian roulette. */
+    void roulette()
+    {
+        constexpr int ROWS = 72, COLS = 128, SPP = 64, REFERENCE_SPP = 1024;
+        std::printf("%dx%d at %d spp, single thread. Errors are against %d spp of the iterative integrator.\n",
+                    COLS, ROWS, SPP, REFERENCE_SPP);
+        std::printf("%10s %28s %10s %12s %10s %12s\n", "scene", "integrator", "seconds", "rays/path", "RMSE", "mean error");
+
+        struct Case
+        {
+            const char* name;
+            const Scene* scene;
+        };
+        const Case cases[] = {
+            { "rtweekend", &PBR_SCENE_RTWEEKEND },
+            { "cornell", &PBR_SCENE_CORNELL },
+        };
+
+        for (const auto& c : cases)
+        {
+            PathIntegrator integrator;
+            integrator.set_scene(c.scene);
+            BVHAccelerator accelerator;
+            accelerator.build(*c.scene);
+
+            auto iterative = [&](const Ray& ray) { return integrator.trace_ray(ray, 0); };
+            std::vector<Colorf> reference = render_image(ROWS, COLS, REFERENCE_SPP, iterative);
+
+            struct Integrator
+            {
+                const char* name;
+                std::function<Radiance(const Ray&)> trace;
+            };
+            const Integrator integrators[] = {
+                { "recursive, depth 4", [&](const Ray& ray) { return trace_recursive(accelerator, ray, 0, 4); } },
+                { "recursive, depth 64", [&](const Ray& ray) { return trace_recursive(accelerator, ray, 0, 64); } },
+                { "iterative, roulette", iterative },
+            };
+
+            for (const auto& i : integrators)
+            {
+                stats::reset();
+                Timer timer;
+                std::vector<Colorf> image = render_image(ROWS, COLS, SPP, i.trace);
+                double seconds = timer.seconds();
+                double rays = (double) stats::total(stats::CLOSEST_HIT_QUERIES) / ((size_t) ROWS * COLS * SPP);
+
+                auto [rmse, bias] = image_error(image, reference);
+                std::printf("%10s %28s %10.3f %12.2f %10.4f %+12.4f\n", c.name, i.name, seconds, rays, rmse, bias);
+            }
+        }
+    }
+}
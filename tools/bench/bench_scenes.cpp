@@ -0,0 +1,40 @@
+#include "bench.h"
+
+namespace bench
+{
+    /** The Cornell box as it was before quads, with every wall faked by a sphere of radius 1e5. */
+    static Scene make_cornell_sphere_walls()
+    {
+        const Scene& cornell = PBR_SCENE_CORNELL;
+
+        // Light, red ball and mirror are unchanged, the walls reuse their materials
+        Scene scene(cornell.begin(), cornell.begin() + 3);
+        Vec centers[] = {
+            { 0.0, -1e5, 0.0 },       // Floor
+            { 0.0, 0.0, -1e5 - 1.5 }, // Back
+            { -1e5 - 5, 0.0, 0.0 },   // Left wall
+            { 1e5 + 5, 0.0, 0.0 },    // Right wall
+            { 0.0, 1e5 + 5, 0.0 },    // Roof
+        };
+        for (int i = 0; i < 5; ++i)
+        {
+            scene.push_back(Actor { cornell[3 + i].material, SphereGeometry { centers[i], 1e5 } });
+        }
+        return scene;
+    }
+
+    /** Cornell render time with sphere walls against quad walls. */
+    void cornell_walls()
+    {
+        constexpr int ROWS = 180, COLS = 320, SPP = 16;
+        std::printf("Cornell box, %dx%d at %d spp, single thread\n", COLS, ROWS, SPP);
+
+        Scene spheres = make_cornell_sphere_walls();
+        double before = measure_render_seconds(spheres, ROWS, COLS, SPP);
+        double after = measure_render_seconds(PBR_SCENE_CORNELL, ROWS, COLS, SPP);
+
+        std::printf("%-16s %10.3f s\n", "sphere walls", before);
+        std::printf("%-16s %10.3f s\n", "quad walls", after);
+        std::printf("%-16s %9.2fx\n", "speedup", before / after);
+    }
+}
@@ -0,0 +1,133 @@
+#include "bench.h"
+
+namespace bench
+{
+    /** Long thin triangles at random orientations, each 20 units long and 0.2 wide, in a cube of side 100. */
+    static std::shared_ptr<TriangleMesh> make_slivers(uint32_t count)
+    {
+        std::mt19937 gen(3);
+        std::uniform_real_distribution<> position(-50.0, 50.0);
+        std::normal_distribution<> normal;
+
+        auto mesh = std::make_shared<TriangleMesh>();
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            Vec center { position(gen), position(gen), position(gen) };
+            Vec along = normalize(Vec { normal(gen), normal(gen), normal(gen) }) * 10;
+            Vec across = normalize(Vec { normal(gen), normal(gen), normal(gen) }) * 0.1;
+            mesh->positions.insert(mesh->positions.end(), { center - along, center + along, center + across });
+            mesh->indices.insert(mesh->indices.end(), { 3 * i, 3 * i + 1, 3 * i + 2 });
+        }
+        return mesh;
+    }
+
+    /*!
+    * Storeys of a building without interior detail: floor slabs, and walls rotated 30 degrees off the axes, each face
+    * split into two triangles along its diagonal. Every triangle spans a whole wall or floor, which is how exported
+    * architectural models tend to look.
+    */
+    static std::shared_ptr<TriangleMesh> make_building(int floors, int walls)
+    {
+        auto mesh = std::make_shared<TriangleMesh>();
+        auto add_quad = [&](const Point& a, const Point& b, const Point& c, const Point& d) {
+            uint32_t first = mesh->positions.size();
+            mesh->positions.insert(mesh->positions.end(), { a, b, c, d });
+            mesh->indices.insert(mesh->indices.end(), { first, first + 1, first + 2, first, first + 2, first + 3 });
+        };
+
+        Transform rotate = Transform::rotate({ 0, 1, 0 }, 30);
+        for (int f = 0; f < floors; ++f)
+        {
+            double y = -50 + 100.0 * f / floors;
+            double height = 100.0 / floors;
+            add_quad(rotate.point({ -50, y, -50 }), rotate.point({ 50, y, -50 }), rotate.point({ 50, y, 50 }), rotate.point({ -50, y, 50 }));
+
+            // Walls along x and along z, each a thin box open at the top and bottom
+            for (int w = 0; w < walls; ++w)
+            {
+                double offset = -50 + 100.0 * (w + 0.5) / walls;
+                for (double side : { -0.1, 0.1 })
+                {
+                    add_quad(rotate.point({ -50, y, offset + side }), rotate.point({ 50, y, offset + side }),
+                             rotate.point({ 50, y + height, offset + side }), rotate.point({ -50, y + height, offset + side }));
+                    add_quad(rotate.point({ offset + side, y, -50 }), rotate.point({ offset + side, y, 50 }),
+                             rotate.point({ offset + side, y + height, 50 }), rotate.point({ offset + side, y + height, -50 }));
+                }
+            }
+        }
+        return mesh;
+    }
+
+    /** Best of three passes of the rays through the mesh, with the nodes each ray visited. */
+    static double measure_mesh_rays_per_second(const TriangleMesh& mesh, const std::vector<Ray>& rays, double& nodes_per_ray)
+    {
+        double best = 0;
+        for (int run = 0; run < 3; ++run)
+        {
+            stats::reset();
+            size_t hits = 0;
+            Timer timer;
+            for (const auto& ray : rays)
+            {
+                double tmax = PBR_INF;
+                uint32_t triangle;
+                Point2D barycentric;
+                hits += mesh.intersect(ray, tmax, triangle, barycentric);
+            }
+            best = std::max(best, rays.size() / timer.seconds());
+            if (hits > rays.size()) std::printf("unreachable\n");
+        }
+        nodes_per_ray = (double) stats::total(stats::NODES_VISITED) / rays.size();
+        return best;
+    }
+
+    /** Reference duplication, build time and traversal speed of spatial splits against the binned build, on meshes with long thin triangles. */
+    void spatial_splits()
+    {
+        struct Case
+        {
+            const char* name;
+            std::shared_ptr<TriangleMesh> mesh;
+
+            /** Distance of the ray origins, the meshes lie within 50 of the origin and the sphere within 3 */
+            double ray_distance;
+        };
+        const Case cases[] = {
+            { "slivers", make_slivers(20000), 150.0 },
+            { "slivers", make_slivers(100000), 150.0 },
+            { "building", make_building(20, 40), 150.0 },
+            { "sphere", make_bumpy_sphere(300, 600), 3.0 },
+        };
+
+        std::printf("%10s %10s %10s %10s %10s %10s %12s %14s %10s\n", "mesh", "triangles", "method", "build ms", "refs/tri",
+                    "SAH cost", "nodes/ray", "rays/s", "speedup");
+        for (const auto& c : cases)
+        {
+            // Spheres are built at load time, start them over like the others
+            TriangleMesh mesh;
+            mesh.positions = c.mesh->positions;
+            mesh.indices = c.mesh->indices;
+
+            auto rays = make_random_rays(50000, c.ray_distance);
+
+            double binned_rps = 0;
+            for (BVHBuildMethod method : { BVHBuildMethod::BINNED, BVHBuildMethod::SPATIAL })
+            {
+                Timer timer;
+                mesh.build(method);
+                double build_ms = timer.seconds() * 1e3;
+
+                double nodes = 0;
+                double rps = measure_mesh_rays_per_second(mesh, rays, nodes);
+                if (method == BVHBuildMethod::BINNED) binned_rps = rps;
+
+                char speedup[16] = "-";
+                if (method == BVHBuildMethod::SPATIAL) std::snprintf(speedup, sizeof(speedup), "%.2fx", rps / binned_rps);
+
+                std::printf("%10s %10zu %10s %10.1f %10.3f %10.2f %12.1f %14.0f %10s\n", c.name, mesh.triangle_count(),
+                            method == BVHBuildMethod::SPATIAL ? "spatial" : "binned", build_ms,
+                            (double) mesh.reference_count() / mesh.triangle_count(), mesh.bvh.sah_cost(), nodes, rps, speedup);
+            }
+        }
+    }
+}
@@ -0,0 +1,154 @@
+#include "bench.h"
+
+namespace bench
+{
+    /** First-bounce rays of a rows x cols image at spp samples per pixel, sampled from the BRDFs at the camera hits. */
+    static std::vector<Ray> make_bounce_rays(const BaseAccelerator& accelerator, int rows, int cols, int spp)
+    {
+        Camera camera;
+        camera.position = PBR_CAMERA_POSITION;
+        camera.look_at = PBR_CAMERA_LOOKAT;
+        camera.fov = PBR_CAMERA_FOV_DEG;
+        camera.calculate_basis((double) cols / rows);
+
+        UniformRNG rng;
+        std::vector<Ray> rays;
+        for (int row = 0; row < rows; ++row)
+        {
+            for (int col = 0; col < cols; ++col)
+            {
+                for (int i = 0; i < spp; ++i)
+                {
+                    auto sample = rng.sample_disk();
+                    double x = ((col + 0.5 + sample.x / 2) / cols) * 2 - 1;
+                    double y = ((row + 0.5 + sample.y / 2) / rows) * 2 - 1;
+                    Ray ray = camera.get_ray(x, y);
+
+                    HitResult hit;
+                    if (accelerator.intersect(ray, hit)) rays.push_back(hit.actor->material->brdf->sample(ray, hit));
+                }
+            }
+        }
+        return rays;
+    }
+
+    /** Render time of depth-first paths against paths traced bounce by bounce in streams. */
+    static void render_streams(const Scene& scene, int rows, int cols, int spp)
+    {
+        Camera camera;
+        camera.position = PBR_CAMERA_POSITION;
+        camera.look_at = PBR_CAMERA_LOOKAT;
+        camera.fov = PBR_CAMERA_FOV_DEG;
+        camera.calculate_basis((double) cols / rows);
+
+        PathIntegrator integrator;
+        integrator.set_scene(&scene);
+
+        std::vector<Ray> rays;
+        UniformRNG rng;
+        for (int row = 0; row < rows; ++row)
+        {
+            for (int col = 0; col < cols; ++col)
+            {
+                for (int i = 0; i < spp; ++i)
+                {
+                    auto sample = rng.sample_disk();
+                    double x = ((col + 0.5 + sample.x / 2) / cols) * 2 - 1;
+                    double y = ((row + 0.5 + sample.y / 2) / rows) * 2 - 1;
+                    rays.push_back(camera.get_ray(x, y));
+                }
+            }
+        }
+
+        Timer depth_timer;
+        Radiance depth_sum;
+        for (const auto& ray : rays) depth_sum = depth_sum + integrator.trace_ray(ray, 0);
+        double depth_seconds = depth_timer.seconds();
+
+        // A row of samples at a time, as the renderer does
+        Timer stream_timer;
+        Radiance stream_sum;
+        size_t row_size = (size_t) cols * spp;
+        std::vector<Radiance> radiance;
+        for (size_t first = 0; first < rays.size(); first += row_size)
+        {
+            std::vector<Ray> row(rays.begin() + first, rays.begin() + first + row_size);
+            integrator.trace_stream(row, 4096, radiance);
+            for (const auto& r : radiance) stream_sum = stream_sum + r;
+        }
+        double stream_seconds = stream_timer.seconds();
+
+        // Different random paths, the means should still agree
+        std::printf("  render %dx%d at %d spp: depth-first %.3f s, streams %.3f s, %.2fx (mean %.4f versus %.4f)\n",
+                    cols, rows, spp, depth_seconds, stream_seconds, depth_seconds / stream_seconds,
+                    depth_sum.x / rays.size(), stream_sum.x / rays.size());
+    }
+
+    /** Rays/sec of the binary BVH for single rays and for streams of several sizes. */
+    static void stream_throughput(const BVHAccelerator& bvh, const std::vector<Ray>& rays)
+    {
+        std::printf("%12s %14s %14s %10s\n", "stream size", "nodes/ray", "rays/s", "speedup");
+
+        std::vector<HitResult> hits(rays.size());
+        std::unique_ptr<bool[]> does_hit(new bool[rays.size()]);
+        double single_rps = 0;
+        for (size_t size : { (size_t) 1, (size_t) 1024, (size_t) 4096, (size_t) 16384, (size_t) 65536 })
+        {
+            // Best of three runs, the counters are the same for each
+            double rps = 0;
+            for (int run = 0; run < 3; ++run)
+            {
+                stats::reset();
+                Timer timer;
+                if (size == 1)
+                {
+                    for (size_t i = 0; i < rays.size(); ++i) does_hit[i] = bvh.intersect(rays[i], hits[i]);
+                }
+                else
+                {
+                    for (size_t first = 0; first < rays.size(); first += size)
+                    {
+                        size_t count = std::min(size, rays.size() - first);
+                        bvh.intersect_stream(&rays[first], count, &hits[first], &does_hit[first]);
+                    }
+                }
+                rps = std::max(rps, rays.size() / timer.seconds());
+            }
+            if (size == 1) single_rps = rps;
+
+            // Node loads, a stream loads each node once for all the rays that reach it
+            auto counter = (size == 1) ? stats::NODES_VISITED : stats::STREAM_NODES_VISITED;
+            double nodes = (double) stats::total(counter) / rays.size();
+            std::printf("%12zu %14.3f %14.0f %9.2fx\n", size, nodes, rps, rps / single_rps);
+        }
+    }
+
+    /** Secondary-ray throughput of the binary BVH, single rays against breadth-first streams, and renders of the built-in scenes. */
+    void streams()
+    {
+        const std::pair<const char*, const Scene*> scenes[] = {
+            { "rtweekend", &PBR_SCENE_RTWEEKEND }, { "cornell", &PBR_SCENE_CORNELL }
+        };
+
+        for (const auto& [name, scene] : scenes)
+        {
+            BVHAccelerator bvh;
+            bvh.build(*scene);
+            std::vector<Ray> rays = make_bounce_rays(bvh, 180, 320, 4);
+            std::printf("%s: %zu actors, %zu bounce rays\n", name, scene->size(), rays.size());
+            stream_throughput(bvh, rays);
+            render_streams(*scene, 90, 160, 16);
+        }
+
+        // The built-in scenes fit in the cache whole, node loads only cost something in large scenes
+        for (size_t count : { 100000, 1000000 })
+        {
+            Scene scene = make_random_spheres(count);
+            BVHAccelerator bvh;
+            bvh.build(scene);
+            std::vector<Ray> rays = make_random_rays(500000, 150.0);
+            std::printf("random spheres: %zu actors, %.0f MB, %zu random rays\n", count, bvh.memory_bytes() / 1e6, rays.size());
+            stream_throughput(bvh, rays);
+        }
+    }
+}
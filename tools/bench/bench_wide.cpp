@@ -0,0 +1,39 @@
+#include "bench.h"
+
+namespace bench
+{
+    /** Binary BVH versus BVH4 and BVH8 over the same scenes, in nodes visited per ray and rays per second. */
+    void wide_bvh()
+    {
+        std::printf("%10s %8s %12s %12s %14s\n", "actors", "layout", "memory (MB)", "nodes/ray", "rays/s");
+
+        for (size_t count : { 1000, 10000, 100000 })
+        {
+            Scene scene = make_random_spheres(count);
+            auto rays = make_random_rays(200000, 150.0);
+
+            BVHAccelerator binary;
+            BVH4Accelerator bvh4;
+            BVH8Accelerator bvh8;
+            const std::pair<const char*, BaseAccelerator*> layouts[] = {
+                { "binary", &binary }, { "bvh4", &bvh4 }, { "bvh8", &bvh8 }
+            };
+
+            for (const auto& [name, accelerator] : layouts)
+            {
+                accelerator->build(scene);
+
+                // Best of three runs, the counters are the same for each
+                double rps = 0;
+                for (int run = 0; run < 3; ++run)
+                {
+                    stats::reset();
+                    rps = std::max(rps, measure_rays_per_second(*accelerator, rays));
+                }
+                double nodes = (double) stats::total(stats::NODES_VISITED) / rays.size();
+
+                std::printf("%10zu %8s %12.2f %12.1f %14.0f\n", count, name, accelerator->memory_bytes() / 1e6, nodes, rps);
+            }
+        }
+    }
+}
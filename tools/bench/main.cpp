@@ -0,0 +1,77 @@
+#include "bench.h"
+
+#include <cstring>
+
+struct Benchmark
+{
+    const char* name;
+    const char* description;
+    void (*run)();
+};
+
+static const Benchmark BENCHMARKS[] = {
+    { "bvh", "Rays/sec against actor count, linear scan versus BVH", bench::bvh_scaling },
+    { "cornell", "Cornell render time with sphere walls versus quad walls", bench::cornell_walls },
+    { "mesh", "Build time and preview render speed for a million-triangle mesh", bench::mesh_preview },
+    { "instances", "Memory and rays/sec for 100k instances of one mesh", bench::instancing },
+    { "wide", "Binary BVH versus BVH4 and BVH8, nodes visited and rays/sec", bench::wide_bvh },
+    { "occlusion", "Shadow rays with closest-hit versus any-hit queries", bench::occlusion },
+    { "build", "BVH build time, node count and SAH cost from 1k to 10M primitives", bench::build_scaling },
+    { "cache", "BVH build time against saving to and mapping from the cache", bench::bvh_cache },
+    { "deferred", "Closest hit with eager versus deferred hit attributes on overlapping spheres", bench::deferred_hits },
+    { "packets", "Primary-ray throughput with single rays versus packets of 8 and 16", bench::packets },
+    { "streams", "Secondary rays and renders with single rays versus breadth-first streams", bench::streams },
+    { "morton", "Build time against traversal speed of the binned, Morton and treelet-restructured builds", bench::morton_build },
+    { "refit", "Per-frame cost of building again against refitting, for drifting spheres", bench::refit },
+    { "quantized", "Memory per primitive and traversal speed of quantized BVH4 nodes against float ones", bench::quantized },
+    { "spatial", "Reference duplication and traversal speedup of spatial-split mesh BVHs on long thin triangles", bench::spatial_splits },
+    { "layout", "Modelled cache misses and traversal speed of depth-first and hot-child-first node orders on 1M spheres", bench::node_layout },
+    { "grid", "Build and trace time of the BVH against dense and hashed grids on sphere clouds, and the structure picked from scene statistics", bench::grid },
+    { "lazy", "Time to first pixel with mesh hierarchies built upfront or by the first ray to enter each mesh", bench::lazy_build },
+    { "preview", "Time to first pixel with the scene built before rendering or while a linear-traced preview renders", bench::preview },
+    { "roulette", "Time and error at equal samples per pixel of the recursive path tracer and the iterative one with Russian roulette", bench::roulette },
+    { "nee", "Error and time against samples per pixel with and without sampling the lights at every bounce", bench::next_event },
+    { "mis", "Error against render time of BRDF sampling, light sampling and multiple importance sampling", bench::mis },
+    { "lights", "Error and time of uniform and power-proportional emitter selection against the light hierarchy with thousands of emitters", bench::many_lights },
+};
+
+static void usage()
+{
+    std::printf("Usage: pbr-bench [name...]\nAvailable benchmarks:\n");
+    for (const auto& b : BENCHMARKS)
+    {
+        std::printf("  %-12s %s\n", b.name, b.description);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        usage();
+        return 1;
+    }
+
+    for (int i = 1; i < argc; ++i)
+    {
+        bool found = false;
+        for (const auto& b : BENCHMARKS)
+        {
+            if (std::strcmp(argv[i], b.name) == 0 || std::strcmp(argv[i], "all") == 0)
+            {
+                std::printf("== %s: %s\n", b.name, b.description);
+                b.run();
+                found = true;
+            }
+        }
+
+        if (!found)
+        {
+            std::printf("Unknown benchmark '%s'\n", argv[i]);
+            usage();
+            return 1;
+        }
+    }
+
+    return 0;
+}